@@ -15,11 +15,13 @@
  */
 
 #include <malloc.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "psl_interface.h"
 #include "vpi_user.h"
@@ -27,20 +29,60 @@
 
 #define CLOCK_EDGE_DELAY 2
 #define CACHELINE_BYTES 128
+#define MAX_AFU_INSTANCES 16
+#define AFU_BASE_PORT 32768
+// Each queued response holds a credit and croom is 8 bits, so no AFU can have
+// more responses outstanding than this
+#define RESP_QUEUE_SIZE 256
+#define RESP_QUEUE_MASK (RESP_QUEUE_SIZE - 1)
 
 struct resp_event {
 	uint32_t tag;
 	uint32_t tagpar;
 	uint32_t code;
 	int32_t credits;
-	struct resp_event *__next;
+};
+
+// Per AFU state.  Each instance of top.v passes its own handle to psl_bfm_init
+// and psl_bfm so one simulator process can serve several AFUs, each on its
+// own socket to pslse.
+
+struct afu_instance {
+	struct AFU_EVENT event;
+	struct resp_event resp_queue[RESP_QUEUE_SIZE];
+	uint32_t resp_head;
+	uint32_t resp_tail;
+	unsigned int bw_delay;
+	int cl_jval, cl_mmio, cl_br, cl_bw, cl_rval;
+	int sim_error;
+	// psl_bfm_init only listens, accept_loop takes the pslse connection in
+	// its own thread and sets connected under connect_lock.  ready is the
+	// simulator's copy once it has seen connected.
+	int accepting;
+	int connected;
+	int ready;
+	pthread_t accept_tid;
+	// Mailbox to the socket I/O thread, used when AFU_IO_THREAD is set.  The
+	// thread owns io_event and the socket, the simulator side only uses
+	// event.  io_posted hands the outputs for the next frame to the thread,
+	// io_frame hands the received frame back to the simulator.
+	int io_thread;
+	int io_sent;
+	int io_posted;
+	int io_frame;
+	int io_rc;
+	pthread_t io_tid;
+	pthread_mutex_t io_lock;
+	pthread_cond_t io_cond;
+	struct AFU_EVENT io_event;
 };
 
 // Global variables
 
-static unsigned int bw_delay;
-static struct AFU_EVENT event;
-static struct resp_event *resp_list;
+static struct afu_instance *afu_instances[MAX_AFU_INSTANCES];
+static pthread_mutex_t connect_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t connect_cond = PTHREAD_COND_INITIALIZER;
+static int connected_count;
 #ifdef OLD_PLI_CODE
 static vpiHandle pclock;
 static vpiHandle jval, jcom, jcompar, jea, jeapar, jrunning, jdone, jcack,
@@ -55,43 +97,7 @@ static vpiHandle bwval, bwtag, bwtagpar, bwdata, bwpar;
 static vpiHandle rval, rtag, rtagpar, resp, rcredits;
 #endif
 
-static int cl_jval, cl_mmio, cl_br, cl_bw, cl_rval;
-// Added New
-        int c_ha_jval;
-        int c_ha_jcom;
-
-        uint32_t c_ah_jrunning;
-        uint32_t c_ah_jdone;
-        uint32_t c_ah_jcack;
-	uint64_t c_ah_jerror;
-        uint32_t c_ah_brlat;
-        uint32_t c_ah_jyield;
-        uint32_t c_ah_tbreq;
-        uint32_t c_ah_paren;
-
-        uint32_t c_ah_cvalid;
-        uint32_t c_ah_ctag;
-        uint32_t c_ah_ctagpar;
-        uint32_t c_ah_ccom;
-        uint32_t c_ah_ccompar;
-        uint32_t c_ah_cabt;
-        uint64_t c_ah_cea;
-        uint32_t c_ah_ceapar;
-        uint32_t c_ah_cch;
-        uint32_t c_ah_csize;
-        uint32_t c_ha_croom;
-
-	uint32_t c_ah_brtag;
-	uint32_t c_ah_brvalid;
-	uint32_t c_ah_brpar;
-	uint16_t parity16;
-	uint8_t  c_ah_brdata[CACHELINE_BYTES];
-
-        uint32_t c_ah_mmack;
-        uint64_t c_ah_mmrdata;
-        uint32_t c_ah_mmrdatapar;
 	uint64_t c_sim_time ;
-        int      c_sim_error ;
 
 // Function declaration
 
@@ -101,7 +107,10 @@ void setMyCacheLine(svLogicVecVal *myLongSignal, uint8_t myCacheData[]);
 // Dpi eqt of set_signal32
 void setDpiSignal32(svLogicVecVal *my32bSignal, uint32_t inData, int size);
 static void setDpiSignal64(svLogicVecVal *my64bSignal, uint64_t data);
-static void psl_control(void);
+static struct afu_instance *get_instance(int handle);
+static int instance_ready(struct afu_instance *afu);
+static void io_post_outputs(struct afu_instance *afu);
+static void psl_control(struct afu_instance *afu);
 /* commenting out unused functions
 static void psl(void);
 */
@@ -268,10 +277,11 @@ void set_simulation_time(const svLogicVecVal *simulationTime)
 //  printf("inside C: time value  = %08lld\n", (long long) c_sim_time);
 }
 
-void get_simuation_error(svLogic *simulationError)
+void get_simuation_error(int handle, svLogic *simulationError)
 {
-  *simulationError  = c_sim_error & 0x1;
-//  printf("inside C: error value  = %08d\n",  c_sim_error);
+  struct afu_instance *afu = get_instance(handle);
+  *simulationError  = afu ? (afu->sim_error & 0x1) : 1;
+//  printf("inside C: error value  = %08d\n",  afu->sim_error);
 }
 
 static void error_message(const char *str)
@@ -283,6 +293,22 @@ static void error_message(const char *str)
 	fflush(stderr);
 }
 
+// Find the state of AFU instance handle, allocating it on first use
+static struct afu_instance *get_instance(int handle)
+{
+	if ((handle < 0) || (handle >= MAX_AFU_INSTANCES)) {
+		error_message("Invalid AFU instance handle");
+		return NULL;
+	}
+	if (afu_instances[handle] == NULL) {
+		afu_instances[handle] = (struct afu_instance *)
+		    calloc(1, sizeof(struct afu_instance));
+		if (afu_instances[handle] == NULL)
+			error_message("Unable to allocate AFU instance");
+	}
+	return afu_instances[handle];
+}
+
 /*
 static int dpi_info_message(char *format)
 {
@@ -307,28 +333,24 @@ static int info_message(char *format, ...)
 
 // PSL functions
 
-static void add_response()
+static void add_response(struct afu_instance *afu)
 {
 	struct resp_event *new_resp;
-	new_resp = (struct resp_event *)malloc(sizeof(struct resp_event));
-	new_resp->tag = event.response_tag;
-	new_resp->tagpar = event.response_tag_parity;
-	new_resp->code = event.response_code;
-	new_resp->credits = event.credits;
-	new_resp->__next = NULL;
-
-	event.response_valid = 0;
 
-	if (resp_list == NULL) {
-		resp_list = new_resp;
+	if (afu->resp_tail - afu->resp_head >= RESP_QUEUE_SIZE) {
+		error_message("Response queue full, response dropped");
+		afu->event.response_valid = 0;
 		return;
 	}
 
-	struct resp_event *resp_ptr = resp_list;
-	while (resp_ptr->__next != NULL)
-		resp_ptr = resp_ptr->__next;
+	new_resp = &(afu->resp_queue[afu->resp_tail & RESP_QUEUE_MASK]);
+	new_resp->tag = afu->event.response_tag;
+	new_resp->tagpar = afu->event.response_tag_parity;
+	new_resp->code = afu->event.response_code;
+	new_resp->credits = afu->event.credits;
+	++afu->resp_tail;
 
-	resp_ptr->__next = new_resp;
+	afu->event.response_valid = 0;
 }
 
 static int test_change(uint32_t previous, uint32_t current, const char *sig)
@@ -509,7 +531,8 @@ PLI_INT32 clock_edge()
 	return 0;
 }
 
-void psl_bfm(const svLogic       ha_pclock, 		// used as pclock on PLI
+void psl_bfm(const int           handle,		// AFU instance
+             const svLogic       ha_pclock, 		// used as pclock on PLI
                    svLogic       *ha_jval_top, 
 	     svLogicVecVal       *ha_jcom_top, 	// 8 bits
                    svLogic       *ha_jcompar_top, 
@@ -564,8 +587,27 @@ void psl_bfm(const svLogic       ha_pclock, 		// used as pclock on PLI
              svLogicVecVal       *ha_rcredits_top		// 9 bits
              )
 {
+	struct afu_instance *afu;
+	uint32_t c_ah_jrunning, c_ah_jdone, c_ah_jcack, c_ah_brlat, c_ah_jyield;
+	uint32_t c_ah_tbreq, c_ah_paren;
+	uint64_t c_ah_jerror;
+	uint32_t c_ah_cvalid, c_ah_ctag, c_ah_ctagpar, c_ah_ccom, c_ah_ccompar;
+	uint32_t c_ah_cabt, c_ah_ceapar, c_ah_cch, c_ah_csize, c_ha_croom;
+	uint64_t c_ah_cea;
+	uint32_t c_ah_brtag, c_ah_brvalid, c_ah_brpar;
+	uint8_t  c_ah_brdata[CACHELINE_BYTES];
+	uint32_t c_ah_mmack, c_ah_mmrdatapar;
+	uint64_t c_ah_mmrdata;
 	int change = 0;
 	int invalidVal = 0;
+	afu = get_instance(handle);
+	if (afu == NULL)
+		return;
+	if (!afu->ready) {
+		afu->ready = instance_ready(afu);
+		if (!afu->ready)
+			return;
+	}
 	if ( ha_pclock == sv_0 ) {
 	// Replication of aux2 method
 	  c_ah_jrunning  = (ah_jrunning_top & 0x2) ? 0 : (ah_jrunning_top & 0x1);
@@ -584,20 +626,20 @@ void psl_bfm(const svLogic       ha_pclock, 		// used as pclock on PLI
           c_ah_jyield    = (ah_jyield & 0x2) ? 0 : (ah_jyield & 0x1);
           c_ah_tbreq     = (ah_tbreq_top & 0x2) ? 0 : (ah_tbreq_top & 0x1);
           c_ah_paren     = (ah_paren_top & 0x2) ? 0 : (ah_paren_top & 0x1);
-  	  change = test_change(event.job_done, c_ah_jdone, "jdone");
+  	  change = test_change(afu->event.job_done, c_ah_jdone, "jdone");
 	  if (change && (c_ah_jerror != 0x0))
           {
 	     printf("%08lld: ", (long long) c_sim_time);
 	     printf("jerror=0x%016llx\n", (long long)c_ah_jerror);
           }
-	  change += test_change(event.job_running, c_ah_jrunning, "jrunning");
-	  change += test_change(event.job_cack_llcmd, c_ah_jcack, "jcack");
-	  change += test_change(event.job_yield, c_ah_jyield, "jyield");
-	  change += test_change(event.timebase_request, c_ah_tbreq, "jtbreq");
-	  change += test_change(event.parity_enable, c_ah_paren, "paren");
-	  change += test_change(event.buffer_read_latency, c_ah_brlat, "brlat");
+	  change += test_change(afu->event.job_running, c_ah_jrunning, "jrunning");
+	  change += test_change(afu->event.job_cack_llcmd, c_ah_jcack, "jcack");
+	  change += test_change(afu->event.job_yield, c_ah_jyield, "jyield");
+	  change += test_change(afu->event.timebase_request, c_ah_tbreq, "jtbreq");
+	  change += test_change(afu->event.parity_enable, c_ah_paren, "paren");
+	  change += test_change(afu->event.buffer_read_latency, c_ah_brlat, "brlat");
 	  if (change)
-	    psl_afu_aux2_change(&event, c_ah_jrunning, c_ah_jdone, c_ah_jcack, c_ah_jerror,
+	    psl_afu_aux2_change(&afu->event, c_ah_jrunning, c_ah_jdone, c_ah_jcack, c_ah_jerror,
 				    c_ah_jyield, c_ah_tbreq, c_ah_paren, c_ah_brlat);
 	// Replication of aux2 method - ends
 	// Replication of the mmio method - start
@@ -611,7 +653,7 @@ void psl_bfm(const svLogic       ha_pclock, 		// used as pclock on PLI
 	      printf("ah_mmdata has either X or Z value =0x%016llx\n", (long long)c_ah_mmrdata);
             }
             c_ah_mmrdatapar = (ah_mmdatapar_top & 0x2) ? 0 : (ah_mmdatapar_top & 0x1);
-            psl_afu_mmio_ack(&event, c_ah_mmrdata, c_ah_mmrdatapar);
+            psl_afu_mmio_ack(&afu->event, c_ah_mmrdata, c_ah_mmrdatapar);
           }
 	// Replication of the mmio method - ends
 	// Replication of buffer_read method - start
@@ -638,108 +680,109 @@ void psl_bfm(const svLogic       ha_pclock, 		// used as pclock on PLI
 	    parity16 = (uint16_t) c_ah_brpar;
 	    parity16 = htons(parity16);		
             getMyCacheLine(ah_brdata_top, c_ah_brdata);
-	    psl_afu_read_buffer_data(&event, CACHELINE_BYTES, c_ah_brdata,
+	    psl_afu_read_buffer_data(&afu->event, CACHELINE_BYTES, c_ah_brdata,
 				 (uint8_t *) & parity16);
 	// Replication of buffer_read method - ends
 	  }
+	  if (afu->io_thread)
+	    io_post_outputs(afu);
 	} else {
 	  //psl();	// the psl() function from PLI is going to be split into several subsidiary functions
- 	  c_sim_error = 0;
-	  psl_control();
+ 	  afu->sim_error = 0;
+	  psl_control(afu);
 	// Job
-	if (event.job_valid)
+	if (afu->event.job_valid)
 	{
 	  // replicating set_job() function
-          setDpiSignal32(ha_jcom_top, event.job_code, 8);
-          *ha_jcompar_top  = (event.job_code_parity) & 0x1;
-	  setDpiSignal64(ha_jea_top, event.job_address);
-	  *ha_jeapar_top  = (event.job_address_parity) & 0x1;
+          setDpiSignal32(ha_jcom_top, afu->event.job_code, 8);
+          *ha_jcompar_top  = (afu->event.job_code_parity) & 0x1;
+	  setDpiSignal64(ha_jea_top, afu->event.job_address);
+	  *ha_jeapar_top  = (afu->event.job_address_parity) & 0x1;
 	  *ha_jval_top = 1;
 	  printf("%08lld: ", (long long) c_sim_time);
-	  printf("Job 0x%03x EA=0x%016llx\n", event.job_code, (long long)event.job_address);
-	  cl_jval = CLOCK_EDGE_DELAY;
-	  event.job_valid = 0;
+	  printf("Job 0x%03x EA=0x%016llx\n", afu->event.job_code, (long long)afu->event.job_address);
+	  afu->cl_jval = CLOCK_EDGE_DELAY;
+	  afu->event.job_valid = 0;
         }	
 	// MMIO
-	if (event.mmio_valid)
+	if (afu->event.mmio_valid)
 	{
 	// replicating the set_mmio() function
-	  *ha_mmrnw_top = event.mmio_read;
-	  *ha_mmdw_top = event.mmio_double;
-	  setDpiSignal32(ha_mmad_top, event.mmio_address, 24);
-	  *ha_mmadpar_top = event.mmio_address_parity;
-	  setDpiSignal64(ha_mmdata_top, event.mmio_wdata);
-	  *ha_mmdatapar_top = (event.mmio_wdata_parity) & 0x1;		// 2016/05/11: UMA: checking whether ensuring bval is set always to 0b0 solves the MMIO parity error which is coming up
-	  *ha_mmcfg_top = event.mmio_afudescaccess;
+	  *ha_mmrnw_top = afu->event.mmio_read;
+	  *ha_mmdw_top = afu->event.mmio_double;
+	  setDpiSignal32(ha_mmad_top, afu->event.mmio_address, 24);
+	  *ha_mmadpar_top = afu->event.mmio_address_parity;
+	  setDpiSignal64(ha_mmdata_top, afu->event.mmio_wdata);
+	  *ha_mmdatapar_top = (afu->event.mmio_wdata_parity) & 0x1;		// 2016/05/11: UMA: checking whether ensuring bval is set always to 0b0 solves the MMIO parity error which is coming up
+	  *ha_mmcfg_top = afu->event.mmio_afudescaccess;
 	  *ha_mmval_top = 1;
 	  printf("%08lld: ", (long long) c_sim_time);
 	  printf("MMIO rnw=%d dw=%d addr=0x%08x data=0x%016llx\n",
-		     event.mmio_read, event.mmio_double, event.mmio_address,
-		     (long long)event.mmio_wdata);
-	  cl_mmio = CLOCK_EDGE_DELAY;
-	  event.mmio_valid = 0;
+		     afu->event.mmio_read, afu->event.mmio_double, afu->event.mmio_address,
+		     (long long)afu->event.mmio_wdata);
+	  afu->cl_mmio = CLOCK_EDGE_DELAY;
+	  afu->event.mmio_valid = 0;
         }	
 	// Buffer read
-	if (event.buffer_read)
+	if (afu->event.buffer_read)
 	{
 	// Replicating	set_buffer_read() function
-	  setDpiSignal32(ha_brtag_top, event.buffer_read_tag, 8);
-	  *ha_brtagpar_top = event.buffer_read_tag_parity;
+	  setDpiSignal32(ha_brtag_top, afu->event.buffer_read_tag, 8);
+	  *ha_brtagpar_top = afu->event.buffer_read_tag_parity;
 	  *ha_brvalid_top = 1;
 	  printf("%08lld: ", (long long) c_sim_time);
-	  printf("Buffer Read tag=0x%02x\n", event.buffer_read_tag);
-	  cl_br = CLOCK_EDGE_DELAY;
-	  event.buffer_read = 0;
+	  printf("Buffer Read tag=0x%02x\n", afu->event.buffer_read_tag);
+	  afu->cl_br = CLOCK_EDGE_DELAY;
+	  afu->event.buffer_read = 0;
         }	
 	// Buffer write
-	if (event.buffer_write)
+	if (afu->event.buffer_write)
 	{
 	// Replicating 	set_buffer_write() function
-	  bw_delay += 2;
+	  afu->bw_delay += 2;
 	  uint32_t parity;
-	  parity = (uint32_t) event.buffer_wparity[0];
+	  parity = (uint32_t) afu->event.buffer_wparity[0];
 	  parity <<= 8;
-	  parity += (uint32_t) event.buffer_wparity[1];
+	  parity += (uint32_t) afu->event.buffer_wparity[1];
           // parity = htons((uint16_t) parity);  // we don't need to do this as we processed parity byte-wise rather than as an int
-	  setDpiSignal32(ha_bwtag_top, event.buffer_write_tag, 8);
-	  *ha_bwtagpar_top = event.buffer_write_tag_parity;
-	  setMyCacheLine(ha_bwdata_top, event.buffer_wdata);
+	  setDpiSignal32(ha_bwtag_top, afu->event.buffer_write_tag, 8);
+	  *ha_bwtagpar_top = afu->event.buffer_write_tag_parity;
+	  setMyCacheLine(ha_bwdata_top, afu->event.buffer_wdata);
 	  setDpiSignal32(ha_bwpar_top, parity, 16);
 	  *ha_bwvalid_top = 1;
 	  printf("%08lld: ", (long long) c_sim_time);
-	  printf("Buffer Write tag=0x%02x\n", event.buffer_write_tag);
-	  cl_bw = CLOCK_EDGE_DELAY;
-	  event.buffer_write = 0;
+	  printf("Buffer Write tag=0x%02x\n", afu->event.buffer_write_tag);
+	  afu->cl_bw = CLOCK_EDGE_DELAY;
+	  afu->event.buffer_write = 0;
 	}
-	if (bw_delay > 0)
-		--bw_delay;
-	if (resp_list && !(bw_delay % 2))
+	if (afu->bw_delay > 0)
+		--afu->bw_delay;
+	if ((afu->resp_head != afu->resp_tail) && !(afu->bw_delay % 2))
         {
 	// Replicating	set_response() function
-	  setDpiSignal32(ha_rtag_top, resp_list->tag, 8);
-	  *ha_rtagpar_top = resp_list->tagpar;
-	  setDpiSignal32(ha_response_top, resp_list->code, 8);
-	  setDpiSignal32(ha_rcredits_top, resp_list->credits, 9);
+	  struct resp_event *resp;
+	  resp = &(afu->resp_queue[afu->resp_head & RESP_QUEUE_MASK]);
+	  setDpiSignal32(ha_rtag_top, resp->tag, 8);
+	  *ha_rtagpar_top = resp->tagpar;
+	  setDpiSignal32(ha_response_top, resp->code, 8);
+	  setDpiSignal32(ha_rcredits_top, resp->credits, 9);
 	  *ha_rvalid_top = 1;
 	  printf("%08lld: ", (long long) c_sim_time);
 	  printf("Response tag=0x%02x code=0x%02x credits=%d\n",
-		     resp_list->tag, resp_list->code, resp_list->credits);
-	  struct resp_event *tmp;
-	  tmp = resp_list;
-	  resp_list = resp_list->__next;
-	  free(tmp);
-	  cl_rval = CLOCK_EDGE_DELAY;
+		     resp->tag, resp->code, resp->credits);
+	  ++afu->resp_head;
+	  afu->cl_rval = CLOCK_EDGE_DELAY;
         }
 	// Response
-	if (event.response_valid)
+	if (afu->event.response_valid)
         {
 	// Not Replicating	add_response() function, just calling it
-		add_response();
+		add_response(afu);
         }
 	// Croom
-	if (event.aux1_change) {
-		setDpiSignal32(ha_croom_top, event.room, 8);
-		event.aux1_change = 0;
+	if (afu->event.aux1_change) {
+		setDpiSignal32(ha_croom_top, afu->event.room, 8);
+		afu->event.aux1_change = 0;
 	}
 	// Replication of acceleartor command interface starts
 	  c_ah_cvalid = (ah_cvalid_top & 0x2) ? 0 : (ah_cvalid_top & 0x1);
@@ -763,35 +806,35 @@ void psl_bfm(const svLogic       ha_pclock, 		// used as pclock on PLI
 		// FIXME: Need to check how to handle Croom on the event structure
 	    printf("%08lld: ", (long long) c_sim_time);
 	    printf("Command Valid: ccom=0x%x\n", c_ah_ccom);
-  	    event.room   = c_ha_croom;
-  	    psl_afu_command(&event, c_ah_ctag, c_ah_ctagpar, c_ah_ccom, c_ah_ccompar, c_ah_cea, c_ah_ceapar, c_ah_csize,
+  	    afu->event.room   = c_ha_croom;
+  	    psl_afu_command(&afu->event, c_ah_ctag, c_ah_ctagpar, c_ah_ccom, c_ah_ccompar, c_ah_cea, c_ah_ceapar, c_ah_csize,
 	 		   c_ah_cabt, c_ah_cch);
 	  }
 	  // Replication of acceleartor command interface ends
 	  // Copying over the rest of the assignments from the clock_edge function
-	  if (cl_jval) {
-	  	--cl_jval;
-	  	if (!cl_jval)
+	  if (afu->cl_jval) {
+	  	--afu->cl_jval;
+	  	if (!afu->cl_jval)
 	  		*ha_jval_top = 0;
 	  }
-	  if (cl_mmio) {
-	  	--cl_mmio;
-	  	if (!cl_mmio)
+	  if (afu->cl_mmio) {
+	  	--afu->cl_mmio;
+	  	if (!afu->cl_mmio)
 	  		*ha_mmval_top = 0;
 	  }
-	  if (cl_br) {
-	  	--cl_br;
-	  	if (!cl_br)
+	  if (afu->cl_br) {
+	  	--afu->cl_br;
+	  	if (!afu->cl_br)
 	  		*ha_brvalid_top = 0;
 	  }
-	  if (cl_bw) {
-	  	--cl_bw;
-	  	if (!cl_bw)
+	  if (afu->cl_bw) {
+	  	--afu->cl_bw;
+	  	if (!afu->cl_bw)
 	  		*ha_bwvalid_top = 0;
 	  }
-	  if (cl_rval) {
-	  	--cl_rval;
-	  	if (!cl_rval)
+	  if (afu->cl_rval) {
+	  	--afu->cl_rval;
+	  	if (!afu->cl_rval)
 	  		*ha_rvalid_top = 0;
 	  }
 	  return;
@@ -896,7 +939,7 @@ PLI_INT32 register_control()
 	jyield = vpi_scan(argsiter);
 	timebase_req = vpi_scan(argsiter);
 	parity_enabled = vpi_scan(argsiter);
-	cl_jval = 0;
+	get_instance(0)->cl_jval = 0;
 
 	set_signal32(jval, 0);
 
@@ -920,7 +963,7 @@ PLI_INT32 register_mmio()
 	mmack = vpi_scan(argsiter);
 	mmrdata = vpi_scan(argsiter);
 	mmrdatapar = vpi_scan(argsiter);
-	cl_mmio = 0;
+	get_instance(0)->cl_mmio = 0;
 
 	set_signal32(mmval, 0);
 
@@ -945,7 +988,7 @@ PLI_INT32 register_command()
 	cch = vpi_scan(argsiter);
 	csize = vpi_scan(argsiter);
 
-	set_signal32(croom, event.room);
+	set_signal32(croom, get_instance(0)->event.room);
 
 	return 0;
 }
@@ -964,7 +1007,7 @@ PLI_INT32 register_rd_buffer()
 	brvalid_out = vpi_scan(argsiter);
 	brtag_out = vpi_scan(argsiter);
 	brlat = vpi_scan(argsiter);
-	cl_br = 0;
+	get_instance(0)->cl_br = 0;
 
 	set_signal32(brval, 0);
 
@@ -982,7 +1025,7 @@ PLI_INT32 register_wr_buffer()
 	bwtagpar = vpi_scan(argsiter);
 	bwdata = vpi_scan(argsiter);
 	bwpar = vpi_scan(argsiter);
-	cl_bw = 0;
+	get_instance(0)->cl_bw = 0;
 
 	set_signal32(bwval, 0);
 
@@ -1000,7 +1043,7 @@ PLI_INT32 register_response()
 	rtagpar = vpi_scan(argsiter);
 	resp = vpi_scan(argsiter);
 	rcredits = vpi_scan(argsiter);
-	cl_rval = 0;
+	get_instance(0)->cl_rval = 0;
 
 	set_signal32(rval, 0);
 
@@ -1172,41 +1215,251 @@ static void psl()
 */
 PLI_INT32 afu_close()
 {
-	psl_close_afu_event(&event);
+	int i;
+
+	for (i = 0; i < MAX_AFU_INSTANCES; i++) {
+		if (afu_instances[i] == NULL)
+			continue;
+		if (afu_instances[i]->accepting) {
+			pthread_cancel(afu_instances[i]->accept_tid);
+			pthread_join(afu_instances[i]->accept_tid, NULL);
+		}
+		if (!afu_instances[i]->connected &&
+		    (afu_instances[i]->event.sockfd >= 0)) {
+			// Still listening, there is no connection to shut down
+			close(afu_instances[i]->event.sockfd);
+		} else if (afu_instances[i]->io_thread) {
+			pthread_cancel(afu_instances[i]->io_tid);
+			pthread_join(afu_instances[i]->io_tid, NULL);
+			psl_close_afu_event(&(afu_instances[i]->io_event));
+		} else {
+			psl_close_afu_event(&(afu_instances[i]->event));
+		}
+		free(afu_instances[i]);
+		afu_instances[i] = NULL;
+	}
 	return 0;
 }
 
 PLI_INT32 afu_init()
 {
-	int port = 32768;
-	while (psl_serv_afu_event(&event, port) != PSL_SUCCESS) {
+	struct afu_instance *afu = get_instance(0);
+	int port = AFU_BASE_PORT;
+	if (afu == NULL)
+		return 0;
+	while (psl_serv_afu_event(&afu->event, port) != PSL_SUCCESS) {
 		if (port == 65535) {
 			error_message("Unable to find open port!");
 		}
 		++port;
 	}
+	afu->connected = 1;
 	set_callback_event(afu_close, cbEndOfSimulation);
 	return 0;
 }
 
-static void psl_control(void)
+// Wait for next clock edge from PSL, sending the pending AFU outputs
+static int get_psl_clock(struct AFU_EVENT *event)
 {
-	// Wait for clock edge from PSL
 	fd_set watchset;
 	FD_ZERO(&watchset);
-	FD_SET(event.sockfd, &watchset);
-	select(event.sockfd + 1, &watchset, NULL, NULL, NULL);
-	int rc = psl_get_psl_events(&event);
+	FD_SET(event->sockfd, &watchset);
+	select(event->sockfd + 1, &watchset, NULL, NULL, NULL);
+	int rc = psl_get_psl_events(event);
 	// No clock edge
 	while (!rc) {
-		select(event.sockfd + 1, &watchset, NULL, NULL, NULL);
-		rc = psl_get_psl_events(&event);
+		select(event->sockfd + 1, &watchset, NULL, NULL, NULL);
+		rc = psl_get_psl_events(event);
+	}
+	return rc;
+}
+
+// Hand the AFU outputs collected since the last frame to the I/O thread so
+// it can answer the next clock edge while the simulator evaluates
+static void io_post_outputs(struct afu_instance *afu)
+{
+	struct AFU_EVENT *from = &afu->event;
+	struct AFU_EVENT *to = &afu->io_event;
+
+	if (afu->io_sent)
+		return;
+	pthread_mutex_lock(&afu->io_lock);
+	if (from->aux2_change) {
+		to->aux2_change = 1;
+		to->job_running = from->job_running;
+		to->job_done = from->job_done;
+		to->job_cack_llcmd = from->job_cack_llcmd;
+		to->job_error = from->job_error;
+		to->job_yield = from->job_yield;
+		to->timebase_request = from->timebase_request;
+		to->parity_enable = from->parity_enable;
+		to->buffer_read_latency = from->buffer_read_latency;
+		from->aux2_change = 0;
+	}
+	if (from->mmio_ack) {
+		to->mmio_ack = 1;
+		to->mmio_rdata = from->mmio_rdata;
+		to->mmio_rdata_parity = from->mmio_rdata_parity;
+		from->mmio_ack = 0;
+	}
+	if (from->buffer_rdata_valid) {
+		to->buffer_rdata_valid = 1;
+		memcpy(to->buffer_rdata, from->buffer_rdata,
+		       sizeof(to->buffer_rdata));
+		memcpy(to->buffer_rparity, from->buffer_rparity,
+		       sizeof(to->buffer_rparity));
+		from->buffer_rdata_valid = 0;
+	}
+	if (from->command_valid) {
+		to->command_valid = 1;
+		to->command_tag = from->command_tag;
+		to->command_tag_parity = from->command_tag_parity;
+		to->command_code = from->command_code;
+		to->command_code_parity = from->command_code_parity;
+		to->command_address = from->command_address;
+		to->command_address_parity = from->command_address_parity;
+		to->command_size = from->command_size;
+		to->command_abort = from->command_abort;
+		to->command_handle = from->command_handle;
+		from->command_valid = 0;
+	}
+	afu->io_sent = 1;
+	afu->io_posted = 1;
+	pthread_cond_broadcast(&afu->io_cond);
+	pthread_mutex_unlock(&afu->io_lock);
+}
+
+// Wait for the I/O thread to receive the next frame and copy its PSL inputs
+static int io_take_inputs(struct afu_instance *afu)
+{
+	struct AFU_EVENT *from = &afu->io_event;
+	struct AFU_EVENT *to = &afu->event;
+	int rc;
+
+	io_post_outputs(afu);
+	pthread_mutex_lock(&afu->io_lock);
+	while (!afu->io_frame)
+		pthread_cond_wait(&afu->io_cond, &afu->io_lock);
+	rc = afu->io_rc;
+	// Leave the frame in place after an error, the thread has ended
+	if (rc < 0) {
+		pthread_mutex_unlock(&afu->io_lock);
+		return rc;
+	}
+	// Clock only frames leave the flags alone so clear them once taken
+	if (from->aux1_change) {
+		to->aux1_change = 1;
+		to->room = from->room;
+		from->aux1_change = 0;
+	}
+	if (from->job_valid) {
+		to->job_valid = 1;
+		to->job_code = from->job_code;
+		to->job_code_parity = from->job_code_parity;
+		to->job_address = from->job_address;
+		to->job_address_parity = from->job_address_parity;
+		from->job_valid = 0;
+	}
+	if (from->mmio_valid) {
+		to->mmio_valid = 1;
+		to->mmio_read = from->mmio_read;
+		to->mmio_double = from->mmio_double;
+		to->mmio_afudescaccess = from->mmio_afudescaccess;
+		to->mmio_address = from->mmio_address;
+		to->mmio_address_parity = from->mmio_address_parity;
+		to->mmio_wdata = from->mmio_wdata;
+		to->mmio_wdata_parity = from->mmio_wdata_parity;
+		from->mmio_valid = 0;
+	}
+	if (from->response_valid) {
+		to->response_valid = 1;
+		to->response_tag = from->response_tag;
+		to->response_tag_parity = from->response_tag_parity;
+		to->response_code = from->response_code;
+		to->credits = from->credits;
+		to->cache_state = from->cache_state;
+		to->cache_position = from->cache_position;
+		from->response_valid = 0;
 	}
+	if (from->buffer_read) {
+		to->buffer_read = 1;
+		to->buffer_read_tag = from->buffer_read_tag;
+		to->buffer_read_tag_parity = from->buffer_read_tag_parity;
+		to->buffer_read_address = from->buffer_read_address;
+		to->buffer_read_length = from->buffer_read_length;
+		from->buffer_read = 0;
+	}
+	if (from->buffer_write) {
+		to->buffer_write = 1;
+		to->buffer_write_tag = from->buffer_write_tag;
+		to->buffer_write_tag_parity = from->buffer_write_tag_parity;
+		to->buffer_write_address = from->buffer_write_address;
+		to->buffer_write_length = from->buffer_write_length;
+		memcpy(to->buffer_wdata, from->buffer_wdata,
+		       sizeof(to->buffer_wdata));
+		memcpy(to->buffer_wparity, from->buffer_wparity,
+		       sizeof(to->buffer_wparity));
+		from->buffer_write = 0;
+	}
+	afu->io_frame = 0;
+	afu->io_sent = 0;
+	pthread_mutex_unlock(&afu->io_lock);
+	return rc;
+}
+
+// I/O thread: once the outputs for the next frame are posted answer PSL's
+// clock edge with them and keep the received frame for the simulator
+static void *io_loop(void *ptr)
+{
+	struct afu_instance *afu = (struct afu_instance *)ptr;
+	int rc;
+
+	pthread_mutex_lock(&afu->io_lock);
+	do {
+		while (!afu->io_posted)
+			pthread_cond_wait(&afu->io_cond, &afu->io_lock);
+		afu->io_posted = 0;
+		pthread_mutex_unlock(&afu->io_lock);
+		rc = get_psl_clock(&afu->io_event);
+		pthread_mutex_lock(&afu->io_lock);
+		afu->io_rc = rc;
+		afu->io_frame = 1;
+		pthread_cond_broadcast(&afu->io_cond);
+	} while (rc >= 0);
+	pthread_mutex_unlock(&afu->io_lock);
+	return NULL;
+}
+
+// Move socket I/O of AFU instance to its own thread
+static void io_start(struct afu_instance *afu)
+{
+	afu->io_event = afu->event;
+	pthread_mutex_init(&afu->io_lock, NULL);
+	pthread_cond_init(&afu->io_cond, NULL);
+	if (pthread_create(&afu->io_tid, NULL, io_loop, afu)) {
+		perror("pthread_create");
+		pthread_mutex_destroy(&afu->io_lock);
+		pthread_cond_destroy(&afu->io_cond);
+		return;
+	}
+	afu->io_thread = 1;
+	printf("AFU socket I/O is handled by a separate thread\n");
+}
+
+static void psl_control(struct afu_instance *afu)
+{
+	int rc;
+
+	// Wait for clock edge from PSL
+	if (afu->io_thread)
+		rc = io_take_inputs(afu);
+	else
+		rc = get_psl_clock(&afu->event);
 	// Error case
 	if (rc < 0) {
 	  printf("%08lld: ", (long long) c_sim_time);
 	  printf("Socket closed: Ending Simulation.");
-	  c_sim_error = 1;
+	  afu->sim_error = 1;
 #ifdef OLD_PLI_CODE
 #ifdef FINISH
 		vpi_control(vpiFinish, 1);
@@ -1217,15 +1470,64 @@ static void psl_control(void)
 	}
 }
 
-void psl_bfm_init()
+// Take the pslse connection for an AFU instance.  pslse connects to its
+// AFUs one at a time while holding its lock, so an instance that is already
+// clocked can't answer it and each instance accepts in its own thread.
+static void *accept_loop(void *ptr)
 {
-	int port = 32768;
-	while (psl_serv_afu_event(&event, port) != PSL_SUCCESS) {
+	struct afu_instance *afu = (struct afu_instance *)ptr;
+
+	if (psl_accept_afu_event(&afu->event) != PSL_SUCCESS) {
+		error_message("Unable to accept pslse connection");
+		return NULL;
+	}
+	if (getenv("AFU_IO_THREAD") && atoi(getenv("AFU_IO_THREAD")))
+		io_start(afu);
+	pthread_mutex_lock(&connect_lock);
+	afu->connected = 1;
+	++connected_count;
+	pthread_cond_broadcast(&connect_cond);
+	pthread_mutex_unlock(&connect_lock);
+	return NULL;
+}
+
+// Hold the simulation until pslse has connected to some AFU instance, then
+// report whether this one is connected.  Instances pslse doesn't use simply
+// see no clock.
+static int instance_ready(struct afu_instance *afu)
+{
+	int connected;
+
+	pthread_mutex_lock(&connect_lock);
+	while (connected_count == 0)
+		pthread_cond_wait(&connect_cond, &connect_lock);
+	connected = afu->connected;
+	pthread_mutex_unlock(&connect_lock);
+	return connected;
+}
+
+// Start AFU instance handle listening for pslse.  Instance n tries port
+// 32768+n first so each afuX.Y entry in shim_host.dat keeps its port from run
+// to run, then the next free port.  Every instance is listening once the
+// initial blocks have run, the connection itself is taken by accept_loop.
+void psl_bfm_init(int handle)
+{
+	struct afu_instance *afu = get_instance(handle);
+	int port = AFU_BASE_PORT + handle;
+	if (afu == NULL)
+		return;
+	while (psl_listen_afu_event(&afu->event, port) != PSL_SUCCESS) {
 		if (port == 65535) {
 			error_message("Unable to find open port!");
 		}
 		++port;
 	}
+	if (pthread_create(&afu->accept_tid, NULL, accept_loop, afu)) {
+		perror("pthread_create");
+		error_message("Unable to wait for pslse connection");
+		return;
+	}
+	afu->accepting = 1;
 	// set_callback_event(afu_close, cbEndOfSimulation);
 	return;
 }
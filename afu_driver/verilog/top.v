@@ -16,14 +16,21 @@
 
 `timescale 1ns / 1ns
 
-module top (
+// AFU_HANDLE selects the afu_driver state used by this instance.  Give each
+// instance in one simulation its own handle to serve several AFUs from a
+// single simulator process.  Instance n listens on port 32768+n if it is free.
+
+module top #(
+  parameter       AFU_HANDLE = 0
+) (
   output          breakpoint
 );
 
-   import "DPI-C" function void psl_bfm_init( );
+   import "DPI-C" function void psl_bfm_init(input int handle);
    import "DPI-C" function void set_simulation_time(input [0:63] simulationTime);
-   import "DPI-C" function void get_simuation_error(inout simulationError);
-   import "DPI-C" function void psl_bfm( input ha_pclock, 
+   import "DPI-C" function void get_simuation_error(input int handle, inout simulationError);
+   import "DPI-C" function void psl_bfm( input int handle,
+             input ha_pclock, 
              inout           ha_jval_top, 
              inout  [0:7]    ha_jcom_top, 
              inout           ha_jcompar_top, 
@@ -287,7 +294,7 @@ module top (
     ha_jeapar_top <= 0;
     ha_pclock <= 0;
     // $afu_init;
-     psl_bfm_init();
+     psl_bfm_init(AFU_HANDLE);
     // $register_clock(ha_pclock);
 /*
     $register_control(ha_jval_top, ha_jcom_top, ha_jcompar_top, ha_jea_top,
@@ -342,7 +349,8 @@ module top (
     simulationTime = $time;
     set_simulation_time(simulationTime);
 //    $display("%d : Calling to C ", simulationTime);
-    psl_bfm( ha_pclock, 
+    psl_bfm( AFU_HANDLE,
+             ha_pclock, 
              ha_jval_top, 
              ha_jcom_top, 
              ha_jcompar_top, 
@@ -399,7 +407,7 @@ module top (
   end
 
   always @ (negedge ha_pclock) begin
-    get_simuation_error(simulationError);
+    get_simuation_error(AFU_HANDLE, simulationError);
   end
 
   always @ (posedge ha_pclock) begin
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Description: bench_codec.c
+ *
+ *  Microbenchmark for the PSL interface wire codec and cacheline parity.
+ *  A PSL side and an AFU side AFU_EVENT are connected over a socketpair and
+ *  events are passed back and forth as in a simulation.  Each direction is
+ *  timed twice, once with every field of the event valid and once with only
+ *  the clock, so the difference is the cost of encoding and decoding the
+ *  fields rather than of the socket.  Build with "make bench" in common/.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "psl_interface.h"
+#include "utils.h"
+
+#define DEFAULT_EVENTS 200000
+
+static uint64_t _now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Mark every PSL to AFU field valid
+static void _fill_psl(struct AFU_EVENT *psl, uint32_t i)
+{
+	psl->aux1_change = 1;
+	psl->room = 64;
+	psl->job_valid = 1;
+	psl->job_code = PSL_JOB_START;
+	psl->job_address = 0x0123456789ABCDEFULL ^ i;
+	psl->mmio_valid = 1;
+	psl->mmio_double = 1;
+	psl->mmio_address = i & 0xFFFFFF;
+	psl->mmio_wdata = 0xFEDCBA9876543210ULL ^ i;
+	psl->response_valid = 1;
+	psl->response_tag = i & 0xFF;
+	psl->credits = 1;
+	psl->buffer_read = 1;
+	psl->buffer_read_tag = i & 0xFF;
+	psl->buffer_read_length = 128;
+	psl->buffer_write = 1;
+	psl->buffer_write_tag = i & 0xFF;
+	psl->buffer_write_length = 128;
+	memset(psl->buffer_wdata, i & 0xFF, CACHELINE_BYTES);
+	generate_cl_parity(psl->buffer_wdata, psl->buffer_wparity);
+}
+
+// Mark every AFU to PSL field valid
+static void _fill_afu(struct AFU_EVENT *afu, uint32_t i)
+{
+	afu->aux2_change = 1;
+	afu->job_running = 1;
+	afu->job_error = 0x0123456789ABCDEFULL ^ i;
+	afu->mmio_ack = 1;
+	afu->mmio_rdata = 0xFEDCBA9876543210ULL ^ i;
+	afu->buffer_rdata_valid = 1;
+	memset(afu->buffer_rdata, i & 0xFF, CACHELINE_BYTES);
+	generate_cl_parity(afu->buffer_rdata, afu->buffer_rparity);
+	afu->command_valid = 1;
+	afu->command_tag = i & 0xFF;
+	afu->command_code = PSL_COMMAND_READ_CL_NA;
+	afu->command_size = 128;
+	afu->command_address = 0x0000123456789A00ULL + (i << 7);
+	afu->command_handle = i & 0x1FF;
+}
+
+// Pass count events each way, return PSL to AFU and AFU to PSL times
+static int _run(struct AFU_EVENT *psl, struct AFU_EVENT *afu, int count,
+		int full, uint64_t * to_afu, uint64_t * to_psl)
+{
+	uint64_t start, mid, end;
+	int i;
+
+	*to_afu = *to_psl = 0;
+	for (i = 0; i < count; i++) {
+		if (full) {
+			_fill_psl(psl, i);
+			_fill_afu(afu, i);
+		}
+		// PSL side encodes, AFU side decodes and sends its reply
+		start = _now_ns();
+		if (psl_signal_afu_model(psl) != PSL_SUCCESS)
+			return -1;
+		while (psl_get_psl_events(afu) == 0) ;
+		mid = _now_ns();
+		// PSL side decodes the reply
+		while (psl_get_afu_events(psl) == 0) ;
+		end = _now_ns();
+		*to_afu += mid - start;
+		*to_psl += end - mid;
+	}
+	return 0;
+}
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -n, --events\t\tevents passed each way, default %d\n",
+	       DEFAULT_EVENTS);
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct AFU_EVENT *psl, *afu;
+	uint8_t line[CACHELINE_BYTES];
+	uint8_t parity[DWORDS_PER_CACHELINE / BYTES_PER_DWORD];
+	uint64_t clock_afu, clock_psl, full_afu, full_psl, start, elapsed;
+	int fd[2];
+	int opt, option_index, count, i, rc;
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"events",	required_argument,	0,		'n'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	count = DEFAULT_EVENTS;
+	while ((opt = getopt_long(argc, argv, "hn:",
+				  long_options, &option_index)) >= 0) {
+		switch (opt) {
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(argv[0]);
+			return 0;
+		}
+	}
+	if (count <= 0) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	psl = (struct AFU_EVENT *)malloc(sizeof(struct AFU_EVENT));
+	afu = (struct AFU_EVENT *)malloc(sizeof(struct AFU_EVENT));
+	if ((psl == NULL) || (afu == NULL)) {
+		perror("malloc");
+		return -1;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	psl_event_reset(psl);
+	psl_event_reset(afu);
+	psl->sockfd = fd[0];
+	afu->sockfd = fd[1];
+
+	rc = _run(psl, afu, count, 0, &clock_afu, &clock_psl);
+	if (!rc)
+		rc = _run(psl, afu, count, 1, &full_afu, &full_psl);
+	if (rc) {
+		fprintf(stderr, "Event transmission failed\n");
+		return -1;
+	}
+
+	printf("Events each way: %d\n", count);
+	printf("PSL to AFU: %6.1f ns/event full, %6.1f ns/event clock only, "
+	       "%6.1f ns/event codec\n", (double)full_afu / count,
+	       (double)clock_afu / count,
+	       ((double)full_afu - (double)clock_afu) / count);
+	printf("AFU to PSL: %6.1f ns/event full, %6.1f ns/event clock only, "
+	       "%6.1f ns/event codec\n", (double)full_psl / count,
+	       (double)clock_psl / count,
+	       ((double)full_psl - (double)clock_psl) / count);
+
+	// Cacheline parity on its own
+	for (i = 0; i < CACHELINE_BYTES; i++)
+		line[i] = i * 37;
+	start = _now_ns();
+	for (i = 0; i < count; i++) {
+		line[i % CACHELINE_BYTES] ^= i;
+		generate_cl_parity(line, parity);
+	}
+	elapsed = _now_ns() - start;
+	printf("Cacheline parity: %6.1f ns/line (0x%02x%02x)\n",
+	       (double)elapsed / count, parity[0], parity[1]);
+
+	close(fd[0]);
+	close(fd[1]);
+	free(psl);
+	free(afu);
+	return 0;
+}
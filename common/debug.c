@@ -247,6 +247,51 @@ static void _debug_send_id_8_8_16_32(FILE * fp, DBG_HEADER header, uint8_t id,
 	}
 }
 
+// Return the number of bytes that follow a header of the given type in the
+// log, or -1 if the header is unknown.
+ssize_t debug_record_size(DBG_HEADER header)
+{
+	switch (header) {
+	case DBG_HEADER_AFU_CONNECT:
+	case DBG_HEADER_AFU_DROP:
+	case DBG_HEADER_MMIO_ACK:
+		return sizeof(uint8_t);
+	case DBG_HEADER_VERSION:
+	case DBG_HEADER_JOB_AUX2:
+	case DBG_HEADER_CMD_BUFFER_WRITE:
+	case DBG_HEADER_CMD_BUFFER_READ:
+	case DBG_HEADER_CMD_RESPONSE:
+		return 2 * sizeof(uint8_t);
+	case DBG_HEADER_CONTEXT_ADD:
+	case DBG_HEADER_CONTEXT_REMOVE:
+	case DBG_HEADER_MMIO_MAP:
+	case DBG_HEADER_MMIO_RETURN:
+		return sizeof(uint8_t) + sizeof(uint16_t);
+	case DBG_HEADER_SOCKET_PUT:
+	case DBG_HEADER_SOCKET_GET:
+	case DBG_HEADER_CMD_CLIENT_REQ:
+	case DBG_HEADER_CMD_CLIENT_ACK:
+		return 2 * sizeof(uint8_t) + sizeof(uint16_t);
+	case DBG_HEADER_JOB_ADD:
+	case DBG_HEADER_JOB_SEND:
+		return sizeof(uint8_t) + sizeof(uint32_t);
+	case DBG_HEADER_CMD_ADD:
+	case DBG_HEADER_CMD_UPDATE:
+		return 2 * sizeof(uint8_t) + 2 * sizeof(uint16_t);
+	case DBG_HEADER_PARM:
+		return 2 * sizeof(uint32_t);
+	case DBG_HEADER_MMIO_ADD:
+	case DBG_HEADER_MMIO_SEND:
+		return 3 * sizeof(uint8_t) + sizeof(uint16_t) +
+		    sizeof(uint32_t);
+	case DBG_HEADER_PE_ADD:
+	case DBG_HEADER_PE_SEND:
+		return sizeof(uint8_t) + sizeof(uint32_t) + sizeof(uint64_t);
+	default:
+		return -1;
+	}
+}
+
 size_t debug_get_64(FILE * fp, uint64_t * value)
 {
 	size_t rc;
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 typedef uint8_t DBG_HEADER;
 
@@ -66,7 +67,28 @@ typedef uint8_t DBG_HEADER;
 #define DBG_PSL_REV_LVL			0x8
 #define DBG_IMAGE_LOADED		0x9
 #define DBG_BASE_IMAGE			0xA
+#define DBG_PARM_LISTEN_BACKLOG		0xB
+#define DBG_PARM_HOTPLUG		0xC
+#define DBG_PARM_WARM_OPEN		0xD
+#define DBG_PARM_PREFETCH_LINES		0xE
+#define DBG_PARM_WRITE_COMBINE_LINES	0xF
+#define DBG_PARM_TIMING_MODEL		0x10
+#define DBG_PARM_READ_LATENCY		0x11
+#define DBG_PARM_WRITE_LATENCY		0x12
+#define DBG_PARM_TOUCH_LATENCY		0x13
+#define DBG_PARM_INTERRUPT_LATENCY	0x14
+#define DBG_PARM_OTHER_LATENCY		0x15
+#define DBG_PARM_LINK_BYTES_PER_CYCLE	0x16
+#define DBG_PARM_ERAT_MISS_PENALTY	0x17
+#define DBG_PARM_CREDIT_DELAY		0x18
+#define DBG_PARM_ERAT_ENTRIES		0x19
+#define DBG_PARM_ERAT_WAYS		0x1A
+#define DBG_PARM_ERAT_POLICY		0x1B
+#define DBG_PARM_ERAT_PAGE_SIZE		0x1C
+#define DBG_PARM_SCHEDULER		0x1D
+#define DBG_PARM_CONTEXT_WEIGHT		0x1E
 
+ssize_t debug_record_size(DBG_HEADER header);
 size_t debug_get_64(FILE * fp, uint64_t * value);
 size_t debug_get_32(FILE * fp, uint32_t * value);
 size_t debug_get_16(FILE * fp, uint16_t * value);
@@ -17,6 +17,7 @@
 #include "psl_interface.h"
 
 #include <arpa/inet.h>
+#include <endian.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -32,16 +33,25 @@
 static uint32_t genoddParitybitperbytes(uint64_t data)
 {
 	//For odd parity: If sum of data bits is even, parity is 1
-	uint32_t oddparity;
-	oddparity = 1;		//since odd, start off setting
+	return 1 ^ __builtin_parityll(data);
+}
 
-	// Count off least significant asserted bit
-	while (data) {
-		oddparity = 1 - oddparity;	// 0->1 or 1->0
-		data &= data - 1;	// Remove lsb that is set to 1
-	}
+/* Store 64 bit value big endian at buf with a single byte swapped store */
 
-	return oddparity;
+static inline void put_be64(unsigned char *buf, uint64_t value)
+{
+	value = htobe64(value);
+	memcpy(buf, &value, sizeof(value));
+}
+
+/* Load 64 bit big endian value from buf with a single load and byte swap */
+
+static inline uint64_t get_be64(const unsigned char *buf)
+{
+	uint64_t value;
+
+	memcpy(&value, buf, sizeof(value));
+	return be64toh(value);
 }
 
 static void set_protocol_level(struct AFU_EVENT *event, uint32_t primary,
@@ -260,12 +270,21 @@ int psl_close_afu_event(struct AFU_EVENT *event)
 
 int psl_serv_afu_event(struct AFU_EVENT *event, int port)
 {
-	int cs = -1;
+	int rc = psl_listen_afu_event(event, port);
+	if (rc != PSL_SUCCESS)
+		return rc;
+	return psl_accept_afu_event(event);
+}
+
+/* Initialize the AFU_EVENT structure and listen on port, the listening socket
+ * is kept in sockfd until psl_accept_afu_event replaces it */
+
+int psl_listen_afu_event(struct AFU_EVENT *event, int port)
+{
 	psl_event_reset(event);
 	event->room = 64;
 	event->rbp = 0;
-	struct sockaddr_in ssadr, csadr;
-	unsigned int csalen = sizeof(csadr);
+	struct sockaddr_in ssadr;
 	memset(&ssadr, 0, sizeof(ssadr));
 	ssadr.sin_family = AF_UNSPEC;
 	ssadr.sin_addr.s_addr = INADDR_ANY;
@@ -291,6 +310,17 @@ int psl_serv_afu_event(struct AFU_EVENT *event, int port)
 		psl_close_afu_event(event);
 		return PSL_BAD_SOCKET;
 	}
+	return PSL_SUCCESS;
+}
+
+/* Wait for the PSL side to connect to the port psl_listen_afu_event is
+ * listening on */
+
+int psl_accept_afu_event(struct AFU_EVENT *event)
+{
+	int cs = -1;
+	struct sockaddr_in csadr;
+	unsigned int csalen = sizeof(csadr);
 	while (cs < 0) {
 		cs = accept(event->sockfd, (struct sockaddr *)&csadr, &csalen);
 		if ((cs < 0) && (errno != EINTR)) {
@@ -578,10 +608,8 @@ int psl_signal_afu_model(struct AFU_EVENT *event)
 	if (event->job_valid != 0) {
 		event->tbuf[0] = event->tbuf[0] | 0x10;
 		event->tbuf[bp++] = event->job_code;
-		for (i = 0; i < 8; i++) {
-			event->tbuf[bp++] =
-			    ((event->job_address) >> ((7 - i) * 8)) & 0xFF;
-		}
+		put_be64(event->tbuf + bp, event->job_address);
+		bp += 8;
 		event->tbuf[bp++] = (((event->job_address_parity) << 1) & 0x2) |
 		    ((event->job_code_parity) & 0x1);
 		event->job_valid = 0;
@@ -610,10 +638,8 @@ int psl_signal_afu_model(struct AFU_EVENT *event)
 			event->tbuf[bp++] =
 			    ((event->mmio_address) >> ((2 - i) * 8)) & 0xFF;
 		}
-		for (i = 0; i < 8; i++) {
-			event->tbuf[bp++] =
-			    ((event->mmio_wdata) >> ((7 - i) * 8)) & 0xFF;
-		}
+		put_be64(event->tbuf + bp, event->mmio_wdata);
+		bp += 8;
 		event->mmio_valid = 0;
 	}
 	if (event->response_valid != 0) {
@@ -652,12 +678,10 @@ int psl_signal_afu_model(struct AFU_EVENT *event)
 			event->tbuf[bp++] =
 			    0x00 | (event->buffer_write_address & 0x3F);
 		}
-		for (i = 0; i < 128; i++) {
-			event->tbuf[bp++] = event->buffer_wdata[i];
-		}
-		for (i = 0; i < 2; i++) {
-			event->tbuf[bp++] = event->buffer_wparity[i];
-		}
+		memcpy(event->tbuf + bp, event->buffer_wdata, 128);
+		bp += 128;
+		memcpy(event->tbuf + bp, event->buffer_wparity, 2);
+		bp += 2;
 		event->buffer_write = 0;
 	}
 	bl = bp;
@@ -688,10 +712,8 @@ static int psl_signal_psl_model(struct AFU_EVENT *event)
 		    (((event->buffer_read_latency) << 4) & 0xF0) |
 		    (((event->job_running)
 		      << 1) & 0x2) | (event->job_done & 1);
-		for (i = 0; i < 8; i++) {
-			event->tbuf[bp++] =
-			    ((event->job_error) >> ((7 - i) * 8)) & 0xFF;
-		}
+		put_be64(event->tbuf + bp, event->job_error);
+		bp += 8;
 		event->tbuf[bp++] = (((event->job_cack_llcmd) << 3) & 0x08) |
 		    (((event->job_yield) << 2) & 0x04) |
 		    (((event->timebase_request) << 1) & 0x03) |
@@ -700,21 +722,17 @@ static int psl_signal_psl_model(struct AFU_EVENT *event)
 	}
 	if (event->mmio_ack) {
 		event->tbuf[0] = event->tbuf[0] | 0x04;
-		for (i = 0; i < 8; i++) {
-			event->tbuf[bp++] =
-			    ((event->mmio_rdata) >> ((7 - i) * 8)) & 0xFF;
-		}
+		put_be64(event->tbuf + bp, event->mmio_rdata);
+		bp += 8;
 		event->tbuf[bp++] = event->mmio_rdata_parity;
 		event->mmio_ack = 0;
 	}
 	if (event->buffer_rdata_valid) {
 		event->tbuf[0] = event->tbuf[0] | 0x02;
-		for (i = 0; i < 128; i++) {
-			event->tbuf[bp++] = event->buffer_rdata[i];
-		}
-		for (i = 0; i < 2; i++) {
-			event->tbuf[bp++] = event->buffer_rparity[i];
-		}
+		memcpy(event->tbuf + bp, event->buffer_rdata, 128);
+		bp += 128;
+		memcpy(event->tbuf + bp, event->buffer_rparity, 2);
+		bp += 2;
 		event->buffer_rdata_valid = 0;
 	}
 	if (event->command_valid) {
@@ -730,10 +748,8 @@ static int psl_signal_psl_model(struct AFU_EVENT *event)
 				       0x10) | (((event->command_size)
 						 >> 8) & 0x0F);
 		event->tbuf[bp++] = event->command_size & 0xFF;
-		for (i = 0; i < 8; i++) {
-			event->tbuf[bp++] =
-			    ((event->command_address) >> ((7 - i) * 8)) & 0xFF;
-		}
+		put_be64(event->tbuf + bp, event->command_address);
+		bp += 8;
 		for (i = 0; i < 2; i++) {
 			event->tbuf[bp++] =
 			    ((event->command_handle) >> ((1 - i) * 8)) & 0xFF;
@@ -826,11 +842,8 @@ int psl_get_afu_events(struct AFU_EVENT *event)
 		event->buffer_read_latency = (event->rbuf[rbc]) >> 4;
 		event->job_running = ((event->rbuf[rbc]) >> 1) & 0x01;
 		event->job_done = (event->rbuf[rbc++]) & 0x01;
-		event->job_error = 0;
-		for (bc = 0; bc < 8; bc++) {
-			event->job_error =
-			    ((event->job_error) << 8) | event->rbuf[rbc++];
-		}
+		event->job_error = get_be64(event->rbuf + rbc);
+		rbc += 8;
 		event->job_cack_llcmd = ((event->rbuf[rbc]) >> 3) & 0x01;
 		event->job_yield = ((event->rbuf[rbc]) >> 2) & 0x01;
 		event->timebase_request = ((event->rbuf[rbc]) >> 1) & 0x01;
@@ -840,23 +853,18 @@ int psl_get_afu_events(struct AFU_EVENT *event)
 	}
 	if ((event->rbuf[0] & 0x04) != 0) {
 		event->mmio_ack = 1;
-		event->mmio_rdata = 0;
-		for (bc = 0; bc < 8; bc++) {
-			event->mmio_rdata =
-			    ((event->mmio_rdata) << 8) | event->rbuf[rbc++];
-		}
+		event->mmio_rdata = get_be64(event->rbuf + rbc);
+		rbc += 8;
 		event->mmio_rdata_parity = event->rbuf[rbc++];
 	} else {
 		event->mmio_ack = 0;
 	}
 	if ((event->rbuf[0] & 0x02) != 0) {
 		event->buffer_rdata_valid = 1;
-		for (bc = 0; bc < 128; bc++) {
-			event->buffer_rdata[bc] = event->rbuf[rbc++];
-		}
-		for (bc = 0; bc < 2; bc++) {
-			event->buffer_rparity[bc] = event->rbuf[rbc++];
-		}
+		memcpy(event->buffer_rdata, event->rbuf + rbc, 128);
+		rbc += 128;
+		memcpy(event->buffer_rparity, event->rbuf + rbc, 2);
+		rbc += 2;
 	} else {
 		event->buffer_rdata_valid = 0;
 	}
@@ -871,12 +879,8 @@ int psl_get_afu_events(struct AFU_EVENT *event)
 		event->command_address_parity = (event->rbuf[rbc] >> 4) & 0x01;
 		event->command_size = (event->rbuf[rbc++] & 0x0F) << 8;
 		event->command_size = event->command_size | event->rbuf[rbc++];
-		event->command_address = 0;
-		for (bc = 0; bc < 8; bc++) {
-			event->command_address =
-			    ((event->command_address) << 8) |
-			    event->rbuf[rbc++];
-		}
+		event->command_address = get_be64(event->rbuf + rbc);
+		rbc += 8;
 		event->command_handle = 0;
 		for (bc = 0; bc < 2; bc++) {
 			event->command_handle =
@@ -956,11 +960,8 @@ int psl_get_psl_events(struct AFU_EVENT *event)
 	if (event->rbuf[0] & 0x10) {
 		event->job_valid = 1;
 		event->job_code = event->rbuf[rbc++];
-		event->job_address = 0;
-		for (bc = 0; bc < 8; bc++) {
-			event->job_address =
-			    ((event->job_address) << 8) | event->rbuf[rbc++];
-		}
+		event->job_address = get_be64(event->rbuf + rbc);
+		rbc += 8;
 		event->job_address_parity = (event->rbuf[rbc] >> 1) & 0x01;
 		event->job_code_parity = event->rbuf[rbc++] & 0x01;
 	} else {
@@ -978,11 +979,8 @@ int psl_get_psl_events(struct AFU_EVENT *event)
 			event->mmio_address =
 			    ((event->mmio_address) << 8) | event->rbuf[rbc++];
 		}
-		event->mmio_wdata = 0;
-		for (bc = 0; bc < 8; bc++) {
-			event->mmio_wdata =
-			    ((event->mmio_wdata) << 8) | event->rbuf[rbc++];
-		}
+		event->mmio_wdata = get_be64(event->rbuf + rbc);
+		rbc += 8;
 	} else {
 		event->mmio_valid = 0;
 	}
@@ -1023,12 +1021,10 @@ int psl_get_psl_events(struct AFU_EVENT *event)
 			event->buffer_write_length = 64;
 		}
 		event->buffer_write_address = (event->rbuf[rbc++]) & 0x3F;
-		for (bc = 0; bc < 128; bc++) {
-			event->buffer_wdata[bc] = event->rbuf[rbc++];
-		}
-		for (bc = 0; bc < 2; bc++) {
-			event->buffer_wparity[bc] = event->rbuf[rbc++];
-		}
+		memcpy(event->buffer_wdata, event->rbuf + rbc, 128);
+		rbc += 128;
+		memcpy(event->buffer_wparity, event->rbuf + rbc, 2);
+		rbc += 2;
 	} else {
 		event->buffer_write = 0;
 	}
@@ -41,6 +41,16 @@ int psl_close_afu_event(struct AFU_EVENT *event);
 
 int psl_serv_afu_event(struct AFU_EVENT *event, int port);
 
+/* psl_serv_afu_event in two steps for a simulator serving several AFUs.
+ * psl_listen_afu_event initializes the AFU_EVENT structure and leaves it
+ * listening on port, psl_accept_afu_event then waits for the PSL side to
+ * connect.  Listening on every port first lets pslse connect to the AFUs in
+ * any order */
+
+int psl_listen_afu_event(struct AFU_EVENT *event, int port);
+
+int psl_accept_afu_event(struct AFU_EVENT *event);
+
 /* Call this to change auxilliary signals (room) */
 
 int psl_aux1_change(struct AFU_EVENT *event, uint32_t room);
@@ -189,7 +189,7 @@ int get_bytes_silent(int fd, int size, uint8_t * data, int timeout, int *abort)
 			break;
 		}
 
-		bytes = recv(fd, data, size - bytes, MSG_PEEK | MSG_DONTWAIT);
+		bytes = recv(fd, data, size, MSG_PEEK | MSG_DONTWAIT);
 		if (((bytes < 0) && (errno != EINTR)) || !bytes) {
 			warn_msg("get_bytes_silent:Socket disconnect on recv");
 			return -1;
@@ -201,7 +201,7 @@ int get_bytes_silent(int fd, int size, uint8_t * data, int timeout, int *abort)
 
 	bytes = 0;
 	while (data && (bytes < size)) {
-		count = recv(fd, &(data[bytes]), size, 0);
+		count = recv(fd, &(data[bytes]), size - bytes, 0);
 		if (count <= 0) {
 			if (errno != EINTR)
 				break;
@@ -240,7 +240,7 @@ int put_bytes_silent(int fd, int size, uint8_t * data)
 
 	bytes = 0;
 	while (data && (bytes < size)) {
-		count = write(fd, &(data[bytes]), size);
+		count = write(fd, &(data[bytes]), size - bytes);
 		if (count < 0) {
 			if (errno == EINTR)
 				continue;
@@ -276,36 +276,26 @@ int put_bytes(int fd, int size, uint8_t * data, FILE * dbg_fp, uint8_t dbg_id,
 // Generate parity for up to 64bits of data
 uint8_t generate_parity(uint64_t data, uint8_t odd)
 {
-	uint8_t parity = odd;
-	// While at least 1 bit is set
-	while (data) {
-		// Invert parity bit
-		parity = 1 - parity;
-		// Zero out least significant bit that is set to 1
-		data &= data - 1;
-	}
-	return parity;
+	return (odd ^ __builtin_parityll(data)) & 1;
 }
 
 // Generate parity for entire cacheline of data
 void generate_cl_parity(uint8_t * data, uint8_t * parity)
 {
-	int i;
-	uint64_t dw;
+	uint64_t dw[DWORDS_PER_CACHELINE];
 	uint8_t p;
-
-	// Walk each double word (dword) in cacheline
-	for (i = 0; i < DWORDS_PER_CACHELINE; i++) {
-		// Copy dword of data into uint64_t dw
-		memcpy(&dw, &(data[BYTES_PER_DWORD * i]), BYTES_PER_DWORD);
-		// Initialize parity entry to 0 when starting parity byte
-		if ((i % BYTES_PER_DWORD) == 0)
-			parity[i / BYTES_PER_DWORD] = 0;
-		// Shift previously calculated parity bits left
-		parity[i / BYTES_PER_DWORD] <<= 1;
-		// Generate parity bit for this dword
-		p = generate_parity(dw, ODD_PARITY);
-		parity[i / BYTES_PER_DWORD] += p;
+	int i, j;
+
+	// Load whole cacheline at once, then fold each dword to its parity bit
+	// with one parity instruction, most significant bit first in each byte
+	memcpy(dw, data, CACHELINE_BYTES);
+	for (i = 0; i < DWORDS_PER_CACHELINE / BYTES_PER_DWORD; i++) {
+		p = 0;
+		for (j = 0; j < BYTES_PER_DWORD; j++)
+			p = (p << 1) |
+			    (ODD_PARITY ^
+			     __builtin_parityll(dw[i * BYTES_PER_DWORD + j]));
+		parity[i] = p;
 	}
 }
 
@@ -330,3 +320,74 @@ int close_socket(int *sockfd)
 
 	return 0;
 }
+
+// Parse "afuM.N" and return number of characters consumed, -1 if invalid
+int parse_afu_name(const char *name, uint8_t * major, uint8_t * minor)
+{
+	const char *p;
+	int value[2];
+	int i;
+
+	if ((name == NULL) || strncmp(name, "afu", 3))
+		return -1;
+	p = name + 3;
+	for (i = 0; i < 2; i++) {
+		if ((i == 1) && (*p++ != '.'))
+			return -1;
+		if ((*p < '0') || (*p > '9'))
+			return -1;
+		value[i] = 0;
+		while ((*p >= '0') && (*p <= '9')) {
+			value[i] = (value[i] * 10) + (*p - '0');
+			if (value[i] >= PSLSE_MAX_AFUS_PER_ADAPTER)
+				return -1;
+			++p;
+		}
+	}
+	if (value[0] >= PSLSE_MAX_ADAPTERS)
+		return -1;
+	*major = value[0];
+	*minor = value[1];
+	return p - name;
+}
+
+// Bit in legacy 16-bit AFU map for AFU id, 0 if id isn't representable
+uint16_t afu_legacy_location(uint8_t id)
+{
+	if ((PSLSE_AFU_MAJOR(id) > 3) || (PSLSE_AFU_MINOR(id) > 3))
+		return 0;
+	return 0x8000 >> ((4 * PSLSE_AFU_MAJOR(id)) + PSLSE_AFU_MINOR(id));
+}
+
+// Set AFU id in extended AFU map
+void afu_map_set(uint8_t * map, uint8_t id)
+{
+	map[id / 8] |= 0x80 >> (id % 8);
+}
+
+// Clear AFU id in extended AFU map
+void afu_map_clear(uint8_t * map, uint8_t id)
+{
+	map[id / 8] &= ~(0x80 >> (id % 8));
+}
+
+// Test AFU id in extended AFU map
+int afu_map_test(const uint8_t * map, uint8_t id)
+{
+	return (map[id / 8] & (0x80 >> (id % 8))) != 0;
+}
+
+// Find next AFU id in extended AFU map after id, -1 to start, -1 if none
+int afu_map_next(const uint8_t * map, int id)
+{
+	for (++id; id < PSLSE_MAX_AFUS; id++) {
+		// Skip empty bytes
+		if (((id % 8) == 0) && (map[id / 8] == 0)) {
+			id += 7;
+			continue;
+		}
+		if (afu_map_test(map, id))
+			return id;
+	}
+	return -1;
+}
@@ -36,7 +36,7 @@
 #define PSL_IDLE_CYCLES 20
 
 #define PSLSE_VERSION_MAJOR	0x01
-#define PSLSE_VERSION_MINOR	0x02
+#define PSLSE_VERSION_MINOR	0x03
 
 #define PSLSE_CONNECT		0x01
 #define PSLSE_QUERY		0x02
@@ -60,6 +60,36 @@
 #define PSLSE_AFU_ERROR		0x14
 #define PSLSE_MMIO_EBREAD	0x15
 #define PSLSE_VSEC_INFO		0x16
+#define PSLSE_AFU_MAP		0x17
+#define PSLSE_MEMORY_READ_LINES	0x18
+#define PSLSE_MEMORY_WRITE_BULK	0x19
+#define PSLSE_REGISTER_RO	0x1a
+#define PSLSE_MMIO_EBREAD_BULK	0x1b
+#define PSLSE_MUX		0x1c
+#define PSLSE_CYCLES		0x1d
+
+// Most cachelines returned for one PSLSE_MEMORY_READ_LINES request.  A batch
+// never crosses a 4KB page so every line shares the demand line's translation.
+#define PSLSE_MAX_READ_LINES	32
+
+// Most cachelines written by one PSLSE_MEMORY_WRITE_BULK request.  Combined
+// writes also stay within one 4KB page.
+#define PSLSE_MAX_WRITE_LINES	32
+
+// Most error buffer doublewords returned for one PSLSE_MMIO_EBREAD_BULK
+// request.  Covers a 4KB error buffer read that starts at an unaligned offset.
+#define PSLSE_MAX_EB_READ_DWORDS	513
+
+// AFU ids are (major << 4) | minor, the same value used as dbg_id.  The
+// legacy 16-bit map sent with PSLSE_CONNECT only covers afu[0-3].[0-3], the
+// extended map returned for PSLSE_AFU_MAP has one bit for every possible id.
+#define PSLSE_MAX_ADAPTERS	16
+#define PSLSE_MAX_AFUS_PER_ADAPTER	16
+#define PSLSE_MAX_AFUS		(PSLSE_MAX_ADAPTERS * PSLSE_MAX_AFUS_PER_ADAPTER)
+#define PSLSE_AFU_MAP_BYTES	(PSLSE_MAX_AFUS / 8)
+#define PSLSE_AFU_ID(major, minor)	(((major) << 4) | (minor))
+#define PSLSE_AFU_MAJOR(id)	((id) >> 4)
+#define PSLSE_AFU_MINOR(id)	((id) & 0xf)
 
 // PSLSE states
 enum pslse_state {
@@ -128,4 +158,18 @@ void generate_cl_parity(uint8_t * data, uint8_t * parity);
 // Gracefully shutdown and close socket connection
 int close_socket(int *sockfd);
 
+// Parse "afuM.N" and return number of characters consumed, -1 if invalid
+int parse_afu_name(const char *name, uint8_t * major, uint8_t * minor);
+
+// Bit in legacy 16-bit AFU map for AFU id, 0 if id isn't representable
+uint16_t afu_legacy_location(uint8_t id);
+
+// Set, clear and test AFU id in extended AFU map
+void afu_map_set(uint8_t * map, uint8_t id);
+void afu_map_clear(uint8_t * map, uint8_t id);
+int afu_map_test(const uint8_t * map, uint8_t id);
+
+// Find next AFU id in extended AFU map after id, -1 to start, -1 if none
+int afu_map_next(const uint8_t * map, int id);
+
 #endif				/* _UTILS_H_ */
@@ -1,13 +1,97 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Description: main.c
+ *
+ *  This file contains the debug.log decoder.  The log is memory mapped and
+ *  a single pass builds an index of every record tagged with the AFU,
+ *  context and command tag it belongs to.  The index is then walked to
+ *  either print the records that match the requested filters or to compute
+ *  summary statistics (command mix, per tag latency and outstanding command
+ *  depth) over them.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "../common/debug.h"
 #include "../common/psl_interface_t.h"
 #include "../common/utils.h"
 
 #define MAX_LINE_CHARS	1024
+#define NO_AFU		0xff
+#define NO_CONTEXT	0xffff
+#define MAX_TAGS	256
+#define MAX_AFU_IDS	256
+#define MAX_HEADERS	32
+#define MAX_CMD_CODES	0x10000
+#define SUMMARY_WINDOWS	10
+#define INITIAL_RECORDS	65536
+
+#define RECORD_HAS_TAG	0x1
+
+struct record {
+	uint64_t offset;
+	uint16_t context;
+	uint8_t header;
+	uint8_t id;
+	uint8_t tag;
+	uint8_t flags;
+};
+
+struct log {
+	uint8_t *data;
+	size_t size;
+	struct record *index;
+	uint64_t records;
+	uint64_t bad_offset;
+	int bad;
+};
+
+struct filter {
+	int afu;
+	int context;
+	int tag;
+	uint32_t types;
+	uint64_t first;
+	uint64_t last;
+	int number;
+};
+
+struct tag_stats {
+	uint64_t count;
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+};
+
+struct cmd_stats {
+	uint64_t count;
+	uint64_t total;
+	uint64_t completed;
+};
 
 int parity, running, latency;
 
@@ -18,35 +102,105 @@ static char *_afu_name(uint8_t id)
 
 	major = id >> 4;
 	minor = id & 0xf;
-	name = (char *)malloc(7);
+	name = (char *)malloc(16);
 	sprintf(name, "afu%d.%d", major, minor);
 	return name;
 }
 
-static int _report_version(FILE * fp)
+static uint16_t _get_16(const uint8_t * p)
 {
-	uint8_t major;
-	uint8_t minor;
+	uint16_t value;
 
-	if (debug_get_8(fp, &major) < 1)
-		return -1;
-	if (debug_get_8(fp, &minor) < 1)
-		return -1;
+	memcpy(&value, p, sizeof(value));
+	return ntohs(value);
+}
+
+static uint32_t _get_32(const uint8_t * p)
+{
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return ntohl(value);
+}
+
+static uint64_t _get_64(const uint8_t * p)
+{
+	uint64_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return ntohll(value);
+}
+
+static const char *_cmd_name(uint16_t code)
+{
+	switch (code) {
+	case PSL_COMMAND_READ_CL_NA:
+		return "READ_CL_NA";
+	case PSL_COMMAND_READ_CL_S:
+		return "READ_CL_S";
+	case PSL_COMMAND_READ_CL_M:
+		return "READ_CL_M";
+	case PSL_COMMAND_READ_CL_LCK:
+		return "READ_CL_LCK";
+	case PSL_COMMAND_READ_CL_RES:
+		return "READ_CL_RES";
+	case PSL_COMMAND_READ_PE:
+		return "READ_PE";
+	case PSL_COMMAND_READ_PNA:
+		return "READ_PNA";
+	case PSL_COMMAND_TOUCH_I:
+		return "TOUCH_I";
+	case PSL_COMMAND_TOUCH_S:
+		return "TOUCH_S";
+	case PSL_COMMAND_TOUCH_M:
+		return "TOUCH_M";
+	case PSL_COMMAND_WRITE_MI:
+		return "WRITE_MI";
+	case PSL_COMMAND_WRITE_MS:
+		return "WRITE_MS";
+	case PSL_COMMAND_WRITE_UNLOCK:
+		return "WRITE_UNLOCK";
+	case PSL_COMMAND_WRITE_C:
+		return "WRITE_C";
+	case PSL_COMMAND_WRITE_NA:
+		return "WRITE_NA";
+	case PSL_COMMAND_WRITE_INJ:
+		return "WRITE_INJ";
+	case PSL_COMMAND_PUSH_I:
+		return "PUSH_I";
+	case PSL_COMMAND_PUSH_S:
+		return "PUSH_S";
+	case PSL_COMMAND_EVICT_I:
+		return "EVICT_I";
+	case PSL_COMMAND_FLUSH:
+		return "FLUSH";
+	case PSL_COMMAND_INTREQ:
+		return "INTREQ";
+	case PSL_COMMAND_LOCK:
+		return "LOCK";
+	case PSL_COMMAND_UNLOCK:
+		return "UNLOCK";
+	case PSL_COMMAND_RESTART:
+		return "RESTART";
+	default:
+		return "Unknown";
+	}
+}
 
-	printf("PSLSE_VERSION=%d.%03d\n", major, minor);
+static int _report_version(const uint8_t * p)
+{
+	printf("PSLSE_VERSION=%d.%03d\n", p[0], p[1]);
 
 	return 0;
 }
 
-static int _parse_parm(FILE * fp)
+static int _parse_parm(const uint8_t * p)
 {
 	uint32_t parm;
 	uint32_t value;
 
-	if (debug_get_32(fp, &parm) < 1)
-		return -1;
-	if (debug_get_32(fp, &value) < 1)
-		return -1;
+	parm = _get_32(p);
+	value = _get_32(p + 4);
 
 	switch (parm) {
 	case DBG_PARM_SEED:
@@ -70,6 +224,72 @@ static int _parse_parm(FILE * fp)
 	case DBG_PARM_BUFFER_PERCENT:
 		printf("PARM:BUFFER_PERCENT=%d\n", value);
 		break;
+	case DBG_PARM_LISTEN_BACKLOG:
+		printf("PARM:LISTEN_BACKLOG=%d\n", value);
+		break;
+	case DBG_PARM_HOTPLUG:
+		printf("PARM:HOTPLUG=%d\n", value);
+		break;
+	case DBG_PARM_WARM_OPEN:
+		printf("PARM:WARM_OPEN=%d\n", value);
+		break;
+	case DBG_PARM_PREFETCH_LINES:
+		printf("PARM:PREFETCH_LINES=%d\n", value);
+		break;
+	case DBG_PARM_WRITE_COMBINE_LINES:
+		printf("PARM:WRITE_COMBINE_LINES=%d\n", value);
+		break;
+	case DBG_PARM_TIMING_MODEL:
+		printf("PARM:TIMING_MODEL=%d\n", value);
+		break;
+	case DBG_PARM_READ_LATENCY:
+		printf("PARM:READ_LATENCY=%d,%d\n", value >> 16,
+		       value & 0xffff);
+		break;
+	case DBG_PARM_WRITE_LATENCY:
+		printf("PARM:WRITE_LATENCY=%d,%d\n", value >> 16,
+		       value & 0xffff);
+		break;
+	case DBG_PARM_TOUCH_LATENCY:
+		printf("PARM:TOUCH_LATENCY=%d,%d\n", value >> 16,
+		       value & 0xffff);
+		break;
+	case DBG_PARM_INTERRUPT_LATENCY:
+		printf("PARM:INTERRUPT_LATENCY=%d,%d\n", value >> 16,
+		       value & 0xffff);
+		break;
+	case DBG_PARM_OTHER_LATENCY:
+		printf("PARM:OTHER_LATENCY=%d,%d\n", value >> 16,
+		       value & 0xffff);
+		break;
+	case DBG_PARM_LINK_BYTES_PER_CYCLE:
+		printf("PARM:LINK_BYTES_PER_CYCLE=%d\n", value);
+		break;
+	case DBG_PARM_ERAT_MISS_PENALTY:
+		printf("PARM:ERAT_MISS_PENALTY=%d\n", value);
+		break;
+	case DBG_PARM_CREDIT_DELAY:
+		printf("PARM:CREDIT_DELAY=%d\n", value);
+		break;
+	case DBG_PARM_ERAT_ENTRIES:
+		printf("PARM:ERAT_ENTRIES=%d\n", value);
+		break;
+	case DBG_PARM_ERAT_WAYS:
+		printf("PARM:ERAT_WAYS=%d\n", value);
+		break;
+	case DBG_PARM_ERAT_POLICY:
+		printf("PARM:ERAT_POLICY=%d\n", value);
+		break;
+	case DBG_PARM_ERAT_PAGE_SIZE:
+		printf("PARM:ERAT_PAGE_SIZE=%d\n", value);
+		break;
+	case DBG_PARM_SCHEDULER:
+		printf("PARM:SCHEDULER=%d\n", value);
+		break;
+	case DBG_PARM_CONTEXT_WEIGHT:
+		printf("PARM:CONTEXT_WEIGHT=%d,%d\n", value >> 16,
+		       value & 0xFFFF);
+		break;
 	default:
 		return -1;
 	}
@@ -77,14 +297,11 @@ static int _parse_parm(FILE * fp)
 	return 0;
 }
 
-static int _parse_afu(FILE * fp, DBG_HEADER header)
+static int _parse_afu(const uint8_t * p, DBG_HEADER header)
 {
-	uint8_t id;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	name = _afu_name(id);
+	name = _afu_name(p[0]);
 
 	switch (header) {
 	case DBG_HEADER_AFU_CONNECT:
@@ -101,17 +318,13 @@ static int _parse_afu(FILE * fp, DBG_HEADER header)
 	return 0;
 }
 
-static int _parse_context(FILE * fp, DBG_HEADER header)
+static int _parse_context(const uint8_t * p, DBG_HEADER header)
 {
 	uint16_t context;
-	uint8_t id;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	name = _afu_name(id);
+	context = _get_16(p + 1);
+	name = _afu_name(p[0]);
 
 	switch (header) {
 	case DBG_HEADER_CONTEXT_ADD:
@@ -128,17 +341,13 @@ static int _parse_context(FILE * fp, DBG_HEADER header)
 	return 0;
 }
 
-static int _parse_job(FILE * fp, DBG_HEADER header)
+static int _parse_job(const uint8_t * p, DBG_HEADER header)
 {
 	uint32_t code;
-	uint8_t id;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_32(fp, &code) < 1)
-		return -1;
-	name = _afu_name(id);
+	code = _get_32(p + 1);
+	name = _afu_name(p[0]);
 
 	printf("%s:JOB: ", name);
 	switch (header) {
@@ -167,18 +376,13 @@ static int _parse_job(FILE * fp, DBG_HEADER header)
 	return 0;
 }
 
-static int _parse_pe(FILE * fp, DBG_HEADER header)
+static int _parse_pe(const uint8_t * p, DBG_HEADER header)
 {
-	uint32_t code;
-	uint8_t id;
 	uint64_t addr;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_32(fp, &code) < 1)
-		return -1;
-	name = _afu_name(id);
+	addr = _get_64(p + 5);
+	name = _afu_name(p[0]);
 
 	printf("%s:JOB: ", name);
 	switch (header) {
@@ -193,63 +397,49 @@ static int _parse_pe(FILE * fp, DBG_HEADER header)
 		return -1;
 	}
 	printf("LLCMD ");
-	if (debug_get_64(fp, &addr) < 1) {
-		printf("No LLCMD addr?");
-		return -1;
- 		}
 	switch (addr) {
-		case PSL_LLCMD_ADD:
-			printf("ADD");
-			break;
-		case PSL_LLCMD_REMOVE:
-			printf("REMOVE");
-			break;
-		case PSL_LLCMD_TERMINATE:	
-			printf("TERMINATE");
-			break;
-		default:
-			printf(" Unknown LLCMD:0x%016"PRIx64, addr);
-		}		
+	case PSL_LLCMD_ADD:
+		printf("ADD");
+		break;
+	case PSL_LLCMD_REMOVE:
+		printf("REMOVE");
+		break;
+	case PSL_LLCMD_TERMINATE:
+		printf("TERMINATE");
+		break;
+	default:
+		printf(" Unknown LLCMD:0x%016" PRIx64, addr);
+	}
 	printf("\n");
 	free(name);
 	return 0;
 }
 
-static int _parse_map(FILE * fp, DBG_HEADER header)
+static int _parse_map(const uint8_t * p, DBG_HEADER header)
 {
 	uint16_t context;
-	uint8_t id;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	name = _afu_name(id);
+	context = _get_16(p + 1);
+	name = _afu_name(p[0]);
 
 	printf("%s:MMIO: Mapped context %d\n", name, context);
 	free(name);
 	return 0;
 }
 
-static int _parse_mmio(FILE * fp, DBG_HEADER header)
+static int _parse_mmio(const uint8_t * p, DBG_HEADER header)
 {
 	uint32_t addr;
 	uint16_t context;
-	uint8_t id, rnw, dw;
+	uint8_t rnw, dw;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &rnw) < 1)
-		return -1;
-	if (debug_get_8(fp, &dw) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	if (debug_get_32(fp, &addr) < 1)
-		return -1;
-	name = _afu_name(id);
+	rnw = p[1];
+	dw = p[2];
+	context = _get_16(p + 3);
+	addr = _get_32(p + 5);
+	name = _afu_name(p[0]);
 
 	printf("%s", name);
 	if (header == DBG_HEADER_MMIO_ADD) {
@@ -277,142 +467,105 @@ static int _parse_mmio(FILE * fp, DBG_HEADER header)
 	return 0;
 }
 
-static int _parse_mmio_ack(FILE * fp, DBG_HEADER header)
+static int _parse_mmio_ack(const uint8_t * p, DBG_HEADER header)
 {
-	uint8_t id;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	name = _afu_name(id);
+	name = _afu_name(p[0]);
 
 	printf("%s:MMIO: Ack\n", name);
 	free(name);
 	return 0;
 }
 
-static int _parse_mmio_return(FILE * fp, DBG_HEADER header)
+static int _parse_mmio_return(const uint8_t * p, DBG_HEADER header)
 {
 	uint16_t context;
-	uint8_t id;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	name = _afu_name(id);
+	context = _get_16(p + 1);
+	name = _afu_name(p[0]);
 
 	printf("%s,%d:MMIO: Return\n", name, context);
 	free(name);
 	return 0;
 }
 
-static int _parse_cmd_add(FILE * fp, DBG_HEADER header)
+static int _parse_cmd_add(const uint8_t * p, DBG_HEADER header)
 {
 	uint16_t context, command;
-	uint8_t id, tag;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &tag) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	if (debug_get_16(fp, &command) < 1)
-		return -1;
-	name = _afu_name(id);
+	context = _get_16(p + 2);
+	command = _get_16(p + 4);
+	name = _afu_name(p[0]);
 
 	printf("%s,%d:CMD: New tag=0x%02x code=0x%04x\n", name, context,
-	       tag, command);
+	       p[1], command);
 	free(name);
 
 	return 0;
 }
 
-static int _parse_cmd_update(FILE * fp, DBG_HEADER header)
+static int _parse_cmd_update(const uint8_t * p, DBG_HEADER header)
 {
 	uint16_t context, resp;
-	uint8_t id, tag;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &tag) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	if (debug_get_16(fp, &resp) < 1)
-		return -1;
-	name = _afu_name(id);
+	context = _get_16(p + 2);
+	resp = _get_16(p + 4);
+	name = _afu_name(p[0]);
 
 	printf("%s,%d:CMD: Update tag=0x%02x resp=0x%02x\n", name, context,
-	       tag, resp);
+	       p[1], resp);
 	free(name);
 
 	return 0;
 }
 
-static int _parse_cmd_client(FILE * fp, DBG_HEADER header)
+static int _parse_cmd_client(const uint8_t * p, DBG_HEADER header)
 {
 	uint16_t context;
-	uint8_t id, tag;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &tag) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-	name = _afu_name(id);
+	context = _get_16(p + 2);
+	name = _afu_name(p[0]);
 
 	printf("%s,%d:CMD: Client ", name, context);
 	if (header == DBG_HEADER_CMD_CLIENT_REQ)
 		printf("Request");
 	else
 		printf("Return");
-	printf(" tag=0x%02x\n", tag);
+	printf(" tag=0x%02x\n", p[1]);
 	free(name);
 
 	return 0;
 }
 
-static int _parse_cmd_buffer(FILE * fp, DBG_HEADER header)
+static int _parse_cmd_buffer(const uint8_t * p, DBG_HEADER header)
 {
-	uint8_t id, tag;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &tag) < 1)
-		return -1;
-	name = _afu_name(id);
+	name = _afu_name(p[0]);
 
 	printf("%s:CMD: Buffer ", name);
 	if (header == DBG_HEADER_CMD_BUFFER_WRITE)
 		printf("Write");
 	else
 		printf("Read");
-	printf(" request tag=0x%02x\n", tag);
+	printf(" request tag=0x%02x\n", p[1]);
 	free(name);
 
 	return 0;
 }
 
-static int _parse_cmd_response(FILE * fp, DBG_HEADER header)
+static int _parse_cmd_response(const uint8_t * p, DBG_HEADER header)
 {
-	uint8_t id, tag;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &tag) < 1)
-		return -1;
-	name = _afu_name(id);
+	name = _afu_name(p[0]);
 
-	printf("%s:CMD: Response tag=0x%02x\n", name, tag);
+	printf("%s:CMD: Response tag=0x%02x\n", name, p[1]);
 	free(name);
 
 	return 0;
@@ -425,23 +578,15 @@ static void _aux2_banner(int *printed, char *name)
 	*printed = 1;
 }
 
-static int _parse_aux(FILE * fp, DBG_HEADER header)
+static int _parse_aux(const uint8_t * p, DBG_HEADER header)
 {
 	uint64_t error = 0;
 	uint8_t aux2;
-	uint8_t id;
 	char *name;
 	int banner = 0;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &aux2) < 1)
-		return -1;
-	name = _afu_name(id);
-	if ((aux2 && DBG_AUX2_DONE) == DBG_AUX2_DONE) {
-		if (debug_get_64(fp, &error) < 1)
-			return -1;
-	}
+	aux2 = p[1];
+	name = _afu_name(p[0]);
 
 	if (latency != (aux2 & DBG_AUX2_LAT_MASK)) {
 		latency = aux2 & DBG_AUX2_LAT_MASK;
@@ -497,21 +642,15 @@ static int _parse_aux(FILE * fp, DBG_HEADER header)
 	return 0;
 }
 
-static int _parse_socket(FILE * fp, DBG_HEADER header, int silent)
+static int _parse_socket(const uint8_t * p, DBG_HEADER header)
 {
 	uint8_t id, type;
 	uint16_t context;
 	char *name;
 
-	if (debug_get_8(fp, &id) < 1)
-		return -1;
-	if (debug_get_8(fp, &type) < 1)
-		return -1;
-	if (debug_get_16(fp, &context) < 1)
-		return -1;
-
-	if (silent)
-		return 0;
+	id = p[0];
+	type = p[1];
+	context = _get_16(p + 2);
 
 	if (id != (uint8_t) - 1) {
 		name = _afu_name(id);
@@ -598,102 +737,576 @@ static int _parse_socket(FILE * fp, DBG_HEADER header, int silent)
 	return 0;
 }
 
-int main(int argc, char **argv)
+static int _print_record(struct log *log, struct record *rec)
 {
-	FILE *fp;
+	const uint8_t *p;
 	DBG_HEADER header;
-	int silent;
 
-	if ((fp = fopen("debug.log", "r")) == NULL) {
-		perror("fopen:debug.log");
+	header = rec->header;
+	p = log->data + rec->offset + sizeof(DBG_HEADER);
+	switch (header) {
+	case DBG_HEADER_VERSION:
+		return _report_version(p);
+	case DBG_HEADER_PARM:
+		return _parse_parm(p);
+	case DBG_HEADER_AFU_CONNECT:
+	case DBG_HEADER_AFU_DROP:
+		return _parse_afu(p, header);
+	case DBG_HEADER_CONTEXT_ADD:
+	case DBG_HEADER_CONTEXT_REMOVE:
+		return _parse_context(p, header);
+	case DBG_HEADER_JOB_ADD:
+	case DBG_HEADER_JOB_SEND:
+		return _parse_job(p, header);
+	case DBG_HEADER_PE_ADD:
+	case DBG_HEADER_PE_SEND:
+		return _parse_pe(p, header);
+	case DBG_HEADER_JOB_AUX2:
+		return _parse_aux(p, header);
+	case DBG_HEADER_MMIO_MAP:
+		return _parse_map(p, header);
+	case DBG_HEADER_MMIO_ADD:
+	case DBG_HEADER_MMIO_SEND:
+		return _parse_mmio(p, header);
+	case DBG_HEADER_MMIO_ACK:
+		return _parse_mmio_ack(p, header);
+	case DBG_HEADER_MMIO_RETURN:
+		return _parse_mmio_return(p, header);
+	case DBG_HEADER_CMD_ADD:
+		return _parse_cmd_add(p, header);
+	case DBG_HEADER_CMD_UPDATE:
+		return _parse_cmd_update(p, header);
+	case DBG_HEADER_CMD_CLIENT_ACK:
+	case DBG_HEADER_CMD_CLIENT_REQ:
+		return _parse_cmd_client(p, header);
+	case DBG_HEADER_CMD_BUFFER_WRITE:
+	case DBG_HEADER_CMD_BUFFER_READ:
+		return _parse_cmd_buffer(p, header);
+	case DBG_HEADER_CMD_RESPONSE:
+		return _parse_cmd_response(p, header);
+	case DBG_HEADER_SOCKET_GET:
+	case DBG_HEADER_SOCKET_PUT:
+		return _parse_socket(p, header);
+	default:
 		return -1;
 	}
+}
 
-	while ((header = debug_get_header(fp)) != (DBG_HEADER) - 1) {
-		silent = 0;
-		switch (header) {
-		case DBG_HEADER_VERSION:
-			_report_version(fp);
-			break;
-		case DBG_HEADER_PARM:
-			if (_parse_parm(fp) < 0)
-				return -1;
-			break;
-		case DBG_HEADER_AFU_CONNECT:
-		case DBG_HEADER_AFU_DROP:
-			if (_parse_afu(fp, header) < 0)
-				return -1;
-			break;
-		case DBG_HEADER_CONTEXT_ADD:
-		case DBG_HEADER_CONTEXT_REMOVE:
-			if (_parse_context(fp, header) < 0)
-				return -1;
-			break;
-		case DBG_HEADER_JOB_ADD:
-		case DBG_HEADER_JOB_SEND:
-			if (_parse_job(fp, header) < 0)
-				return -1;
+// Fill in the AFU, context and tag keys of an index entry.  Buffer and
+// response records only carry the tag so they inherit the context from the
+// most recent CMD_ADD for the same AFU and tag.
+static void _index_keys(struct record *rec, const uint8_t * p,
+			uint16_t tag_context[MAX_AFU_IDS][MAX_TAGS])
+{
+	rec->id = NO_AFU;
+	rec->context = NO_CONTEXT;
+	rec->tag = 0;
+	rec->flags = 0;
+
+	switch (rec->header) {
+	case DBG_HEADER_VERSION:
+	case DBG_HEADER_PARM:
+		break;
+	case DBG_HEADER_AFU_CONNECT:
+	case DBG_HEADER_AFU_DROP:
+	case DBG_HEADER_JOB_ADD:
+	case DBG_HEADER_JOB_SEND:
+	case DBG_HEADER_JOB_AUX2:
+	case DBG_HEADER_MMIO_ACK:
+	case DBG_HEADER_PE_ADD:
+	case DBG_HEADER_PE_SEND:
+		rec->id = p[0];
+		break;
+	case DBG_HEADER_CONTEXT_ADD:
+	case DBG_HEADER_CONTEXT_REMOVE:
+	case DBG_HEADER_MMIO_MAP:
+	case DBG_HEADER_MMIO_RETURN:
+		rec->id = p[0];
+		rec->context = _get_16(p + 1);
+		break;
+	case DBG_HEADER_MMIO_ADD:
+	case DBG_HEADER_MMIO_SEND:
+		rec->id = p[0];
+		rec->context = _get_16(p + 3);
+		break;
+	case DBG_HEADER_SOCKET_PUT:
+	case DBG_HEADER_SOCKET_GET:
+		rec->id = p[0];
+		rec->context = _get_16(p + 2);
+		break;
+	case DBG_HEADER_CMD_ADD:
+		tag_context[p[0]][p[1]] = _get_16(p + 2);
+		/* fall through */
+	case DBG_HEADER_CMD_UPDATE:
+	case DBG_HEADER_CMD_CLIENT_REQ:
+	case DBG_HEADER_CMD_CLIENT_ACK:
+		rec->id = p[0];
+		rec->tag = p[1];
+		rec->context = _get_16(p + 2);
+		rec->flags |= RECORD_HAS_TAG;
+		break;
+	case DBG_HEADER_CMD_BUFFER_WRITE:
+	case DBG_HEADER_CMD_BUFFER_READ:
+	case DBG_HEADER_CMD_RESPONSE:
+		rec->id = p[0];
+		rec->tag = p[1];
+		rec->context = tag_context[p[0]][p[1]];
+		rec->flags |= RECORD_HAS_TAG;
+		break;
+	}
+}
+
+// Single pass over the mapped log recording where every record starts.
+// Parsing stops at the first unknown header or truncated record, the
+// records before it are still usable.
+static int _build_index(struct log *log)
+{
+	uint16_t (*tag_context)[MAX_TAGS];
+	struct record *rec;
+	uint64_t offset, allocated;
+	ssize_t size;
+	DBG_HEADER header;
+
+	tag_context = malloc(MAX_AFU_IDS * sizeof(*tag_context));
+	if (tag_context == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	memset(tag_context, 0xff, MAX_AFU_IDS * sizeof(*tag_context));
+
+	// Start small and let the index double as it fills so its size
+	// follows the number of records rather than the size of the log
+	allocated = INITIAL_RECORDS;
+	log->index = (struct record *)malloc(allocated * sizeof(struct record));
+	if (log->index == NULL) {
+		perror("malloc");
+		free(tag_context);
+		return -1;
+	}
+
+	offset = 0;
+	while (offset < log->size) {
+		header = log->data[offset];
+		size = debug_record_size(header);
+		if ((size < 0) ||
+		    (offset + sizeof(DBG_HEADER) + size > log->size)) {
+			log->bad = 1;
+			log->bad_offset = offset;
 			break;
-		case DBG_HEADER_PE_ADD:
-		case DBG_HEADER_PE_SEND:
-			if (_parse_pe(fp, header) < 0)
+		}
+		if (log->records == allocated) {
+			allocated *= 2;
+			rec = (struct record *)realloc(log->index, allocated *
+						       sizeof(struct record));
+			if (rec == NULL) {
+				perror("realloc");
+				free(tag_context);
 				return -1;
+			}
+			log->index = rec;
+		}
+		rec = &(log->index[log->records++]);
+		rec->offset = offset;
+		rec->header = header;
+		_index_keys(rec, log->data + offset + sizeof(DBG_HEADER),
+			    tag_context);
+		offset += sizeof(DBG_HEADER) + size;
+	}
+
+	free(tag_context);
+	return 0;
+}
+
+static int _match(struct filter *filter, struct record *rec)
+{
+	if ((filter->afu >= 0) && (rec->id != filter->afu))
+		return 0;
+	if ((filter->context >= 0) && (rec->context != filter->context))
+		return 0;
+	if ((filter->tag >= 0) &&
+	    (!(rec->flags & RECORD_HAS_TAG) || (rec->tag != filter->tag)))
+		return 0;
+	if (filter->types && !(filter->types & (1 << rec->header)))
+		return 0;
+	return 1;
+}
+
+static int _dump(struct log *log, struct filter *filter)
+{
+	struct record *rec;
+	uint64_t i;
+
+	for (i = filter->first; (i <= filter->last) && (i < log->records); i++) {
+		rec = &(log->index[i]);
+		if (!_match(filter, rec))
+			continue;
+		if (filter->number)
+			printf("%" PRIu64 ": ", i);
+		if (_print_record(log, rec) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// Streaming pass over the filtered records.  The log has no time stamps so
+// latency and depth are measured in log records.
+static int _summary(struct log *log, struct filter *filter)
+{
+	uint64_t(*start)[MAX_TAGS];
+	struct cmd_stats *(*pending)[MAX_TAGS];
+	struct tag_stats tags[MAX_TAGS];
+	struct cmd_stats *mix;
+	uint64_t type_count[MAX_HEADERS];
+	uint64_t window_max[SUMMARY_WINDOWS], window_sum[SUMMARY_WINDOWS];
+	uint64_t window_records[SUMMARY_WINDOWS];
+	uint64_t afu_max[MAX_AFU_IDS], afu_depth[MAX_AFU_IDS];
+	uint64_t i, last, span, window, matched, depth, depth_max, depth_sum;
+	uint64_t lat;
+	struct record *rec;
+	struct cmd_stats *cmd;
+	const uint8_t *p;
+	char *name;
+	int w;
+
+	start = calloc(MAX_AFU_IDS, sizeof(*start));
+	pending = calloc(MAX_AFU_IDS, sizeof(*pending));
+	mix = calloc(MAX_CMD_CODES, sizeof(*mix));
+	if ((start == NULL) || (pending == NULL) || (mix == NULL)) {
+		perror("calloc");
+		free(start);
+		free(pending);
+		free(mix);
+		return -1;
+	}
+	memset(tags, 0, sizeof(tags));
+	memset(type_count, 0, sizeof(type_count));
+	memset(window_max, 0, sizeof(window_max));
+	memset(window_sum, 0, sizeof(window_sum));
+	memset(window_records, 0, sizeof(window_records));
+	memset(afu_max, 0, sizeof(afu_max));
+	memset(afu_depth, 0, sizeof(afu_depth));
+	matched = depth = depth_max = depth_sum = 0;
+
+	last = filter->last;
+	if (last >= log->records)
+		last = log->records - 1;
+	span = 0;
+	if (log->records && (last >= filter->first))
+		span = last - filter->first + 1;
+	window = (span + SUMMARY_WINDOWS - 1) / SUMMARY_WINDOWS;
+	if (window == 0)
+		window = 1;
+
+	for (i = filter->first; span && (i <= last); i++) {
+		rec = &(log->index[i]);
+		if (!_match(filter, rec))
+			continue;
+		++matched;
+		++type_count[rec->header];
+		p = log->data + rec->offset + sizeof(DBG_HEADER);
+		switch (rec->header) {
+		case DBG_HEADER_CMD_ADD:
+			cmd = &(mix[_get_16(p + 4)]);
+			++cmd->count;
+			if (pending[rec->id][rec->tag] == NULL) {
+				++depth;
+				++afu_depth[rec->id];
+			}
+			start[rec->id][rec->tag] = i;
+			pending[rec->id][rec->tag] = cmd;
 			break;
-		case DBG_HEADER_JOB_AUX2:
-			if (_parse_aux(fp, header) < 0)
-				return -1;
+		case DBG_HEADER_CMD_RESPONSE:
+			cmd = pending[rec->id][rec->tag];
+			if (cmd == NULL)
+				break;
+			lat = i - start[rec->id][rec->tag];
+			cmd->total += lat;
+			++cmd->completed;
+			if (!tags[rec->tag].count || (lat < tags[rec->tag].min))
+				tags[rec->tag].min = lat;
+			if (lat > tags[rec->tag].max)
+				tags[rec->tag].max = lat;
+			tags[rec->tag].total += lat;
+			++tags[rec->tag].count;
+			pending[rec->id][rec->tag] = NULL;
+			--depth;
+			--afu_depth[rec->id];
 			break;
-		case DBG_HEADER_MMIO_MAP:
-			if (_parse_map(fp, header) < 0)
-				return -1;
+		default:
 			break;
-		case DBG_HEADER_MMIO_ADD:
-		case DBG_HEADER_MMIO_SEND:
-			if (_parse_mmio(fp, header) < 0)
-				return -1;
+		}
+		if (rec->id != NO_AFU && afu_depth[rec->id] > afu_max[rec->id])
+			afu_max[rec->id] = afu_depth[rec->id];
+		if (depth > depth_max)
+			depth_max = depth;
+		depth_sum += depth;
+		w = (i - filter->first) / window;
+		if (depth > window_max[w])
+			window_max[w] = depth;
+		window_sum[w] += depth;
+		++window_records[w];
+	}
+
+	printf("Records: %" PRIu64 " matched of %" PRIu64 "\n", matched,
+	       log->records);
+	printf("\nRecord types:\n");
+	for (i = 0; i < MAX_HEADERS; i++) {
+		if (type_count[i])
+			printf("  0x%02x %12" PRIu64 "\n", (unsigned)i,
+			       type_count[i]);
+	}
+
+	printf("\nCommand mix (latency in log records):\n");
+	printf("  %-14s %6s %12s %12s %10s\n", "command", "code", "count",
+	       "completed", "avg lat");
+	for (i = 0; i < MAX_CMD_CODES; i++) {
+		if (!mix[i].count)
+			continue;
+		printf("  %-14s 0x%04x %12" PRIu64 " %12" PRIu64,
+		       _cmd_name(i), (unsigned)i, mix[i].count,
+		       mix[i].completed);
+		if (mix[i].completed)
+			printf(" %10.1f", (double)mix[i].total /
+			       mix[i].completed);
+		printf("\n");
+	}
+
+	printf("\nPer tag latency (log records):\n");
+	printf("  %-4s %12s %10s %10s %10s\n", "tag", "count", "min", "avg",
+	       "max");
+	for (i = 0; i < MAX_TAGS; i++) {
+		if (!tags[i].count)
+			continue;
+		printf("  0x%02x %12" PRIu64 " %10" PRIu64 " %10.1f %10" PRIu64
+		       "\n", (unsigned)i, tags[i].count, tags[i].min,
+		       (double)tags[i].total / tags[i].count, tags[i].max);
+	}
+
+	printf("\nOutstanding commands:\n");
+	printf("  max=%" PRIu64 " avg=%.2f\n", depth_max,
+	       matched ? (double)depth_sum / matched : 0.0);
+	for (i = 0; i < MAX_AFU_IDS; i++) {
+		if (!afu_max[i])
+			continue;
+		name = _afu_name(i);
+		printf("  %s max=%" PRIu64 " still pending=%" PRIu64 "\n",
+		       name, afu_max[i], afu_depth[i]);
+		free(name);
+	}
+	for (w = 0; w < SUMMARY_WINDOWS; w++) {
+		if (!window_records[w])
+			continue;
+		i = filter->first + (w + 1) * window - 1;
+		if (i > last)
+			i = last;
+		printf("  records %" PRIu64 "-%" PRIu64 ": max=%" PRIu64
+		       " avg=%.2f\n", filter->first + w * window, i,
+		       window_max[w], (double)window_sum[w] / window_records[w]);
+	}
+
+	free(start);
+	free(pending);
+	free(mix);
+	return 0;
+}
+
+static int _parse_afu_id(char *arg)
+{
+	int major, minor;
+
+	if (sscanf(arg, "afu%d.%d", &major, &minor) == 2) {
+		if ((major < 0) || (major >= PSLSE_MAX_ADAPTERS) || (minor < 0) ||
+		    (minor >= PSLSE_MAX_AFUS_PER_ADAPTER))
+			return -1;
+		return PSLSE_AFU_ID(major, minor);
+	}
+	return strtol(arg, NULL, 0);
+}
+
+static uint32_t _parse_types(char *arg)
+{
+	uint32_t types = 0;
+	char *type;
+
+	for (type = strtok(arg, ","); type; type = strtok(NULL, ",")) {
+		if (!strcmp(type, "version"))
+			types |= 1 << DBG_HEADER_VERSION;
+		else if (!strcmp(type, "parm"))
+			types |= 1 << DBG_HEADER_PARM;
+		else if (!strcmp(type, "socket"))
+			types |= (1 << DBG_HEADER_SOCKET_PUT) |
+			    (1 << DBG_HEADER_SOCKET_GET);
+		else if (!strcmp(type, "afu"))
+			types |= (1 << DBG_HEADER_AFU_CONNECT) |
+			    (1 << DBG_HEADER_AFU_DROP);
+		else if (!strcmp(type, "context"))
+			types |= (1 << DBG_HEADER_CONTEXT_ADD) |
+			    (1 << DBG_HEADER_CONTEXT_REMOVE);
+		else if (!strcmp(type, "job"))
+			types |= (1 << DBG_HEADER_JOB_ADD) |
+			    (1 << DBG_HEADER_JOB_SEND) |
+			    (1 << DBG_HEADER_PE_ADD) |
+			    (1 << DBG_HEADER_PE_SEND);
+		else if (!strcmp(type, "aux2"))
+			types |= 1 << DBG_HEADER_JOB_AUX2;
+		else if (!strcmp(type, "mmio"))
+			types |= (1 << DBG_HEADER_MMIO_MAP) |
+			    (1 << DBG_HEADER_MMIO_ADD) |
+			    (1 << DBG_HEADER_MMIO_SEND) |
+			    (1 << DBG_HEADER_MMIO_ACK) |
+			    (1 << DBG_HEADER_MMIO_RETURN);
+		else if (!strcmp(type, "cmd"))
+			types |= (1 << DBG_HEADER_CMD_ADD) |
+			    (1 << DBG_HEADER_CMD_UPDATE) |
+			    (1 << DBG_HEADER_CMD_CLIENT_REQ) |
+			    (1 << DBG_HEADER_CMD_CLIENT_ACK) |
+			    (1 << DBG_HEADER_CMD_BUFFER_WRITE) |
+			    (1 << DBG_HEADER_CMD_BUFFER_READ) |
+			    (1 << DBG_HEADER_CMD_RESPONSE);
+		else if (debug_record_size(strtoul(type, NULL, 0)) >= 0)
+			types |= 1 << strtoul(type, NULL, 0);
+		else
+			return 0;
+	}
+	return types;
+}
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]... [LOG]\n\n", name);
+	printf("Decode LOG (default debug.log)\n\n");
+	printf("  -a, --afu\t\tonly records for AFU (afuX.Y or debug id)\n");
+	printf("  -c, --context\t\tonly records for context\n");
+	printf("  -t, --tag\t\tonly command records for tag\n");
+	printf("  -y, --type\t\tonly records of type (comma separated list\n");
+	printf("\t\t\tof version,parm,socket,afu,context,job,aux2,\n");
+	printf("\t\t\tmmio,cmd or header values)\n");
+	printf("  -f, --first\t\tfirst record number to decode\n");
+	printf("  -l, --last\t\tlast record number to decode\n");
+	printf("  -n, --number\t\tprefix output with record numbers\n");
+	printf("  -s, --summary\t\tprint statistics instead of records\n");
+	printf("      --help\t\tdisplay this help and exit\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct log log;
+	struct filter filter;
+	struct stat st;
+	char *path, *name;
+	int fd, opt, option_index, summary, rc;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"afu",		required_argument,	0,		'a'},
+		{"context",	required_argument,	0,		'c'},
+		{"tag",		required_argument,	0,		't'},
+		{"type",	required_argument,	0,		'y'},
+		{"first",	required_argument,	0,		'f'},
+		{"last",	required_argument,	0,		'l'},
+		{"number",	no_argument,		0,		'n'},
+		{"summary",	no_argument,		0,		's'},
+		{NULL, 0, 0, 0}
+	};
+
+	memset(&filter, 0, sizeof(filter));
+	filter.afu = filter.context = filter.tag = -1;
+	filter.last = (uint64_t) - 1;
+	summary = 0;
+	option_index = 0;
+	while ((opt = getopt_long(argc, argv, "ha:c:t:y:f:l:ns",
+				  long_options, &option_index)) >= 0) {
+		switch (opt) {
+		case 0:
 			break;
-		case DBG_HEADER_MMIO_ACK:
-			if (_parse_mmio_ack(fp, header) < 0)
+		case 'a':
+			if ((filter.afu = _parse_afu_id(optarg)) < 0) {
+				fprintf(stderr, "Bad AFU: %s\n", optarg);
 				return -1;
+			}
 			break;
-		case DBG_HEADER_MMIO_RETURN:
-			if (_parse_mmio_return(fp, header) < 0)
-				return -1;
+		case 'c':
+			filter.context = strtol(optarg, NULL, 0);
 			break;
-		case DBG_HEADER_CMD_ADD:
-			if (_parse_cmd_add(fp, header) < 0)
-				return -1;
+		case 't':
+			filter.tag = strtol(optarg, NULL, 0);
 			break;
-		case DBG_HEADER_CMD_UPDATE:
-			if (_parse_cmd_update(fp, header) < 0)
+		case 'y':
+			if ((filter.types = _parse_types(optarg)) == 0) {
+				fprintf(stderr, "Bad type: %s\n", optarg);
 				return -1;
+			}
 			break;
-		case DBG_HEADER_CMD_CLIENT_ACK:
-		case DBG_HEADER_CMD_CLIENT_REQ:
-			if (_parse_cmd_client(fp, header) < 0)
-				return -1;
+		case 'f':
+			filter.first = strtoull(optarg, NULL, 0);
 			break;
-		case DBG_HEADER_CMD_BUFFER_WRITE:
-		case DBG_HEADER_CMD_BUFFER_READ:
-			if (_parse_cmd_buffer(fp, header) < 0)
-				return -1;
+		case 'l':
+			filter.last = strtoull(optarg, NULL, 0);
 			break;
-		case DBG_HEADER_CMD_RESPONSE:
-			if (_parse_cmd_response(fp, header) < 0)
-				return -1;
+		case 'n':
+			filter.number = 1;
 			break;
-		case DBG_HEADER_SOCKET_GET:
-		case DBG_HEADER_SOCKET_PUT:
-			if (_parse_socket(fp, header, silent) < 0)
-				return -1;
+		case 's':
+			summary = 1;
 			break;
+		case 'h':
 		default:
-			printf("Bad header: %d\n", header);
+			usage(name);
+			return 0;
+		}
+	}
+	path = "debug.log";
+	if (optind < argc)
+		path = argv[optind];
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "open:%s: ", path);
+		perror(NULL);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("fstat");
+		close(fd);
+		return -1;
+	}
+
+	memset(&log, 0, sizeof(log));
+	log.size = st.st_size;
+	if (log.size) {
+		log.data = mmap(NULL, log.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (log.data == MAP_FAILED) {
+			perror("mmap");
+			close(fd);
 			return -1;
 		}
-		header = 0;
+		madvise(log.data, log.size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	rc = _build_index(&log);
+	if (rc == 0) {
+		if (summary)
+			rc = _summary(&log, &filter);
+		else
+			rc = _dump(&log, &filter);
+	}
+	if ((rc == 0) && log.bad) {
+		if (debug_record_size(log.data[log.bad_offset]) < 0)
+			printf("Bad header: %d\n", log.data[log.bad_offset]);
+		else
+			printf("Truncated record at offset %" PRIu64 "\n",
+			       log.bad_offset);
+		rc = -1;
 	}
 
-	fclose(fp);
-	return 0;
+	free(log.index);
+	if (log.size)
+		munmap(log.data, log.size);
+	return rc;
 }
@@ -17,13 +17,17 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
@@ -61,6 +65,29 @@
 #define DSISR 0x4000000040000000L
 #define ERR_BUFF_MAX_COPY_SIZE 4096
 
+// Fixed part of the largest event header, the query response
+#define EVENT_PEEK_BYTES 33
+// Read-only buffer contents are sent in chunks of this size
+#define RO_SEND_BYTES 0x10000
+
+// Multiplexed connection frames are 2 byte tag, 2 byte length and data
+#define MUX_HEADER_BYTES 4
+#define MUX_MAX_FRAME 0xFFFF
+
+// Progress of each handle through cxl_afu_free_bulk()
+#define LIBCXL_BULK_NONE 0
+#define LIBCXL_BULK_OPENED 1
+#define LIBCXL_BULK_REQUESTED 2
+
+// Connection shared by all AFU handles of the process
+static pthread_mutex_t _mux_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _mux_fd = -1;
+static int _mux_off;
+static int _mux_pipe[2] = { -1, -1 };
+static uint16_t _mux_tag;
+static struct mux_handle *_mux_handles;
+static uint8_t _mux_buffer[MUX_HEADER_BYTES + MUX_MAX_FRAME];
+
 static int _delay_1ms()
 {
 	struct timespec ts;
@@ -92,52 +119,55 @@ static void _all_idle(struct cxl_afu_h *afu)
 	afu->open.state = LIBCXL_REQ_IDLE;
 	afu->attach.state = LIBCXL_REQ_IDLE;
 	afu->mmio.state = LIBCXL_REQ_IDLE;
+	afu->ro.state = LIBCXL_REQ_IDLE;
+	afu->cycles.state = LIBCXL_REQ_IDLE;
 	afu->mapped = 0;
 	afu->attached = 0;
 	afu->opened = 0;
 }
 
-static int _handle_dsi(struct cxl_afu_h *afu, uint64_t addr)
+// Add event to ring and wake up any poll on cxl_afu_fd()
+static int _event_push(struct cxl_afu_h *afu, uint16_t type, uint16_t irq,
+		       uint64_t value)
 {
-	uint16_t size;
-	int i;
+	struct event_ring *ring = &(afu->events);
+	struct event_entry *entry;
+	uint8_t byte = (uint8_t) type;
+	int rc;
 
-	if (!afu)
-		fatal_msg("NULL afu passed to libcxl.c:_handle_dsi");
-	// Only track a single DSI at a time
-	pthread_mutex_lock(&(afu->event_lock));
-	i = 0;
-	while (afu->events[i] != NULL) {
-		if (afu->events[i]->header.type == CXL_EVENT_DATA_STORAGE) {
-			pthread_mutex_unlock(&(afu->event_lock));
-			return 0;
-		}
-		++i;
+	// Pending bits keep one entry per source so this only fails on a bug
+	if (ring->head - ring->tail >= EVENT_RING_SIZE) {
+		warn_msg("Event ring full, dropped event type %d", type);
+		return -1;
 	}
-	assert(i < EVENT_QUEUE_MAX);
+	entry = &(ring->entry[ring->head & (EVENT_RING_SIZE - 1)]);
+	entry->type = type;
+	entry->irq = irq;
+	entry->value = value;
+	__sync_synchronize();
+	ring->head++;
 
-	size = sizeof(struct cxl_event_header) +
-	    sizeof(struct cxl_event_data_storage);
-	afu->events[i] = (struct cxl_event *)calloc(1, size);
-	afu->events[i]->header.type = CXL_EVENT_DATA_STORAGE;
-	afu->events[i]->header.size = size;
-	afu->events[i]->header.process_element = afu->context;
-	afu->events[i]->fault.addr = addr & FOURK_MASK;
-	afu->events[i]->fault.dsisr = DSISR;
+	do
+		rc = write(afu->pipe[1], &byte, 1);
+	while ((rc < 0) && (errno == EINTR));
+	return rc;
+}
 
-	do {
-		i = write(afu->pipe[1], &(afu->events[i]->header.type), 1);
-	}
-	while ((i == 0) || (errno == EINTR));
-	pthread_mutex_unlock(&(afu->event_lock));
-	return i;
+static int _handle_dsi(struct cxl_afu_h *afu, uint64_t addr)
+{
+	if (!afu)
+		fatal_msg("NULL afu passed to libcxl.c:_handle_dsi");
+	// Only track a single DSI at a time
+	if (__sync_lock_test_and_set(&(afu->events.dsi_pending), 1))
+		return 0;
+	return _event_push(afu, CXL_EVENT_DATA_STORAGE, 0, addr & FOURK_MASK);
 }
 
 static int _handle_interrupt(struct cxl_afu_h *afu)
 {
-	uint16_t size, irq;
+	uint16_t irq;
+	uint32_t bit;
 	uint8_t data[sizeof(irq)];
-	int i;
 
 	if (!afu)
 		fatal_msg("NULL afu passed to libcxl.c:_handle_interrupt");
@@ -149,41 +179,23 @@ static int _handle_interrupt(struct cxl_afu_h *afu)
 	}
 	memcpy(&irq, data, sizeof(irq));
 	irq = ntohs(irq);
-
-	// Only track a single interrupt at a time
-	pthread_mutex_lock(&(afu->event_lock));
-	i = 0;
-	while (afu->events[i] != NULL) {
-		if (afu->events[i]->header.type == CXL_EVENT_AFU_INTERRUPT) {
-			pthread_mutex_unlock(&(afu->event_lock));
-			return 0;
-		}
-		++i;
+	if (irq >= EVENT_IRQ_MAX) {
+		warn_msg("Interrupt source %d out of range", irq);
+		return 0;
 	}
-	assert(i < EVENT_QUEUE_MAX);
-
-	size = sizeof(struct cxl_event_header) +
-	    sizeof(struct cxl_event_afu_interrupt);
-	afu->events[i] = (struct cxl_event *)calloc(1, size);
-	afu->events[i]->header.type = CXL_EVENT_AFU_INTERRUPT;
-	afu->events[i]->header.size = size;
-	afu->events[i]->header.process_element = afu->context;
-	afu->events[i]->irq.irq = irq;
 
-	do {
-		i = write(afu->pipe[1], &(afu->events[i]->header.type), 1);
-	}
-	while ((i == 0) || (errno == EINTR));
-	pthread_mutex_unlock(&(afu->event_lock));
-	return i;
+	// Repeated interrupts from a source coalesce until software reads it
+	bit = 1 << (irq % 32);
+	if (__sync_fetch_and_or(&(afu->events.irq_pending[irq / 32]), bit) &
+	    bit)
+		return 0;
+	return _event_push(afu, CXL_EVENT_AFU_INTERRUPT, irq, 0);
 }
 
 static int _handle_afu_error(struct cxl_afu_h *afu)
 {
 	uint64_t error;
-	uint16_t size;
 	uint8_t data[sizeof(error)];
-	int i;
 
 	if (!afu)
 		fatal_msg("NULL afu passed to libcxl.c:_handle_afu_error");
@@ -197,31 +209,9 @@ static int _handle_afu_error(struct cxl_afu_h *afu)
 	error = ntohll(error);
 
 	// Only track a single AFU error at a time
-	pthread_mutex_lock(&(afu->event_lock));
-	i = 0;
-	while (afu->events[i] != NULL) {
-		if (afu->events[i]->header.type == CXL_EVENT_AFU_ERROR) {
-			pthread_mutex_unlock(&(afu->event_lock));
-			return 0;
-		}
-		++i;
-	}
-	assert(i < EVENT_QUEUE_MAX);
-
-	size = sizeof(struct cxl_event_header) +
-	    sizeof(struct cxl_event_afu_error);
-	afu->events[i] = (struct cxl_event *)calloc(1, size);
-	afu->events[i]->header.type = CXL_EVENT_AFU_ERROR;
-	afu->events[i]->header.size = size;
-	afu->events[i]->header.process_element = afu->context;
-	afu->events[i]->afu_error.error = error;
-
-	do {
-		i = write(afu->pipe[1], &(afu->events[i]->header.type), 1);
-	}
-	while ((i == 0) || (errno == EINTR));
-	pthread_mutex_unlock(&(afu->event_lock));
-	return i;
+	if (__sync_lock_test_and_set(&(afu->events.error_pending), 1))
+		return 0;
+	return _event_push(afu, CXL_EVENT_AFU_ERROR, 0, error);
 }
 
 static void _handle_read(struct cxl_afu_h *afu, uint64_t addr, uint8_t size)
@@ -252,7 +242,43 @@ static void _handle_read(struct cxl_afu_h *afu, uint64_t addr, uint8_t size)
 	DPRINTF("READ from addr @ 0x%016" PRIx64 "\n", addr);
 }
 
-static void _handle_write(struct cxl_afu_h *afu, uint64_t addr, uint8_t size,
+static void _handle_read_lines(struct cxl_afu_h *afu, uint64_t addr,
+			       uint8_t lines, uint8_t index)
+{
+	uint8_t buffer[1 + PSLSE_MAX_READ_LINES * CACHELINE_BYTES];
+	uint64_t demand;
+	int size;
+
+	if (!afu)
+		fatal_msg("NULL afu passed to libcxl.c:_handle_read_lines");
+	// PSLSE keeps the batch within one page so checking the demand line
+	// checks every line
+	demand = addr + (uint64_t) index * CACHELINE_BYTES;
+	if ((lines > PSLSE_MAX_READ_LINES) || (index >= lines) ||
+	    !_testmemaddr((uint8_t *) demand)) {
+		if (_handle_dsi(afu, demand) < 0) {
+			perror("DSI Failure");
+			return;
+		}
+		DPRINTF("READ from invalid addr @ 0x%016" PRIx64 "\n", demand);
+		buffer[0] = (uint8_t) PSLSE_MEM_FAILURE;
+		if (put_bytes_silent(afu->fd, 1, buffer) != 1) {
+			afu->opened = 0;
+			afu->attached = 0;
+		}
+		return;
+	}
+	size = lines * CACHELINE_BYTES;
+	buffer[0] = PSLSE_MEM_SUCCESS;
+	memcpy(&(buffer[1]), (void *)addr, size);
+	if (put_bytes_silent(afu->fd, size + 1, buffer) != size + 1) {
+		afu->opened = 0;
+		afu->attached = 0;
+	}
+	DPRINTF("READ %d lines from addr @ 0x%016" PRIx64 "\n", lines, addr);
+}
+
+static void _handle_write(struct cxl_afu_h *afu, uint64_t addr, uint32_t size,
 			  uint8_t * data)
 {
 	uint8_t buffer;
@@ -278,7 +304,7 @@ static void _handle_write(struct cxl_afu_h *afu, uint64_t addr, uint8_t size,
 		afu->opened = 0;
 		afu->attached = 0;
 	}
-	DPRINTF("WRITE to addr @ 0x%016" PRIx64 "\n", addr);
+	DPRINTF("WRITE %d bytes to addr @ 0x%016" PRIx64 "\n", size, addr);
 }
 
 static void _handle_touch(struct cxl_afu_h *afu, uint64_t addr, uint8_t size)
@@ -311,10 +337,24 @@ static void _handle_touch(struct cxl_afu_h *afu, uint64_t addr, uint8_t size)
 static void _handle_ack(struct cxl_afu_h *afu)
 {
 	uint8_t data[sizeof(uint64_t)];
+	int i;
 
 	if (!afu)
 		fatal_msg("NULL afu passed to libcxl.c:_handle_ack");
 	DPRINTF("MMIO ACK\n");
+	if (afu->mmio.type == PSLSE_MMIO_EBREAD_BULK) {
+		if (get_bytes_silent(afu->fd,
+				     afu->mmio.bulk_count * sizeof(uint64_t),
+				     (uint8_t *) afu->mmio.bulk, 1000, 0) < 0) {
+			warn_msg("Socket failure getting error buffer data");
+			_all_idle(afu);
+			for (i = 0; i < afu->mmio.bulk_count; i++)
+				afu->mmio.bulk[i] = 0xFEEDB00FFEEDB00FL;
+		} else {
+			for (i = 0; i < afu->mmio.bulk_count; i++)
+				afu->mmio.bulk[i] = ntohll(afu->mmio.bulk[i]);
+		}
+	}
 	if ((afu->mmio.type == PSLSE_MMIO_READ64)| (afu->mmio.type == PSLSE_MMIO_EBREAD)) {
 		if (get_bytes_silent(afu->fd, sizeof(uint64_t), data, 1000, 0) <
 		    0) {
@@ -483,16 +523,25 @@ static void _mmio_read(struct cxl_afu_h *afu)
 {
 	uint8_t *buffer;
 	uint32_t addr;
+	uint16_t count;
 	int size, offset;
 
 	if (!afu)
 		fatal_msg("NULL afu passed to libcxl.c:_mmio_read");
 	size = 1 + sizeof(addr);
+	if (afu->mmio.type == PSLSE_MMIO_EBREAD_BULK)
+		size += sizeof(count);
 	buffer = (uint8_t *) malloc(size);
 	buffer[0] = afu->mmio.type;
 	offset = 1;
 	addr = htonl(afu->mmio.addr);
 	memcpy((char *)&(buffer[offset]), (char *)&addr, sizeof(addr));
+	offset += sizeof(addr);
+	if (afu->mmio.type == PSLSE_MMIO_EBREAD_BULK) {
+		count = htons(afu->mmio.bulk_count);
+		memcpy((char *)&(buffer[offset]), (char *)&count,
+		       sizeof(count));
+	}
 	if (put_bytes_silent(afu->fd, size, buffer) != size) {
 	        warn_msg("_mmio_read: put_bytes_silent failed");
 		free(buffer);
@@ -507,15 +556,438 @@ static void _mmio_read(struct cxl_afu_h *afu)
 	afu->mmio.state = LIBCXL_REQ_PENDING;
 }
 
-static void *_psl_loop(void *ptr)
+// Send read-only buffer registration and buffer contents to PSLSE
+static void _register_ro(struct cxl_afu_h *afu)
+{
+	uint8_t buffer[1 + 2 * sizeof(uint64_t)];
+	uint64_t value;
+	int size;
+
+	if (!afu)
+		fatal_msg("NULL afu passed to libcxl.c:_register_ro");
+	size = 1 + 2 * sizeof(uint64_t);
+	buffer[0] = PSLSE_REGISTER_RO;
+	value = htonll(afu->ro.addr);
+	memcpy((char *)&(buffer[1]), (char *)&value, sizeof(uint64_t));
+	value = htonll(afu->ro.len);
+	memcpy((char *)&(buffer[1 + sizeof(uint64_t)]), (char *)&value,
+	       sizeof(uint64_t));
+	if ((afu->ro.sent == 0) &&
+	    (put_bytes_silent(afu->fd, size, buffer) != size))
+		goto ro_fail;
+
+	// Buffer contents follow the request, one chunk per call so a shared
+	// connection is never blocked for long
+	size = (int)MIN(afu->ro.len - afu->ro.sent, RO_SEND_BYTES);
+	if (put_bytes_silent(afu->fd, size,
+			     (uint8_t *) (afu->ro.addr + afu->ro.sent)) != size)
+		goto ro_fail;
+	afu->ro.sent += size;
+	if (afu->ro.sent == afu->ro.len)
+		afu->ro.state = LIBCXL_REQ_PENDING;
+	return;
+
+ ro_fail:
+	close_socket(&(afu->fd));
+	afu->opened = 0;
+	afu->attached = 0;
+	afu->ro.state = LIBCXL_REQ_IDLE;
+}
+
+// Ask PSLSE for the AFU cycle count
+static void _req_cycles(struct cxl_afu_h *afu)
+{
+	uint8_t buffer = PSLSE_CYCLES;
+
+	if (!afu)
+		fatal_msg("NULL afu passed to libcxl.c:_req_cycles");
+	if (put_bytes_silent(afu->fd, 1, &buffer) != 1) {
+		close_socket(&(afu->fd));
+		_all_idle(afu);
+		return;
+	}
+	afu->cycles.state = LIBCXL_REQ_PENDING;
+}
+
+// Read the configuration records that follow a query response
+static int _query_crs(struct cxl_afu_h *afu, uint16_t num_crs)
+{
+	uint8_t buffer[sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint32_t)];
+	struct afu_cr *crs;
+	uint16_t value;
+	uint32_t lvalue;
+	int i;
+
+	crs = NULL;
+	if (num_crs) {
+		crs = (struct afu_cr *)calloc(num_crs, sizeof(struct afu_cr));
+		if (crs == NULL)
+			return -1;
+	}
+	for (i = 0; i < num_crs; i++) {
+		if (get_bytes_silent(afu->fd, sizeof(buffer), buffer, 1000,
+				     0) < 0) {
+			free(crs);
+			return -1;
+		}
+		memcpy((char *)&value, (char *)&(buffer[0]), 2);
+		crs[i].cr_device = (long)ntohs(value);
+		memcpy((char *)&value, (char *)&(buffer[2]), 2);
+		crs[i].cr_vendor = (long)ntohs(value);
+		memcpy((char *)&lvalue, (char *)&(buffer[4]), 4);
+		crs[i].cr_class = ntohl(lvalue);
+	}
+	if (afu->crs)
+		free(afu->crs);
+	afu->crs = crs;
+	afu->num_crs = num_crs;
+	return 0;
+}
+
+// Send any requests to PSLSE
+static void _psl_requests(struct cxl_afu_h *afu)
+{
+	if (afu->int_req.state == LIBCXL_REQ_REQUEST)
+		_req_max_int(afu);
+	if (afu->attach.state == LIBCXL_REQ_REQUEST)
+		_pslse_attach(afu);
+	if (afu->ro.state == LIBCXL_REQ_REQUEST)
+		_register_ro(afu);
+	if (afu->cycles.state == LIBCXL_REQ_REQUEST)
+		_req_cycles(afu);
+	if (afu->mmio.state == LIBCXL_REQ_REQUEST) {
+		switch (afu->mmio.type) {
+		case PSLSE_MMIO_MAP:
+			_mmio_map(afu);
+			break;
+		case PSLSE_MMIO_WRITE64:
+			_mmio_write64(afu);
+			break;
+		case PSLSE_MMIO_WRITE32:
+			_mmio_write32(afu);
+			break;
+		case PSLSE_MMIO_EBREAD_BULK:
+		case PSLSE_MMIO_EBREAD:
+		case PSLSE_MMIO_READ64:
+		case PSLSE_MMIO_READ32:	/*fall through */
+			_mmio_read(afu);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Bytes in the event from PSLSE that starts with data, 0 if more than len
+// bytes are needed to tell.  Must match what _psl_event() reads.
+static int _event_size(struct cxl_afu_h *afu, uint8_t * data, int len)
+{
+	uint16_t value;
+
+	switch (data[0]) {
+	case PSLSE_OPEN:
+	case PSLSE_REGISTER_RO:
+		return 2;
+	case PSLSE_MAX_INT:
+	case PSLSE_INTERRUPT:
+		return 1 + sizeof(uint16_t);
+	case PSLSE_QUERY:
+		if (len < EVENT_PEEK_BYTES)
+			return 0;
+		memcpy((char *)&value, (char *)&(data[31]), 2);
+		return EVENT_PEEK_BYTES +
+		    value * (2 * sizeof(uint16_t) + sizeof(uint32_t));
+	case PSLSE_MEMORY_READ:
+	case PSLSE_MEMORY_TOUCH:
+		return 2 + sizeof(uint64_t);
+	case PSLSE_MEMORY_READ_LINES:
+		return 3 + sizeof(uint64_t);
+	case PSLSE_MEMORY_WRITE:
+		if (len < 2)
+			return 0;
+		return 2 + sizeof(uint64_t) + data[1];
+	case PSLSE_MEMORY_WRITE_BULK:
+		if (len < 3)
+			return 0;
+		memcpy((char *)&value, (char *)&(data[1]), 2);
+		return 3 + sizeof(uint64_t) + ntohs(value);
+	case PSLSE_MMIO_ACK:
+		switch (afu->mmio.type) {
+		case PSLSE_MMIO_READ64:
+		case PSLSE_MMIO_EBREAD:
+			return 1 + sizeof(uint64_t);
+		case PSLSE_MMIO_READ32:
+			return 1 + sizeof(uint32_t);
+		case PSLSE_MMIO_EBREAD_BULK:
+			return 1 + afu->mmio.bulk_count * sizeof(uint64_t);
+		default:
+			return 1;
+		}
+	case PSLSE_AFU_ERROR:
+		return 1 + sizeof(uint64_t);
+	case PSLSE_CYCLES:
+		return 1 + 3 * sizeof(uint64_t);
+	default:
+		return 1;
+	}
+}
+
+// Read and handle one event from PSLSE, -1 if the AFU can not continue
+static int _psl_event(struct cxl_afu_h *afu)
 {
-	struct cxl_afu_h *afu = (struct cxl_afu_h *)ptr;
 	uint8_t buffer[MAX_LINE_CHARS];
+	uint8_t bulk[PSLSE_MAX_WRITE_LINES * CACHELINE_BYTES];
 	uint8_t size;
+	uint8_t index;
+	uint16_t bulk_size;
 	uint64_t addr;
 	uint16_t value;
-	uint32_t lvalue;
 	uint64_t llvalue;
+
+	if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
+		warn_msg("Socket failure getting PSL event");
+		_all_idle(afu);
+		return -1;
+	}
+	DPRINTF("PSL EVENT\n");
+	switch (buffer[0]) {
+	case PSLSE_OPEN:
+		if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
+			warn_msg("Socket failure getting OPEN context");
+			_all_idle(afu);
+			break;
+		}
+		afu->context = (uint16_t) buffer[0];
+		afu->open.state = LIBCXL_REQ_IDLE;
+		break;
+	case PSLSE_ATTACH:
+		afu->attach.state = LIBCXL_REQ_IDLE;
+		break;
+	case PSLSE_DETACH:
+	        info_msg("detach response from from pslse");
+		afu->mapped = 0;
+		afu->attached = 0;
+		afu->opened = 0;
+		afu->open.state = LIBCXL_REQ_IDLE;
+		afu->attach.state = LIBCXL_REQ_IDLE;
+		afu->mmio.state = LIBCXL_REQ_IDLE;
+		afu->int_req.state = LIBCXL_REQ_IDLE;
+		break;
+	case PSLSE_MAX_INT:
+		size = sizeof(uint16_t);
+		if (get_bytes_silent(afu->fd, size, buffer, 1000, 0) <
+		    0) {
+			warn_msg
+			    ("Socket failure getting max interrupt acknowledge");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&value, (char *)buffer,
+		       sizeof(uint16_t));
+		afu->irqs_max = ntohs(value);
+		afu->int_req.state = LIBCXL_REQ_IDLE;
+		break;
+	case PSLSE_QUERY: {
+		size = sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t) +
+		    sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint64_t) +
+		    sizeof(uint16_t);
+		if (get_bytes_silent(afu->fd, size, buffer, 1000, 0) <
+		    0) {
+			warn_msg("Socket failure getting PSLSE query");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&value, (char *)&(buffer[0]), 2);
+		afu->irqs_min = (long)(value);
+		memcpy((char *)&value, (char *)&(buffer[2]), 2);
+		afu->irqs_max = (long)(value);
+                	memcpy((char *)&value, (char *)&(buffer[4]), 2);
+		afu->modes_supported = (long)(value);
+                	memcpy((char *)&llvalue, (char *)&(buffer[6]), 8);
+		afu->mmio_len = (long)(llvalue & 0x00ffffffffffffff);
+                	memcpy((char *)&llvalue, (char *)&(buffer[14]), 8);
+		afu->mmio_off = (long)(llvalue);
+                	memcpy((char *)&llvalue, (char *)&(buffer[22]), 8);
+		afu->eb_len = (long)(llvalue);
+		memcpy((char *)&value, (char *)&(buffer[30]), 2);
+		if (_query_crs(afu, value) < 0) {
+			warn_msg("Socket failure getting PSLSE query");
+			_all_idle(afu);
+			break;
+		}
+		//no better place to put this right now
+		afu->prefault_mode = CXL_PREFAULT_MODE_NONE;
+		break;
+	}
+	case PSLSE_MEMORY_READ:
+		DPRINTF("AFU MEMORY READ\n");
+		if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory read size");
+			_all_idle(afu);
+			break;
+		}
+		size = (uint8_t) buffer[0];
+		if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
+				     -1, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory read addr");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
+		addr = ntohll(addr);
+		_handle_read(afu, addr, size);
+		break;
+	case PSLSE_MEMORY_READ_LINES:
+		DPRINTF("AFU MEMORY READ LINES\n");
+		if (get_bytes_silent(afu->fd, 2, buffer, 1000, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory read lines");
+			_all_idle(afu);
+			break;
+		}
+		size = (uint8_t) buffer[0];
+		index = (uint8_t) buffer[1];
+		if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
+				     -1, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory read addr");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
+		addr = ntohll(addr);
+		_handle_read_lines(afu, addr, size, index);
+		break;
+	case PSLSE_MEMORY_WRITE:
+		DPRINTF("AFU MEMORY WRITE\n");
+		if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory write size");
+			_all_idle(afu);
+			break;
+		}
+		size = (uint8_t) buffer[0];
+		if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
+				     -1, 0) < 0) {
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
+		addr = ntohll(addr);
+		if (get_bytes_silent(afu->fd, size, buffer, 1000, 0) <
+		    0) {
+			warn_msg
+			    ("Socket failure getting memory write data");
+			_all_idle(afu);
+			break;
+		}
+		_handle_write(afu, addr, size, buffer);
+		break;
+	case PSLSE_MEMORY_WRITE_BULK:
+		DPRINTF("AFU MEMORY WRITE BULK\n");
+		if (get_bytes_silent(afu->fd, sizeof(uint16_t), buffer,
+				     1000, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory write size");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&bulk_size, (char *)buffer,
+		       sizeof(uint16_t));
+		bulk_size = ntohs(bulk_size);
+		if (bulk_size > sizeof(bulk)) {
+			warn_msg("Memory write size %d too large",
+				 bulk_size);
+			_all_idle(afu);
+			break;
+		}
+		if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
+				     -1, 0) < 0) {
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
+		addr = ntohll(addr);
+		if (get_bytes_silent(afu->fd, bulk_size, bulk, 1000, 0) <
+		    0) {
+			warn_msg
+			    ("Socket failure getting memory write data");
+			_all_idle(afu);
+			break;
+		}
+		_handle_write(afu, addr, bulk_size, bulk);
+		break;
+	case PSLSE_MEMORY_TOUCH:
+		DPRINTF("AFU MEMORY TOUCH\n");
+		if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory touch size");
+			_all_idle(afu);
+			break;
+		}
+		size = buffer[0];
+		if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
+				     -1, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting memory touch addr");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
+		addr = ntohll(addr);
+		_handle_touch(afu, addr, size);
+		break;
+	case PSLSE_MMIO_ACK:
+		_handle_ack(afu);
+		break;
+	case PSLSE_REGISTER_RO:
+		if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
+			warn_msg
+			    ("Socket failure getting read only status");
+			_all_idle(afu);
+			break;
+		}
+		afu->ro.status = buffer[0];
+		afu->ro.state = LIBCXL_REQ_IDLE;
+		break;
+	case PSLSE_CYCLES:
+		if (get_bytes_silent(afu->fd, 3 * sizeof(uint64_t), buffer,
+				     1000, 0) < 0) {
+			warn_msg("Socket failure getting cycle count");
+			_all_idle(afu);
+			break;
+		}
+		memcpy((char *)&llvalue, (char *)&(buffer[0]), 8);
+		afu->cycles.cycles = ntohll(llvalue);
+		memcpy((char *)&llvalue, (char *)&(buffer[8]), 8);
+		afu->cycles.mmio = ntohll(llvalue);
+		memcpy((char *)&llvalue, (char *)&(buffer[16]), 8);
+		afu->cycles.irq = ntohll(llvalue);
+		afu->cycles.state = LIBCXL_REQ_IDLE;
+		break;
+	case PSLSE_INTERRUPT:
+		if (_handle_interrupt(afu) < 0) {
+			perror("Interrupt Failure");
+			return -1;
+		}
+		break;
+	case PSLSE_AFU_ERROR:
+		if (_handle_afu_error(afu) < 0) {
+			perror("AFU ERROR Failure");
+			return -1;
+		}
+		break;
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void *_psl_loop(void *ptr)
+{
+	struct cxl_afu_h *afu = (struct cxl_afu_h *)ptr;
 	int rc;
 
 	if (!afu)
@@ -523,31 +995,7 @@ static void *_psl_loop(void *ptr)
 	afu->opened = 1;
 	while (afu->opened) {
 		_delay_1ms();
-		// Send any requests to PSLSE over socket
-		if (afu->int_req.state == LIBCXL_REQ_REQUEST)
-			_req_max_int(afu);
-		if (afu->attach.state == LIBCXL_REQ_REQUEST)
-			_pslse_attach(afu);
-		if (afu->mmio.state == LIBCXL_REQ_REQUEST) {
-			switch (afu->mmio.type) {
-			case PSLSE_MMIO_MAP:
-				_mmio_map(afu);
-				break;
-			case PSLSE_MMIO_WRITE64:
-				_mmio_write64(afu);
-				break;
-			case PSLSE_MMIO_WRITE32:
-				_mmio_write32(afu);
-				break;
-			case PSLSE_MMIO_EBREAD:
-			case PSLSE_MMIO_READ64:
-			case PSLSE_MMIO_READ32:	/*fall through */
-				_mmio_read(afu);
-				break;
-			default:
-				break;
-			}
-		}
+		_psl_requests(afu);
 		// Process socket input from PSLSE
 		rc = bytes_ready(afu->fd, 1000, 0);
 		if (rc == 0)
@@ -557,256 +1005,530 @@ static void *_psl_loop(void *ptr)
 			_all_idle(afu);
 			break;
 		}
-		if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
-			warn_msg("Socket failure getting PSL event");
-			_all_idle(afu);
+		if (_psl_event(afu) < 0)
 			break;
+	}
+
+	afu->attached = 0;
+	pthread_exit(NULL);
+}
+
+// Open socket to the PSLSE server named in pslse_server.dat
+static int _pslse_socket(int *fd)
+{
+	char *pslse_server_dat_path;
+	FILE *fp;
+	uint8_t buffer[MAX_LINE_CHARS];
+	struct sockaddr_in ssadr;
+	struct hostent *he;
+	char *host, *port_str;
+	int port;
+
+	// Get hostname and port of PSLSE server
+	DPRINTF("AFU CONNECT\n");
+	pslse_server_dat_path = getenv("PSLSE_SERVER_DAT");
+	if (!pslse_server_dat_path) pslse_server_dat_path = "pslse_server.dat";
+	fp = fopen(pslse_server_dat_path, "r");
+	if (!fp) {
+		perror("fopen:pslse_server.dat");
+		return -1;
+	}
+	do {
+		if (fgets((char *)buffer, MAX_LINE_CHARS - 1, fp) == NULL) {
+			perror("fgets:pslse_server.dat");
+			fclose(fp);
+			return -1;
 		}
-		DPRINTF("PSL EVENT\n");
-		switch (buffer[0]) {
-		case PSLSE_OPEN:
-			if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
-				warn_msg("Socket failure getting OPEN context");
-				_all_idle(afu);
-				break;
-			}
-			afu->context = (uint16_t) buffer[0];
-			afu->open.state = LIBCXL_REQ_IDLE;
-			break;
-		case PSLSE_ATTACH:
-			afu->attach.state = LIBCXL_REQ_IDLE;
-			break;
-		case PSLSE_DETACH:
-		        info_msg("detach response from from pslse");
-			afu->mapped = 0;
-			afu->attached = 0;
-			afu->opened = 0;
-			afu->open.state = LIBCXL_REQ_IDLE;
-			afu->attach.state = LIBCXL_REQ_IDLE;
-			afu->mmio.state = LIBCXL_REQ_IDLE;
-			afu->int_req.state = LIBCXL_REQ_IDLE;
+	}
+	while (buffer[0] == '#');
+	fclose(fp);
+	host = (char *)buffer;
+	port_str = strchr((char *)buffer, ':');
+	*port_str = '\0';
+	port_str++;
+	if (!host || !port_str) {
+		warn_msg
+		    ("cxl_afu_open_dev:Invalid format in pslse_server.data");
+		return -1;
+	}
+	port = atoi(port_str);
+
+	info_msg("Connecting to host '%s' port %d", host, port);
+
+	// Connect to PSLSE server
+	if ((he = gethostbyname(host)) == NULL) {
+		herror("gethostbyname");
+		puts(host);
+		return -1;
+	}
+	memset(&ssadr, 0, sizeof(ssadr));
+	memcpy(&ssadr.sin_addr, he->h_addr_list[0], he->h_length);
+	ssadr.sin_family = AF_INET;
+	ssadr.sin_port = htons(port);
+	if ((*fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		return -1;
+	}
+	ssadr.sin_family = AF_INET;
+	ssadr.sin_port = htons(port);
+	if (connect(*fd, (struct sockaddr *)&ssadr, sizeof(ssadr)) < 0) {
+		perror("connect");
+		close(*fd);
+		return -1;
+	}
+	return 0;
+}
+
+// Version handshake with PSLSE, discards the legacy 16-bit AFU map
+static int _pslse_hello(int fd)
+{
+	uint8_t buffer[8];
+
+	strcpy((char *)buffer, "PSLSE");
+	buffer[5] = (uint8_t) PSLSE_VERSION_MAJOR;
+	buffer[6] = (uint8_t) PSLSE_VERSION_MINOR;
+	if (put_bytes_silent(fd, 7, buffer) != 7) {
+		warn_msg("cxl_afu_open_dev:Failed to write to socket!");
+		return -1;
+	}
+	if (get_bytes_silent(fd, 1, buffer, -1, 0) < 0) {
+		warn_msg("cxl_afu_open_dev:Socket failed open acknowledge");
+		return -1;
+	}
+	if (buffer[0] != (uint8_t) PSLSE_CONNECT) {
+		warn_msg("cxl_afu_open_dev:PSLSE bad acknowledge");
+		return -1;
+	}
+	// Legacy 16-bit map only covers afu[0-3].[0-3], use extended map
+	if (get_bytes_silent(fd, sizeof(uint16_t), buffer, 1000, 0) < 0) {
+		warn_msg("cxl_afu_open_dev:afu_map");
+		return -1;
+	}
+	return 0;
+}
+
+// Wake the multiplexed connection thread to send new requests
+static void _mux_wake()
+{
+	uint8_t byte = 0;
+
+	if (_mux_pipe[1] < 0)
+		return;
+	while ((write(_mux_pipe[1], &byte, 1) < 0) && (errno == EINTR)) ;
+}
+
+// Read exactly size bytes from multiplexed connection
+static int _mux_read_all(int fd, uint8_t * data, int size)
+{
+	int count, bytes;
+
+	bytes = 0;
+	while (bytes < size) {
+		count = recv(fd, &(data[bytes]), size - bytes, MSG_WAITALL);
+		if ((count < 0) && (errno == EINTR))
+			continue;
+		if (count <= 0)
+			return -1;
+		bytes += count;
+	}
+	return 0;
+}
+
+// Write exactly size bytes without raising SIGPIPE on a closed handle
+static int _mux_write_all(int fd, uint8_t * data, int size)
+{
+	int count, bytes;
+
+	bytes = 0;
+	while (bytes < size) {
+		count = send(fd, &(data[bytes]), size - bytes, MSG_NOSIGNAL);
+		if ((count < 0) && (errno == EINTR))
+			continue;
+		if (count < 0)
+			return -1;
+		bytes += count;
+	}
+	return 0;
+}
+
+static struct mux_handle *_mux_find(uint16_t tag)
+{
+	struct mux_handle *handle;
+
+	for (handle = _mux_handles; handle != NULL; handle = handle->_next) {
+		if (handle->tag == tag)
 			break;
-		case PSLSE_MAX_INT:
-			size = sizeof(uint16_t);
-			if (get_bytes_silent(afu->fd, size, buffer, 1000, 0) <
-			    0) {
-				warn_msg
-				    ("Socket failure getting max interrupt acknowledge");
-				_all_idle(afu);
-				break;
-			}
-			memcpy((char *)&value, (char *)buffer,
-			       sizeof(uint16_t));
-			afu->irqs_max = ntohs(value);
-			afu->int_req.state = LIBCXL_REQ_IDLE;
+	}
+	return handle;
+}
+
+// Forward data, or the close, of one handle to PSLSE
+static int _mux_frame_out(struct mux_handle *handle)
+{
+	uint16_t value;
+	int count;
+
+	count = recv(handle->fd, &(_mux_buffer[MUX_HEADER_BYTES]),
+		     MUX_MAX_FRAME, MSG_DONTWAIT);
+	if ((count < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+		return 0;
+	if (count <= 0) {
+		// Handle closed, PSLSE sees end of file
+		close(handle->fd);
+		handle->fd = -1;
+		handle->local_fd = -1;
+		count = 0;
+	}
+	value = htons(handle->tag);
+	memcpy(&(_mux_buffer[0]), &value, sizeof(value));
+	value = htons((uint16_t) count);
+	memcpy(&(_mux_buffer[2]), &value, sizeof(value));
+	return _mux_write_all(_mux_fd, _mux_buffer, MUX_HEADER_BYTES + count);
+}
+
+// Handle complete events from PSLSE for the AFU using handle
+static int _mux_events(struct mux_handle *handle)
+{
+	struct cxl_afu_h *afu = handle->afu;
+	uint8_t data[EVENT_PEEK_BYTES];
+	int count, size, ready;
+
+	while (afu->opened) {
+		count = recv(afu->fd, data, sizeof(data),
+			     MSG_PEEK | MSG_DONTWAIT);
+		if ((count < 0) && ((errno == EINTR) || (errno == EAGAIN)))
 			break;
-		case PSLSE_QUERY: {
-			size = sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint16_t) +
-			    sizeof(uint64_t) + sizeof(uint64_t) + sizeof(uint64_t) +  
-                            sizeof(uint16_t) + sizeof(uint16_t) + sizeof(uint32_t);
-			if (get_bytes_silent(afu->fd, size, buffer, 1000, 0) <
-			    0) {
-				warn_msg("Socket failure getting PSLSE query");
-				_all_idle(afu);
-				break;
-			}
-			memcpy((char *)&value, (char *)&(buffer[0]), 2);
-			afu->irqs_min = (long)(value);
-			memcpy((char *)&value, (char *)&(buffer[2]), 2);
-			afu->irqs_max = (long)(value);
-                	memcpy((char *)&value, (char *)&(buffer[4]), 2);
-			afu->modes_supported = (long)(value);
-                	memcpy((char *)&llvalue, (char *)&(buffer[6]), 8);
-			afu->mmio_len = (long)(llvalue & 0x00ffffffffffffff);
-                	memcpy((char *)&llvalue, (char *)&(buffer[14]), 8);
-			afu->mmio_off = (long)(llvalue);
-                	memcpy((char *)&llvalue, (char *)&(buffer[22]), 8);
-			afu->eb_len = (long)(llvalue);
-                	memcpy((char *)&value, (char *)&(buffer[30]), 2);
-			afu->cr_device = (long)ntohs(value);
-                        memcpy((char *)&value, (char *)&(buffer[32]), 2);
-			afu->cr_vendor = (long)ntohs(value);
-                        memcpy((char *)&lvalue, (char *)&(buffer[34]), 4);
-			afu->cr_class = ntohl(lvalue);
-			//no better place to put this right now
-			afu->prefault_mode = CXL_PREFAULT_MODE_NONE;
+		if (count <= 0) {
+			warn_msg("Socket failure getting PSL event");
+			_all_idle(afu);
 			break;
 		}
-		case PSLSE_MEMORY_READ:
-			DPRINTF("AFU MEMORY READ\n");
-			if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
-				warn_msg
-				    ("Socket failure getting memory read size");
-				_all_idle(afu);
-				break;
-			}
-			size = (uint8_t) buffer[0];
-			if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
-					     -1, 0) < 0) {
-				warn_msg
-				    ("Socket failure getting memory read addr");
-				_all_idle(afu);
-				break;
-			}
-			memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
-			addr = ntohll(addr);
-			_handle_read(afu, addr, size);
+		// Events are only read once complete so this thread never
+		// waits on one handle
+		size = _event_size(afu, data, count);
+		if ((size == 0) || (ioctl(afu->fd, FIONREAD, &ready) < 0) ||
+		    (ready < size))
 			break;
-		case PSLSE_MEMORY_WRITE:
-			DPRINTF("AFU MEMORY WRITE\n");
-			if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
-				warn_msg
-				    ("Socket failure getting memory write size");
-				_all_idle(afu);
-				break;
-			}
-			size = (uint8_t) buffer[0];
-			if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
-					     -1, 0) < 0) {
-				_all_idle(afu);
-				break;
-			}
-			memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
-			addr = ntohll(addr);
-			if (get_bytes_silent(afu->fd, size, buffer, 1000, 0) <
-			    0) {
-				warn_msg
-				    ("Socket failure getting memory write data");
-				_all_idle(afu);
-				break;
-			}
-			_handle_write(afu, addr, size, buffer);
+		if (_psl_event(afu) < 0)
 			break;
-		case PSLSE_MEMORY_TOUCH:
-			DPRINTF("AFU MEMORY TOUCH\n");
-			if (get_bytes_silent(afu->fd, 1, buffer, 1000, 0) < 0) {
-				warn_msg
-				    ("Socket failure getting memory touch size");
-				_all_idle(afu);
-				break;
-			}
-			size = buffer[0];
-			if (get_bytes_silent(afu->fd, sizeof(uint64_t), buffer,
-					     -1, 0) < 0) {
-				warn_msg
-				    ("Socket failure getting memory touch addr");
-				_all_idle(afu);
-				break;
-			}
-			memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
-			addr = ntohll(addr);
-			_handle_touch(afu, addr, size);
-			break;
-		case PSLSE_MMIO_ACK:
-			_handle_ack(afu);
-			break;
-		case PSLSE_INTERRUPT:
-			if (_handle_interrupt(afu) < 0) {
-				perror("Interrupt Failure");
-				goto psl_fail;
+		// Forward the response now so the handle never fills up
+		if ((handle->fd >= 0) && (_mux_frame_out(handle) < 0))
+			return -1;
+	}
+	if (!afu->opened) {
+		afu->attached = 0;
+		handle->afu = NULL;
+	}
+	return 0;
+}
+
+// Handle one frame from PSLSE
+static int _mux_frame_in()
+{
+	struct mux_handle *handle;
+	uint16_t tag, len;
+	uint8_t *data;
+
+	data = &(_mux_buffer[MUX_HEADER_BYTES]);
+	if (_mux_read_all(_mux_fd, _mux_buffer, MUX_HEADER_BYTES) < 0)
+		return -1;
+	memcpy(&tag, &(_mux_buffer[0]), sizeof(tag));
+	tag = ntohs(tag);
+	memcpy(&len, &(_mux_buffer[2]), sizeof(len));
+	len = ntohs(len);
+	if (len && (_mux_read_all(_mux_fd, data, len) < 0))
+		return -1;
+
+	handle = _mux_find(tag);
+	if ((handle == NULL) || (handle->fd < 0)) {
+		if (handle && (len == 0))
+			handle->remote_closed = 1;
+		return 0;
+	}
+	if (len == 0) {
+		// PSLSE closed handle, let AFU code see end of file
+		handle->remote_closed = 1;
+		shutdown(handle->fd, SHUT_WR);
+	} else if (_mux_write_all(handle->fd, data, len) < 0) {
+		debug_msg("mux: dropped data for closed handle %d", tag);
+	}
+	if (handle->afu)
+		return _mux_events(handle);
+	return 0;
+}
+
+// Free handles that both sides have closed so their tags can be reused
+static void _mux_sweep(int all)
+{
+	struct mux_handle **ptr, *handle;
+
+	ptr = &_mux_handles;
+	while (*ptr != NULL) {
+		handle = *ptr;
+		if (!all && ((handle->fd >= 0) || !handle->remote_closed)) {
+			ptr = &(handle->_next);
+			continue;
+		}
+		if (handle->afu) {
+			_all_idle(handle->afu);
+			handle->afu->attached = 0;
+		}
+		if (handle->fd >= 0)
+			close(handle->fd);
+		*ptr = handle->_next;
+		free(handle);
+	}
+}
+
+// Service thread for the multiplexed connection shared by all handles
+static void *_mux_loop(void *ptr)
+{
+	struct mux_handle *handle;
+	struct pollfd *pfd;
+	uint8_t byte;
+	int count, max, busy, ready, i;
+
+	pfd = NULL;
+	max = 0;
+	pthread_mutex_lock(&_mux_lock);
+	while (1) {
+		// Send requests of opened AFUs
+		busy = 0;
+		count = 2;
+		for (handle = _mux_handles; handle != NULL;
+		     handle = handle->_next) {
+			if (handle->afu && handle->afu->opened)
+				_psl_requests(handle->afu);
+			if (handle->afu && !handle->afu->opened) {
+				handle->afu->attached = 0;
+				handle->afu = NULL;
 			}
-			break;
-		case PSLSE_AFU_ERROR:
-			if (_handle_afu_error(afu) < 0) {
-				perror("AFU ERROR Failure");
-				goto psl_fail;
+			// Read-only buffers are sent in chunks
+			if (handle->afu &&
+			    (handle->afu->ro.state == LIBCXL_REQ_REQUEST))
+				busy = 1;
+			if (handle->fd >= 0)
+				++count;
+		}
+
+		// Wait for wake up, data from PSLSE or data from a handle
+		if (count > max) {
+			max = count * 2;
+			free(pfd);
+			pfd = (struct pollfd *)malloc(max *
+						      sizeof(struct pollfd));
+			if (pfd == NULL) {
+				perror("malloc");
+				goto mux_fail;
 			}
-			break;
-		default:
-			break;
 		}
+		pfd[0].fd = _mux_pipe[0];
+		pfd[1].fd = _mux_fd;
+		i = 2;
+		for (handle = _mux_handles; handle != NULL;
+		     handle = handle->_next) {
+			if (handle->fd >= 0)
+				pfd[i++].fd = handle->fd;
+		}
+		for (i = 0; i < count; i++) {
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+		}
+		pthread_mutex_unlock(&_mux_lock);
+		i = poll(pfd, count, busy ? 0 : -1);
+		pthread_mutex_lock(&_mux_lock);
+		if ((i < 0) && (errno != EINTR)) {
+			perror("poll");
+			goto mux_fail;
+		}
+		while (read(_mux_pipe[0], &byte, 1) > 0) ;
+
+		// Only this thread closes handles so the order still matches
+		i = 2;
+		for (handle = _mux_handles; (handle != NULL) && (i < count);
+		     handle = handle->_next) {
+			if (handle->fd < 0)
+				continue;
+			if (pfd[i++].revents && (_mux_frame_out(handle) < 0))
+				goto mux_fail;
+		}
+		if (pfd[1].revents) {
+			do {
+				if (_mux_frame_in() < 0)
+					goto mux_fail;
+			} while ((ioctl(_mux_fd, FIONREAD, &ready) == 0) &&
+				 (ready > 0));
+		}
+		// Events may have arrived before the AFU was opened
+		for (handle = _mux_handles; handle != NULL;
+		     handle = handle->_next) {
+			if (handle->afu && (_mux_events(handle) < 0))
+				goto mux_fail;
+		}
+		_mux_sweep(0);
 	}
 
- psl_fail:
-	afu->attached = 0;
+ mux_fail:
+	warn_msg("Multiplexed connection to PSLSE closed");
+	_mux_sweep(1);
+	close_socket(&_mux_fd);
+	_mux_fd = -1;
+	pthread_mutex_unlock(&_mux_lock);
+	free(pfd);
 	pthread_exit(NULL);
 }
 
-static int _pslse_connect(uint16_t * afu_map, int *fd)
+// Open the multiplexed connection and start its thread, lock must be held
+static int _mux_start()
 {
-	char *pslse_server_dat_path;
-	FILE *fp;
-	uint8_t buffer[MAX_LINE_CHARS];
-	struct sockaddr_in ssadr;
-	struct hostent *he;
-	char *host, *port_str;
-	int port;
+	pthread_attr_t attr;
+	pthread_t thread;
+	uint8_t buffer;
+	int fd;
 
-	// Get hostname and port of PSLSE server
-	DPRINTF("AFU CONNECT\n");
-	pslse_server_dat_path = getenv("PSLSE_SERVER_DAT");
-	if (!pslse_server_dat_path) pslse_server_dat_path = "pslse_server.dat";
-	fp = fopen(pslse_server_dat_path, "r");
-	if (!fp) {
-		perror("fopen:pslse_server.dat");
-		goto connect_fail;
-	}
-	do {
-		if (fgets((char *)buffer, MAX_LINE_CHARS - 1, fp) == NULL) {
-			perror("fgets:pslse_server.dat");
-			fclose(fp);
-			goto connect_fail;
+	if (_pslse_socket(&fd) < 0)
+		return -1;
+	if (_pslse_hello(fd) < 0)
+		goto start_fail;
+	buffer = PSLSE_MUX;
+	if (put_bytes_silent(fd, 1, &buffer) != 1)
+		goto start_fail;
+	if ((get_bytes_silent(fd, 1, &buffer, 1000, 0) < 0) ||
+	    (buffer != (uint8_t) PSLSE_MUX)) {
+		warn_msg("PSLSE can not multiplex, using connection per AFU");
+		_mux_off = 1;
+		goto start_fail;
+	}
+	// Wake up pipe is kept for the life of the process
+	if (_mux_pipe[0] < 0) {
+		if (pipe(_mux_pipe) < 0) {
+			perror("pipe");
+			goto start_fail;
 		}
+		fcntl(_mux_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(_mux_pipe[1], F_SETFL, O_NONBLOCK);
 	}
-	while (buffer[0] == '#');
-	fclose(fp);
-	host = (char *)buffer;
-	port_str = strchr((char *)buffer, ':');
-	*port_str = '\0';
-	port_str++;
-	if (!host || !port_str) {
-		warn_msg
-		    ("cxl_afu_open_dev:Invalid format in pslse_server.data");
-		goto connect_fail;
+	_mux_fd = fd;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, _mux_loop, NULL)) {
+		perror("pthread_create");
+		pthread_attr_destroy(&attr);
+		_mux_fd = -1;
+		goto start_fail;
 	}
-	port = atoi(port_str);
+	pthread_attr_destroy(&attr);
+	return 0;
 
-	info_msg("Connecting to host '%s' port %d", host, port);
+ start_fail:
+	close_socket(&fd);
+	return -1;
+}
 
-	// Connect to PSLSE server
-	if ((he = gethostbyname(host)) == NULL) {
-		herror("gethostbyname");
-		puts(host);
-		goto connect_fail;
+// Open new AFU handle on the multiplexed connection, *fd is then used like
+// a connection to PSLSE.  PSLSE_MUX=0 in the environment gives every
+// handle its own connection.
+static int _mux_open(int *fd)
+{
+	struct mux_handle *handle, **ptr;
+	char *env;
+	int pair[2];
+
+	env = getenv("PSLSE_MUX");
+	if (_mux_off || (env && !strcmp(env, "0")))
+		return _pslse_socket(fd);
+	pthread_mutex_lock(&_mux_lock);
+	if ((_mux_fd < 0) && (_mux_start() < 0)) {
+		pthread_mutex_unlock(&_mux_lock);
+		return _mux_off ? _pslse_socket(fd) : -1;
+	}
+	handle = (struct mux_handle *)calloc(1, sizeof(struct mux_handle));
+	if ((handle == NULL) ||
+	    (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)) {
+		perror("mux handle");
+		pthread_mutex_unlock(&_mux_lock);
+		free(handle);
+		return -1;
 	}
-	memset(&ssadr, 0, sizeof(ssadr));
-	memcpy(&ssadr.sin_addr, he->h_addr_list[0], he->h_length);
-	ssadr.sin_family = AF_INET;
-	ssadr.sin_port = htons(port);
-	if ((*fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-		perror("socket");
-		goto connect_fail;
+	// Tags are reused once both sides have closed them
+	do
+		handle->tag = _mux_tag++;
+	while (_mux_find(handle->tag) != NULL);
+	handle->local_fd = pair[0];
+	handle->fd = pair[1];
+	for (ptr = &_mux_handles; *ptr != NULL; ptr = &((*ptr)->_next)) {
+		// Descriptor number of a closed handle was reused
+		if ((*ptr)->local_fd == pair[0])
+			(*ptr)->local_fd = -1;
+	}
+	*ptr = handle;
+	pthread_mutex_unlock(&_mux_lock);
+	_mux_wake();
+	*fd = pair[0];
+	return 0;
+}
+
+// Service opened AFU from the multiplexed connection thread, -1 if the
+// AFU has its own connection
+static int _mux_attach(struct cxl_afu_h *afu)
+{
+	struct mux_handle *handle;
+
+	pthread_mutex_lock(&_mux_lock);
+	for (handle = _mux_handles; handle != NULL; handle = handle->_next) {
+		if ((handle->local_fd == afu->fd) && (handle->fd >= 0))
+			break;
 	}
-	ssadr.sin_family = AF_INET;
-	ssadr.sin_port = htons(port);
-	if (connect(*fd, (struct sockaddr *)&ssadr, sizeof(ssadr)) < 0) {
-		perror("connect");
-		goto connect_fail;
+	if (handle != NULL) {
+		afu->mux = 1;
+		afu->opened = 1;
+		handle->afu = afu;
 	}
-	strcpy((char *)buffer, "PSLSE");
-	buffer[5] = (uint8_t) PSLSE_VERSION_MAJOR;
-	buffer[6] = (uint8_t) PSLSE_VERSION_MINOR;
-	if (put_bytes_silent(*fd, 7, buffer) != 7) {
-		warn_msg("cxl_afu_open_dev:Failed to write to socket!");
-		goto connect_fail;
+	pthread_mutex_unlock(&_mux_lock);
+	if (handle == NULL)
+		return -1;
+	_mux_wake();
+	return 0;
+}
+
+// Stop servicing AFU from the multiplexed connection thread
+static void _mux_detach(struct cxl_afu_h *afu)
+{
+	struct mux_handle *handle;
+
+	pthread_mutex_lock(&_mux_lock);
+	for (handle = _mux_handles; handle != NULL; handle = handle->_next) {
+		if (handle->afu == afu) {
+			handle->afu = NULL;
+			handle->local_fd = -1;
+		}
 	}
-	if (get_bytes_silent(*fd, 1, buffer, -1, 0) < 0) {
-		warn_msg("cxl_afu_open_dev:Socket failed open acknowledge");
+	pthread_mutex_unlock(&_mux_lock);
+}
+
+static int _pslse_connect(uint8_t * afu_map, int *fd)
+{
+	uint8_t buffer[1 + PSLSE_AFU_MAP_BYTES];
+
+	if (_mux_open(fd) < 0)
+		goto connect_fail;
+	if (_pslse_hello(*fd) < 0) {
 		close_socket(fd);
 		goto connect_fail;
 	}
-	if (buffer[0] != (uint8_t) PSLSE_CONNECT) {
-		warn_msg("cxl_afu_open_dev:PSLSE bad acknowledge");
+	buffer[0] = PSLSE_AFU_MAP;
+	if (put_bytes_silent(*fd, 1, buffer) != 1) {
+		warn_msg("cxl_afu_open_dev:Failed to write to socket!");
 		close_socket(fd);
 		goto connect_fail;
 	}
-	if (get_bytes_silent(*fd, sizeof(uint16_t), buffer, 1000, 0) < 0) {
-		warn_msg("cxl_afu_open_dev:afu_map");
+	if ((get_bytes_silent(*fd, 1 + PSLSE_AFU_MAP_BYTES, buffer, 1000, 0) <
+	     0) || (buffer[0] != (uint8_t) PSLSE_AFU_MAP)) {
+		warn_msg("cxl_afu_open_dev:extended afu_map");
 		close_socket(fd);
 		goto connect_fail;
 	}
-	memcpy((char *)afu_map, (char *)buffer, 2);
-	*afu_map = (long)ntohs(*afu_map);
+	memcpy(afu_map, &(buffer[1]), PSLSE_AFU_MAP_BYTES);
 	return 0;
 
  connect_fail:
@@ -814,54 +1536,40 @@ static int _pslse_connect(uint16_t * afu_map, int *fd)
 	return -1;
 }
 
-static struct cxl_adapter_h *_new_adapter(uint16_t afu_map, uint16_t position,
-					  int fd)
+// Position is the adapter number, -1 if there are no more adapters
+static struct cxl_adapter_h *_new_adapter(const uint8_t * afu_map,
+					  int position, int fd)
 {
 	struct cxl_adapter_h *adapter;
-	uint16_t mask = 0xf000;
-	int id_num = 0;
 
-	if (position == 0)
+	if (position < 0)
 		return NULL;
 
 	adapter = (struct cxl_adapter_h *)
 	    calloc(1, sizeof(struct cxl_adapter_h));
-	while ((position & mask) == 0) {
-		mask >>= 4;
-		++id_num;
-	}
-	adapter->map = afu_map;
+	memcpy(adapter->map, afu_map, PSLSE_AFU_MAP_BYTES);
 	adapter->position = position;
-	adapter->mask = mask;
 	adapter->fd = fd;
-	adapter->id = calloc(6, sizeof(char));
-	sprintf(adapter->id, "card%d", id_num);
+	adapter->id = calloc(16, sizeof(char));
+	sprintf(adapter->id, "card%d", position);
 	return adapter;
 }
 
-static struct cxl_afu_h *_new_afu(uint16_t afu_map, uint16_t position, int fd)
+// Position is the AFU id, -1 if there are no more AFUs
+static struct cxl_afu_h *_new_afu(const uint8_t * afu_map, int position,
+				  int fd)
 {
 	uint8_t *buffer;
 	int size;
 	struct cxl_afu_h *afu;
-	uint16_t adapter_mask = 0xf000;
-	uint16_t afu_mask = 0x8000;
-	int major = 0;
-	int minor = 0;
+	int major, minor;
 
-	if (position == 0) {
+	if (position < 0) {
 		errno = ENODEV;
 		return NULL;
 	}
-	while ((position & adapter_mask) == 0) {
-		adapter_mask >>= 4;
-		afu_mask >>= 4;
-		++major;
-	}
-	while ((position & afu_mask) == 0) {
-		afu_mask >>= 1;
-		++minor;
-	}
+	major = PSLSE_AFU_MAJOR(position);
+	minor = PSLSE_AFU_MINOR(position);
 	afu = (struct cxl_afu_h *)
 	    calloc(1, sizeof(struct cxl_afu_h));
 	if (afu == NULL) {
@@ -872,10 +1580,9 @@ static struct cxl_afu_h *_new_afu(uint16_t afu_map, uint16_t position, int fd)
 	if (pipe(afu->pipe) < 0)
 		return NULL;
 
-	pthread_mutex_init(&(afu->event_lock), NULL);
 	afu->fd = fd;
-	afu->map = afu_map;
-	afu->dbg_id = (major << 4) | minor;
+	memcpy(afu->map, afu_map, PSLSE_AFU_MAP_BYTES);
+	afu->dbg_id = PSLSE_AFU_ID(major, minor);
 	debug_msg("opened host-side socket %d", afu->fd);
 
 	// Send PSLSE query
@@ -893,7 +1600,7 @@ static struct cxl_afu_h *_new_afu(uint16_t afu_map, uint16_t position, int fd)
 
 	afu->adapter = major;
 	afu->position = position;
-	afu->id = calloc(7, sizeof(char));
+	afu->id = calloc(16, sizeof(char));
 	_all_idle(afu);
 	sprintf(afu->id, "afu%d.%d", major, minor);
 
@@ -924,7 +1631,6 @@ static void _release_afus(struct cxl_afu_h *afu)
 		}
 		if (afu->id)
 			free(afu->id);
-		pthread_mutex_destroy(&(afu->event_lock));
 		free(afu);
 	}
 }
@@ -951,19 +1657,18 @@ static void _release_adapters(struct cxl_adapter_h *adapter)
 	}
 }
 
-static struct cxl_afu_h *_pslse_open(int *fd, uint16_t afu_map, uint8_t major,
-				     uint8_t minor, char afu_type)
+static struct cxl_afu_h *_pslse_open(int *fd, const uint8_t * afu_map,
+				     uint8_t major, uint8_t minor,
+				     char afu_type)
 {
 	struct cxl_afu_h *afu;
 	uint8_t *buffer;
-	uint16_t position;
+	uint8_t position;
 
 	if (!fd)
 		fatal_msg("NULL fd passed to libcxl.c:_pslse_open");
-	position = 0x8000;
-	position >>= 4 * major;
-	position >>= minor;
-	if ((afu_map & position) != position) {
+	position = PSLSE_AFU_ID(major, minor);
+	if (!afu_map_test(afu_map, position)) {
 		warn_msg("open:AFU not in system");
 		close_socket(fd);
 		errno = ENODEV;
@@ -988,11 +1693,12 @@ static struct cxl_afu_h *_pslse_open(int *fd, uint16_t afu_map, uint8_t major,
 
 	afu->_head = afu;
 	afu->adapter = major;
-	afu->id = (char *)malloc(7);
+	afu->id = (char *)malloc(16);
 	afu->open.state = LIBCXL_REQ_PENDING;
 
-	// Start thread
-	if (pthread_create(&(afu->thread), NULL, _psl_loop, afu)) {
+	// Start thread unless the multiplexed connection thread services AFU
+	if ((_mux_attach(afu) < 0) &&
+	    pthread_create(&(afu->thread), NULL, _psl_loop, afu)) {
 		perror("pthread_create");
 		close_socket(&(afu->fd));
 		goto open_fail;
@@ -1002,7 +1708,10 @@ static struct cxl_afu_h *_pslse_open(int *fd, uint16_t afu_map, uint8_t major,
 		_delay_1ms();
 
 	if (!afu->opened) {
-		pthread_join(afu->thread, NULL);
+		if (afu->mux)
+			_mux_detach(afu);
+		else
+			pthread_join(afu->thread, NULL);
 		goto open_fail;
 	}
 
@@ -1011,7 +1720,6 @@ static struct cxl_afu_h *_pslse_open(int *fd, uint16_t afu_map, uint8_t major,
 	return afu;
 
  open_fail:
-	pthread_mutex_destroy(&(afu->event_lock));
 	free(afu);
 	errno = ENODEV;
 	return NULL;
@@ -1020,21 +1728,19 @@ static struct cxl_afu_h *_pslse_open(int *fd, uint16_t afu_map, uint8_t major,
 struct cxl_adapter_h *cxl_adapter_next(struct cxl_adapter_h *adapter)
 {
 	struct cxl_adapter_h *head;
-	uint16_t afu_map, afu_mask;
-	int fd;
+	uint8_t afu_map[PSLSE_AFU_MAP_BYTES];
+	int id, fd;
 
 	// First adapter
 	if (adapter == NULL) {
 		// Query PSLSE
-		if (_pslse_connect(&afu_map, &fd) < 0)
+		if (_pslse_connect(afu_map, &fd) < 0)
 			return NULL;
 		// No devices?
-		assert(afu_map != 0);
-		afu_mask = 0x8000;
-		// Find first AFU and return struct for it
-		while ((afu_map & afu_mask) != afu_mask)
-			afu_mask >>= 1;
-		head = _new_adapter(afu_map, afu_mask, fd);
+		id = afu_map_next(afu_map, -1);
+		assert(id >= 0);
+		// Find first AFU and return struct for its adapter
+		head = _new_adapter(afu_map, PSLSE_AFU_MAJOR(id), fd);
 		head->_head = head;
 		return head;
 	}
@@ -1044,23 +1750,19 @@ struct cxl_adapter_h *cxl_adapter_next(struct cxl_adapter_h *adapter)
 		adapter->fd = 0;
 		return adapter->_next;
 	}
-	// Find next adapter
-	afu_mask = adapter->position;
-	afu_map = adapter->map;
-	while (((afu_mask & ~adapter->mask) == 0) && (afu_mask != 0))
-		afu_mask >>= 1;
-
 	// Find first AFU on another adapter
-	while (((afu_map & afu_mask) != afu_mask) && (afu_mask != 0))
-		afu_mask >>= 1;
+	id = afu_map_next(adapter->map,
+			  PSLSE_AFU_ID(adapter->position,
+				       PSLSE_MAX_AFUS_PER_ADAPTER - 1));
 
 	// No more AFUs
-	if (afu_mask == 0) {
+	if (id < 0) {
 		_release_adapters(adapter->_head);
 		return NULL;
 	}
 	// Update pointers and return next adapter
-	adapter->_next = _new_adapter(afu_map, afu_mask, adapter->fd);
+	adapter->_next = _new_adapter(adapter->map, PSLSE_AFU_MAJOR(id),
+				      adapter->fd);
 	adapter->_next->_head = adapter->_head;
 	adapter->fd = 0;
 	return adapter->_next;
@@ -1108,33 +1810,30 @@ struct cxl_afu_h *cxl_adapter_afu_next(struct cxl_adapter_h *adapter,
 				       struct cxl_afu_h *afu)
 {
 	struct cxl_afu_h *head;
-	uint16_t afu_map, afu_mask;
-	int fd;
+	uint8_t afu_map[PSLSE_AFU_MAP_BYTES];
+	int id, fd;
 
 	if (adapter == NULL)
 		return NULL;
 
-	afu_mask = adapter->position;
-
 	// Query PSLSE
 	if (adapter->fd == 0) {
-		if (_pslse_connect(&afu_map, &fd) < 0)
+		if (_pslse_connect(afu_map, &fd) < 0)
 			return NULL;
 	} else {
-		afu_map = adapter->map;
+		memcpy(afu_map, adapter->map, PSLSE_AFU_MAP_BYTES);
+		fd = adapter->fd;
 	}
 
 	// First afu
 	if (afu == NULL) {
-		// No devices?
-		assert(afu_map != 0);
-		// Find first AFU and return struct for it
-		afu_mask = adapter->mask & 0x8888;
-		while ((afu_map & afu_mask) != afu_mask)
-			afu_mask >>= 1;
-		head = _new_afu(afu_map, afu_mask, adapter->fd);
+		// Find first AFU on this adapter and return struct for it
+		id = afu_map_next(afu_map,
+				  PSLSE_AFU_ID(adapter->position, 0) - 1);
+		if ((id >= 0) && (PSLSE_AFU_MAJOR(id) != adapter->position))
+			id = -1;
+		head = _new_afu(afu_map, id, fd);
 		adapter->fd = 0;
-		head->_head = head;
 		if (head != NULL)
 			head->_head = head;
 		return head;
@@ -1146,18 +1845,15 @@ struct cxl_afu_h *cxl_adapter_afu_next(struct cxl_adapter_h *adapter,
 		return afu->_next;
 	}
 	// Find next afu on this adapter
-	afu_mask = afu->position >> 1;
-	while (((afu_mask & adapter->mask) != 0)
-	       && ((afu_mask & afu->map) == 0))
-		afu_mask >>= 1;
+	id = afu_map_next(afu->map, afu->position);
 
 	// No more AFUs on this adapter
-	if ((afu_mask & adapter->mask) == 0) {
+	if ((id < 0) || (PSLSE_AFU_MAJOR(id) != adapter->position)) {
 		_release_afus(adapter->afu_list);
 		return NULL;
 	}
 	// Update pointers and return next afu
-	afu->_next = _new_afu(afu_map, afu_mask, afu->fd);
+	afu->_next = _new_afu(afu_map, id, afu->fd);
 	afu->_next->_head = afu->_head;
 	afu->fd = 0;
 	return afu->_next;
@@ -1166,26 +1862,24 @@ struct cxl_afu_h *cxl_adapter_afu_next(struct cxl_adapter_h *adapter,
 struct cxl_afu_h *cxl_afu_next(struct cxl_afu_h *afu)
 {
 	struct cxl_afu_h *head;
-	uint16_t afu_map, afu_mask;
-	int fd;
+	uint8_t afu_map[PSLSE_AFU_MAP_BYTES];
+	int id, fd;
 
 	if ((afu == NULL) || (afu->fd == 0)) {
 		// Query PSLSE
-		if (_pslse_connect(&afu_map, &fd) < 0)
+		if (_pslse_connect(afu_map, &fd) < 0)
 			return NULL;
 	} else {
-		afu_map = afu->map;
+		memcpy(afu_map, afu->map, PSLSE_AFU_MAP_BYTES);
 	}
 
 	// First afu
 	if (afu == NULL) {
 		// No devices?
-		assert(afu_map != 0);
-		afu_mask = 0x8000;
+		id = afu_map_next(afu_map, -1);
+		assert(id >= 0);
 		// Find first AFU and return struct for it
-		while ((afu_map & afu_mask) != afu_mask)
-			afu_mask >>= 1;
-		head = _new_afu(afu_map, afu_mask, fd);
+		head = _new_afu(afu_map, id, fd);
 		head->_head = head;
 		return head;
 	}
@@ -1196,18 +1890,15 @@ struct cxl_afu_h *cxl_afu_next(struct cxl_afu_h *afu)
 		return afu->_next;
 	}
 	// Find next afu
-	afu_mask = afu->position;
-	afu_mask >>= 1;
-	while ((afu_mask != 0) && ((afu_mask & afu->map) == 0))
-		afu_mask >>= 1;
+	id = afu_map_next(afu->map, afu->position);
 
 	// No more AFUs
-	if (afu_mask == 0) {
+	if (id < 0) {
 		_release_afus(afu->_head);
 		return NULL;
 	}
 	// Update pointers and return next afu
-	afu->_next = _new_afu(afu_map, afu_mask, afu->fd);
+	afu->_next = _new_afu(afu_map, id, afu->fd);
 	afu->_next->_head = afu->_head;
 	afu->fd = 0;
 	return afu->_next;
@@ -1224,33 +1915,27 @@ char *cxl_afu_dev_name(struct cxl_afu_h *afu)
 
 struct cxl_afu_h *cxl_afu_open_dev(char *path)
 {
-	uint16_t afu_map;
+	uint8_t afu_map[PSLSE_AFU_MAP_BYTES];
 	uint8_t major, minor;
 	char *afu_id;
 	char afu_type;
-	int fd;
+	int fd, len;
 
 	if (!path)
 		return NULL;
-	if (_pslse_connect(&afu_map, &fd) < 0)
-		return NULL;
 
 	// Discover AFU position
 	afu_id = strrchr(path, '/');
-	afu_id++;
-	if ((afu_id[3] < '0') || (afu_id[3] > '3')) {
-		warn_msg("Invalid afu major: %c", afu_id[3]);
+	afu_id = afu_id ? afu_id + 1 : path;
+	if ((len = parse_afu_name(afu_id, &major, &minor)) < 0) {
+		warn_msg("Invalid afu name: %s", afu_id);
 		errno = ENODEV;
 		return NULL;
 	}
-	if ((afu_id[5] < '0') || (afu_id[5] > '3')) {
-		warn_msg("Invalid afu minor: %c", afu_id[5]);
-		errno = ENODEV;
+	afu_type = afu_id[len];
+
+	if (_pslse_connect(afu_map, &fd) < 0)
 		return NULL;
-	}
-	major = afu_id[3] - '0';
-	minor = afu_id[5] - '0';
-	afu_type = afu_id[6];
 
 	return _pslse_open(&fd, afu_map, major, minor, afu_type);
 }
@@ -1258,7 +1943,6 @@ struct cxl_afu_h *cxl_afu_open_dev(char *path)
 struct cxl_afu_h *cxl_afu_open_h(struct cxl_afu_h *afu, enum cxl_views view)
 {
 	uint8_t major, minor;
-	uint16_t mask;
 	char afu_type;
 
 	if (afu == NULL) {
@@ -1267,21 +1951,12 @@ struct cxl_afu_h *cxl_afu_open_h(struct cxl_afu_h *afu, enum cxl_views view)
 	}
 	// Query PSLSE
 	if (afu->fd == 0) {
-		if (_pslse_connect(&(afu->map), &afu->fd) < 0)
+		if (_pslse_connect(afu->map, &afu->fd) < 0)
 			return NULL;
 	}
 
-	mask = 0xf000;
-	major = minor = 0;
-	while (((mask & afu->position) != afu->position) && (mask != 0)) {
-		mask >>= 4;
-		major++;
-	}
-	mask &= 0x8888;
-	while (((mask & afu->position) != afu->position) && (mask != 0)) {
-		mask >>= 1;
-		minor++;
-	}
+	major = PSLSE_AFU_MAJOR(afu->position);
+	minor = PSLSE_AFU_MINOR(afu->position);
 	switch (view) {
 	case CXL_VIEW_DEDICATED:
 		afu_type = 'd';
@@ -1302,39 +1977,100 @@ struct cxl_afu_h *cxl_afu_open_h(struct cxl_afu_h *afu, enum cxl_views view)
 	return _pslse_open(&(afu->fd), afu->map, major, minor, afu_type);
 }
 
-void cxl_afu_free(struct cxl_afu_h *afu)
+// Ask PSLSE to detach AFU, returns 1 if the request was sent
+static int _detach_request(struct cxl_afu_h *afu)
 {
 	uint8_t buffer;
-	int rc;
-
-	if (!afu) {
-		warn_msg("cxl_afu_free: No AFU given");
-		goto free_done_no_afu;
-	}
-	if (!afu->opened)
-		goto free_done;
 
 	DPRINTF("AFU FREE\n");
 	buffer = PSLSE_DETACH;
-	rc = put_bytes_silent(afu->fd, 1, &buffer);
-	if (rc == 1) {
-	        debug_msg("detach request sent from from host on socket %d", afu->fd);
-		while (afu->attached)	/*infinite loop */
-			_delay_1ms();
-	}
+	if (put_bytes_silent(afu->fd, 1, &buffer) != 1)
+		return 0;
+	debug_msg("detach request sent from from host on socket %d", afu->fd);
+	return 1;
+}
+
+// Close connection of opened AFU once PSLSE detached it
+static void _close_afu(struct cxl_afu_h *afu)
+{
 	debug_msg("closing host side socket %d", afu->fd);
+	if (afu->mux)
+		_mux_detach(afu);
 	close_socket(&(afu->fd));
 	afu->opened = 0;
-	pthread_join(afu->thread, NULL);
+	if (!afu->mux)
+		pthread_join(afu->thread, NULL);
+}
 
- free_done:
+// Free AFU handle and its buffers
+static void _free_afu(struct cxl_afu_h *afu)
+{
 	if (afu->id != NULL)
 		free(afu->id);
- free_done_no_afu:
-	pthread_mutex_destroy(&(afu->event_lock));
+	if (afu->crs != NULL)
+		free(afu->crs);
 	free(afu);
 }
 
+void cxl_afu_free(struct cxl_afu_h *afu)
+{
+	if (!afu) {
+		warn_msg("cxl_afu_free: No AFU given");
+		return;
+	}
+	if (afu->opened) {
+		if (_detach_request(afu)) {
+			while (afu->attached)	/*infinite loop */
+				_delay_1ms();
+		}
+		_close_afu(afu);
+	}
+	_free_afu(afu);
+}
+
+void cxl_afu_free_bulk(struct cxl_afu_h **afus, int count)
+{
+	uint8_t *state;
+	int i;
+
+	if ((afus == NULL) || (count <= 0)) {
+		warn_msg("cxl_afu_free_bulk: No AFUs given");
+		return;
+	}
+	state = (uint8_t *) calloc(count, sizeof(uint8_t));
+	if (state == NULL) {
+		for (i = 0; i < count; i++) {
+			if (afus[i])
+				cxl_afu_free(afus[i]);
+		}
+		return;
+	}
+
+	// Send every detach request before waiting for any, PSLSE queues
+	// the detaches of all the contexts at once
+	for (i = 0; i < count; i++) {
+		if (!afus[i] || !afus[i]->opened)
+			continue;
+		state[i] = LIBCXL_BULK_OPENED;
+		if (_detach_request(afus[i]))
+			state[i] = LIBCXL_BULK_REQUESTED;
+	}
+	for (i = 0; i < count; i++) {
+		if (state[i] != LIBCXL_BULK_REQUESTED)
+			continue;
+		while (afus[i]->attached)	/*infinite loop */
+			_delay_1ms();
+	}
+	for (i = 0; i < count; i++) {
+		if (!afus[i])
+			continue;
+		if (state[i] != LIBCXL_BULK_NONE)
+			_close_afu(afus[i]);
+		_free_afu(afus[i]);
+	}
+	free(state);
+}
+
 int cxl_afu_opened(struct cxl_afu_h *afu)
 {
 	if (!afu) {
@@ -1365,6 +2101,7 @@ int cxl_afu_attach(struct cxl_afu_h *afu, uint64_t wed)
 	// Perform PSLSE attach
 	afu->attach.wed = wed;
 	afu->attach.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
 	while (afu->attach.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 		_delay_1ms();
 	afu->attached = 1;
@@ -1372,6 +2109,47 @@ int cxl_afu_attach(struct cxl_afu_h *afu, uint64_t wed)
 	return 0;
 }
 
+int cxl_afu_attach_bulk(struct cxl_afu_h **afus, int count, uint64_t * weds)
+{
+	int i;
+
+	if ((afus == NULL) || (count <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	DPRINTF("AFU ATTACH BULK\n");
+	for (i = 0; i < count; i++) {
+		if (!afus[i]) {
+			errno = EINVAL;
+			return -1;
+		}
+		if (!afus[i]->opened) {
+			warn_msg("cxl_afu_attach_bulk: Must open AFU first");
+			errno = ENODEV;
+			return -1;
+		}
+		if (afus[i]->attached) {
+			warn_msg("cxl_afu_attach_bulk: AFU already attached");
+			errno = ENODEV;
+			return -1;
+		}
+	}
+
+	// Request every attach before waiting for any
+	for (i = 0; i < count; i++) {
+		afus[i]->attach.wed = weds ? weds[i] : 0;
+		afus[i]->attach.state = LIBCXL_REQ_REQUEST;
+	}
+	_mux_wake();
+	for (i = 0; i < count; i++) {
+		while (afus[i]->attach.state != LIBCXL_REQ_IDLE) /*infinite loop */
+			_delay_1ms();
+		afus[i]->attached = 1;
+	}
+
+	return 0;
+}
+
 int cxl_afu_attach_full(struct cxl_afu_h *afu, uint64_t wed,
 			uint16_t num_interrupts, uint64_t amr)
 {
@@ -1468,40 +2246,90 @@ int cxl_set_irqs_max(struct cxl_afu_h *afu, long value)
 
 int cxl_event_pending(struct cxl_afu_h *afu)
 {
-	if (afu->events[0] != NULL)
+	if (afu->events.head != afu->events.tail)
 		return 1;
 
 	return 0;
 }
 
-int cxl_read_event(struct cxl_afu_h *afu, struct cxl_event *event)
+int cxl_read_events(struct cxl_afu_h *afu, struct cxl_event *events,
+		    int count)
 {
-	uint8_t type;
-	int i;
+	struct event_ring *ring;
+	struct event_entry *entry;
+	struct cxl_event *event;
+	uint8_t buffer[EVENT_RING_SIZE];
+	int i, bytes, rc;
 
-	if (afu == NULL || event == NULL) {
+	if ((afu == NULL) || (events == NULL) || (count <= 0)) {
 		errno = EINVAL;
 		return -1;
 	}
 	// Function will block until event occurs
-	pthread_mutex_lock(&(afu->event_lock));
-	while (afu->opened && !afu->events[0]) {	/*infinite loop */
-		pthread_mutex_unlock(&(afu->event_lock));
+	ring = &(afu->events);
+	while (ring->head == ring->tail) {	/*infinite loop */
+		if (!afu->opened) {
+			errno = ENODEV;
+			return -1;
+		}
 		if (_delay_1ms() < 0)
 			return -1;
-		pthread_mutex_lock(&(afu->event_lock));
+	}
+	__sync_synchronize();
+
+	// Copy out every available event up to count
+	for (i = 0; (i < count) && (ring->tail != ring->head); i++) {
+		entry = &(ring->entry[ring->tail & (EVENT_RING_SIZE - 1)]);
+		event = &(events[i]);
+		memset(event, 0, sizeof(struct cxl_event));
+		event->header.type = entry->type;
+		event->header.process_element = afu->context;
+		switch (entry->type) {
+		case CXL_EVENT_AFU_INTERRUPT:
+			event->header.size = sizeof(struct cxl_event_header) +
+			    sizeof(struct cxl_event_afu_interrupt);
+			event->irq.irq = entry->irq;
+			__sync_fetch_and_and(&(ring->irq_pending[entry->irq / 32]),
+					     ~(1 << (entry->irq % 32)));
+			break;
+		case CXL_EVENT_DATA_STORAGE:
+			event->header.size = sizeof(struct cxl_event_header) +
+			    sizeof(struct cxl_event_data_storage);
+			event->fault.addr = entry->value;
+			event->fault.dsisr = DSISR;
+			__sync_lock_release(&(ring->dsi_pending));
+			break;
+		case CXL_EVENT_AFU_ERROR:
+			event->header.size = sizeof(struct cxl_event_header) +
+			    sizeof(struct cxl_event_afu_error);
+			event->afu_error.error = entry->value;
+			__sync_lock_release(&(ring->error_pending));
+			break;
+		default:
+			break;
+		}
+		__sync_synchronize();
+		ring->tail++;
 	}
 
-	// Copy event data, free and move remaining events in queue
-	memcpy(event, afu->events[0], afu->events[0]->header.size);
-	free(afu->events[0]);
-	for (i = 1; i < EVENT_QUEUE_MAX; i++)
-		afu->events[i - 1] = afu->events[i];
-	afu->events[EVENT_QUEUE_MAX - 1] = NULL;
-	pthread_mutex_unlock(&(afu->event_lock));
-	if (read(afu->pipe[0], &type, 1) > 0)
-		return 0;
-	return -1;
+	// One byte per event was written for cxl_afu_fd() users
+	for (bytes = 0; bytes < i; bytes += rc) {
+		rc = read(afu->pipe[0], buffer, i - bytes);
+		if ((rc < 0) && (errno == EINTR)) {
+			rc = 0;
+			continue;
+		}
+		if (rc <= 0)
+			return -1;
+	}
+	return i;
+}
+
+int cxl_read_event(struct cxl_afu_h *afu, struct cxl_event *event)
+{
+	if (cxl_read_events(afu, event, 1) < 0)
+		return -1;
+	return 0;
 }
 
 int cxl_read_expected_event(struct cxl_afu_h *afu, struct cxl_event *event,
@@ -1543,6 +2371,7 @@ int cxl_mmio_map(struct cxl_afu_h *afu, uint32_t flags)
 	afu->mmio.type = PSLSE_MMIO_MAP;
 	afu->mmio.data = (uint64_t) flags;
 	afu->mmio.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
 	while (afu->mmio.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 		_delay_1ms();
 	afu->mapped = 1;
@@ -1573,6 +2402,7 @@ int cxl_mmio_write64(struct cxl_afu_h *afu, uint64_t offset, uint64_t data)
 	afu->mmio.addr = (uint32_t) offset;
 	afu->mmio.data = data;
 	afu->mmio.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
 	while (afu->mmio.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 		_delay_1ms();
 
@@ -1599,6 +2429,7 @@ int cxl_mmio_read64(struct cxl_afu_h *afu, uint64_t offset, uint64_t * data)
 	afu->mmio.type = PSLSE_MMIO_READ64;
 	afu->mmio.addr = (uint32_t) offset;
 	afu->mmio.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
 	while (afu->mmio.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 		_delay_1ms();
 	*data = afu->mmio.data;
@@ -1619,6 +2450,7 @@ int cxl_errinfo_read(struct cxl_afu_h *afu, void *dst, off_t off, size_t len)
 	off_t index1, index2;
 	uint8_t *buffer;
 	size_t total_read_length;
+	off_t count;
 
 	if ((afu == NULL) || !afu->mapped)   {
 		errno = ENODEV;
@@ -1644,25 +2476,33 @@ int cxl_errinfo_read(struct cxl_afu_h *afu, void *dst, off_t off, size_t len)
 		len = ERR_BUFF_MAX_COPY_SIZE - (off & 0x7);
 	}
 
-	/* perform aligned read from the mmio region */
+	/* perform aligned read from the mmio region, PSLSE returns up to
+	 * PSLSE_MAX_EB_READ_DWORDS doublewords per request */
         index1 = 0;
 	while (aligned_start <= last_byte)  {
+		count = ((last_byte - aligned_start) >> 3) + 1;
+		if (count > PSLSE_MAX_EB_READ_DWORDS)
+			count = PSLSE_MAX_EB_READ_DWORDS;
 	// Send MMIO request to PSLSE
-		afu->mmio.type = PSLSE_MMIO_EBREAD;
+		afu->mmio.type = PSLSE_MMIO_EBREAD_BULK;
 		afu->mmio.addr = (uint32_t) aligned_start ;
+		afu->mmio.bulk = &wbuf[index1];
+		afu->mmio.bulk_count = (uint16_t) count;
 		afu->mmio.state = LIBCXL_REQ_REQUEST;
+		_mux_wake();
 		while (afu->mmio.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 			_delay_1ms();
 		if (!afu->opened)
 			goto bread64_fail;
 		// if offset, have to potentially do BE->LE swap
-        	if ((off & 0x7) >0) 
-                	afu->mmio.data = htonll(afu->mmio.data);
-        	wbuf[index1] = afu->mmio.data;
-        	aligned_start = aligned_start + 8;
-                ++index1;
+		while (count--) {
+			if ((off & 0x7) >0)
+				wbuf[index1] = htonll(wbuf[index1]);
+			aligned_start = aligned_start + 8;
+			++index1;
+		}
         }
-	memcpy(&wbuf[0], &bbuf[off & 0x7], len);
+	memmove(&wbuf[0], &bbuf[off & 0x7], len);
 	// if offset we have to do LE->BE swap back	
  	if ((off & 0x7) > 0)    {
                 index2 = 0;
@@ -1704,6 +2544,7 @@ int cxl_mmio_write32(struct cxl_afu_h *afu, uint64_t offset, uint32_t data)
 	afu->mmio.addr = (uint32_t) offset;
 	afu->mmio.data = (uint64_t) data;
 	afu->mmio.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
 	while (afu->mmio.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 		_delay_1ms();
 
@@ -1730,6 +2571,7 @@ int cxl_mmio_read32(struct cxl_afu_h *afu, uint64_t offset, uint32_t * data)
 	afu->mmio.type = PSLSE_MMIO_READ32;
 	afu->mmio.addr = (uint32_t) offset;
 	afu->mmio.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
 	while (afu->mmio.state != LIBCXL_REQ_IDLE)	/*infinite loop */
 		_delay_1ms();
 	*data = (uint32_t) afu->mmio.data;
@@ -1744,14 +2586,77 @@ int cxl_mmio_read32(struct cxl_afu_h *afu, uint64_t offset, uint32_t * data)
 	return -1;
 }
 
+int cxl_sim_register_ro(struct cxl_afu_h *afu, void *ptr, size_t len)
+{
+	if ((ptr == NULL) || (len == 0) || (len > INT_MAX)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((afu == NULL) || !afu->attached)
+		goto ro_fail;
+
+	// Send buffer to PSLSE
+	afu->ro.addr = (uint64_t) ptr;
+	afu->ro.len = (uint64_t) len;
+	afu->ro.sent = 0;
+	afu->ro.status = 1;
+	afu->ro.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
+	while (afu->ro.state != LIBCXL_REQ_IDLE)	/*infinite loop */
+		_delay_1ms();
+
+	if (!afu->opened)
+		goto ro_fail;
+	if (afu->ro.status) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return 0;
+
+ ro_fail:
+	errno = ENODEV;
+	return -1;
+}
+
+int cxl_sim_get_cycles(struct cxl_afu_h *afu, uint64_t * cycles,
+		       uint64_t * mmio_cycle, uint64_t * irq_cycle)
+{
+	if (cycles == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((afu == NULL) || !afu->opened)
+		goto cycles_fail;
+
+	afu->cycles.state = LIBCXL_REQ_REQUEST;
+	_mux_wake();
+	while (afu->cycles.state != LIBCXL_REQ_IDLE)	/*infinite loop */
+		_delay_1ms();
+
+	if (!afu->opened)
+		goto cycles_fail;
+	*cycles = afu->cycles.cycles;
+	if (mmio_cycle != NULL)
+		*mmio_cycle = afu->cycles.mmio;
+	if (irq_cycle != NULL)
+		*irq_cycle = afu->cycles.irq;
+	return 0;
+
+ cycles_fail:
+	errno = ENODEV;
+	return -1;
+}
+
 int cxl_get_cr_device(struct cxl_afu_h *afu, long cr_num, long *valp)
 {
 	if (afu == NULL) 
 		return -1;
-        //uint16_t crnum = cr_num;
-	// For now, don't worry about cr_num
-	//*valp =  htons(afu->cr_device);
-	*valp =  afu->cr_device;
+	if ((cr_num < 0) || (cr_num >= afu->num_crs)) {
+		errno = EINVAL;
+		return -1;
+	}
+	*valp =  afu->crs[cr_num].cr_device;
 	return 0;
 }
 
@@ -1759,10 +2664,11 @@ int cxl_get_cr_vendor(struct cxl_afu_h *afu, long cr_num, long *valp)
 {
 	if (afu == NULL) 
 		return -1;
-        //uint16_t crnum = cr_num;
-	// For now, don't worry about cr_num
-	//*valp =  htons(afu->cr_vendor);
-	*valp =  afu->cr_vendor;
+	if ((cr_num < 0) || (cr_num >= afu->num_crs)) {
+		errno = EINVAL;
+		return -1;
+	}
+	*valp =  afu->crs[cr_num].cr_vendor;
 	return 0;
 }
 
@@ -1770,10 +2676,11 @@ int cxl_get_cr_class(struct cxl_afu_h *afu, long cr_num, long *valp)
 {
 	if (afu == NULL) 
 		return -1;
-        //uint16_t crnum = cr_num;
-	// For now, don't worry about cr_num
-	//*valp =  htonl(afu->cr_class);
-	*valp =  afu->cr_class;
+	if ((cr_num < 0) || (cr_num >= afu->num_crs)) {
+		errno = EINVAL;
+		return -1;
+	}
+	*valp =  afu->crs[cr_num].cr_class;
 	return 0;
 }
 
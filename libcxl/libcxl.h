@@ -90,6 +90,12 @@ struct cxl_afu_h *cxl_afu_open_dev(char *path);
 struct cxl_afu_h *cxl_afu_open_h(struct cxl_afu_h *afu, enum cxl_views view);
 //struct cxl_afu_h * cxl_afu_fd_to_h(int fd);
 void cxl_afu_free(struct cxl_afu_h *afu);
+/*
+ * Free many AFU handles at once.  The detach requests of all handles are
+ * sent before waiting for any of them so PSLSE can queue the detaches of all
+ * contexts together.
+ */
+void cxl_afu_free_bulk(struct cxl_afu_h **afus, int count);
 int cxl_afu_opened(struct cxl_afu_h *afu);
 
 /*
@@ -108,6 +114,13 @@ int cxl_afu_attach(struct cxl_afu_h *afu, uint64_t wed);
 int cxl_afu_attach_work(struct cxl_afu_h *afu,
 			struct cxl_ioctl_start_work *work);
 
+/*
+ * Attach many opened AFU handles at once, handle i with weds[i] or 0 if weds
+ * is NULL.  The attach requests of all handles are sent before waiting for
+ * any of them so the attaches overlap instead of running one after another.
+ */
+int cxl_afu_attach_bulk(struct cxl_afu_h **afus, int count, uint64_t *weds);
+
 /* Deprecated interface */
 int cxl_afu_attach_full(struct cxl_afu_h *afu, uint64_t wed,
 			uint16_t num_interrupts, uint64_t amr);
@@ -180,6 +193,14 @@ int cxl_get_psl_revision(struct cxl_adapter_h *adapter, long *valp);
  */
 int cxl_event_pending(struct cxl_afu_h *afu);
 int cxl_read_event(struct cxl_afu_h *afu, struct cxl_event *event);
+/*
+ * Read up to count events in one call, blocking until at least one is
+ * available.  Returns the number of events read or -1 on error.  An AFU
+ * interrupt source that fires again before its event is read is reported
+ * once.  Events of a handle must be read from one thread.
+ */
+int cxl_read_events(struct cxl_afu_h *afu, struct cxl_event *events,
+		    int count);
 int cxl_read_expected_event(struct cxl_afu_h *afu, struct cxl_event *event,
 			    uint32_t type, uint16_t irq);
 
@@ -237,6 +258,24 @@ int cxl_get_cr_class(struct cxl_afu_h *afu, long cr_num, long *valp);
 int cxl_errinfo_size(struct cxl_afu_h *afu, size_t *valp);
 int cxl_errinfo_read(struct cxl_afu_h *afu, void *dst, off_t off, size_t len);
 
+/*
+ * PSL Simulation Engine only: Register a buffer the application will not
+ * modify until the AFU is detached.  PSLSE keeps a copy of the buffer and
+ * serves AFU reads that fall entirely inside it without asking the
+ * application.  The AFU must be attached.
+ */
+int cxl_sim_register_ro(struct cxl_afu_h *afu, void *ptr, size_t len);
+
+/*
+ * PSL Simulation Engine only: Read the number of PSL cycles PSLSE has
+ * clocked the AFU.  The count only advances while the AFU is clocked, so
+ * differences measure simulated time.  When not NULL mmio_cycle gets the
+ * cycle the last MMIO of this handle completed and irq_cycle the cycle the
+ * last interrupt for this handle was sent, 0 if there was none.
+ */
+int cxl_sim_get_cycles(struct cxl_afu_h *afu, uint64_t *cycles,
+		       uint64_t *mmio_cycle, uint64_t *irq_cycle);
+
 
 
 #endif
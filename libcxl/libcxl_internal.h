@@ -22,7 +22,11 @@
 #include <poll.h>
 #include <pthread.h>
 
-#define EVENT_QUEUE_MAX 3
+#include "../common/utils.h"
+
+// Ring holds one entry per IRQ source plus a DSI and an AFU error
+#define EVENT_RING_SIZE 2048
+#define EVENT_IRQ_MAX (EVENT_RING_SIZE - 2)
 
 enum libcxl_req_state {
 	LIBCXL_REQ_IDLE,
@@ -50,19 +54,67 @@ struct mmio_req {
 	volatile uint8_t type;
 	volatile uint32_t addr;
 	uint64_t data;
+	uint64_t *bulk;
+	uint16_t bulk_count;
+};
+
+struct ro_req {
+	volatile enum libcxl_req_state state;
+	volatile uint8_t status;
+	uint64_t addr;
+	uint64_t len;
+	uint64_t sent;
+};
+
+struct cycles_req {
+	volatile enum libcxl_req_state state;
+	uint64_t cycles;
+	uint64_t mmio;
+	uint64_t irq;
+};
+
+struct mux_handle {
+	uint16_t tag;
+	int fd;
+	int local_fd;
+	int remote_closed;
+	struct cxl_afu_h *afu;
+	struct mux_handle *_next;
+};
+
+struct event_entry {
+	uint16_t type;
+	uint16_t irq;
+	uint64_t value;
+};
+
+// Single producer (PSL event thread), single consumer (cxl_read_event)
+struct event_ring {
+	volatile uint32_t head;
+	volatile uint32_t tail;
+	volatile uint32_t irq_pending[(EVENT_IRQ_MAX + 31) / 32];
+	volatile uint32_t dsi_pending;
+	volatile uint32_t error_pending;
+	struct event_entry entry[EVENT_RING_SIZE];
+};
+
+struct afu_cr {
+	long cr_device;
+	long cr_vendor;
+	long cr_class;
 };
 
 struct cxl_afu_h {
 	pthread_t thread;
-	pthread_mutex_t event_lock;
-	struct cxl_event *events[EVENT_QUEUE_MAX];
+	struct event_ring events;
 	int adapter;
 	char *id;
 	uint16_t context;
-	uint16_t map;
-	uint16_t position;
+	uint8_t map[PSLSE_AFU_MAP_BYTES];
+	uint8_t position;
 	uint8_t dbg_id;
 	int fd;
+	int mux;
 	int opened;
 	int attached;
 	int mapped;
@@ -75,13 +127,14 @@ struct cxl_afu_h {
 	long mmio_off;
 	long prefault_mode;
         size_t eb_len;
-	long cr_device;
-	long cr_vendor;
-	long cr_class;
+	uint16_t num_crs;
+	struct afu_cr *crs;
 	struct int_req int_req;
 	struct open_req open;
 	struct attach_req attach;
 	struct mmio_req mmio;
+	struct ro_req ro;
+	struct cycles_req cycles;
 	struct cxl_afu_h *_head;
 	struct cxl_afu_h *_next;
 	struct cxl_afu_h *_next_adapter;
@@ -96,9 +149,8 @@ struct cxl_adapter_h {
 	long pslse_version;
 	int fd;
 	char *id;
-	uint16_t map;
-	uint16_t mask;
-	uint16_t position;
+	uint8_t map[PSLSE_AFU_MAP_BYTES];
+	uint8_t position;
 	struct cxl_adapter_h *_head;
 	struct cxl_adapter_h *_next;
 	struct cxl_afu_h *afu_list;
@@ -20,6 +20,8 @@
  * This file contains code for handling client disconnect.
  */
 
+#include <stdlib.h>
+
 #include "client.h"
 
 void client_drop(struct client *client, int cycles, enum client_state state)
@@ -29,3 +31,21 @@ void client_drop(struct client *client, int cycles, enum client_state state)
 	client->state = state;
 	client->mem_access = NULL;
 }
+
+// Release read only buffer copies registered by client
+void client_free_ro(struct client *client)
+{
+	struct ro_region *ro;
+
+	while (client->ro != NULL) {
+		ro = client->ro;
+		client->ro = ro->_next;
+		free(ro->data);
+		free(ro);
+	}
+	if (client->ro_load != NULL) {
+		free(client->ro_load->data);
+		free(client->ro_load);
+		client->ro_load = NULL;
+	}
+}
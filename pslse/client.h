@@ -19,6 +19,9 @@
 #include <pthread.h>
 #include <stdint.h>
 
+// Longest request from a client before it is associated to a PSL
+#define CLIENT_REQUEST_BYTES 8
+
 enum client_state {
 	CLIENT_NONE,
 	CLIENT_INIT,
@@ -31,28 +34,45 @@ enum flush_state {
 	FLUSH_FLUSHING
 };
 
+// Application buffer registered as read only for the rest of the job
+struct ro_region {
+	uint64_t addr;
+	uint64_t len;
+	uint8_t *data;
+	struct ro_region *_next;
+};
+
 struct client {
 	int pending;
 	int idle_cycles;
 	int fd;
 	int context;
 	int abort;
+	int detached;
 	int timeout;
 	enum flush_state flushing;
 	enum client_state state;
 	uint16_t max_irqs;
 	char type;
 	uint64_t wed;
+	uint64_t mmio_cycle;
+	uint64_t irq_cycle;
 	uint32_t mmio_offset;
 	uint32_t mmio_size;
 	void *mem_access;
 	void *mmio_access;
+	struct ro_region *ro;
+	struct ro_region *ro_load;
+	uint64_t ro_offset;
+	uint8_t request[CLIENT_REQUEST_BYTES];
+	int request_len;
 	char *ip;
-	pthread_t thread;
 	struct client *_prev;
 	struct client *_next;
 };
 
 void client_drop(struct client *client, int cycles, enum client_state state);
 
+void client_free_ro(struct client *client);
+
 #endif				/* _CLIENT_H_ */
@@ -33,6 +33,15 @@
  *  handle_response(), handle_buffer_write(), handle_buffer_data() and
  *  handle_touch().  The state field is used to track the progress of each
  *  event until is fully completed and removed from the list completely.
+ *
+ *  When the TIMING_MODEL parm is set the random choices are replaced by a
+ *  timing model.  Commands are serviced in order as they become ready, read
+ *  data and responses wait for the latency of the command class, cacheline
+ *  transfers are paced by the link bandwidth and each response returns its
+ *  credit a fixed delay after the command completed.
+ *
+ *  When several contexts have work waiting the SCHEDULER parm decides which
+ *  context each handle_*() function serves next, see sched.c.
  */
 
 #include <assert.h>
@@ -51,9 +60,10 @@
 // Initialize cmd structure for tracking AFU command activity
 struct cmd *cmd_init(struct AFU_EVENT *afu_event, struct parms *parms,
 		     struct mmio *mmio, volatile enum pslse_state *state,
-		     char *afu_name, FILE * dbg_fp, uint8_t dbg_id)
+		     uint64_t * cycles, uint32_t * parity_enabled,
+		     struct prng *prng, char *afu_name,
+		     FILE * dbg_fp, uint8_t dbg_id)
 {
-	int i, j;
 	struct cmd *cmd;
 
 	cmd = (struct cmd *)calloc(1, sizeof(struct cmd));
@@ -66,19 +76,10 @@ struct cmd *cmd_init(struct AFU_EVENT *afu_event, struct parms *parms,
 	cmd->mmio = mmio;
 	cmd->parms = parms;
 	cmd->psl_state = state;
+	cmd->cycles = cycles;
+	cmd->parity_enabled = parity_enabled;
+	cmd->prng = prng;
 	cmd->credits = parms->credits;
-	cmd->page_entries.page_filter = ~((uint64_t) PAGE_MASK);
-	cmd->page_entries.entry_filter = 0;
-	for (i = 0; i < LOG2_ENTRIES; i++) {
-		cmd->page_entries.entry_filter <<= 1;
-		cmd->page_entries.entry_filter += 1;
-	}
-	cmd->page_entries.entry_filter <<= PAGE_ADDR_BITS;
-	for (i = 0; i < PAGE_ENTRIES; i++) {
-		for (j = 0; j < PAGE_WAYS; j++) {
-			cmd->page_entries.valid[i][j] = 0;
-		}
-	}
 	cmd->afu_name = afu_name;
 	cmd->dbg_fp = dbg_fp;
 	cmd->dbg_id = dbg_id;
@@ -175,17 +176,145 @@ static struct client *_get_client(struct cmd *cmd, struct cmd_event *event)
 	return cmd->client[event->context];
 }
 
+// Timing model latency class of command type
+static enum latency_class _latency_class(enum cmd_type type)
+{
+	switch (type) {
+	case CMD_READ:
+	case CMD_READ_PE:
+		return LATENCY_READ;
+	case CMD_WRITE:
+		return LATENCY_WRITE;
+	case CMD_TOUCH:
+		return LATENCY_TOUCH;
+	case CMD_INTERRUPT:
+		return LATENCY_INTERRUPT;
+	default:
+		return LATENCY_OTHER;
+	}
+}
+
+// Set the cycle a new command may complete.  Without the timing model that
+// is right away.
+static void _set_ready(struct cmd *cmd, struct cmd_event *event)
+{
+	event->ready = *(cmd->cycles);
+	if (!cmd->parms->timing_model)
+		return;
+
+	event->ready += latency_cycles(cmd->parms, cmd->prng,
+				       _latency_class(event->type));
+	// Address translation not cached
+	if (((event->type == CMD_READ) || (event->type == CMD_WRITE) ||
+	     (event->type == CMD_TOUCH)) &&
+	    !erat_cached(cmd->erat, event->context, event->addr))
+		event->ready += cmd->parms->erat_penalty;
+}
+
+// Has command latency elapsed
+static int _ready(struct cmd *cmd, struct cmd_event *event)
+{
+	return (*(cmd->cycles) >= event->ready);
+}
+
+// Is link free for another cacheline transfer
+static int _link_free(struct cmd *cmd, uint64_t link)
+{
+	if (!cmd->parms->timing_model || !cmd->parms->link_bytes)
+		return 1;
+	return (*(cmd->cycles) >= link);
+}
+
+// Occupy link for the cycles one cacheline transfer takes
+static void _link_use(struct cmd *cmd, uint64_t * link)
+{
+	uint32_t bytes = cmd->parms->link_bytes;
+
+	if (!cmd->parms->timing_model || !bytes)
+		return;
+	*link = *(cmd->cycles) + (CACHELINE_BYTES + bytes - 1) / bytes;
+}
+
+// Stamp commands that just completed with the cycle their response may
+// return the credit.  That is credit_delay cycles after completion, which is
+// no earlier than the command latency allows.
+static void _credit_stamp(struct cmd *cmd)
+{
+	struct cmd_event *event;
+	uint64_t done;
+
+	if (!cmd->parms->timing_model)
+		return;
+
+	for (event = cmd->list; event != NULL; event = event->_next) {
+		if ((event->state != MEM_DONE) || event->credit)
+			continue;
+		done = *(cmd->cycles);
+		if (done < event->ready)
+			done = event->ready;
+		event->credit = done + cmd->parms->credit_delay;
+	}
+}
+
+// Can response to completed command return its credit yet
+static int _credit_ready(struct cmd *cmd, struct cmd_event *event)
+{
+	if (!cmd->parms->timing_model)
+		return 1;
+	return (*(cmd->cycles) >= event->credit);
+}
+
+// Can read make progress in handle_buffer_write()
+static int _read_progress(struct cmd *cmd, struct cmd_event *event)
+{
+	if (!cmd->parms->timing_model)
+		return 1;
+
+	// Data waits for read latency and the link, requests to client are
+	// not held so they overlap the latency
+	if (event->state == MEM_RECEIVED)
+		return (_ready(cmd, event) && _link_free(cmd, cmd->link_in));
+	return (event->state == MEM_IDLE);
+}
+
+// Count the events each context has in the list, contexts with a non-zero
+// count have pending work.  The counts are allocated by psl_init() before it
+// sets max_clients.
+static void _count_pending(struct cmd *cmd, uint32_t context, int delta)
+{
+	if (context >= (uint32_t) cmd->max_clients)
+		return;
+
+	cmd->pending[context] += delta;
+}
+
+// Does context have events in the list
+int cmd_pending(struct cmd *cmd, int32_t context)
+{
+	return ((cmd->pending != NULL) && (context >= 0) &&
+		(context < cmd->max_clients) && cmd->pending[context]);
+}
+
+// Forget pending counts after the list has been emptied
+void cmd_pending_clear(struct cmd *cmd)
+{
+	if (cmd->pending != NULL)
+		memset(cmd->pending, 0, cmd->max_clients * sizeof(uint32_t));
+}
+
 // Add new command to list
-static void _add_cmd(struct cmd *cmd, uint32_t context, uint32_t tag,
-		     uint32_t command, uint32_t abort, enum cmd_type type,
-		     uint64_t addr, uint32_t size, enum mem_state state,
-		     uint32_t resp, uint8_t unlock)
+static struct cmd_event *_add_cmd(struct cmd *cmd, uint32_t context,
+				   uint32_t tag, uint32_t command,
+				   uint32_t abort, enum cmd_type type,
+				   uint64_t addr, uint32_t size,
+				   enum mem_state state, uint32_t resp,
+				   uint8_t unlock)
 {
 	struct cmd_event **head;
 	struct cmd_event *event;
 
 	if (cmd == NULL)
-		return;
+		return NULL;
 
 	event = (struct cmd_event *)calloc(1, sizeof(struct cmd_event));
 	event->context = context;
@@ -208,13 +337,309 @@ static void _add_cmd(struct cmd *cmd, uint32_t context, uint32_t tag,
 		event->resp = PSL_RESPONSE_FAILED;
 		event->state = MEM_DONE;
 	}
+	_set_ready(cmd, event);
 
 	head = &(cmd->list);
-	while ((*head != NULL) && !allow_reorder(cmd->parms))
+	while ((*head != NULL) && !allow_reorder(cmd->parms, cmd->prng))
 		head = &((*head)->_next);
 	event->_next = *head;
 	*head = event;
+	_count_pending(cmd, context, 1);
 	debug_cmd_add(cmd->dbg_fp, cmd->dbg_id, tag, context, command);
+	return event;
+}
+
+// Get prefetch state for context, or NULL if prefetch is disabled
+static struct prefetch *_prefetch(struct cmd *cmd, int32_t context)
+{
+	struct prefetch *pf;
+
+	if ((cmd == NULL) || !cmd->parms->prefetch_lines || (context < 0) ||
+	    (context >= cmd->max_clients))
+		return NULL;
+
+	if (cmd->prefetch == NULL) {
+		cmd->prefetch = (struct prefetch *)calloc(cmd->max_clients,
+							  sizeof(struct
+								 prefetch));
+		if (cmd->prefetch == NULL) {
+			perror("calloc");
+			return NULL;
+		}
+	}
+	pf = &(cmd->prefetch[context]);
+	if (pf->data == NULL) {
+		pf->data = (uint8_t *) malloc((cmd->parms->prefetch_lines + 1) *
+					      CACHELINE_BYTES);
+		if (pf->data == NULL) {
+			perror("malloc");
+			return NULL;
+		}
+	}
+	return pf;
+}
+
+// Locked and reserved reads must always see memory, never a copy held by
+// pslse
+static int _copy_allowed(uint32_t command)
+{
+	return ((command != PSL_COMMAND_READ_CL_LCK) &&
+		(command != PSL_COMMAND_READ_CL_RES));
+}
+
+// Discard all buffered lines for context
+void cmd_prefetch_invalidate(struct cmd *cmd, int32_t context)
+{
+	if ((cmd == NULL) || (cmd->prefetch == NULL) || (context < 0) ||
+	    (context >= cmd->max_clients))
+		return;
+
+	cmd->prefetch[context].valid = 0;
+	cmd->prefetch[context].pending = 0;
+}
+
+// Discard buffered copy of a line written by context
+static void _prefetch_drop(struct cmd *cmd, int32_t context, uint64_t addr)
+{
+	struct prefetch *pf;
+	uint64_t line = addr & CACHELINE_MASK;
+
+	if ((cmd->prefetch == NULL) || (context < 0) ||
+	    (context >= cmd->max_clients))
+		return;
+
+	pf = &(cmd->prefetch[context]);
+	if ((line < pf->base) ||
+	    (line >= pf->base + (uint64_t) pf->lines * CACHELINE_BYTES))
+		return;
+	pf->valid &= ~(1U << ((line - pf->base) / CACHELINE_BYTES));
+}
+
+// Forget read only buffers the AFU writes to, the copy is no longer valid
+static void _ro_drop(struct cmd *cmd, int32_t context, uint64_t addr,
+		     uint32_t size)
+{
+	struct ro_region **head, *ro;
+
+	if ((context < 0) || (context >= cmd->max_clients) ||
+	    (cmd->client[context] == NULL))
+		return;
+
+	head = &(cmd->client[context]->ro);
+	while (*head != NULL) {
+		ro = *head;
+		if ((addr < ro->addr + ro->len) && (ro->addr < addr + size)) {
+			warn_msg("AFU wrote to read only buffer at 0x%016"
+				 PRIx64, addr);
+			*head = ro->_next;
+			free(ro->data);
+			free(ro);
+			continue;
+		}
+		head = &(ro->_next);
+	}
+}
+
+// Compare read with previous read by the same context and return stream
+// direction: 1 for ascending, -1 for descending, 0 for no stream
+static int8_t _prefetch_track(struct cmd *cmd, int32_t context,
+			      uint32_t command, uint64_t addr)
+{
+	struct prefetch *pf;
+	uint64_t line = addr & CACHELINE_MASK;
+	int8_t stream = 0;
+
+	if (!_copy_allowed(command) ||
+	    ((pf = _prefetch(cmd, context)) == NULL))
+		return 0;
+
+	if (line == pf->last + CACHELINE_BYTES)
+		stream = 1;
+	else if (line == pf->last - CACHELINE_BYTES)
+		stream = -1;
+	pf->last = line;
+	return stream;
+}
+
+// Get lock and reservation state for context
+static struct reservation *_reservation(struct cmd *cmd, int32_t context)
+{
+	int i;
+
+	if ((cmd == NULL) || (context < 0) || (context >= cmd->max_clients))
+		return NULL;
+
+	if (cmd->reservation == NULL) {
+		cmd->reservation =
+		    (struct reservation *)calloc(cmd->max_clients,
+						 sizeof(struct reservation));
+		if (cmd->reservation == NULL) {
+			perror("calloc");
+			return NULL;
+		}
+		for (i = 0; i < cmd->max_clients; i++)
+			cmd->reservation[i].context = i;
+	}
+	return &(cmd->reservation[context]);
+}
+
+// Hash bucket for lock and reservation of line
+static int _line_bucket(uint64_t line)
+{
+	return (int)((line / CACHELINE_BYTES) % LINE_HASH_BUCKETS);
+}
+
+// Does context hold a lock
+static int _lock_held(struct cmd *cmd, int32_t context)
+{
+	return ((cmd->reservation != NULL) && (context >= 0) &&
+		(context < cmd->max_clients) &&
+		cmd->reservation[context].locked);
+}
+
+// Does context hold a reservation
+static int _reserved(struct cmd *cmd, int32_t context)
+{
+	return ((cmd->reservation != NULL) && (context >= 0) &&
+		(context < cmd->max_clients) &&
+		cmd->reservation[context].reserved);
+}
+
+// Does context still hold its reservation of line
+static int _reserved_line(struct cmd *cmd, int32_t context, uint64_t line)
+{
+	return (_reserved(cmd, context) &&
+		(cmd->reservation[context].res_addr == line));
+}
+
+// Release lock held by context
+static void _unlock(struct cmd *cmd, int32_t context)
+{
+	struct reservation **head;
+	struct reservation *res;
+
+	if (!_lock_held(cmd, context))
+		return;
+
+	res = &(cmd->reservation[context]);
+	head = &(cmd->lock_hash[_line_bucket(res->lock_addr)]);
+	while ((*head != NULL) && (*head != res))
+		head = &((*head)->_lock_next);
+	if (*head != NULL)
+		*head = res->_lock_next;
+	res->_lock_next = NULL;
+	res->locked = 0;
+}
+
+// Release reservation held by context
+static void _unreserve(struct cmd *cmd, int32_t context)
+{
+	struct reservation **head;
+	struct reservation *res;
+
+	if (!_reserved(cmd, context))
+		return;
+
+	res = &(cmd->reservation[context]);
+	head = &(cmd->res_hash[_line_bucket(res->res_addr)]);
+	while ((*head != NULL) && (*head != res))
+		head = &((*head)->_res_next);
+	if (*head != NULL)
+		*head = res->_res_next;
+	res->_res_next = NULL;
+	res->reserved = 0;
+}
+
+// Is line locked by a context other than context
+static int _locked_by_other(struct cmd *cmd, int32_t context, uint64_t line)
+{
+	struct reservation *res;
+
+	for (res = cmd->lock_hash[_line_bucket(line)]; res != NULL;
+	     res = res->_lock_next) {
+		if ((res->context != context) && (res->lock_addr == line))
+			return 1;
+	}
+	return 0;
+}
+
+// Contexts other than context lose their reservation of line
+static void _drop_reservations(struct cmd *cmd, int32_t context,
+			       uint64_t line)
+{
+	struct reservation **head;
+	struct reservation *res;
+
+	head = &(cmd->res_hash[_line_bucket(line)]);
+	while (*head != NULL) {
+		res = *head;
+		if ((res->context == context) || (res->res_addr != line)) {
+			head = &(res->_res_next);
+			continue;
+		}
+		*head = res->_res_next;
+		res->_res_next = NULL;
+		res->reserved = 0;
+	}
+}
+
+// Context takes the lock of line.  Commands from other contexts to the line
+// that have not started yet get NLOCK, commands to other lines carry on.
+static void _lock(struct cmd *cmd, int32_t context, uint64_t line)
+{
+	struct reservation *res;
+	struct cmd_event *event;
+	int bucket;
+
+	if ((res = _reservation(cmd, context)) == NULL)
+		return;
+
+	_unlock(cmd, context);
+	bucket = _line_bucket(line);
+	res->locked = 1;
+	res->lock_addr = line;
+	res->_lock_next = cmd->lock_hash[bucket];
+	cmd->lock_hash[bucket] = res;
+	_drop_reservations(cmd, context, line);
+	for (event = cmd->list; event != NULL; event = event->_next) {
+		if ((event->state != MEM_IDLE) ||
+		    (event->context == context) ||
+		    (event->type == CMD_INTERRUPT) ||
+		    (event->type == CMD_OTHER) ||
+		    ((event->addr & CACHELINE_MASK) != line))
+			continue;
+		event->state = MEM_DONE;
+		event->resp = PSL_RESPONSE_NLOCK;
+		debug_cmd_update(cmd->dbg_fp, cmd->dbg_id, event->tag,
+				 event->context, event->resp);
+	}
+}
+
+// Context reserves line
+static void _reserve(struct cmd *cmd, int32_t context, uint64_t line)
+{
+	struct reservation *res;
+	int bucket;
+
+	if ((res = _reservation(cmd, context)) == NULL)
+		return;
+
+	_unreserve(cmd, context);
+	bucket = _line_bucket(line);
+	res->reserved = 1;
+	res->res_addr = line;
+	res->_res_next = cmd->res_hash[bucket];
+	cmd->res_hash[bucket] = res;
+}
+
+// Release lock and reservation held by context
+void cmd_release_locks(struct cmd *cmd, int32_t context)
+{
+	if (cmd == NULL)
+		return;
+
+	_unlock(cmd, context);
+	_unreserve(cmd, context);
 }
 
 // Format and add interrupt to command list
@@ -230,9 +655,8 @@ static void _add_interrupt(struct cmd *cmd, uint32_t handle, uint32_t tag,
 		type = CMD_OTHER;
 		goto int_done;
 	}
-	// Only track first interrupt until software reads event
-	if (!cmd->irq)
-		cmd->irq = irq;
+	// Software may update memory once it sees the interrupt
+	cmd_prefetch_invalidate(cmd, handle);
  int_done:
 	_add_cmd(cmd, handle, tag, command, abort, type, (uint64_t) irq, 0,
 		 MEM_IDLE, resp, 0);
@@ -314,6 +738,8 @@ static void _add_read(struct cmd *cmd, uint32_t handle, uint32_t tag,
 		      uint32_t command, uint32_t abort, uint64_t addr,
 		      uint32_t size)
 {
+	struct cmd_event *event;
+
 	// Check command size and address
 	if (!_aligned(addr, size)) {
 		_add_other(cmd, handle, tag, command, abort,
@@ -322,8 +748,10 @@ static void _add_read(struct cmd *cmd, uint32_t handle, uint32_t tag,
 	}
 	// Reads will be added to the list and will next be processed
 	// in the function handle_buffer_write()
-	_add_cmd(cmd, handle, tag, command, abort, CMD_READ, addr, size,
-		 MEM_IDLE, PSL_RESPONSE_DONE, 0);
+	event = _add_cmd(cmd, handle, tag, command, abort, CMD_READ, addr,
+			 size, MEM_IDLE, PSL_RESPONSE_DONE, 0);
+	if (event != NULL)
+		event->stream = _prefetch_track(cmd, handle, command, addr);
 }
 
 // Format and add memory write to command list
@@ -337,6 +765,9 @@ static void _add_write(struct cmd *cmd, uint32_t handle, uint32_t tag,
 			   PSL_RESPONSE_FAILED);
 		return;
 	}
+	// Any buffered copy of the line is stale once the write is issued
+	_prefetch_drop(cmd, handle, addr);
+	_ro_drop(cmd, handle, addr, size);
 	// Writes will be added to the list and will next be processed
 	// in the function handle_touch()
 	_add_cmd(cmd, handle, tag, command, abort, CMD_WRITE, addr, size,
@@ -349,6 +780,7 @@ static void _parse_cmd(struct cmd *cmd, uint32_t command, uint32_t tag,
 		       uint32_t handle, uint32_t latency)
 {
 	uint16_t irq = (uint16_t) (addr & IRQ_MASK);
+	uint64_t line = addr & CACHELINE_MASK;
 	uint8_t unlock = 0;
 	if (handle >= cmd->mmio->desc.num_of_processes) {
 		_add_other(cmd, handle, tag, command, abort,
@@ -366,27 +798,33 @@ static void _parse_cmd(struct cmd *cmd, uint32_t command, uint32_t tag,
 		break;
 		// Cacheline lock
 	case PSL_COMMAND_LOCK:
-		_update_pending_resps(cmd, PSL_RESPONSE_NLOCK);
-		cmd->locked = 1;
-		cmd->lock_addr = addr & CACHELINE_MASK;
+		if (_locked_by_other(cmd, handle, line)) {
+			_add_other(cmd, handle, tag, command, abort,
+				   PSL_RESPONSE_NLOCK);
+			break;
+		}
+		_lock(cmd, handle, line);
 		_add_touch(cmd, handle, tag, command, abort, addr, size, 0);
 		break;
 		// Memory Reads
 	case PSL_COMMAND_READ_CL_LCK:
-		_update_pending_resps(cmd, PSL_RESPONSE_NLOCK);
-		_update_pending_resps(cmd, PSL_RESPONSE_NLOCK);
-		cmd->locked = 1;
-		cmd->lock_addr = addr & CACHELINE_MASK;
 	case PSL_COMMAND_READ_CL_RES:	/*fall through */
-		if (!cmd->locked)
-			cmd->res_addr = addr & CACHELINE_MASK;
 	case PSL_COMMAND_READ_CL_NA:	/*fall through */
 	case PSL_COMMAND_READ_CL_S:	/*fall through */
 	case PSL_COMMAND_READ_CL_M:	/*fall through */
 	case PSL_COMMAND_READ_PNA:	/*fall through */
+		if (_locked_by_other(cmd, handle, line)) {
+			_add_other(cmd, handle, tag, command, abort,
+				   PSL_RESPONSE_NLOCK);
+			break;
+		}
+		if (command == PSL_COMMAND_READ_CL_LCK)
+			_lock(cmd, handle, line);
+		else if (command == PSL_COMMAND_READ_CL_RES)
+			_reserve(cmd, handle, line);
 		_add_read(cmd, handle, tag, command, abort, addr, size);
 		break;
-		// Cacheline unlock
+		// Cacheline unlock, lock is released with the response
 	case PSL_COMMAND_UNLOCK:
 		_add_unlock(cmd, handle, tag, command, abort);
 		break;
@@ -394,12 +832,27 @@ static void _parse_cmd(struct cmd *cmd, uint32_t command, uint32_t tag,
 	case PSL_COMMAND_WRITE_UNLOCK:
 		unlock = 1;
 	case PSL_COMMAND_WRITE_C:	/*fall through */
-		if (!unlock)
-			cmd->res_addr = 0L;
 	case PSL_COMMAND_WRITE_MI:	/*fall through */
 	case PSL_COMMAND_WRITE_MS:	/*fall through */
 	case PSL_COMMAND_WRITE_NA:	/*fall through */
 	case PSL_COMMAND_WRITE_INJ:	/*fall through */
+		if (_locked_by_other(cmd, handle, line)) {
+			_add_other(cmd, handle, tag, command, abort,
+				   PSL_RESPONSE_NLOCK);
+			break;
+		}
+		// Conditional write only goes ahead while the context still
+		// holds the reservation of the line and uses it up, any
+		// write ends reservations of the line by other contexts
+		if (command == PSL_COMMAND_WRITE_C) {
+			if (!_reserved_line(cmd, handle, line)) {
+				_add_other(cmd, handle, tag, command, abort,
+					   PSL_RESPONSE_NRES);
+				break;
+			}
+			_unreserve(cmd, handle);
+		}
+		_drop_reservations(cmd, handle, line);
 		if (!(latency % 2) || (latency > 3))
 			error_msg("Write with invalid br_lat=%d", latency);
 		_add_write(cmd, handle, tag, command, abort, addr, size,
@@ -407,14 +860,14 @@ static void _parse_cmd(struct cmd *cmd, uint32_t command, uint32_t tag,
 		break;
 		// Treat these as memory touch to test for valid addresses
 	case PSL_COMMAND_EVICT_I:
-		if (cmd->locked && cmd->res_addr) {
+		if (_lock_held(cmd, handle) && _reserved(cmd, handle)) {
 			_add_other(cmd, handle, tag, command, abort,
 				   PSL_RESPONSE_NRES);
 			break;
 		}
 	case PSL_COMMAND_PUSH_I:	/*fall through */
 	case PSL_COMMAND_PUSH_S:	/*fall through */
-		if (cmd->locked) {
+		if (_lock_held(cmd, handle)) {
 			_add_other(cmd, handle, tag, command, abort,
 				   PSL_RESPONSE_NLOCK);
 			break;
@@ -423,6 +876,11 @@ static void _parse_cmd(struct cmd *cmd, uint32_t command, uint32_t tag,
 	case PSL_COMMAND_TOUCH_S:	/*fall through */
 	case PSL_COMMAND_TOUCH_M:	/*fall through */
 	case PSL_COMMAND_FLUSH:	/*fall through */
+		if (_locked_by_other(cmd, handle, line)) {
+			_add_other(cmd, handle, tag, command, abort,
+				   PSL_RESPONSE_NLOCK);
+			break;
+		}
 		_add_touch(cmd, handle, tag, command, abort, addr, size,
 			   unlock);
 		break;
@@ -541,6 +999,215 @@ void handle_cmd(struct cmd *cmd, uint32_t parity_enabled, uint32_t latency)
 	_parse_cmd(cmd, command, tag, address, size, abort, handle, latency);
 }
 
+// Find the read only buffer the client registered that covers read
+static struct ro_region *_ro_region(struct client *client,
+				    struct cmd_event *event)
+{
+	struct ro_region *ro;
+
+	if ((event->type != CMD_READ) || !_copy_allowed(event->command))
+		return NULL;
+
+	for (ro = client->ro; ro != NULL; ro = ro->_next) {
+		if ((event->addr >= ro->addr) &&
+		    (event->addr + event->size <= ro->addr + ro->len))
+			break;
+	}
+	return ro;
+}
+
+// Find the prefetched line read can use, NULL if the line isn't buffered or
+// its page translation is no longer cached
+static struct prefetch *_prefetch_line(struct cmd *cmd,
+				       struct cmd_event *event,
+				       uint32_t * index)
+{
+	struct prefetch *pf;
+	uint64_t line = event->addr & CACHELINE_MASK;
+
+	if ((event->type != CMD_READ) || !_copy_allowed(event->command) ||
+	    ((pf = _prefetch(cmd, event->context)) == NULL))
+		return NULL;
+
+	if ((line < pf->base) ||
+	    (line >= pf->base + (uint64_t) pf->lines * CACHELINE_BYTES))
+		return NULL;
+	*index = (line - pf->base) / CACHELINE_BYTES;
+	if (!(pf->valid & (1U << *index)) ||
+	    !erat_cached(cmd->erat, event->context, line))
+		return NULL;
+	return pf;
+}
+
+// Satisfy read from a read only buffer the client registered.  Paged
+// responses are still generated the same way handle_mem_return() does.
+static int _ro_hit(struct cmd *cmd, struct client *client,
+		   struct cmd_event *event)
+{
+	struct ro_region *ro;
+	uint64_t offset = event->addr & ~CACHELINE_MASK;
+
+	if ((ro = _ro_region(client, event)) == NULL)
+		return 0;
+
+	if ((client->flushing == FLUSH_NONE) &&
+	    !erat_cached(cmd->erat, event->context, event->addr) &&
+	    allow_paged(cmd->parms, cmd->prng)) {
+		event->resp = PSL_RESPONSE_PAGED;
+		event->state = MEM_DONE;
+		client->flushing = FLUSH_PAGED;
+		debug_cmd_update(cmd->dbg_fp, cmd->dbg_id, event->tag,
+				 event->context, event->resp);
+		return 1;
+	}
+
+	erat_access(cmd->erat, event->context, event->addr);
+	memcpy((void *)&(event->data[offset]),
+	       (void *)&(ro->data[event->addr - ro->addr]), event->size);
+	if (*(cmd->parity_enabled))
+		generate_cl_parity(event->data, event->parity);
+	event->state = MEM_RECEIVED;
+	debug_msg("%s:READ ONLY HIT tag=0x%02x addr=0x%016"PRIx64,
+		  cmd->afu_name, event->tag, event->addr);
+	return 1;
+}
+
+// Satisfy read from context's prefetched lines if the line is buffered and
+// its page translation is still cached
+static int _prefetch_hit(struct cmd *cmd, struct cmd_event *event)
+{
+	struct prefetch *pf;
+	uint64_t offset = event->addr & ~CACHELINE_MASK;
+	uint32_t index;
+
+	if ((pf = _prefetch_line(cmd, event, &index)) == NULL)
+		return 0;
+
+	// Buffered lines are used once so re-reads always go to memory
+	pf->valid &= ~(1U << index);
+	erat_access(cmd->erat, event->context, event->addr);
+	memcpy((void *)&(event->data[offset]),
+	       (void *)&(pf->data[index * CACHELINE_BYTES + offset]),
+	       event->size);
+	if (*(cmd->parity_enabled))
+		generate_cl_parity(event->data, event->parity);
+	event->state = MEM_RECEIVED;
+	debug_msg("%s:PREFETCH HIT tag=0x%02x addr=0x%016"PRIx64,
+		  cmd->afu_name, event->tag, event->addr);
+	return 1;
+}
+
+// Decide how many lines to fetch for a read that missed the line buffer.
+// Streams are extended in their direction up to the page boundary.
+static uint8_t _prefetch_batch(struct cmd *cmd, struct cmd_event *event,
+			       uint64_t * base)
+{
+	struct prefetch *pf;
+	uint64_t line = event->addr & CACHELINE_MASK;
+	uint32_t page_line, lines;
+
+	*base = line;
+	if (!event->stream || ((pf = _prefetch(cmd, event->context)) == NULL))
+		return 1;
+
+	page_line = (line & PAGE_MASK) / CACHELINE_BYTES;
+	lines = cmd->parms->prefetch_lines + 1;
+	if (event->stream > 0) {
+		if (lines > (PAGE_MASK + 1) / CACHELINE_BYTES - page_line)
+			lines = (PAGE_MASK + 1) / CACHELINE_BYTES - page_line;
+	} else {
+		if (lines > page_line + 1)
+			lines = page_line + 1;
+		*base = line - (uint64_t) (lines - 1) * CACHELINE_BYTES;
+	}
+	if (lines < 2)
+		return 1;
+
+	// Old lines are replaced once the new batch returns
+	pf->valid = 0;
+	pf->pending = 1;
+	pf->base = *base;
+	pf->lines = lines;
+	return lines;
+}
+
+// Client of event can take a new memory request.  Events of a client that
+// has gone are offered as well so the handler can fail them.
+static int _client_free(struct cmd *cmd, struct cmd_event *event)
+{
+	struct client *client;
+
+	if ((cmd->client == NULL) || (event->context >= cmd->max_clients))
+		return 1;
+	client = cmd->client[event->context];
+	return ((client == NULL) || (client->mem_access == NULL));
+}
+
+// Read would be served from the read only buffer or the prefetched lines
+// rather than the client
+static int _copy_hit(struct cmd *cmd, struct cmd_event *event)
+{
+	struct client *client;
+	uint32_t index;
+
+	if ((cmd->client != NULL) && (event->context < cmd->max_clients) &&
+	    ((client = cmd->client[event->context]) != NULL) &&
+	    (_ro_region(client, event) != NULL))
+		return 1;
+	return (_prefetch_line(cmd, event, &index) != NULL);
+}
+
+// Memory event a handler can move now.  Reads waiting on their client and
+// requests for a client with a memory access outstanding are not, unless
+// the read is served from a copy.
+static int _issuable(struct cmd *cmd, struct cmd_event *event)
+{
+	if ((event->type == CMD_READ) || (event->type == CMD_READ_PE)) {
+		if (event->state == MEM_RECEIVED)
+			return 1;
+		if (event->state != MEM_IDLE)
+			return 0;
+		return (_client_free(cmd, event) || _copy_hit(cmd, event));
+	}
+	if ((event->state == MEM_IDLE) || (event->state == MEM_RECEIVED))
+		return _client_free(cmd, event);
+	return 1;
+}
+
+// Pick the context to serve next among those with an event that candidate
+// accepts, -1 if any context may be served.  Memory events are only offered
+// if they can be issued so the pick doesn't land on a context that can't
+// move.  FIFO takes the list in order and skips all of this.
+static int32_t _sched_context(struct cmd *cmd, enum sched_class class,
+			      int (*candidate) (struct cmd *,
+						struct cmd_event *))
+{
+	struct cmd_event *event;
+
+	if ((cmd->sched == NULL) || (cmd->sched->policy == SCHED_FIFO))
+		return -1;
+	sched_clear(cmd->sched);
+	for (event = cmd->list; event != NULL; event = event->_next) {
+		if (candidate(cmd, event) &&
+		    ((class != SCHED_MEMORY) || _issuable(cmd, event)))
+			sched_ready(cmd->sched, event->context);
+	}
+	return sched_pick(cmd->sched, class);
+}
+
+// Determine if event belongs to the scheduled context
+static int _scheduled(struct cmd_event *event, int32_t context)
+{
+	return ((context < 0) || (event->context == (uint32_t) context));
+}
+
+// Read that can make progress
+static int _read_candidate(struct cmd *cmd, struct cmd_event *event)
+{
+	return (((event->type == CMD_READ) || (event->type == CMD_READ_PE)) &&
+		(event->state != MEM_DONE) && _read_progress(cmd, event));
+}
+
 // Handle randomly selected pending read by either generating early buffer
 // write with bogus data, send request to client for real data or do final
 // buffer write with valid data after it has been received from client.
@@ -548,21 +1215,24 @@ void handle_buffer_write(struct cmd *cmd)
 {
 	struct cmd_event *event;
 	struct client *client;
-	uint8_t buffer[10];
+	uint8_t buffer[11];
 	uint64_t *addr;
-	int quadrant, byte;
+	uint64_t base;
+	int32_t context;
+	int quadrant, byte, size;
 
 	// Make sure cmd structure is valid
 	if (cmd == NULL)
 		return;
 
-	// Randomly select a pending read or read_pe (or none)
+	// Randomly select a pending read or read_pe of the scheduled
+	// context (or none)
+	context = _sched_context(cmd, SCHED_MEMORY, _read_candidate);
 	event = cmd->list;
 	while (event != NULL) {
-	        if (((event->type == CMD_READ) || (event->type == CMD_READ_PE) )&&
-		    (event->state != MEM_DONE) &&
+		if (_read_candidate(cmd, event) && _scheduled(event, context) &&
 		    ((event->client_state != CLIENT_VALID) ||
-		     !allow_reorder(cmd->parms))) {
+		     !allow_reorder(cmd->parms, cmd->prng))) {
 			break;
 		}
 		event = event->_next;
@@ -582,6 +1252,7 @@ void handle_buffer_write(struct cmd *cmd)
 				     event->parity) == PSL_SUCCESS) {
 			debug_msg("%s:BUFFER WRITE tag=0x%02x", cmd->afu_name,
 				  event->tag);
+			_link_use(cmd, &(cmd->link_in));
 			for (quadrant = 0; quadrant < 4; quadrant++) {
 				DPRINTF("DEBUG: Q%d 0x", quadrant);
 				for (byte = 0; byte < CACHELINE_BYTES / 4;
@@ -602,13 +1273,17 @@ void handle_buffer_write(struct cmd *cmd)
 	if (event->state != MEM_IDLE)
 		return;
 
-	if (!event->buffer_activity && allow_buffer(cmd->parms)) {
+	if (!event->buffer_activity && allow_buffer(cmd->parms, cmd->prng)) {
 		// Buffer write with bogus data, but only once
 	        // should I skip this in the case of read_pe?
 		debug_cmd_buffer_write(cmd->dbg_fp, cmd->dbg_id, event->tag);
 		psl_buffer_write(cmd->afu_event, event->tag, event->addr,
 				 CACHELINE_BYTES, event->data, event->parity);
 		event->buffer_activity = 1;
+	} else if (_ro_hit(cmd, client, event) || _prefetch_hit(cmd, event)) {
+		// Data copied from pslse copy, buffer write on next call
+		sched_served(cmd->sched, SCHED_MEMORY, event->context);
+		return;
 	} else if (client->mem_access == NULL) {
 	        // if read:
 		// Send read request to client, set client->mem_access
@@ -619,14 +1294,29 @@ void handle_buffer_write(struct cmd *cmd)
 		// build data and parity to represent pe
 	        // set event->state to mem_received
                 if (event->type == CMD_READ) {
-		  buffer[0] = (uint8_t) PSLSE_MEMORY_READ;
-		  buffer[1] = (uint8_t) event->size;
-		  addr = (uint64_t *) & (buffer[2]);
-		  *addr = htonll(event->addr);
 		  event->abort = &(client->abort);
-		  debug_msg("%s:MEMORY READ tag=0x%02x size=%d addr=0x%016"PRIx64,
-			    cmd->afu_name, event->tag, event->size, event->addr);
-		  if (put_bytes(client->fd, 10, buffer, cmd->dbg_fp,
+		  event->lines = _prefetch_batch(cmd, event, &base);
+		  if (event->lines > 1) {
+		    // Fetch whole stream batch, demand line is at index
+		    buffer[0] = (uint8_t) PSLSE_MEMORY_READ_LINES;
+		    buffer[1] = event->lines;
+		    buffer[2] = (uint8_t) (((event->addr & CACHELINE_MASK) -
+					    base) / CACHELINE_BYTES);
+		    addr = (uint64_t *) & (buffer[3]);
+		    *addr = htonll(base);
+		    size = 11;
+		    debug_msg("%s:MEMORY READ tag=0x%02x lines=%d addr=0x%016"PRIx64,
+			      cmd->afu_name, event->tag, event->lines, base);
+		  } else {
+		    buffer[0] = (uint8_t) PSLSE_MEMORY_READ;
+		    buffer[1] = (uint8_t) event->size;
+		    addr = (uint64_t *) & (buffer[2]);
+		    *addr = htonll(event->addr);
+		    size = 10;
+		    debug_msg("%s:MEMORY READ tag=0x%02x size=%d addr=0x%016"PRIx64,
+			      cmd->afu_name, event->tag, event->size, event->addr);
+		  }
+		  if (put_bytes(client->fd, size, buffer, cmd->dbg_fp,
 				cmd->dbg_id, event->context) < 0) {
 		    client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
 		  }
@@ -647,6 +1337,7 @@ void handle_buffer_write(struct cmd *cmd)
 		  debug_msg("%s:PROCESS ELEMENT READ tag=0x%02x handle=%d",
 			    cmd->afu_name, event->tag, event->context);
 		}
+		sched_served(cmd->sched, SCHED_MEMORY, event->context);
 	}
 }
 
@@ -656,7 +1347,8 @@ void handle_buffer_read(struct cmd *cmd)
 	struct cmd_event *event;
 
 	// Check that cmd struct is valid buffer read is available
-	if ((cmd == NULL) || (cmd->buffer_read != NULL))
+	if ((cmd == NULL) || (cmd->buffer_read != NULL) ||
+	    !_link_free(cmd, cmd->link_out))
 		return;
 
 	// Randomly select a pending write (or none)
@@ -665,7 +1357,7 @@ void handle_buffer_read(struct cmd *cmd)
 		if ((event->type == CMD_WRITE) &&
 		    (event->state == MEM_TOUCHED) &&
 		    ((event->client_state != CLIENT_VALID) ||
-		     !allow_reorder(cmd->parms))) {
+		     !allow_reorder(cmd->parms, cmd->prng))) {
 			break;
 		}
 		event = event->_next;
@@ -683,11 +1375,19 @@ void handle_buffer_read(struct cmd *cmd)
 	if (psl_buffer_read(cmd->afu_event, event->tag, event->addr,
 			    CACHELINE_BYTES) == PSL_SUCCESS) {
 		cmd->buffer_read = event;
+		_link_use(cmd, &(cmd->link_out));
 		debug_cmd_buffer_read(cmd->dbg_fp, cmd->dbg_id, event->tag);
 		event->state = MEM_BUFFER;
 	}
 }
 
+// Touch or write waiting to touch memory
+static int _touch_candidate(struct cmd *cmd, struct cmd_event *event)
+{
+	return (((event->type == CMD_TOUCH) || (event->type == CMD_WRITE)) &&
+		(event->state == MEM_IDLE));
+}
+
 // Handle randomly selected memory touch
 void handle_touch(struct cmd *cmd)
 {
@@ -695,18 +1395,19 @@ void handle_touch(struct cmd *cmd)
 	struct client *client;
 	uint8_t buffer[10];
 	uint64_t *addr;
+	int32_t context;
 
 	// Make sure cmd structure is valid
 	if (cmd == NULL)
 		return;
 
-	// Randomly select a pending touch (or none)
+	// Randomly select a pending touch of the scheduled context (or none)
+	context = _sched_context(cmd, SCHED_MEMORY, _touch_candidate);
 	event = cmd->list;
 	while (event != NULL) {
-		if (((event->type == CMD_TOUCH) || (event->type == CMD_WRITE))
-		    && (event->state == MEM_IDLE)
+		if (_touch_candidate(cmd, event) && _scheduled(event, context)
 		    && ((event->client_state != CLIENT_VALID)
-			|| !allow_reorder(cmd->parms))) {
+			|| !allow_reorder(cmd->parms, cmd->prng))) {
 			break;
 		}
 		event = event->_next;
@@ -734,27 +1435,38 @@ void handle_touch(struct cmd *cmd)
 	}
 	event->state = MEM_TOUCH;
 	client->mem_access = (void *)event;
+	sched_served(cmd->sched, SCHED_MEMORY, event->context);
 	debug_cmd_client(cmd->dbg_fp, cmd->dbg_id, event->tag, event->context);
 }
 
-// Send pending interrupt to client as soon as possible
-void handle_interrupt(struct cmd *cmd)
+// Interrupt ready to be sent
+static int _interrupt_candidate(struct cmd *cmd, struct cmd_event *event)
+{
+	return ((event->type == CMD_INTERRUPT) && (event->state == MEM_IDLE) &&
+		_ready(cmd, event));
+}
+
+// Send pending interrupt to client as soon as possible, returns the client
+// the interrupt was sent to
+struct client *handle_interrupt(struct cmd *cmd)
 {
 	struct cmd_event **head;
-	struct cmd_event *event;
+	struct cmd_event *event, *other;
 	struct client *client;
 	uint16_t irq;
 	uint8_t buffer[3];
+	int32_t context;
 
 	// Make sure cmd structure is valid
 	if (cmd == NULL)
-		return;
+		return NULL;
 
-	// Send any interrupts to client immediately
+	// Send any interrupts of the scheduled context to client immediately
+	context = _sched_context(cmd, SCHED_INTERRUPT, _interrupt_candidate);
 	head = &cmd->list;
 	while (*head != NULL) {
-		if (((*head)->type == CMD_INTERRUPT) &&
-		    ((*head)->state == MEM_IDLE))
+		if (_interrupt_candidate(cmd, *head) &&
+		    _scheduled(*head, context))
 			break;
 		head = &((*head)->_next);
 	}
@@ -762,20 +1474,34 @@ void handle_interrupt(struct cmd *cmd)
 
 	// Test for client disconnect
 	if ((event == NULL) || ((client = _get_client(cmd, event)) == NULL))
-		return;
+		return NULL;
 
-	// Send interrupt to client
+	// Send interrupt source of this command to its context
 	buffer[0] = PSLSE_INTERRUPT;
-	irq = htons(cmd->irq);
+	irq = htons((uint16_t) event->addr);
 	memcpy(&(buffer[1]), &irq, 2);
 	event->abort = &(client->abort);
-	debug_msg("%s:INTERRUPT irq=%d", cmd->afu_name, cmd->irq);
+	debug_msg("%s:INTERRUPT irq=%d", cmd->afu_name, (int)event->addr);
 	if (put_bytes(client->fd, 3, buffer, cmd->dbg_fp, cmd->dbg_id,
 		      event->context) < 0) {
 		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
 	}
 	debug_cmd_client(cmd->dbg_fp, cmd->dbg_id, event->tag, event->context);
 	event->state = MEM_DONE;
+	sched_served(cmd->sched, SCHED_INTERRUPT, event->context);
+
+	// Other waiting requests for the same source and context coalesce
+	// into the interrupt just sent
+	for (other = event->_next; other != NULL; other = other->_next) {
+		if ((other->type == CMD_INTERRUPT) &&
+		    (other->state == MEM_IDLE) &&
+		    (other->context == event->context) &&
+		    (other->addr == event->addr)) {
+			other->abort = &(client->abort);
+			other->state = MEM_DONE;
+		}
+	}
+	return client;
 }
 
 void handle_buffer_data(struct cmd *cmd, uint32_t parity_enable)
@@ -819,7 +1545,7 @@ void handle_buffer_data(struct cmd *cmd, uint32_t parity_enable)
 		cmd->buffer_read = NULL;
 
 		// Randomly decide to not send data to client yet
-		if (!event->buffer_activity && allow_buffer(cmd->parms)) {
+		if (!event->buffer_activity && allow_buffer(cmd->parms, cmd->prng)) {
 			event->state = MEM_TOUCHED;
 			event->buffer_activity = 1;
 			return;
@@ -830,24 +1556,140 @@ void handle_buffer_data(struct cmd *cmd, uint32_t parity_enable)
 
 }
 
+// Writes must not be combined across ordering commands from the same context
+static int _combine_barrier(struct cmd *cmd, int32_t context)
+{
+	struct cmd_event *event;
+
+	if (_lock_held(cmd, context))
+		return 1;
+
+	for (event = cmd->list; event != NULL; event = event->_next) {
+		if (event->context != context)
+			continue;
+		if ((event->type == CMD_INTERRUPT) ||
+		    (event->type == CMD_TOUCH) ||
+		    (event->command == PSL_COMMAND_UNLOCK) ||
+		    (event->command == PSL_COMMAND_RESTART))
+			return 1;
+	}
+	return 0;
+}
+
+// Hold a ready write while another write from the same context to the same
+// page is still on its way from the AFU and could be combined with it
+static int _combine_wait(struct cmd *cmd, struct cmd_event *event)
+{
+	struct cmd_event *next;
+	uint64_t page, max;
+
+	max = cmd->parms->write_combine_lines * CACHELINE_BYTES;
+	if (!max || event->unlock || _combine_barrier(cmd, event->context))
+		return 0;
+
+	page = event->addr & ~((uint64_t) PAGE_MASK);
+	for (next = cmd->list; next != NULL; next = next->_next) {
+		if ((next->type != CMD_WRITE) ||
+		    (next->context != event->context) || next->unlock ||
+		    ((next->addr & ~((uint64_t) PAGE_MASK)) != page))
+			continue;
+		// Only writes that have not received their data yet
+		if (next->state >= MEM_REQUEST)
+			continue;
+		if ((next->addr + max > event->addr) &&
+		    (event->addr + max > next->addr))
+			return 1;
+	}
+	return 0;
+}
+
+// Chain ready writes adjacent to event onto event->combined.  Returns the
+// lowest address covered and sets *size to the combined length.
+static uint64_t _combine_writes(struct cmd *cmd, struct cmd_event *event,
+				uint32_t * size)
+{
+	struct cmd_event *next, **tail;
+	uint64_t lo, hi, new_lo, new_hi, page;
+	uint32_t max;
+	int found;
+
+	lo = event->addr;
+	hi = event->addr + event->size;
+	*size = event->size;
+	event->combined = NULL;
+	max = cmd->parms->write_combine_lines * CACHELINE_BYTES;
+	if (!max || event->unlock || _combine_barrier(cmd, event->context))
+		return lo;
+
+	page = event->addr & ~((uint64_t) PAGE_MASK);
+	tail = &(event->combined);
+	do {
+		found = 0;
+		for (next = cmd->list; next != NULL; next = next->_next) {
+			if ((next == event) || (next->type != CMD_WRITE) ||
+			    (next->state != MEM_RECEIVED) ||
+			    (next->context != event->context) ||
+			    next->unlock || (hi - lo + next->size > max))
+				continue;
+			if (next->addr == hi) {
+				new_lo = lo;
+				new_hi = hi + next->size;
+			} else if (next->addr + next->size == lo) {
+				new_lo = next->addr;
+				new_hi = hi;
+			} else {
+				continue;
+			}
+			// Combined write may not cross a page
+			if (((new_lo & ~((uint64_t) PAGE_MASK)) != page) ||
+			    (((new_hi - 1) & ~((uint64_t) PAGE_MASK)) != page))
+				continue;
+			lo = new_lo;
+			hi = new_hi;
+			// Chained writes leave MEM_RECEIVED so the scan
+			// cannot pick them twice
+			next->state = MEM_REQUEST;
+			next->combined = NULL;
+			*tail = next;
+			tail = &(next->combined);
+			found = 1;
+		}
+	} while (found);
+
+	*size = hi - lo;
+	return lo;
+}
+
+// Write data ready to be sent to client
+static int _write_candidate(struct cmd *cmd, struct cmd_event *event)
+{
+	return ((event->type == CMD_WRITE) && (event->state == MEM_RECEIVED) &&
+		!_combine_wait(cmd, event));
+}
+
 void handle_mem_write(struct cmd *cmd)
 {
 	struct cmd_event **head;
-	struct cmd_event *event;
+	struct cmd_event *event, *next;
 	struct client *client;
 	uint64_t *addr;
 	uint8_t *buffer;
-	uint64_t offset;
+	uint64_t offset, base;
+	uint32_t size;
+	uint16_t *bulk;
+	int32_t context;
 
 	// Make sure cmd structure is valid
 	if (cmd == NULL)
 		return;
 
-	// Send any ready write data to client immediately
+	// Send any ready write data of the scheduled context to client
+	// immediately, unless it is waiting for neighbouring writes to
+	// combine with
+	context = _sched_context(cmd, SCHED_MEMORY, _write_candidate);
 	head = &cmd->list;
 	while (*head != NULL) {
-		if (((*head)->type == CMD_WRITE) &&
-		    ((*head)->state == MEM_RECEIVED))
+		if (_write_candidate(cmd, *head) && _scheduled(*head, context))
 			break;
 		head = &((*head)->_next);
 	}
@@ -867,33 +1709,71 @@ void handle_mem_write(struct cmd *cmd)
 	// successful before generating a response.  The client
 	// response will cause a call to either handle_aerror() or
 	// handle_mem_return().
-	buffer = (uint8_t *) malloc(event->size + 10);
-	offset = event->addr & ~CACHELINE_MASK;
-	buffer[0] = (uint8_t) PSLSE_MEMORY_WRITE;
-	buffer[1] = (uint8_t) event->size;
-	addr = (uint64_t *) & (buffer[2]);
-	*addr = htonll(event->addr);
-	memcpy(&(buffer[10]), &(event->data[offset]), event->size);
-	event->abort = &(client->abort);
-	debug_msg("%s:MEMORY WRITE tag=0x%02x size=%d addr=0x%016"PRIx64,
-		  cmd->afu_name, event->tag, event->size, event->addr);
-	if (put_bytes(client->fd, event->size + 10, buffer, cmd->dbg_fp,
+	base = _combine_writes(cmd, event, &size);
+	if (event->combined != NULL) {
+		// Combined writes go as one bulk write, each event
+		// copies its bytes into place
+		buffer = (uint8_t *) malloc(size + 11);
+		buffer[0] = (uint8_t) PSLSE_MEMORY_WRITE_BULK;
+		bulk = (uint16_t *) & (buffer[1]);
+		*bulk = htons((uint16_t) size);
+		addr = (uint64_t *) & (buffer[3]);
+		*addr = htonll(base);
+		for (next = event; next != NULL; next = next->combined) {
+			offset = next->addr & ~CACHELINE_MASK;
+			memcpy(&(buffer[11 + next->addr - base]),
+			       &(next->data[offset]), next->size);
+			next->abort = &(client->abort);
+			if (next != event)
+				debug_cmd_client(cmd->dbg_fp, cmd->dbg_id,
+						 next->tag, next->context);
+		}
+		debug_msg("%s:MEMORY WRITE tag=0x%02x size=%d addr=0x%016"PRIx64
+			  " combined", cmd->afu_name, event->tag, size, base);
+		size += 11;
+	} else {
+		buffer = (uint8_t *) malloc(event->size + 10);
+		offset = event->addr & ~CACHELINE_MASK;
+		buffer[0] = (uint8_t) PSLSE_MEMORY_WRITE;
+		buffer[1] = (uint8_t) event->size;
+		addr = (uint64_t *) & (buffer[2]);
+		*addr = htonll(event->addr);
+		memcpy(&(buffer[10]), &(event->data[offset]), event->size);
+		event->abort = &(client->abort);
+		debug_msg("%s:MEMORY WRITE tag=0x%02x size=%d addr=0x%016"PRIx64,
+			  cmd->afu_name, event->tag, event->size, event->addr);
+		size = event->size + 10;
+	}
+	if (put_bytes(client->fd, size, buffer, cmd->dbg_fp,
 		      cmd->dbg_id, client->context) < 0) {
 		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
 	}
+	free(buffer);
 	debug_cmd_client(cmd->dbg_fp, cmd->dbg_id, event->tag, event->context);
 	event->state = MEM_REQUEST;
 	client->mem_access = (void *)event;
+	sched_served(cmd->sched, SCHED_MEMORY, event->context);
 }
 
 // Handle data returning from client for memory read
 static void _handle_mem_read(struct cmd *cmd, struct cmd_event *event, int fd)
 {
+	struct prefetch *pf = NULL;
 	uint8_t data[MAX_LINE_CHARS];
+	uint8_t *line = data;
+	uint32_t index;
 	uint64_t offset = event->addr & ~CACHELINE_MASK;
+	uint32_t size = event->size;
+
+	// Batched reads return every line of the batch into the line buffer
+	if ((event->lines > 1) &&
+	    ((pf = _prefetch(cmd, event->context)) != NULL)) {
+		size = pf->lines * CACHELINE_BYTES;
+		line = pf->data;
+	}
 
 	// Client is returning data from memory read
-	if (get_bytes_silent(fd, event->size, data, cmd->parms->timeout,
+	if (get_bytes_silent(fd, size, line, cmd->parms->timeout,
 			     event->abort) < 0) {
 	        debug_msg("%s:_handle_mem_read failed tag=0x%02x size=%d addr=0x%016"PRIx64,
 			  cmd->afu_name, event->tag, event->size, event->addr);
@@ -903,87 +1783,29 @@ static void _handle_mem_read(struct cmd *cmd, struct cmd_event *event, int fd)
 				 event->context, event->resp);
 		return;
 	}
-	memcpy((void *)&(event->data[offset]), (void *)&data, event->size);
-	generate_cl_parity(event->data, event->parity);
-	event->state = MEM_RECEIVED;
-}
-
-// Calculate page address in cached index for translation
-static void _calc_index(struct cmd *cmd, uint64_t * addr, uint64_t * index)
-{
-	*addr &= cmd->page_entries.page_filter;
-	*index = *addr & cmd->page_entries.entry_filter;
-	*index >>= PAGE_ADDR_BITS;
-}
-
-// Update age of translation entries and create new entry if needed
-static void _update_age(struct cmd *cmd, uint64_t addr)
-{
-	uint64_t index;
-	int i, set, age, oldest, empty;
-
-	_calc_index(cmd, &addr, &index);
-	set = age = oldest = 0;
-	empty = PAGE_WAYS;
-	for (i = 0; i < PAGE_WAYS; i++) {
-		if (cmd->page_entries.valid[index][i] &&
-		    (cmd->page_entries.entry[index][i] != addr)) {
-			cmd->page_entries.age[index][i]++;
-			if (cmd->page_entries.age[index][i] > age) {
-				age = cmd->page_entries.age[index][i];
-				oldest = i;
-			}
-		}
-		if (!cmd->page_entries.valid[index][i] && (empty == PAGE_WAYS)) {
-			empty = i;
-		}
-		if (cmd->page_entries.valid[index][i] &&
-		    (cmd->page_entries.entry[index][i] == addr)) {
-			cmd->page_entries.age[index][i] = 0;
-			set = 1;
-		}
-	}
-
-	// Entry found and updated
-	if (set)
-		return;
-
-	// Empty slot exists
-	if (empty < PAGE_WAYS) {
-		cmd->page_entries.entry[index][empty] = addr;
-		cmd->page_entries.valid[index][empty] = 1;
-		cmd->page_entries.age[index][empty] = 0;
-		return;
-	}
-	// Evict oldest entry and replace with new entry
-	cmd->page_entries.entry[index][oldest] = addr;
-	cmd->page_entries.valid[index][oldest] = 1;
-	cmd->page_entries.age[index][oldest] = 0;
-}
-
-// Determine if page translation is already cached
-static int _page_cached(struct cmd *cmd, uint64_t addr)
-{
-	uint64_t index;
-	int i, hit;
-
-	_calc_index(cmd, &addr, &index);
-	i = hit = 0;
-	while ((i < PAGE_WAYS) && cmd->page_entries.valid[index][i] &&
-	       (cmd->page_entries.entry[index][i] != addr)) {
-		i++;
+	if (pf != NULL) {
+		index = ((event->addr & CACHELINE_MASK) - pf->base) /
+		    CACHELINE_BYTES;
+		line += index * CACHELINE_BYTES + offset;
+		if (!pf->pending)
+			pf->valid = 0;
+		else if (pf->lines < 8 * sizeof(pf->valid))
+			pf->valid = (1U << pf->lines) - 1;
+		else
+			pf->valid = ~0U;
+		pf->valid &= ~(1U << index);
+		pf->pending = 0;
 	}
-
-	// Hit entry
-	if ((i < PAGE_WAYS) && cmd->page_entries.valid[index][i])
-		hit = 1;
-
-	return hit;
+	memcpy((void *)&(event->data[offset]), (void *)line, event->size);
+	if (*(cmd->parity_enabled))
+		generate_cl_parity(event->data, event->parity);
+	event->state = MEM_RECEIVED;
 }
 
 // Decide what to do with a client memory acknowledgement
 void handle_mem_return(struct cmd *cmd, struct cmd_event *event, int fd)
 {
+	struct cmd_event *next;
 	struct client *client;
 
 	// Test for client disconnect
@@ -995,10 +1817,13 @@ void handle_mem_return(struct cmd *cmd, struct cmd_event *event, int fd)
 
 	// Randomly cause paged response
 	if (((event->type != CMD_WRITE) || (event->state != MEM_REQUEST)) &&
-	    (client->flushing == FLUSH_NONE) && !_page_cached(cmd, event->addr)
-	    && allow_paged(cmd->parms)) {
-		if (event->type == CMD_READ)
+	    (client->flushing == FLUSH_NONE) &&
+	    !erat_cached(cmd->erat, event->context, event->addr) &&
+	    allow_paged(cmd->parms, cmd->prng)) {
+		if (event->type == CMD_READ) {
 			_handle_mem_read(cmd, event, fd);
+			cmd_prefetch_invalidate(cmd, event->context);
+		}
 		event->resp = PSL_RESPONSE_PAGED;
 		event->state = MEM_DONE;
 		client->flushing = FLUSH_PAGED;
@@ -1007,7 +1832,7 @@ void handle_mem_return(struct cmd *cmd, struct cmd_event *event, int fd)
 		return;
 	}
 
-	_update_age(cmd, event->addr);
+	erat_access(cmd->erat, event->context, event->addr);
 
 	if (event->type == CMD_READ)
 		_handle_mem_read(cmd, event, fd);
@@ -1015,18 +1840,36 @@ void handle_mem_return(struct cmd *cmd, struct cmd_event *event, int fd)
 		event->state = MEM_DONE;
 	else if (event->state == MEM_TOUCH)	// Touch before write
 		event->state = MEM_TOUCHED;
-	else			// Write after touch
+	else {			// Write after touch
+		// Complete every write combined into this one
+		for (next = event->combined; next != NULL;
+		     next = next->combined) {
+			_prefetch_drop(cmd, next->context, next->addr);
+			next->state = MEM_DONE;
+			debug_cmd_return(cmd->dbg_fp, cmd->dbg_id, next->tag,
+					 next->context);
+		}
+		_prefetch_drop(cmd, event->context, event->addr);
 		event->state = MEM_DONE;
+	}
 	debug_cmd_return(cmd->dbg_fp, cmd->dbg_id, event->tag, event->context);
 }
 
 // Mark memory event as address error in preparation for response
 void handle_aerror(struct cmd *cmd, struct cmd_event *event)
 {
-	event->resp = PSL_RESPONSE_AERROR;
-	event->state = MEM_DONE;
-	debug_cmd_update(cmd->dbg_fp, cmd->dbg_id, event->tag,
-			 event->context, event->resp);
+	for (; event != NULL; event = event->combined) {
+		event->resp = PSL_RESPONSE_AERROR;
+		event->state = MEM_DONE;
+		debug_cmd_update(cmd->dbg_fp, cmd->dbg_id, event->tag,
+				 event->context, event->resp);
+	}
+}
+
+// Response that can be driven
+static int _response_candidate(struct cmd *cmd, struct cmd_event *event)
+{
+	return ((event->state == MEM_DONE) && _credit_ready(cmd, event));
 }
 
 // Send a randomly selected pending response back to AFU
@@ -1035,10 +1878,14 @@ void handle_response(struct cmd *cmd)
 	struct cmd_event **head;
 	struct cmd_event *event;
 	struct client *client;
+	int32_t context;
 	int rc;
 
-	// Select a random pending response (or none)
+	_credit_stamp(cmd);
+
+	// Select a random pending response of the scheduled context (or none)
 	client = NULL;
+	context = _sched_context(cmd, SCHED_RESPONSE, _response_candidate);
 	head = &cmd->list;
 	while (*head != NULL) {
 		// Fast track error responses
@@ -1050,7 +1897,8 @@ void handle_response(struct cmd *cmd)
 			event = *head;
 			goto drive_resp;
 		}
-		if (((*head)->state == MEM_DONE) && !allow_reorder(cmd->parms)) {
+		if (_response_candidate(cmd, *head) &&
+		    _scheduled(*head, context) && !allow_reorder(cmd->parms, cmd->prng)) {
 			break;
 		}
 		head = &((*head)->_next);
@@ -1059,7 +1907,7 @@ void handle_response(struct cmd *cmd)
 	// Randomly decide not to drive response yet
 	event = *head;
 	if ((event == NULL) || ((event->client_state == CLIENT_VALID)
-				&& !allow_resp(cmd->parms))) {
+				&& !allow_resp(cmd->parms, cmd->prng))) {
 		return;
 	}
 	// Test for client disconnect
@@ -1094,9 +1942,14 @@ void handle_response(struct cmd *cmd)
 		debug_msg("%s:RESPONSE tag=0x%02x code=0x%x", cmd->afu_name,
 			  event->tag, event->resp);
 		debug_cmd_response(cmd->dbg_fp, cmd->dbg_id, event->tag);
+		sched_served(cmd->sched, SCHED_RESPONSE, event->context);
 		if ((client != NULL) && (event->command == PSL_COMMAND_RESTART))
 			client->flushing = FLUSH_NONE;
+		if ((event->command == PSL_COMMAND_UNLOCK) ||
+		    (event->command == PSL_COMMAND_WRITE_UNLOCK))
+			_unlock(cmd, event->context);
 		*head = event->_next;
+		_count_pending(cmd, event->context, -1);
 		free(event->data);
 		free(event->parity);
 		free(event);
@@ -1109,6 +1962,10 @@ int client_cmd(struct cmd *cmd, struct client *client)
 	int rc = 0;
 	struct cmd_event *event = cmd->list;
 
+	// Only contexts with pending work need the list searched
+	if (!cmd_pending(cmd, client->context))
+		return 0;
+
 	while (event != NULL) {
 		if (event->context != client->context) {
 			// Event is not for this client
@@ -21,17 +21,15 @@
 #include <stdio.h>
 
 #include "client.h"
+#include "erat.h"
 #include "mmio.h"
 #include "parms.h"
+#include "sched.h"
 #include "../common/psl_interface.h"
 
-#define TOTAL_PAGES_CACHED 64
-#define PAGE_WAYS 4
-#define LOG2_WAYS 2		// log2(PAGE_WAYS) = log2(4) = 2
-#define PAGE_ENTRIES (TOTAL_PAGES_CACHED / PAGE_WAYS)
-#define LOG2_ENTRIES 4		// log2(PAGE_ENTRIES) = log2(64/4) = log2(16) = 4
 #define PAGE_ADDR_BITS 12
 #define PAGE_MASK 0xFFF
+#define LINE_HASH_BUCKETS 64
 
 enum cmd_type {
 	CMD_READ,
@@ -52,12 +50,29 @@ enum mem_state {
 	MEM_DONE
 };
 
-struct pages {
-	uint64_t entry[PAGE_ENTRIES][PAGE_WAYS];
-	uint64_t entry_filter;
-	uint64_t page_filter;
-	int age[PAGE_ENTRIES][PAGE_WAYS];
-	uint8_t valid[PAGE_ENTRIES][PAGE_WAYS];
+// Per context sequential read prefetch state.  Data holds the most recent
+// batch fetched from the client, valid has one bit per line in the batch
+// that has not been used yet.  Pending is cleared if the lines are
+// invalidated while the batch is still outstanding.
+struct prefetch {
+	uint64_t last;
+	uint64_t base;
+	uint32_t valid;
+	uint8_t lines;
+	uint8_t pending;
+	uint8_t *data;
+};
+
+// Cacheline lock and reservation held by a context.  Held locks and
+// reservations are also chained in hash buckets by line.
+struct reservation {
+	uint64_t lock_addr;
+	uint64_t res_addr;
+	int32_t context;
+	uint8_t locked;
+	uint8_t reserved;
+	struct reservation *_lock_next;
+	struct reservation *_res_next;
 };
 
 struct cmd_event {
@@ -68,14 +83,19 @@ struct cmd_event {
 	uint32_t abt;
 	uint32_t size;
 	uint32_t resp;
+	uint64_t ready;
+	uint64_t credit;
 	uint8_t unlock;
 	uint8_t buffer_activity;
+	int8_t stream;
+	uint8_t lines;
 	uint8_t *data;
 	uint8_t *parity;
 	int *abort;
 	enum cmd_type type;
 	enum mem_state state;
 	enum client_state client_state;
+	struct cmd_event *combined;
 	struct cmd_event *_next;
 };
 
@@ -86,22 +106,31 @@ struct cmd {
 	struct mmio *mmio;
 	struct parms *parms;
 	struct client **client;
-	struct pages page_entries;
+	struct prefetch *prefetch;
+	struct reservation *reservation;
+	struct reservation *lock_hash[LINE_HASH_BUCKETS];
+	struct reservation *res_hash[LINE_HASH_BUCKETS];
+	struct erat *erat;
+	struct sched *sched;
+	uint32_t *pending;
 	volatile enum pslse_state *psl_state;
+	uint64_t *cycles;
+	uint32_t *parity_enabled;
+	struct prng *prng;
+	uint64_t link_in;
+	uint64_t link_out;
 	char *afu_name;
 	FILE *dbg_fp;
 	uint8_t dbg_id;
-	uint64_t lock_addr;
-	uint64_t res_addr;
 	uint32_t credits;
 	int max_clients;
-	uint16_t irq;
-	int locked;
 };
 
 struct cmd *cmd_init(struct AFU_EVENT *afu_event, struct parms *parms,
 		     struct mmio *mmio, volatile enum pslse_state *state,
-		     char *afu_name, FILE * dbg_fp, uint8_t dbg_id);
+		     uint64_t * cycles, uint32_t * parity_enabled,
+		     struct prng *prng, char *afu_name,
+		     FILE * dbg_fp, uint8_t dbg_id);
 
 void handle_cmd(struct cmd *cmd, uint32_t parity_enabled, uint32_t latency);
 
@@ -115,7 +144,7 @@ void handle_buffer_write(struct cmd *cmd);
 
 void handle_touch(struct cmd *cmd);
 
-void handle_interrupt(struct cmd *cmd);
+struct client *handle_interrupt(struct cmd *cmd);
 
 void handle_mem_return(struct cmd *cmd, struct cmd_event *event, int fd);
 
@@ -123,6 +152,14 @@ void handle_aerror(struct cmd *cmd, struct cmd_event *event);
 
 void handle_response(struct cmd *cmd);
 
+void cmd_prefetch_invalidate(struct cmd *cmd, int32_t context);
+
+void cmd_release_locks(struct cmd *cmd, int32_t context);
+
 int client_cmd(struct cmd *cmd, struct client *client);
 
+int cmd_pending(struct cmd *cmd, int32_t context);
+
+void cmd_pending_clear(struct cmd *cmd);
+
 #endif				/* _CMD_H_ */
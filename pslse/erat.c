@@ -0,0 +1,209 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Description: erat.c
+ *
+ *  This file contains the model of the PSL translation cache.  Entries are
+ *  tagged with the context and the page number of the translation and are
+ *  held in a set associative array whose size, associativity, replacement
+ *  policy and page size come from the ERAT_* parms.  erat_cached() only
+ *  looks for a translation, the cmd code uses it to decide on PAGED
+ *  responses and timing model miss penalties.  erat_access() is called
+ *  when a translation is used, it counts the hit or miss and fills the
+ *  translation on a miss.  Counts are kept per context and in total and
+ *  are reported when a context is released and when the AFU disconnects.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "erat.h"
+#include "../common/utils.h"
+
+// Initialize translation cache model for AFU with max_contexts contexts
+struct erat *erat_init(struct parms *parms, struct prng *prng,
+		       int max_contexts)
+{
+	struct erat *erat;
+
+	erat = (struct erat *)calloc(1, sizeof(struct erat));
+	if (erat == NULL)
+		return NULL;
+
+	erat->ways = parms->erat_ways;
+	erat->sets = parms->erat_entries / parms->erat_ways;
+	erat->page_shift = parms->erat_page_shift;
+	erat->policy = parms->erat_policy;
+	erat->prng = prng;
+	erat->max_contexts = max_contexts;
+	erat->entry = (struct erat_entry *)calloc(erat->sets * erat->ways,
+						  sizeof(struct erat_entry));
+	erat->stats = (struct erat_stats *)calloc(max_contexts,
+						  sizeof(struct erat_stats));
+	if ((erat->entry == NULL) || (erat->stats == NULL)) {
+		erat_free(erat);
+		return NULL;
+	}
+	return erat;
+}
+
+// Find the set that holds translations for page
+static struct erat_entry *_set(struct erat *erat, uint64_t page)
+{
+	return &(erat->entry[(page % erat->sets) * erat->ways]);
+}
+
+// Find the entry holding the translation or NULL
+static struct erat_entry *_lookup(struct erat *erat, int32_t context,
+				  uint64_t page)
+{
+	struct erat_entry *set;
+	uint32_t i;
+
+	set = _set(erat, page);
+	for (i = 0; i < erat->ways; i++) {
+		if (set[i].valid && (set[i].page == page) &&
+		    (set[i].context == context))
+			return &(set[i]);
+	}
+	return NULL;
+}
+
+// Pick the entry of the set to replace, an empty entry if there is one
+static struct erat_entry *_victim(struct erat *erat, struct erat_entry *set)
+{
+	struct erat_entry *victim;
+	uint32_t i;
+
+	for (i = 0; i < erat->ways; i++) {
+		if (!set[i].valid)
+			return &(set[i]);
+	}
+	if (erat->policy == ERAT_RANDOM)
+		return &(set[prng_below(erat->prng, erat->ways)]);
+
+	// LRU stamps entries when used, FIFO when filled
+	victim = set;
+	for (i = 1; i < erat->ways; i++) {
+		if (set[i].stamp < victim->stamp)
+			victim = &(set[i]);
+	}
+	return victim;
+}
+
+// Determine if translation of addr for context is cached
+int erat_cached(struct erat *erat, int32_t context, uint64_t addr)
+{
+	if (erat == NULL)
+		return 0;
+	return (_lookup(erat, context, addr >> erat->page_shift) != NULL);
+}
+
+// Use translation of addr for context, filling it on a miss.  Returns 1 on a
+// hit and 0 on a miss.
+int erat_access(struct erat *erat, int32_t context, uint64_t addr)
+{
+	struct erat_stats *stats;
+	struct erat_entry *entry;
+	uint64_t page;
+
+	if (erat == NULL)
+		return 0;
+
+	stats = NULL;
+	if ((context >= 0) && (context < erat->max_contexts))
+		stats = &(erat->stats[context]);
+	page = addr >> erat->page_shift;
+	++erat->stamp;
+
+	entry = _lookup(erat, context, page);
+	if (entry != NULL) {
+		if (erat->policy == ERAT_LRU)
+			entry->stamp = erat->stamp;
+		++erat->total.hits;
+		if (stats)
+			++stats->hits;
+		return 1;
+	}
+
+	++erat->total.misses;
+	if (stats)
+		++stats->misses;
+	entry = _victim(erat, _set(erat, page));
+	if (entry->valid) {
+		++erat->total.evictions;
+		if (stats)
+			++stats->evictions;
+	}
+	entry->page = page;
+	entry->context = context;
+	entry->stamp = erat->stamp;
+	entry->valid = 1;
+	return 0;
+}
+
+// Drop translations of context and start its counts over
+void erat_invalidate(struct erat *erat, int32_t context)
+{
+	uint32_t i;
+
+	if ((erat == NULL) || (context < 0) || (context >= erat->max_contexts))
+		return;
+
+	for (i = 0; i < erat->sets * erat->ways; i++) {
+		if (erat->entry[i].context == context)
+			erat->entry[i].valid = 0;
+	}
+	memset(&(erat->stats[context]), 0, sizeof(struct erat_stats));
+}
+
+// Report counts for context, or totals if context is negative
+void erat_report(struct erat *erat, char *name, int32_t context)
+{
+	struct erat_stats *stats;
+	uint64_t accesses;
+
+	if ((erat == NULL) || (context >= erat->max_contexts))
+		return;
+
+	stats = (context < 0) ? &(erat->total) : &(erat->stats[context]);
+	accesses = stats->hits + stats->misses;
+	if (!accesses)
+		return;
+
+	if (context < 0)
+		info_msg("%s ERAT: %"PRIu64" hits, %"PRIu64" misses, %"PRIu64
+			 " evictions, %"PRIu64"%% hit rate", name, stats->hits,
+			 stats->misses, stats->evictions,
+			 (100 * stats->hits) / accesses);
+	else
+		info_msg("%s ERAT context %d: %"PRIu64" hits, %"PRIu64
+			 " misses, %"PRIu64" evictions, %"PRIu64"%% hit rate",
+			 name, context, stats->hits, stats->misses,
+			 stats->evictions, (100 * stats->hits) / accesses);
+}
+
+// Free translation cache model
+void erat_free(struct erat *erat)
+{
+	if (erat == NULL)
+		return;
+	free(erat->entry);
+	free(erat->stats);
+	free(erat);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _ERAT_H_
+#define _ERAT_H_
+
+#include <stdint.h>
+
+#include "parms.h"
+
+enum erat_policy {
+	ERAT_LRU,
+	ERAT_FIFO,
+	ERAT_RANDOM
+};
+
+struct erat_entry {
+	uint64_t page;
+	uint64_t stamp;
+	int32_t context;
+	uint8_t valid;
+};
+
+struct erat_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+struct erat {
+	struct erat_entry *entry;
+	struct erat_stats *stats;
+	struct erat_stats total;
+	struct prng *prng;
+	uint64_t stamp;
+	uint32_t sets;
+	uint32_t ways;
+	uint32_t page_shift;
+	enum erat_policy policy;
+	int max_contexts;
+};
+
+struct erat *erat_init(struct parms *parms, struct prng *prng,
+		       int max_contexts);
+
+int erat_cached(struct erat *erat, int32_t context, uint64_t addr);
+
+int erat_access(struct erat *erat, int32_t context, uint64_t addr);
+
+void erat_invalidate(struct erat *erat, int32_t context);
+
+void erat_report(struct erat *erat, char *name, int32_t context);
+
+void erat_free(struct erat *erat);
+
+#endif				/* _ERAT_H_ */
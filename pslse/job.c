@@ -50,31 +50,18 @@ struct job *job_init(struct AFU_EVENT *afu_event,
 	return job;
 }
 
-// Create new pe to send to AFU
+// Create new pe to send to AFU.  The list keeps a tail pointer so pes are
+// appended without walking the list.
 struct job_event *add_pe(struct job *job, uint32_t code, uint64_t addr)
 {
-        struct job_event **tail;
-	struct job_event *this;
 	struct job_event *event;
 
-	// Find the end of the list
-	// tail = &(job->pe);
-	// while (*tail != NULL)
-	// 	tail = &((*tail)->_next);
-
-	if (job->pe == NULL) {
-	  debug_msg( "%s,%d:add_pe, first pe, code=0x%02x addr=0x%016"PRIx64, job->afu_name, job->dbg_id, code, addr );
-	  tail = &(job->pe);
-	} else {
-	  debug_msg( "%s,%d:add_pe, subsequent pe, code=0x%02x addr=0x%016"PRIx64, job->afu_name, job->dbg_id, code, addr );
-	  this = job->pe;
-	  while (this->_next != NULL) {
-	    debug_msg( "%s,%d:add_pe this=0x%016"PRIx64, job->afu_name, job->dbg_id, this );
-	    debug_msg( "%s,%d:add_pe _next=0x%016"PRIx64, job->afu_name, job->dbg_id, this->_next );
-	    this = this->_next;
-	  }
-	  tail = &(this->_next);
-	}
+	if (job->pe == NULL)
+		debug_msg("%s,%d:add_pe, first pe, code=0x%02x addr=0x%016"PRIx64,
+			  job->afu_name, job->dbg_id, code, addr);
+	else
+		debug_msg("%s,%d:add_pe, subsequent pe, code=0x%02x addr=0x%016"
+			  PRIx64, job->afu_name, job->dbg_id, code, addr);
 
 	// Create new pe job event and add to end of list
 	event = (struct job_event *)calloc(1, sizeof(struct job_event));
@@ -84,75 +71,75 @@ struct job_event *add_pe(struct job *job, uint32_t code, uint64_t addr)
 	event->addr = addr;
 	event->state = PSLSE_IDLE;
 	event->_next = NULL;
-	*tail = event;
+	if (job->pe == NULL)
+		job->pe = event;
+	else
+		job->pe_tail->_next = event;
+	job->pe_tail = event;
 
-	debug_msg( "%s,%d:add_pe: created pe:0x%016"PRIx64", stored pointer at=0x%016"PRIx64, 
-		   job->afu_name, job->dbg_id, event, tail );
-	
 	// DEBUG
-	//debug_job_add(job->dbg_fp, job->dbg_id, event->code);
 	debug_pe_add(job->dbg_fp, job->dbg_id, event->code, addr);
 
 	return event;
 }
 
+// Send the next pe to the AFU.  Only one pe is outstanding at a time, the
+// next one is sent on the cycle the AFU acks the pending one.
 void send_pe(struct job *job)
 {
 	struct job_event *event;
 
-	// this needs to block the send of the "next" pe until 
-	// the job is running
-	// and the previous pe is running
-
 	// Test for valid job
 	if ((job == NULL) || (job->job == NULL))
 		return;
 
-	// Client disconnected - free com event linked list
-	// fixme
-	/* if (job->com->state == PSLSE_DONE) { */
-	/* 	event = job->com; */
-	/* 	job->com = event->_next; */
-	/* 	free(event); */
-	/* 	return; */
-	/* } */
-
 	// Test for running job
-	// I think we need to make sure running is set upon receipt of the jrunning ack
-	if ( *(job->psl_state) != PSLSE_RUNNING )
+	if (*(job->psl_state) != PSLSE_RUNNING)
+		return;
+
+	// Wait for the pending pe to be acked
+	if (job->pe_pending != NULL) {
+		debug_msg("%s:LLCMD pending code=0x%02x ea=0x%016" PRIx64,
+			  job->afu_name, job->pe_pending->code,
+			  job->pe_pending->addr);
 		return;
+	}
 
-	// Test for valid pe
-	// do this in a loop, checking each pe in the list
+	// Pes are sent in order so the next one is at the head
 	event = job->pe;
-	while (event != NULL) {
-	   switch (event->state) {
-	   case PSLSE_PENDING:
-	      // is event pending?  leave - we have to wait for this one to finish
-	      debug_msg("%s:LLCMD pending code=0x%02x ea=0x%016" PRIx64, job->afu_name,
-		          event->code, event->addr);
-
-	      return;
-	   case PSLSE_IDLE:
-	      // is event idle? send it and return
-	      // is psl_job_control the right routine to use?
-	      if (psl_job_control(job->afu_event, event->code, event->addr) == PSL_SUCCESS) {
-	         event->state = PSLSE_PENDING;
-	         debug_msg("%s:LLCMD sent code=0x%02x ea=0x%016" PRIx64, job->afu_name,
-		          event->code, event->addr);
-
-	         // DEBUG
-	         //debug_job_send(job->dbg_fp, job->dbg_id, event->code);
-	         debug_pe_send(job->dbg_fp, job->dbg_id, event->code, event->addr);
-	      }
-	      return;
-	   default:
-	      // error?
-	      return;
-	      break;
-           }  
+	if ((event == NULL) || (event->state != PSLSE_IDLE))
+		return;
+	if (psl_job_control(job->afu_event, event->code, event->addr) ==
+	    PSL_SUCCESS) {
+		event->state = PSLSE_PENDING;
+		job->pe_pending = event;
+		debug_msg("%s:LLCMD sent code=0x%02x ea=0x%016" PRIx64,
+			  job->afu_name, event->code, event->addr);
+
+		// DEBUG
+		debug_pe_send(job->dbg_fp, job->dbg_id, event->code,
+			      event->addr);
 	}
-	return;
+}
+
+// Remove the pe the AFU acked from the list and return it, caller frees it
+struct job_event *cack_pe(struct job *job)
+{
+	struct job_event *event;
+
+	event = job->pe_pending;
+	if (event == NULL)
+		return NULL;
+
+	// The pending pe is always at the head
+	assert(event == job->pe);
+	job->pe = event->_next;
+	if (job->pe == NULL)
+		job->pe_tail = NULL;
+	job->pe_pending = NULL;
+	debug_msg("%s,%d:cack_pe, pe=0x%016"PRIx64, job->afu_name, job->dbg_id,
+		  event);
+	return event;
 }
 
 // Create new job to send to AFU
@@ -224,5 +211,17 @@ void send_job(struct job *job)
 	}
 }
 
+// Is a reset waiting to be sent or waiting for job_done from AFU?
+int job_reset_queued(struct job *job)
+{
+	struct job_event *event;
+
+	for (event = job->job; event != NULL; event = event->_next) {
+		if (event->code == PSL_JOB_RESET)
+			return 1;
+	}
+	return 0;
+}
+
 // handle_aux2 was renamed to _handle_aux2 and moved to psl.c because we needed the psl struct to 
 // send the detach ack back to the client
@@ -34,6 +34,8 @@ struct job {
 	struct AFU_EVENT *afu_event;
 	struct job_event *job;
 	struct job_event *pe;
+	struct job_event *pe_tail;
+	struct job_event *pe_pending;
 	volatile enum pslse_state *psl_state;
 	uint32_t read_latency;
 	char *afu_name;
@@ -49,8 +51,12 @@ struct job_event *add_pe(struct job *job, uint32_t code, uint64_t addr);
 
 void send_pe(struct job *job);
 
+struct job_event *cack_pe(struct job *job);
+
 struct job_event *add_job(struct job *job, uint32_t code, uint64_t addr);
 
 void send_job(struct job *job);
 
+int job_reset_queued(struct job *job);
+
 #endif				/* _JOB_H_ */
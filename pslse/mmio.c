@@ -101,7 +101,9 @@ static struct mmio_event *_add_event(struct mmio *mmio, struct client *client,
 	// event->addr = addr;
 	event->desc = desc;
 	event->data = data;
+	event->eb_rd = 0;
 	event->state = PSLSE_IDLE;
+	event->_bulk = NULL;
 	event->_next = NULL;
 
 	// debug the mmio and print the input address and the translated address
@@ -145,11 +147,18 @@ static void _wait_for_done(enum pslse_state *state, pthread_mutex_t * lock)
 		lock_delay(lock);
 }
 
-// Read the entire AFU descriptor and keep a copy
+// Read the entire AFU descriptor and keep a copy.  MMIO events are sent to
+// the AFU in list order so each batch of reads is queued at once and only the
+// last event of the batch is waited on.
 int read_descriptor(struct mmio *mmio, pthread_mutex_t * lock)
 {
 	struct mmio_event *event00, *event20, *event28, *event30, *event38,
 	    *event40, *event48;
+	struct mmio_event **cr_events;
+	struct config_record *cr;
+	uint64_t crstart, crlen;
+	uint16_t crnum;
+	int i;
 
 	// Queue mmio reads
 	event00 = _add_desc(mmio, 1, 1, 0x00 >> 2, 0L);
@@ -159,9 +168,9 @@ int read_descriptor(struct mmio *mmio, pthread_mutex_t * lock)
 	event38 = _add_desc(mmio, 1, 1, 0x38 >> 2, 0L);
 	event40 = _add_desc(mmio, 1, 1, 0x40 >> 2, 0L);
 	event48 = _add_desc(mmio, 1, 1, 0x48 >> 2, 0L);
+	_wait_for_done(&(event48->state), lock);
 
 	// Store data from reads
-	_wait_for_done(&(event00->state), lock);
 	mmio->desc.req_prog_model = (uint16_t) event00->data & 0xffffl;
 	mmio->desc.num_of_afu_CRs = (uint16_t) (event00->data >> 16) & 0xffffl;
 	mmio->desc.num_of_processes =
@@ -169,28 +178,16 @@ int read_descriptor(struct mmio *mmio, pthread_mutex_t * lock)
 	mmio->desc.num_ints_per_process =
 	    (uint16_t) (event00->data >> 48) & 0xffffl;
 	free(event00);
-
-	_wait_for_done(&(event20->state), lock);
 	mmio->desc.AFU_CR_len = event20->data;
 	free(event20);
-
-	_wait_for_done(&(event28->state), lock);
 	mmio->desc.AFU_CR_offset = event28->data;
 	free(event28);
-
-	_wait_for_done(&(event30->state), lock);
 	mmio->desc.PerProcessPSA = event30->data;
 	free(event30);
-
-	_wait_for_done(&(event38->state), lock);
 	mmio->desc.PerProcessPSA_offset = event38->data;
 	free(event38);
-
-	_wait_for_done(&(event40->state), lock);
 	mmio->desc.AFU_EB_len = event40->data;
 	free(event40);
-
-	_wait_for_done(&(event48->state), lock);
 	mmio->desc.AFU_EB_offset = event48->data;
 	free(event48);
 
@@ -209,45 +206,49 @@ int read_descriptor(struct mmio *mmio, pthread_mutex_t * lock)
 		return -1;
 	}
 
-        // NEW BLOCK add code to check for CRs and read them in if available
-        struct mmio_event *eventdevven, *eventclass;
-        uint32_t crstart;
-        uint16_t crnum = mmio->desc.num_of_afu_CRs;
-        if ( crnum > 0) {
-        crstart = mmio->desc.AFU_CR_offset;
-        // allocate 
-        struct config_record *cr_array = malloc(crnum * sizeof(struct config_record *));
-        //struct config_record *crptr = &cr_array;
-        mmio->desc.crptr = cr_array;
-	// Queue mmio reads
-	// Only do 32-bit mmio for config record data
-	//eventdevven = _add_desc(mmio, 1, 1,crstart >> 2, 0L);
-	eventdevven = _add_desc(mmio, 1, 0,crstart >> 2, 0L);
-	//eventclass = _add_desc(mmio, 1, 1, (crstart+8) >> 2, 0L);
-	eventclass = _add_desc(mmio, 1, 0, (crstart+8) >> 2, 0L);
-	
+	// Read device, vendor and class from every AFU configuration record.
+	// Always keep at least one record so AFUs without any report zeros.
+	crnum = mmio->desc.num_of_afu_CRs;
+	cr = (struct config_record *)calloc(crnum ? crnum : 1,
+					    sizeof(struct config_record));
+	if (cr == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	mmio->desc.crptr = cr;
+	if (crnum == 0)
+		return 0;
+	cr_events = (struct mmio_event **)malloc(2 * crnum *
+						  sizeof(struct mmio_event *));
+	if (cr_events == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	// Queue mmio reads for all records, only do 32-bit mmio for config
+	// record data
+	crlen = mmio->desc.AFU_CR_len & PSA_MASK;
+	for (i = 0; i < crnum; i++) {
+		crstart = mmio->desc.AFU_CR_offset + i * crlen;
+		cr_events[2 * i] = _add_desc(mmio, 1, 0, crstart >> 2, 0L);
+		cr_events[2 * i + 1] = _add_desc(mmio, 1, 0, (crstart + 8) >> 2,
+						 0L);
+	}
+	_wait_for_done(&(cr_events[2 * crnum - 1]->state), lock);
+
 	// Store data from reads
-	_wait_for_done(&(eventdevven->state), lock);
-	//debug_msg("XXXX: DATA: = %08x\n", eventdevven->data);
-	//cr_array->cr_vendor = (uint16_t) (eventdevven->data >> 48) & 0xffffl;
-	cr_array->cr_vendor = (uint16_t) (eventdevven->data >> 16);
-	//cr_array->cr_device = (uint16_t) (eventdevven->data >> 32) 0xffffl;
-	cr_array->cr_device = (uint16_t) (eventdevven->data );
-        debug_msg("%x:%x CR dev & vendor", cr_array->cr_device, cr_array->cr_vendor);
-        free(eventdevven);
-        	debug_msg("%x:%x CR dev & vendor swapped", ntohs(cr_array->cr_device),ntohs(cr_array->cr_vendor));
-        _wait_for_done(&(eventclass->state), lock);
-	cr_array->cr_class = (uint32_t) (eventclass->data >> 32) & 0xffffffffl;
-        free(eventclass);
-        }
-	else { /* always make a fake cr */
-	struct config_record *cr_array = malloc(sizeof(struct config_record *));
-	mmio->desc.crptr = cr_array;
-	cr_array->cr_vendor = 0;
-	cr_array->cr_device = 0;
-	cr_array->cr_class = 0;
+	for (i = 0; i < crnum; i++) {
+		cr[i].cr_vendor = (uint16_t) (cr_events[2 * i]->data >> 16);
+		cr[i].cr_device = (uint16_t) (cr_events[2 * i]->data);
+		cr[i].cr_class = (uint32_t) (cr_events[2 * i + 1]->data >> 32);
+		debug_msg("%s:CR%d %x:%x dev & vendor class=%x",
+			  mmio->afu_name, i, cr[i].cr_device, cr[i].cr_vendor,
+			  cr[i].cr_class);
+		free(cr_events[2 * i]);
+		free(cr_events[2 * i + 1]);
 	}
-        // end of NEW BLOCK`
+	free(cr_events);
+
 	return 0;
 }
 
@@ -484,6 +485,56 @@ static struct mmio_event *_handle_mmio_read_eb(struct mmio *mmio,
 	return NULL;
 }
 
+// Add mmio read events for a range of the error buffer to list.  All reads
+// are queued at once so they go to the AFU back to back, the events are
+// chained through _bulk and the first one is returned.
+static struct mmio_event *_handle_mmio_read_eb_bulk(struct mmio *mmio,
+						    struct client *client)
+{
+	struct mmio_event *event, *first, **bulk;
+	uint32_t offset;
+	uint16_t count;
+	int fd = client->fd;
+	int i;
+
+	if (get_bytes_silent(fd, 4, (uint8_t *) & offset, mmio->timeout,
+			     &(client->abort)) < 0) {
+		goto read_fail;
+	}
+	if (get_bytes_silent(fd, 2, (uint8_t *) & count, mmio->timeout,
+			     &(client->abort)) < 0) {
+		goto read_fail;
+	}
+	offset = ntohl(offset);
+	count = ntohs(count);
+	if ((count == 0) || (count > PSLSE_MAX_EB_READ_DWORDS)) {
+		warn_msg("Bad error buffer read of %d doublewords", count);
+		goto read_fail;
+	}
+	offset = offset + (uint32_t)mmio->desc.AFU_EB_offset;
+	debug_msg("%s:offset for eb read is %x, %d doublewords",
+		  mmio->afu_name, offset, count);
+	first = NULL;
+	bulk = &first;
+	for (i = 0; i < count; i++) {
+		event = _add_desc(mmio, 1, 1, (offset + 8 * i) >> 2, 0);
+		if (event == NULL) {
+			// Events already queued are still in the list
+			warn_msg("Failed to queue error buffer read");
+			goto read_fail;
+		}
+		*bulk = event;
+		bulk = &(event->_bulk);
+	}
+	return first;
+
+ read_fail:
+	// Socket connection is dead
+	debug_msg("%s:_handle_mmio_read_eb_bulk failed context=%d",
+		  mmio->afu_name, client->context);
+	client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+	return NULL;
+}
 
 // Handle MMIO request from client
 struct mmio_event *handle_mmio(struct mmio *mmio, struct client *client,
@@ -501,6 +552,8 @@ struct mmio_event *handle_mmio(struct mmio *mmio, struct client *client,
 		return NULL;
 	}
 
+	if (eb_rd == PSLSE_MMIO_EBREAD_BULK)
+		return _handle_mmio_read_eb_bulk(mmio, client);
 	if (eb_rd) 
 		return _handle_mmio_read_eb(mmio, client, dw);
 
@@ -510,6 +563,53 @@ struct mmio_event *handle_mmio(struct mmio *mmio, struct client *client,
 		return _handle_mmio_write(mmio, client, dw);
 }
 
+// Return data for a chain of error buffer reads once the last one is done
+static struct mmio_event *_handle_mmio_done_bulk(struct mmio *mmio,
+						 struct client *client,
+						 struct mmio_event *event)
+{
+	struct mmio_event *next;
+	uint64_t data64;
+	uint8_t *buffer;
+	int count, offset;
+
+	// Events are acked in list order so the last one finishes the chain
+	count = 1;
+	for (next = event->_bulk; next != NULL; next = next->_bulk) {
+		if (next->state != PSLSE_DONE)
+			return event;
+		++count;
+	}
+
+	// Return acknowledge with all read data
+	buffer = (uint8_t *) malloc(1 + count * sizeof(uint64_t));
+	if (buffer == NULL) {
+		perror("malloc");
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+	} else {
+		buffer[0] = PSLSE_MMIO_ACK;
+		offset = 1;
+		for (next = event; next != NULL; next = next->_bulk) {
+			data64 = htonll(next->data);
+			memcpy(&(buffer[offset]), &data64, sizeof(uint64_t));
+			offset += sizeof(uint64_t);
+		}
+		if (put_bytes(client->fd, offset, buffer, mmio->dbg_fp,
+			      mmio->dbg_id, client->context) < 0) {
+			client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		}
+		free(buffer);
+	}
+	debug_mmio_return(mmio->dbg_fp, mmio->dbg_id, client->context);
+	while (event != NULL) {
+		next = event->_bulk;
+		free(event);
+		event = next;
+	}
+
+	return NULL;
+}
+
 // Handle MMIO done
 struct mmio_event *handle_mmio_done(struct mmio *mmio, struct client *client)
 {
@@ -528,6 +628,9 @@ struct mmio_event *handle_mmio_done(struct mmio *mmio, struct client *client)
 	if (event->state != PSLSE_DONE)
 		return event;
 
+	if (event->_bulk != NULL)
+		return _handle_mmio_done_bulk(mmio, client, event);
+
 	if (event->rnw) {
 		// Return acknowledge with read data
 		if (event->dw) {
@@ -48,6 +48,7 @@ struct mmio_event {
 	uint64_t data;
 	uint32_t parity;
 	enum pslse_state state;
+	struct mmio_event *_bulk;
 	struct mmio_event *_next;
 };
 
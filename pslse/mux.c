@@ -0,0 +1,424 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Description: mux.c
+ *
+ *  This file contains the relay for client connections that carry several
+ *  AFU handles.  libcxl opens one connection per process and sends
+ *  PSLSE_MUX, after which every frame on the connection is a 2 byte handle
+ *  tag, a 2 byte length and the data.  A length of 0 closes the handle.  The
+ *  first frame for a new tag creates a socket pair for the handle.  One end
+ *  is passed to the main thread through notify_fd and is then treated
+ *  exactly like a newly accepted client connection, so the handshake, query,
+ *  open and all PSL traffic run unchanged.  A relay thread per connection
+ *  copies data between the connection and the handle socket pairs.  The
+ *  handle ends are non-blocking, data a client isn't reading yet is queued
+ *  on its handle and the connection is only left unread while a handle has
+ *  MUX_QUEUE_LIMIT bytes queued.  A tag is only forgotten once both sides
+ *  have closed it, so libcxl can reuse it.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "mux.h"
+#include "../common/utils.h"
+
+#define MUX_HEADER_BYTES 4
+#define MUX_MAX_FRAME 0xFFFF
+#define MUX_QUEUE_LIMIT (4 * MUX_MAX_FRAME)
+
+struct mux_handle {
+	uint16_t tag;
+	int fd;
+	int remote_closed;
+	uint8_t *queue;
+	int queue_head;
+	int queued;
+	int queue_size;
+	struct mux_handle *_next;
+};
+
+struct mux {
+	int fd;
+	int notify_fd;
+	char *ip;
+	struct mux_handle *handles;
+	uint8_t buffer[MUX_HEADER_BYTES + MUX_MAX_FRAME];
+};
+
+// Read exactly size bytes from connection
+static int _read_all(int fd, uint8_t * data, int size)
+{
+	int count, bytes;
+
+	bytes = 0;
+	while (bytes < size) {
+		count = recv(fd, &(data[bytes]), size - bytes, MSG_WAITALL);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return -1;
+		bytes += count;
+	}
+	return 0;
+}
+
+// Write exactly size bytes to connection
+static int _write_all(int fd, uint8_t * data, int size)
+{
+	int count, bytes;
+
+	bytes = 0;
+	while (bytes < size) {
+		count = send(fd, &(data[bytes]), size - bytes, MSG_NOSIGNAL);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count < 0)
+			return -1;
+		bytes += count;
+	}
+	return 0;
+}
+
+// Send frame for tag, data is already in place after the header
+static int _send_frame(struct mux *mux, uint16_t tag, uint16_t len)
+{
+	uint16_t value;
+
+	value = htons(tag);
+	memcpy(&(mux->buffer[0]), &value, sizeof(value));
+	value = htons(len);
+	memcpy(&(mux->buffer[2]), &value, sizeof(value));
+	return _write_all(mux->fd, mux->buffer, MUX_HEADER_BYTES + len);
+}
+
+static struct mux_handle *_find(struct mux *mux, uint16_t tag)
+{
+	struct mux_handle *handle;
+
+	for (handle = mux->handles; handle != NULL; handle = handle->_next) {
+		if (handle->tag == tag)
+			break;
+	}
+	return handle;
+}
+
+static void _remove(struct mux *mux, struct mux_handle *handle)
+{
+	struct mux_handle **ptr;
+
+	for (ptr = &(mux->handles); *ptr != NULL; ptr = &((*ptr)->_next)) {
+		if (*ptr == handle) {
+			*ptr = handle->_next;
+			break;
+		}
+	}
+	if (handle->fd >= 0)
+		close(handle->fd);
+	free(handle->queue);
+	free(handle);
+}
+
+// Append data the client end of a handle hasn't taken yet to its queue
+static int _queue(struct mux_handle *handle, uint8_t * data, int len)
+{
+	uint8_t *queue;
+	int size;
+
+	if (handle->queue_head) {
+		memmove(handle->queue, &(handle->queue[handle->queue_head]),
+			handle->queued);
+		handle->queue_head = 0;
+	}
+	size = handle->queued + len;
+	if (size > handle->queue_size) {
+		queue = (uint8_t *) realloc(handle->queue, size);
+		if (queue == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		handle->queue = queue;
+		handle->queue_size = size;
+	}
+	memcpy(&(handle->queue[handle->queued]), data, len);
+	handle->queued += len;
+	return 0;
+}
+
+// Pass as much queued data to the client end as it will take, then pass on
+// a remote close once nothing is left ahead of it
+static void _flush(struct mux_handle *handle)
+{
+	int count;
+
+	while (handle->queued > 0) {
+		count = send(handle->fd, &(handle->queue[handle->queue_head]),
+			     handle->queued, MSG_NOSIGNAL);
+		if ((count < 0) && (errno == EINTR))
+			continue;
+		if ((count < 0) && (errno == EAGAIN))
+			return;
+		if (count < 0) {
+			debug_msg("mux: dropped data for closed handle %d",
+				  handle->tag);
+			handle->queued = 0;
+			break;
+		}
+		handle->queue_head += count;
+		handle->queued -= count;
+	}
+	handle->queue_head = 0;
+	if (handle->remote_closed)
+		shutdown(handle->fd, SHUT_WR);
+}
+
+// Create socket pair for new tag and pass client end to main thread
+static struct mux_handle *_add(struct mux *mux, uint16_t tag)
+{
+	struct mux_handle *handle;
+	struct mux_client *client;
+	int pair[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+		perror("socketpair");
+		return NULL;
+	}
+	// A client that stops reading must not stall the other handles
+	fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+	handle = (struct mux_handle *)calloc(1, sizeof(struct mux_handle));
+	client = (struct mux_client *)calloc(1, sizeof(struct mux_client));
+	if ((handle == NULL) || (client == NULL)) {
+		perror("calloc");
+		goto add_fail;
+	}
+	client->fd = pair[1];
+	client->ip = (char *)malloc(strlen(mux->ip) + 8);
+	if (client->ip == NULL) {
+		perror("malloc");
+		goto add_fail;
+	}
+	sprintf(client->ip, "%s#%d", mux->ip, tag);
+	if (write(mux->notify_fd, &client, sizeof(client)) != sizeof(client)) {
+		perror("write");
+		free(client->ip);
+		goto add_fail;
+	}
+	handle->tag = tag;
+	handle->fd = pair[0];
+	handle->_next = mux->handles;
+	mux->handles = handle;
+	return handle;
+
+ add_fail:
+	free(client);
+	free(handle);
+	close(pair[0]);
+	close(pair[1]);
+	return NULL;
+}
+
+// Handle one frame from the connection
+static int _frame_in(struct mux *mux)
+{
+	struct mux_handle *handle;
+	uint16_t tag, len;
+	uint8_t *data;
+	int count;
+
+	data = &(mux->buffer[MUX_HEADER_BYTES]);
+	if (_read_all(mux->fd, mux->buffer, MUX_HEADER_BYTES) < 0)
+		return -1;
+	memcpy(&tag, &(mux->buffer[0]), sizeof(tag));
+	tag = ntohs(tag);
+	memcpy(&len, &(mux->buffer[2]), sizeof(len));
+	len = ntohs(len);
+	if (len && (_read_all(mux->fd, data, len) < 0))
+		return -1;
+
+	handle = _find(mux, tag);
+	if (len == 0) {
+		// Remote end closed, let client see end of file
+		if (handle == NULL)
+			return 0;
+		handle->remote_closed = 1;
+		if (handle->fd < 0)
+			_remove(mux, handle);
+		else if (handle->queued == 0)
+			shutdown(handle->fd, SHUT_WR);
+		return 0;
+	}
+	if (handle == NULL)
+		handle = _add(mux, tag);
+	if ((handle == NULL) || (handle->fd < 0) || handle->remote_closed)
+		return 0;
+
+	// Keep order behind anything already queued, else queue what the
+	// client end doesn't take now
+	count = 0;
+	if (handle->queued == 0) {
+		do {
+			count = send(handle->fd, data, len, MSG_NOSIGNAL);
+		} while ((count < 0) && (errno == EINTR));
+		if ((count < 0) && (errno != EAGAIN)) {
+			debug_msg("mux: dropped data for closed handle %d", tag);
+			return 0;
+		}
+		if (count < 0)
+			count = 0;
+	}
+	if (count < len)
+		return _queue(handle, &(data[count]), len - count);
+	return 0;
+}
+
+// Forward client data, or the close, of one handle to the connection
+static int _frame_out(struct mux *mux, struct mux_handle *handle)
+{
+	int count;
+
+	count = read(handle->fd, &(mux->buffer[MUX_HEADER_BYTES]),
+		     MUX_MAX_FRAME);
+	if ((count < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+		return 0;
+	if (count > 0)
+		return _send_frame(mux, handle->tag, (uint16_t) count);
+
+	// Client end closed, anything still queued for it is dropped
+	close(handle->fd);
+	handle->fd = -1;
+	handle->queued = 0;
+	count = _send_frame(mux, handle->tag, 0);
+	if (handle->remote_closed)
+		_remove(mux, handle);
+	return count;
+}
+
+// Relay thread for one multiplexed connection
+static void *_mux_loop(void *ptr)
+{
+	struct mux *mux = (struct mux *)ptr;
+	struct mux_handle *handle, *next;
+	struct pollfd *pfd;
+	int count, max, full, i;
+
+	pfd = NULL;
+	max = 0;
+	while (1) {
+		// One entry for the connection and one per open handle
+		count = 1;
+		for (handle = mux->handles; handle != NULL;
+		     handle = handle->_next)
+			++count;
+		if (count > max) {
+			max = count * 2;
+			free(pfd);
+			pfd = (struct pollfd *)malloc(max *
+						      sizeof(struct pollfd));
+			if (pfd == NULL) {
+				perror("malloc");
+				break;
+			}
+		}
+		// Leave the connection unread while a handle's queue is full
+		full = 0;
+		i = 1;
+		for (handle = mux->handles; handle != NULL;
+		     handle = handle->_next) {
+			if (handle->queued >= MUX_QUEUE_LIMIT)
+				full = 1;
+			pfd[i].fd = handle->fd;
+			pfd[i].events = POLLIN;
+			if (handle->queued)
+				pfd[i].events |= POLLOUT;
+			pfd[i].revents = 0;
+			++i;
+		}
+		pfd[0].fd = full ? -1 : mux->fd;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		if (poll(pfd, count, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		// Handles first, entries may be removed by incoming frames
+		i = 1;
+		for (handle = mux->handles; handle != NULL; handle = next) {
+			next = handle->_next;
+			if ((i < count) && (pfd[i].revents & POLLOUT))
+				_flush(handle);
+			if ((i < count) && (pfd[i].revents & ~POLLOUT) &&
+			    (handle->fd >= 0) && (_frame_out(mux, handle) < 0))
+				goto mux_done;
+			++i;
+		}
+		if (pfd[0].revents && (_frame_in(mux) < 0))
+			break;
+	}
+
+ mux_done:
+	info_msg("Multiplexed connection from %s closed", mux->ip);
+	while (mux->handles != NULL)
+		_remove(mux, mux->handles);
+	close_socket(&(mux->fd));
+	free(pfd);
+	free(mux->ip);
+	free(mux);
+	pthread_exit(NULL);
+}
+
+// Start relay thread for connection that sent PSLSE_MUX.  New handles are
+// passed as struct mux_client pointers written to notify_fd.
+int mux_start(int fd, char *ip, int notify_fd)
+{
+	struct mux *mux;
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	mux = (struct mux *)calloc(1, sizeof(struct mux));
+	if (mux == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	mux->fd = fd;
+	mux->notify_fd = notify_fd;
+	mux->ip = strdup(ip);
+	// The connection was serviced non-blocking by the main thread
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &attr, _mux_loop, mux)) {
+		perror("pthread_create");
+		pthread_attr_destroy(&attr);
+		free(mux->ip);
+		free(mux);
+		return -1;
+	}
+	pthread_attr_destroy(&attr);
+	return 0;
+}
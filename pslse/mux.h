@@ -0,0 +1,30 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _MUX_H_
+#define _MUX_H_
+
+#include <stdint.h>
+
+// Handle of a multiplexed connection handed to the main thread
+struct mux_client {
+	int fd;
+	char *ip;
+};
+
+int mux_start(int fd, char *ip, int notify_fd);
+
+#endif				/* _MUX_H_ */
@@ -18,40 +18,67 @@
 #include <string.h>
 #include <time.h>
 
+#include "erat.h"
 #include "parms.h"
+#include "sched.h"
 #include "../common/utils.h"
 #include "../common/debug.h"
 
 #define DEFAULT_CREDITS 64
+#define DEFAULT_LISTEN_BACKLOG 128
+#define MAX_LATENCY 0xFFFF
+#define DEFAULT_ERAT_ENTRIES 64
+#define DEFAULT_ERAT_WAYS 4
+#define MAX_ERAT_ENTRIES 4096
+#define MAX_CONTEXT_WEIGHT 0xFFFF
 
 // Randomly decide based on percent chance
-static inline int percent_chance(int chance)
+static inline int percent_chance(struct prng *prng, int chance)
 {
-	return ((rand() % 100) < chance);
+	return ((int)prng_below(prng, 100) < chance);
 }
 
 // Randomly decide to allow response to AFU
-int allow_resp(struct parms *parms)
+int allow_resp(struct parms *parms, struct prng *prng)
 {
-	return percent_chance(parms->resp_percent);
+	// Timing model decides when responses are driven
+	if (parms->timing_model)
+		return 1;
+	return percent_chance(prng, parms->resp_percent);
 }
 
 // Randomly decide to allow PAGED response
-int allow_paged(struct parms *parms)
+int allow_paged(struct parms *parms, struct prng *prng)
 {
-	return percent_chance(parms->paged_percent);
+	return percent_chance(prng, parms->paged_percent);
 }
 
 // Randomly decide to allow command to be handled out of order
-int allow_reorder(struct parms *parms)
+int allow_reorder(struct parms *parms, struct prng *prng)
 {
-	return percent_chance(parms->reorder_percent);
+	// Timing model handles commands in order as they become ready
+	if (parms->timing_model)
+		return 0;
+	return percent_chance(prng, parms->reorder_percent);
 }
 
 // Randomly decide to allow bogus buffer activity
-int allow_buffer(struct parms *parms)
+int allow_buffer(struct parms *parms, struct prng *prng)
 {
-	return percent_chance(parms->buffer_percent);
+	if (parms->timing_model)
+		return 0;
+	return percent_chance(prng, parms->buffer_percent);
+}
+
+// Timing model latency in cycles for a command of class
+unsigned int latency_cycles(struct parms *parms, struct prng *prng,
+			    enum latency_class class)
+{
+	struct latency *latency = &(parms->latency[class]);
+
+	if (latency->max <= latency->min)
+		return latency->min;
+	return latency->min + prng_below(prng, 1 + latency->max - latency->min);
 }
 
 // Decide a single random percentage value from a percentage range
@@ -75,6 +102,95 @@ static void percent_parm(char *value, int *parm)
 	}
 }
 
+// Parse latency as a single fixed value or a min,max range
+static int latency_parm(char *value, struct latency *latency)
+{
+	char *comma;
+	int min, max;
+
+	min = max = atoi(value);
+	comma = strchr(value, ',');
+	if (comma)
+		max = atoi(comma + 1);
+	if (max < min) {
+		min = max;
+		max = atoi(value);
+	}
+	if ((min < 0) || (max > MAX_LATENCY))
+		return -1;
+	latency->min = min;
+	latency->max = max;
+	return 0;
+}
+
+// Set latency parm for class and record it in the debug log
+static void set_latency(FILE * dbg_fp, char *parm, char *value,
+			struct parms *parms, enum latency_class class,
+			uint32_t dbg_parm)
+{
+	struct latency *latency = &(parms->latency[class]);
+
+	if (latency_parm(value, latency) < 0)
+		warn_msg("%s must be 0-%d", parm, MAX_LATENCY);
+	debug_parm(dbg_fp, dbg_parm, (latency->min << 16) | latency->max);
+}
+
+// Parse ERAT replacement policy name
+static int erat_policy_parm(char *value)
+{
+	if (!strcmp(value, "LRU"))
+		return ERAT_LRU;
+	if (!strcmp(value, "FIFO"))
+		return ERAT_FIFO;
+	if (!strcmp(value, "RANDOM"))
+		return ERAT_RANDOM;
+	return -1;
+}
+
+// Parse ERAT page size 4K, 64K or 16M into page address bits
+static int erat_page_parm(char *value)
+{
+	if (!strcmp(value, "4K"))
+		return 12;
+	if (!strcmp(value, "64K"))
+		return 16;
+	if (!strcmp(value, "16M"))
+		return 24;
+	return -1;
+}
+
+// Parse scheduler policy name
+static int sched_policy_parm(char *value)
+{
+	if (!strcmp(value, "FIFO"))
+		return SCHED_FIFO;
+	if (!strcmp(value, "ROUND_ROBIN"))
+		return SCHED_ROUND_ROBIN;
+	if (!strcmp(value, "WEIGHTED"))
+		return SCHED_WEIGHTED;
+	if (!strcmp(value, "PRIORITY"))
+		return SCHED_PRIORITY;
+	return -1;
+}
+
+// Parse context,weight pair and set weight of context
+static int context_weight_parm(char *value, struct parms *parms)
+{
+	char *comma;
+	int context, weight;
+
+	comma = strchr(value, ',');
+	if (comma == NULL)
+		return -1;
+	context = atoi(value);
+	weight = atoi(comma + 1);
+	if ((context < 0) || (context >= MAX_WEIGHTED_CONTEXTS) ||
+	    (weight < 0) || (weight > MAX_CONTEXT_WEIGHT))
+		return -1;
+	parms->context_weight[context] = weight;
+	return (context << 16) | weight;
+}
+
 // Open and parse parms file
 struct parms *parse_parms(char *filename, FILE * dbg_fp)
 {
@@ -82,7 +198,7 @@ struct parms *parse_parms(char *filename, FILE * dbg_fp)
 	char parm[MAX_LINE_CHARS];
 	char *value;
 	FILE *fp;
-	int data;
+	int data, i;
 
 	// Allocate memory for struct
 	parms = (struct parms *)malloc(sizeof(struct parms));
@@ -97,6 +213,23 @@ struct parms *parse_parms(char *filename, FILE * dbg_fp)
 	parms->paged_percent = 5;
 	parms->reorder_percent = 20;
 	parms->buffer_percent = 50;
+	parms->listen_backlog = DEFAULT_LISTEN_BACKLOG;
+	parms->hotplug = 0;
+	parms->warm_open = 0;
+	parms->prefetch_lines = 0;
+	parms->write_combine_lines = 0;
+	parms->timing_model = 0;
+	memset(parms->latency, 0, sizeof(parms->latency));
+	parms->link_bytes = 0;
+	parms->erat_penalty = 0;
+	parms->credit_delay = 0;
+	parms->erat_entries = DEFAULT_ERAT_ENTRIES;
+	parms->erat_ways = DEFAULT_ERAT_WAYS;
+	parms->erat_policy = ERAT_LRU;
+	parms->erat_page_shift = 12;
+	parms->sched_policy = SCHED_FIFO;
+	for (i = 0; i < MAX_WEIGHTED_CONTEXTS; i++)
+		parms->context_weight[i] = 1;
 
 	// Open file and parse contents
 	fp = fopen(filename, "r");
@@ -196,6 +329,134 @@ struct parms *parse_parms(char *filename, FILE * dbg_fp)
 		} else if (!(strcmp(parm, "BASE_IMAGE_REV_LEVEL"))) {
 			parms->base_image = atoi(value);
 			debug_parm(dbg_fp, DBG_BASE_IMAGE, parms->base_image);
+		} else if (!(strcmp(parm, "LISTEN_BACKLOG"))) {
+			data = atoi(value);
+			if (data <= 0)
+				warn_msg("LISTEN_BACKLOG must be greater than 0");
+			else
+				parms->listen_backlog = data;
+			debug_parm(dbg_fp, DBG_PARM_LISTEN_BACKLOG,
+				   parms->listen_backlog);
+		} else if (!(strcmp(parm, "HOTPLUG"))) {
+			parms->hotplug = atoi(value) ? 1 : 0;
+			debug_parm(dbg_fp, DBG_PARM_HOTPLUG, parms->hotplug);
+		} else if (!(strcmp(parm, "WARM_OPEN"))) {
+			parms->warm_open = atoi(value) ? 1 : 0;
+			debug_parm(dbg_fp, DBG_PARM_WARM_OPEN, parms->warm_open);
+		} else if (!(strcmp(parm, "PREFETCH_LINES"))) {
+			data = atoi(value);
+			if ((data >= PSLSE_MAX_READ_LINES) || (data < 0))
+				warn_msg("PREFETCH_LINES must be 0-%d",
+					 PSLSE_MAX_READ_LINES - 1);
+			else
+				parms->prefetch_lines = data;
+			debug_parm(dbg_fp, DBG_PARM_PREFETCH_LINES,
+				   parms->prefetch_lines);
+		} else if (!(strcmp(parm, "WRITE_COMBINE_LINES"))) {
+			data = atoi(value);
+			if ((data > PSLSE_MAX_WRITE_LINES) || (data < 0))
+				warn_msg("WRITE_COMBINE_LINES must be 0-%d",
+					 PSLSE_MAX_WRITE_LINES);
+			else
+				parms->write_combine_lines = data;
+			debug_parm(dbg_fp, DBG_PARM_WRITE_COMBINE_LINES,
+				   parms->write_combine_lines);
+		} else if (!(strcmp(parm, "TIMING_MODEL"))) {
+			parms->timing_model = atoi(value) ? 1 : 0;
+			debug_parm(dbg_fp, DBG_PARM_TIMING_MODEL,
+				   parms->timing_model);
+		} else if (!(strcmp(parm, "READ_LATENCY"))) {
+			set_latency(dbg_fp, parm, value, parms, LATENCY_READ,
+				    DBG_PARM_READ_LATENCY);
+		} else if (!(strcmp(parm, "WRITE_LATENCY"))) {
+			set_latency(dbg_fp, parm, value, parms, LATENCY_WRITE,
+				    DBG_PARM_WRITE_LATENCY);
+		} else if (!(strcmp(parm, "TOUCH_LATENCY"))) {
+			set_latency(dbg_fp, parm, value, parms, LATENCY_TOUCH,
+				    DBG_PARM_TOUCH_LATENCY);
+		} else if (!(strcmp(parm, "INTERRUPT_LATENCY"))) {
+			set_latency(dbg_fp, parm, value, parms,
+				    LATENCY_INTERRUPT,
+				    DBG_PARM_INTERRUPT_LATENCY);
+		} else if (!(strcmp(parm, "OTHER_LATENCY"))) {
+			set_latency(dbg_fp, parm, value, parms, LATENCY_OTHER,
+				    DBG_PARM_OTHER_LATENCY);
+		} else if (!(strcmp(parm, "LINK_BYTES_PER_CYCLE"))) {
+			data = atoi(value);
+			if (data < 0)
+				warn_msg("LINK_BYTES_PER_CYCLE must be 0 or more");
+			else
+				parms->link_bytes = data;
+			debug_parm(dbg_fp, DBG_PARM_LINK_BYTES_PER_CYCLE,
+				   parms->link_bytes);
+		} else if (!(strcmp(parm, "ERAT_MISS_PENALTY"))) {
+			data = atoi(value);
+			if ((data > MAX_LATENCY) || (data < 0))
+				warn_msg("ERAT_MISS_PENALTY must be 0-%d",
+					 MAX_LATENCY);
+			else
+				parms->erat_penalty = data;
+			debug_parm(dbg_fp, DBG_PARM_ERAT_MISS_PENALTY,
+				   parms->erat_penalty);
+		} else if (!(strcmp(parm, "CREDIT_DELAY"))) {
+			data = atoi(value);
+			if ((data > MAX_LATENCY) || (data < 0))
+				warn_msg("CREDIT_DELAY must be 0-%d",
+					 MAX_LATENCY);
+			else
+				parms->credit_delay = data;
+			debug_parm(dbg_fp, DBG_PARM_CREDIT_DELAY,
+				   parms->credit_delay);
+		} else if (!(strcmp(parm, "ERAT_ENTRIES"))) {
+			data = atoi(value);
+			if ((data > MAX_ERAT_ENTRIES) || (data <= 0))
+				warn_msg("ERAT_ENTRIES must be 1-%d",
+					 MAX_ERAT_ENTRIES);
+			else
+				parms->erat_entries = data;
+			debug_parm(dbg_fp, DBG_PARM_ERAT_ENTRIES,
+				   parms->erat_entries);
+		} else if (!(strcmp(parm, "ERAT_WAYS"))) {
+			data = atoi(value);
+			if (data <= 0)
+				warn_msg("ERAT_WAYS must be greater than 0");
+			else
+				parms->erat_ways = data;
+			debug_parm(dbg_fp, DBG_PARM_ERAT_WAYS,
+				   parms->erat_ways);
+		} else if (!(strcmp(parm, "ERAT_POLICY"))) {
+			data = erat_policy_parm(value);
+			if (data < 0)
+				warn_msg("ERAT_POLICY must be LRU, FIFO or RANDOM");
+			else
+				parms->erat_policy = data;
+			debug_parm(dbg_fp, DBG_PARM_ERAT_POLICY,
+				   parms->erat_policy);
+		} else if (!(strcmp(parm, "ERAT_PAGE_SIZE"))) {
+			data = erat_page_parm(value);
+			if (data < 0)
+				warn_msg("ERAT_PAGE_SIZE must be 4K, 64K or 16M");
+			else
+				parms->erat_page_shift = data;
+			debug_parm(dbg_fp, DBG_PARM_ERAT_PAGE_SIZE,
+				   1 << parms->erat_page_shift);
+		} else if (!(strcmp(parm, "SCHEDULER"))) {
+			data = sched_policy_parm(value);
+			if (data < 0)
+				warn_msg("SCHEDULER must be FIFO, ROUND_ROBIN, WEIGHTED or PRIORITY");
+			else
+				parms->sched_policy = data;
+			debug_parm(dbg_fp, DBG_PARM_SCHEDULER,
+				   parms->sched_policy);
+		} else if (!(strcmp(parm, "CONTEXT_WEIGHT"))) {
+			data = context_weight_parm(value, parms);
+			if (data < 0)
+				warn_msg("CONTEXT_WEIGHT must be context,weight with context 0-%d and weight 0-%d",
+					 MAX_WEIGHTED_CONTEXTS - 1,
+					 MAX_CONTEXT_WEIGHT);
+			else
+				debug_parm(dbg_fp, DBG_PARM_CONTEXT_WEIGHT,
+					   data);
 		} else {
 			warn_msg("Ignoring invalid parm in %s: %s\n",
 				 filename, parm);
@@ -203,9 +464,14 @@ struct parms *parse_parms(char *filename, FILE * dbg_fp)
 		}
 	}
 
-	// Close file and set seed
+	// Close file, each AFU seeds its own generator from SEED
 	fclose(fp);
-	srand(parms->seed);
+	if ((parms->erat_ways > parms->erat_entries) ||
+	    (parms->erat_entries % parms->erat_ways)) {
+		warn_msg("ERAT_ENTRIES must be a multiple of ERAT_WAYS");
+		parms->erat_entries = DEFAULT_ERAT_ENTRIES;
+		parms->erat_ways = DEFAULT_ERAT_WAYS;
+	}
 
 	// Print out parm settings
 	info_msg("PSLSE parm values:");
@@ -216,10 +482,59 @@ struct parms *parse_parms(char *filename, FILE * dbg_fp)
 		printf("\tTimeout  = %d seconds\n", parms->timeout);
 	else
 		printf("\tTimeout  = DISABLED\n");
-	printf("\tResponse = %d%%\n", parms->resp_percent);
+	if (parms->timing_model) {
+		printf("\tTiming model = ENABLED\n");
+		printf("\t  Read      = %d,%d cycles\n",
+		       parms->latency[LATENCY_READ].min,
+		       parms->latency[LATENCY_READ].max);
+		printf("\t  Write     = %d,%d cycles\n",
+		       parms->latency[LATENCY_WRITE].min,
+		       parms->latency[LATENCY_WRITE].max);
+		printf("\t  Touch     = %d,%d cycles\n",
+		       parms->latency[LATENCY_TOUCH].min,
+		       parms->latency[LATENCY_TOUCH].max);
+		printf("\t  Interrupt = %d,%d cycles\n",
+		       parms->latency[LATENCY_INTERRUPT].min,
+		       parms->latency[LATENCY_INTERRUPT].max);
+		printf("\t  Other     = %d,%d cycles\n",
+		       parms->latency[LATENCY_OTHER].min,
+		       parms->latency[LATENCY_OTHER].max);
+		if (parms->link_bytes)
+			printf("\t  Link      = %d bytes/cycle\n",
+			       parms->link_bytes);
+		printf("\t  ERAT miss = %d cycles\n", parms->erat_penalty);
+		printf("\t  Credit    = %d cycles\n", parms->credit_delay);
+	} else {
+		printf("\tResponse = %d%%\n", parms->resp_percent);
+		printf("\tReorder  = %d%%\n", parms->reorder_percent);
+		printf("\tBuffer   = %d%%\n", parms->buffer_percent);
+	}
 	printf("\tPaged    = %d%%\n", parms->paged_percent);
-	printf("\tReorder  = %d%%\n", parms->reorder_percent);
-	printf("\tBuffer   = %d%%\n", parms->buffer_percent);
+	if ((parms->erat_entries != DEFAULT_ERAT_ENTRIES) ||
+	    (parms->erat_ways != DEFAULT_ERAT_WAYS) ||
+	    (parms->erat_policy != ERAT_LRU) || (parms->erat_page_shift != 12))
+		printf("\tERAT     = %d entries, %d ways, %s, %dKB pages\n",
+		       parms->erat_entries, parms->erat_ways,
+		       (parms->erat_policy == ERAT_LRU) ? "LRU" :
+		       (parms->erat_policy == ERAT_FIFO) ? "FIFO" : "RANDOM",
+		       1 << (parms->erat_page_shift - 10));
+	if (parms->sched_policy != SCHED_FIFO)
+		printf("\tScheduler = %s\n",
+		       (parms->sched_policy == SCHED_ROUND_ROBIN) ?
+		       "ROUND_ROBIN" :
+		       (parms->sched_policy == SCHED_WEIGHTED) ? "WEIGHTED" :
+		       "PRIORITY");
+	if (parms->listen_backlog != DEFAULT_LISTEN_BACKLOG)
+		printf("\tBacklog  = %d\n", parms->listen_backlog);
+	if (parms->hotplug)
+		printf("\tHotplug  = ENABLED\n");
+	if (parms->warm_open)
+		printf("\tWarm open = ENABLED\n");
+	if (parms->prefetch_lines)
+		printf("\tPrefetch = %d lines\n", parms->prefetch_lines);
+	if (parms->write_combine_lines)
+		printf("\tWrite combine = %d lines\n",
+		       parms->write_combine_lines);
 //When we start reading these values in from pslse.parms, uncomment
 //	printf("\tCAIA_Ver     = %4d\n", parms->caia_version);
 //	printf("\tPSL_REV      = %d\n", parms->psl_rev_level);
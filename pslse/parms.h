@@ -19,6 +19,27 @@
 
 #include <stdio.h>
 
+#include "prng.h"
+
+// Command classes with their own timing model latency
+enum latency_class {
+	LATENCY_READ,
+	LATENCY_WRITE,
+	LATENCY_TOUCH,
+	LATENCY_INTERRUPT,
+	LATENCY_OTHER,
+	LATENCY_CLASSES
+};
+
+// Contexts that can be given their own CONTEXT_WEIGHT
+#define MAX_WEIGHTED_CONTEXTS 512
+
+// Latency in cycles, drawn per command from min..max
+struct latency {
+	unsigned int min;
+	unsigned int max;
+};
+
 struct parms {
 	unsigned int timeout;
 	unsigned int credits;
@@ -31,19 +52,39 @@ struct parms {
 	unsigned int psl_rev_level;
 	unsigned int image_loaded;
 	unsigned int base_image;
+	unsigned int listen_backlog;
+	unsigned int hotplug;
+	unsigned int warm_open;
+	unsigned int prefetch_lines;
+	unsigned int write_combine_lines;
+	unsigned int timing_model;
+	struct latency latency[LATENCY_CLASSES];
+	unsigned int link_bytes;
+	unsigned int erat_penalty;
+	unsigned int credit_delay;
+	unsigned int erat_entries;
+	unsigned int erat_ways;
+	unsigned int erat_policy;
+	unsigned int erat_page_shift;
+	unsigned int sched_policy;
+	unsigned int context_weight[MAX_WEIGHTED_CONTEXTS];
 };
 
 // Randomly decide to allow response to AFU
-int allow_resp(struct parms *parms);
+int allow_resp(struct parms *parms, struct prng *prng);
 
 // Randomly decide to allow PAGED response
-int allow_paged(struct parms *parms);
+int allow_paged(struct parms *parms, struct prng *prng);
 
 // Randomly decide to allow command to be handled out of order
-int allow_reorder(struct parms *parms);
+int allow_reorder(struct parms *parms, struct prng *prng);
 
 // Randomly decide to allow bogus buffer activity
-int allow_buffer(struct parms *parms);
+int allow_buffer(struct parms *parms, struct prng *prng);
+
+// Timing model latency in cycles for a command of class
+unsigned int latency_cycles(struct parms *parms, struct prng *prng,
+			    enum latency_class class);
 
 // Open and parse parms file
 struct parms *parse_parms(char *filename, FILE * dbg_fp);
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Description: prng.h
+ *
+ *  Pseudo random number generator used for the random decisions of each AFU.
+ *  Every psl has its own xoshiro256** generator seeded from the SEED parm and
+ *  the AFU id, so each AFU sees the same sequence on every run with the same
+ *  seed no matter how the psl threads interleave, and no lock is shared
+ *  between threads.
+ */
+
+#ifndef _PRNG_H_
+#define _PRNG_H_
+
+#include <stdint.h>
+
+struct prng {
+	uint64_t s[4];
+};
+
+static inline uint64_t _prng_rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+// Seed generator for stream of seed, each stream gives its own sequence
+static inline void prng_seed(struct prng *prng, uint32_t seed,
+			     uint32_t stream)
+{
+	uint64_t x, z;
+	int i;
+
+	// Expand seed and stream to the full state with splitmix64
+	x = ((uint64_t) seed << 32) | stream;
+	for (i = 0; i < 4; i++) {
+		x += 0x9E3779B97F4A7C15ULL;
+		z = x;
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+		prng->s[i] = z ^ (z >> 31);
+	}
+}
+
+// Next 64 bit random value
+static inline uint64_t prng_next(struct prng *prng)
+{
+	uint64_t *s = prng->s;
+	uint64_t result, t;
+
+	result = _prng_rotl(s[1] * 5, 7) * 9;
+	t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = _prng_rotl(s[3], 45);
+	return result;
+}
+
+// Random value 0..range-1, scaled by multiply rather than divide
+static inline uint32_t prng_below(struct prng *prng, uint32_t range)
+{
+	return (uint32_t) (((prng_next(prng) >> 32) * range) >> 32);
+}
+
+#endif				/* _PRNG_H_ */
@@ -38,27 +38,43 @@
 #include "../common/debug.h"
 #include "../common/psl_interface.h"
 
+// Read only buffers are received in pieces no larger than this
+#define RO_CHUNK_BYTES 0x10000
+
+// Add client in context slot to the AFU and its list of active contexts.
+// Caller must hold lock.
+void psl_add_client(struct psl *psl, struct client *client, int32_t context)
+{
+	psl->client[context] = client;
+	psl->active_slot[context] = psl->active_count;
+	psl->active[psl->active_count++] = context;
+}
+
+// Remove client of context from the AFU and its list of active contexts,
+// the last active context moves into its place in the list
+static void _remove_client(struct psl *psl, int32_t context)
+{
+	int32_t slot, last;
+
+	psl->client[context] = NULL;
+	slot = psl->active_slot[context];
+	if (slot < 0)
+		return;
+	last = psl->active[--psl->active_count];
+	psl->active[slot] = last;
+	psl->active_slot[last] = slot;
+	psl->active_slot[context] = -1;
+}
+
 // are there any pending commands with this context?
 int _is_cmd_pending(struct psl *psl, int32_t context)
 {
-  struct cmd_event *cmd_event;
-
   if ( psl->cmd == NULL ) {
     // no cmd struct
     return 0;
   }
 
-  cmd_event = psl->cmd->list;
-  while ( cmd_event != NULL ) {
-    if ( cmd_event->context == context ) {
-      // found a matching element
-      return 1;
-    }
-    cmd_event = cmd_event->_next;
-  }
-
-  // no matching elements found
-  return 0;
+  return cmd_pending(psl->cmd, context);
 
 }
 
@@ -90,6 +106,7 @@ static void _attach(struct psl *psl, struct client *client)
 	// add to client type.
 	memcpy((char *)&wed, (char *)buffer, sizeof(uint64_t));
 	client->wed = ntohll(wed);
+	cmd_prefetch_invalidate(psl->cmd, client->context);
 
 	// Send start to AFU
 	// only add PSL_JOB_START for dedicated and master clients.
@@ -102,6 +119,7 @@ static void _attach(struct psl *psl, struct client *client)
 	switch (client->type) {
 	case 'd':
 	  if (psl->attached_clients == 0) {
+	    psl->afu_reset_idle = 0;
 	    if (add_job(psl->job, PSL_JOB_START, client->wed) != NULL) {
 	      // if dedicated, we can ack PSLSE_ATTACH
 	      // if master, we might want to wait until after the llcmd add is complete
@@ -182,6 +200,7 @@ static void _detach(struct psl *psl, struct client *client)
 		}
 	} else {
 	  if (client->type == 'd' ) {
+	    client->detached = 1;
 	    client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
 	  }
 	}
@@ -194,6 +213,112 @@ static void _detach(struct psl *psl, struct client *client)
 	
 }
 
+// Done receiving read only buffer, keep the copy if there is one and tell
+// the client whether the buffer was registered
+static void _finish_ro(struct psl *psl, struct client *client)
+{
+	struct ro_region *ro;
+	uint8_t ack[2];
+
+	ro = client->ro_load;
+	client->ro_load = NULL;
+	ack[0] = PSLSE_REGISTER_RO;
+	ack[1] = 0;
+	if ((ro->data == NULL) || !ro->len) {
+		warn_msg("Unable to register read only buffer for context %d",
+			 client->context);
+		free(ro->data);
+		free(ro);
+		ack[1] = 1;
+	} else {
+		ro->_next = client->ro;
+		client->ro = ro;
+		debug_msg("%s:REGISTER RO context=%d addr=0x%016"PRIx64
+			  " len=0x%"PRIx64, psl->name, client->context,
+			  ro->addr, ro->len);
+	}
+	if (put_bytes(client->fd, 2, ack, psl->dbg_fp, psl->dbg_id,
+		      client->context) < 0) {
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+	}
+}
+
+// Receive the next chunk of a read only buffer, one chunk per call so a
+// large buffer does not hold the lock for long
+static void _load_ro(struct psl *psl, struct client *client)
+{
+	struct ro_region *ro;
+	uint8_t *drain;
+	int size, rc;
+
+	ro = client->ro_load;
+	if (client->ro_offset < ro->len) {
+		if (bytes_ready(client->fd, 1, &(client->abort)) == 0)
+			return;
+		size = RO_CHUNK_BYTES;
+		if (ro->len - client->ro_offset < RO_CHUNK_BYTES)
+			size = (int)(ro->len - client->ro_offset);
+		// Contents are read even if the copy can't be kept so the
+		// socket stays in sync
+		drain = NULL;
+		if (ro->data == NULL)
+			drain = (uint8_t *) malloc(size);
+		rc = -1;
+		if ((ro->data != NULL) || (drain != NULL))
+			rc = get_bytes_silent(client->fd, size, ro->data ?
+					      &(ro->data[client->ro_offset]) :
+					      drain, psl->timeout,
+					      &(client->abort));
+		free(drain);
+		if (rc < 0) {
+			warn_msg("Failed to get read only buffer from client");
+			client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+			return;
+		}
+		client->ro_offset += size;
+	}
+	if (client->ro_offset == ro->len)
+		_finish_ro(psl, client);
+}
+
+// Client is registering a buffer it will not modify while attached.  Copy
+// the buffer so AFU reads of it can be served without the client.  Only the
+// request is read here, _load_ro() receives the contents.
+static void _register_ro(struct psl *psl, struct client *client)
+{
+	struct ro_region *ro;
+	uint8_t buffer[2 * sizeof(uint64_t)];
+	uint64_t addr, len;
+
+	if (get_bytes_silent(client->fd, 2 * sizeof(uint64_t), buffer,
+			     psl->timeout, &(client->abort)) < 0) {
+		warn_msg("Failed to get read only buffer from client");
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		return;
+	}
+	memcpy((char *)&addr, (char *)buffer, sizeof(uint64_t));
+	addr = ntohll(addr);
+	memcpy((char *)&len, (char *)&(buffer[sizeof(uint64_t)]),
+	       sizeof(uint64_t));
+	len = ntohll(len);
+
+	// Without a region to track the contents the socket can't be kept
+	// in sync
+	ro = (struct ro_region *)malloc(sizeof(struct ro_region));
+	if (ro == NULL) {
+		perror("malloc");
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		return;
+	}
+	ro->addr = addr;
+	ro->len = len;
+	ro->data = len ? (uint8_t *) malloc(len) : NULL;
+	ro->_next = NULL;
+	client->ro_load = ro;
+	client->ro_offset = 0;
+	_load_ro(psl, client);
+}
+
 // Client release from AFU
 static void _free(struct psl *psl, struct client *client)
 {
@@ -209,15 +334,22 @@ static void _free(struct psl *psl, struct client *client)
 		free(client->ip);
 	client->ip = NULL;
 	mem_access = (struct cmd_event *)client->mem_access;
-	if (mem_access != NULL) {
-		if (mem_access->state != MEM_DONE) {
-			mem_access->resp = PSL_RESPONSE_FAILED;
-			mem_access->state = MEM_DONE;
-		}
+	// Combined writes are only outstanding while the first one is
+	while ((mem_access != NULL) && (mem_access->state != MEM_DONE)) {
+		mem_access->resp = PSL_RESPONSE_FAILED;
+		mem_access->state = MEM_DONE;
+		mem_access = mem_access->combined;
 	}
 	client->mem_access = NULL;
 	client->mmio_access = NULL;
 	client->state = CLIENT_NONE;
+	client_free_ro(client);
+	cmd_prefetch_invalidate(psl->cmd, client->context);
+	cmd_release_locks(psl->cmd, client->context);
+	erat_report(psl->cmd->erat, psl->name, client->context);
+	erat_invalidate(psl->cmd->erat, client->context);
+	sched_report(psl->cmd->sched, psl->name, client->context);
+	sched_reset(psl->cmd->sched, client->context);
 
 	psl->attached_clients--;
 	info_msg( "Detatched a client: current attached clients = %d\n", psl->attached_clients );
@@ -231,7 +363,6 @@ int _handle_aux2(struct psl *psl, uint32_t * parity, uint32_t * latency,
 		uint64_t * error)
 {
         struct job *job;
-	struct job_event *_prev;
 	struct job_event *cacked_pe;
 	struct job_event *event;
 	uint32_t job_running;
@@ -289,36 +420,9 @@ int _handle_aux2(struct psl *psl, uint32_t * parity, uint32_t * latency,
 		// Handle job cack llcmd
 		if (job_cack_llcmd) {
 		        // remove the current pending pe from the list
-		        // loop through the pe's for the current pending one;
-		        // copy its _next to _prev's _next
-		        // remove the current pe
 		        debug_msg("%s,%d:_handle_aux2, jcack, complete llcmd and remove pe", 
 				  job->afu_name, job->dbg_id );
-			cacked_pe = NULL;
-			if (job->pe != NULL) {		  
-			  if (job->pe->state == PSLSE_PENDING) {
-			    // remove the first entry in the list
-			    debug_msg("%s,%d:_handle_aux2, jcack, first pe is pending, job=0x%016"PRIx64", pe=0x%016"PRIx64, 
-				      job->afu_name, job->dbg_id, job, job->pe );
-			    cacked_pe = job->pe;
-			    job->pe = job->pe->_next;
-			  } else {
-			    _prev = job->pe;
-			    while (_prev->_next != NULL) {
-			      debug_msg("%s,%d:_handle_aux2, jcack, looking for pending pe, _prev=0x%016"PRIx64", _next=0x%016"PRIx64, 
-					job->afu_name, job->dbg_id, _prev, _prev->_next );
-			      if (_prev->_next->state == PSLSE_PENDING) {
-				// remove this entry in the list
-				debug_msg("%s,%d:_handle_aux2, jcack, found pending pe, _next=0x%016"PRIx64, 
-					job->afu_name, job->dbg_id, _prev->_next );
-				cacked_pe = _prev->_next;
-				_prev->_next = _prev->_next->_next;
-			      } else {
-				_prev = _prev->_next;
-			      }
-			    }
-			  }
-			}
+			cacked_pe = cack_pe(job);
 			if (cacked_pe != NULL) {
 			  // this is the pe that I want to "finish" processing
 			  // get just the llcmd part of the addr
@@ -348,7 +452,7 @@ int _handle_aux2(struct psl *psl, uint32_t * parity, uint32_t * latency,
 			    	      psl->dbg_fp, psl->dbg_id,
 			    	      psl->client[context]->context);
 			    _free( psl, psl->client[context] );
-			    psl->client[context] = NULL;  // I don't like this part...
+			    _remove_client(psl, context);  // I don't like this part...
 			    break;
 			  default:
 			    debug_msg("%s,%d:_handle_aux2: acked llcmd %d did not match an LLCMD pe", 
@@ -420,13 +524,13 @@ static void _handle_afu(struct psl *psl)
                 // no interrupt/event is sent up to the application - don't "put_bytes" back to client(s)
 	        // all clients lose connection to afu but how is this observered by the client?
 	        warn_msg("%s: Received JERROR: 0x%016"PRIx64" in afu-directed mode", psl->name, error);
-		for (i = 0; i < psl->max_clients; i++) {
-			if (psl->client[i] == NULL)
-				continue;
-			client_drop(psl->client[i], PSL_IDLE_CYCLES, CLIENT_NONE);
-		}
+		for (i = 0; i < psl->active_count; i++)
+			client_drop(psl->client[psl->active[i]],
+				    PSL_IDLE_CYCLES, CLIENT_NONE);
 	  }
 	}
+	if (reset_done)
+		psl->afu_reset_idle = 1;
 	handle_mmio_ack(psl->mmio, psl->parity_enabled);
 	if (psl->cmd != NULL) {
 		if (reset_done)
@@ -438,10 +542,30 @@ static void _handle_afu(struct psl *psl)
 		handle_mem_write(psl->cmd);
 		handle_touch(psl->cmd);
 		handle_cmd(psl->cmd, psl->parity_enabled, psl->latency);
-		handle_interrupt(psl->cmd);
+		client = handle_interrupt(psl->cmd);
+		if (client != NULL)
+			client->irq_cycle = psl->cycles;
 	}
 }
 
+// Send AFU cycle count and the cycle stamps of the client
+static void _cycles(struct psl *psl, struct client *client)
+{
+	uint8_t buffer[1 + 3 * sizeof(uint64_t)];
+	uint64_t value;
+
+	buffer[0] = PSLSE_CYCLES;
+	value = htonll(psl->cycles);
+	memcpy(&(buffer[1]), &value, sizeof(uint64_t));
+	value = htonll(client->mmio_cycle);
+	memcpy(&(buffer[1 + sizeof(uint64_t)]), &value, sizeof(uint64_t));
+	value = htonll(client->irq_cycle);
+	memcpy(&(buffer[1 + 2 * sizeof(uint64_t)]), &value, sizeof(uint64_t));
+	if (put_bytes(client->fd, sizeof(buffer), buffer, psl->dbg_fp,
+		      psl->dbg_id, client->context) < 0)
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+}
+
 static void _handle_client(struct psl *psl, struct client *client)
 {
 	struct mmio_event *mmio;
@@ -454,11 +578,19 @@ static void _handle_client(struct psl *psl, struct client *client)
 	if (client->mmio_access != NULL) {
 		client->idle_cycles = PSL_IDLE_CYCLES;
 		client->mmio_access = handle_mmio_done(psl->mmio, client);
+		if (client->mmio_access == NULL)
+			client->mmio_cycle = psl->cycles;
 	}
 	// Client disconnected
 	if (client->state == CLIENT_NONE)
 		return;
 
+	// Finish receiving read only buffer before any other request
+	if (client->ro_load != NULL) {
+		_load_ro(psl, client);
+		return;
+	}
+
 	// Check for event from application
 	cmd = (struct cmd_event *)client->mem_access;
 	mmio = NULL;
@@ -491,11 +623,23 @@ static void _handle_client(struct psl *psl, struct client *client)
 		case PSLSE_MMIO_MAP:
 			handle_mmio_map(psl->mmio, client);
 			break;
+		case PSLSE_REGISTER_RO:
+			_register_ro(psl, client);
+			break;
+		case PSLSE_CYCLES:
+			_cycles(psl, client);
+			break;
 		case PSLSE_MMIO_WRITE64:
 			dw = 1;
 		case PSLSE_MMIO_WRITE32:	/*fall through */
+			psl->afu_reset_idle = 0;
+			cmd_prefetch_invalidate(psl->cmd, client->context);
 			mmio = handle_mmio(psl->mmio, client, 0, dw, 0);
 			break;
+		case PSLSE_MMIO_EBREAD_BULK:
+			mmio = handle_mmio(psl->mmio, client, 1, 1,
+					   PSLSE_MMIO_EBREAD_BULK);
+			break;
 		case PSLSE_MMIO_EBREAD:
                         eb_rd = 1;
 		case PSLSE_MMIO_READ64: /*fall through */
@@ -515,12 +659,26 @@ static void _handle_client(struct psl *psl, struct client *client)
 	}
 }
 
+// Can dedicated client close skip the reset?  Only with WARM_OPEN set, after
+// a detach request, with nothing outstanding and the AFU reset or resetting.
+static int _warm_close(struct psl *psl, struct client *client)
+{
+	if (!psl->warm_open || !client->detached)
+		return 0;
+	if ((psl->cmd->list != NULL) || (psl->mmio->list != NULL))
+		return 0;
+	if (!psl->afu_reset_idle && !job_reset_queued(psl->job))
+		return 0;
+	debug_msg("%s: warm close, skipping reset", psl->name);
+	return 1;
+}
+
 // PSL thread loop
 static void *_psl_loop(void *ptr)
 {
 	struct psl *psl = (struct psl *)ptr;
 	struct cmd_event *event, *temp;
-	int events, i, stopped, reset;
+	int events, i, n, count, start, stopped, reset;
 	uint8_t ack = PSLSE_DETACH;
 
 	stopped = 1;
@@ -541,6 +699,7 @@ static void *_psl_loop(void *ptr)
 		if (psl->idle_cycles) {
 			// Clock AFU
 			psl_signal_afu_model(psl->afu_event);
+			psl->cycles++;
 			// Check for events from AFU
 			events = psl_get_afu_events(psl->afu_event);
 
@@ -572,11 +731,11 @@ static void *_psl_loop(void *ptr)
 			lock_delay(psl->lock);
 			continue;
 		}
-		// Check for event from application
+		// Drop dedicated clients that have detached, only attached
+		// contexts are visited
 		reset = 0;
-		for (i = 0; i < psl->max_clients; i++) {
-			if (psl->client[i] == NULL)
-				continue;
+		for (n = 0; n < psl->active_count; n++) {
+			i = psl->active[n];
 			if ((psl->client[i]->type == 'd') && 
 			    (psl->client[i]->state == CLIENT_NONE) &&
 			    (psl->client[i]->idle_cycles == 0)) {
@@ -585,20 +744,38 @@ static void *_psl_loop(void *ptr)
 				put_bytes(psl->client[i]->fd, 1, &ack,
 					  psl->dbg_fp, psl->dbg_id,
 					  psl->client[i]->context);
+				// Warm open keeps AFU if client left it clean
+				if (!_warm_close(psl, psl->client[i]))
+					reset = 1;
 				_free(psl, psl->client[i]);
-				psl->client[i] = NULL;  // aha - this is how we only called _free once the old way
+				_remove_client(psl, i);  // aha - this is how we only called _free once the old way
 				                        // why do we not free client[i]?
 				                        // because this was a short cut pointer
 				                        // the *real* client point is in client_list in pslse
-				reset = 1;
 				// for m/s devices we need to do this differently and not send a reset...
 				// _handle_client - creates the llcmd's to term and remove
 				// send_pe - sends the llcmd pe's to afu one at a time
 				// _handle_afu calls _handle_aux2
 				// _handle_aux2 finishes the llcmd pe's when jcack is asserted by afu
 				//   when the remove llcmd is processed, we should put_bytes, _free and set client[i] to NULL
-				continue;
+				// The last active context took its place
+				--n;
 			}
+		}
+
+		// Serve the clients.  Unless SCHEDULER is FIFO the walk starts
+		// one context further on each pass so no context is always
+		// handled first.  The list can only grow during the walk,
+		// contexts attached meanwhile wait for the next pass.
+		count = psl->active_count;
+		start = 0;
+		if ((psl->cmd->sched != NULL) &&
+		    (psl->cmd->sched->policy != SCHED_FIFO) && (count > 0)) {
+			start = psl->client_start % count;
+			psl->client_start = start + 1;
+		}
+		for (n = 0; n < count; n++) {
+			i = psl->active[(start + n) % count];
 			if (psl->state == PSLSE_RESET)
 				continue;
 			_handle_client(psl, psl->client[i]);
@@ -633,6 +810,7 @@ static void *_psl_loop(void *ptr)
 				free(temp);
 			}
 			psl->cmd->list = NULL;
+			cmd_pending_clear(psl->cmd);
 			info_msg("Sending reset to AFU");
 			add_job(psl->job, PSL_JOB_RESET, 0L);
 		}
@@ -641,33 +819,50 @@ static void *_psl_loop(void *ptr)
 	}
 
 	// Disconnect clients
-	for (i = 0; i < psl->max_clients; i++) {
-		if ((psl->client != NULL) && (psl->client[i] != NULL)) {
-			// FIXME: Send warning to clients first?
-			info_msg("Disconnecting %s context %d", psl->name,
-				 psl->client[i]->context);
-			close_socket(&(psl->client[i]->fd));
-		}
+	for (n = 0; n < psl->active_count; n++) {
+		i = psl->active[n];
+		// FIXME: Send warning to clients first?
+		info_msg("Disconnecting %s context %d", psl->name,
+			 psl->client[i]->context);
+		close_socket(&(psl->client[i]->fd));
 	}
 
 	// DEBUG
 	debug_afu_drop(psl->dbg_fp, psl->dbg_id);
 
+	// Remove from AFU registry so new clients can't find it
+	psl_unregister(psl);
+
 	// Disconnect from simulator, free memory and shut down thread
 	info_msg("Disconnecting %s @ %s:%d", psl->name, psl->host, psl->port);
 	if (psl->client)
 		free(psl->client);
+	free(psl->active);
+	free(psl->active_slot);
 	if (psl->_prev)
 		psl->_prev->_next = psl->_next;
 	if (psl->_next)
 		psl->_next->_prev = psl->_prev;
 	if (psl->cmd) {
+		if (psl->cmd->prefetch) {
+			for (i = 0; i < psl->max_clients; i++)
+				free(psl->cmd->prefetch[i].data);
+			free(psl->cmd->prefetch);
+		}
+		free(psl->cmd->reservation);
+		free(psl->cmd->pending);
+		erat_report(psl->cmd->erat, psl->name, -1);
+		erat_free(psl->cmd->erat);
+		sched_report(psl->cmd->sched, psl->name, -1);
+		sched_free(psl->cmd->sched);
 		free(psl->cmd);
 	}
 	if (psl->job) {
 		free(psl->job);
 	}
 	if (psl->mmio) {
+		if (psl->mmio->desc.crptr)
+			free(psl->mmio->desc.crptr);
 		free(psl->mmio);
 	}
 	if (psl->host)
@@ -685,44 +880,67 @@ static void *_psl_loop(void *ptr)
 	pthread_exit(NULL);
 }
 
+// Remove PSL from AFU registry, caller must hold lock
+void psl_unregister(struct psl *psl)
+{
+	if (psl->registry->psl[psl->dbg_id] != psl)
+		return;
+	psl->registry->psl[psl->dbg_id] = NULL;
+	afu_map_clear(psl->registry->map, psl->dbg_id);
+	psl->registry->legacy_map &= ~afu_legacy_location(psl->dbg_id);
+	--psl->registry->count;
+}
+
+// Disconnect PSL from simulator and clients, caller must hold lock.  The psl
+// thread frees the struct once it exits so psl must not be used after this.
+void psl_stop(struct psl *psl)
+{
+	int i;
+
+	info_msg("Shutting down connection to %s", psl->name);
+	psl_unregister(psl);
+	for (i = 0; i < psl->active_count; i++)
+		psl->client[psl->active[i]]->abort = 1;
+	psl->state = PSLSE_DONE;
+}
+
 // Initialize and start PSL thread
 //
-// The return value is encode int a 16-bit value divided into 4 for each
-// possible adapter.  Then the 4 bits in each adapter represent the 4 possible
-// AFUs on an adapter.  For example: afu0.0 is 0x8000 and afu3.0 is 0x0008.
-uint16_t psl_init(struct psl **head, struct parms *parms, char *id, char *host,
-		  int port, pthread_mutex_t * lock, FILE * dbg_fp)
+// Once the AFU descriptor has been read the PSL is published in the registry
+// under its AFU id, (major << 4) | minor, which is also its dbg_id.  Caller
+// must hold lock.  Returns 0 on success.
+int psl_init(struct psl **head, struct psl_registry *registry,
+	     struct parms *parms, char *id, char *host, int port,
+	     pthread_mutex_t * lock, FILE * dbg_fp)
 {
 	struct psl *psl;
 	struct job_event *reset;
-	uint16_t location;
+	struct psl **list;
+	struct psl *prev;
+	pthread_t thread;
+	int len, i;
 
-	location = 0x8000;
+	list = head;
 	if ((psl = (struct psl *)calloc(1, sizeof(struct psl))) == NULL) {
 		perror("malloc");
 		error_msg("Unable to allocation memory for psl");
 		goto init_fail;
 	}
 	psl->timeout = parms->timeout;
-	if ((strlen(id) != 6) || strncmp(id, "afu", 3) || (id[4] != '.')) {
-		warn_msg("Invalid afu name: %s", id);
+	len = parse_afu_name(id, &(psl->major), &(psl->minor));
+	if ((len < 0) || (id[len] != '\0')) {
+		warn_msg("Invalid afu name: %s (expected afu[0-%d].[0-%d])", id,
+			 PSLSE_MAX_ADAPTERS - 1,
+			 PSLSE_MAX_AFUS_PER_ADAPTER - 1);
 		goto init_fail;
 	}
-	if ((id[3] < '0') || (id[3] > '3')) {
-		warn_msg("Invalid afu major: %c", id[3]);
-		goto init_fail;
-	}
-	if ((id[5] < '0') || (id[5] > '3')) {
-		warn_msg("Invalid afu minor: %c", id[5]);
+	psl->dbg_fp = dbg_fp;
+	psl->dbg_id = PSLSE_AFU_ID(psl->major, psl->minor);
+	if (registry->psl[psl->dbg_id] != NULL) {
+		warn_msg("Duplicate afu name: %s", id);
 		goto init_fail;
 	}
-	psl->dbg_fp = dbg_fp;
-	psl->major = id[3] - '0';
-	psl->minor = id[5] - '0';
-	psl->dbg_id = psl->major << 4;
-	psl->dbg_id |= psl->minor;
-	location >>= (4 * psl->major);
-	location >>= psl->minor;
+	psl->registry = registry;
 	if ((psl->name = (char *)malloc(strlen(id) + 1)) == NULL) {
 		perror("malloc");
 		error_msg("Unable to allocation memory for psl->name");
@@ -771,11 +989,14 @@ uint16_t psl_init(struct psl **head, struct parms *parms, char *id, char *host,
 		perror("mmio_init");
 		goto init_fail;
 	}
+	// Random decisions for this AFU come from its own stream
+	prng_seed(&(psl->prng), parms->seed, psl->dbg_id);
 	// Initialize cmd handler
 	debug_msg("%s @ %s:%d: cmd_init", psl->name, psl->host, psl->port);
 	if ((psl->cmd = cmd_init(psl->afu_event, parms, psl->mmio,
-				 &(psl->state), psl->name, psl->dbg_fp,
-				 psl->dbg_id))
+				 &(psl->state), &(psl->cycles),
+				 &(psl->parity_enabled), &(psl->prng),
+				 psl->name, psl->dbg_fp, psl->dbg_id))
 	    == NULL) {
 		perror("cmd_init");
 		goto init_fail;
@@ -785,24 +1006,30 @@ uint16_t psl_init(struct psl **head, struct parms *parms, char *id, char *host,
 	psl->vsec_psl_rev_level= parms->psl_rev_level;
 	psl->vsec_image_loaded= parms->image_loaded;
 	psl->vsec_base_image= parms->base_image;
+	psl->warm_open = parms->warm_open;
 	// Set credits for AFU
 	if (psl_aux1_change(psl->afu_event, psl->cmd->credits) != PSL_SUCCESS) {
 		warn_msg("Unable to set credits");
 		goto init_fail;
 	}
 	// Start psl loop thread
+	psl->head = list;
 	if (pthread_create(&(psl->thread), NULL, _psl_loop, psl)) {
 		perror("pthread_create");
 		goto init_fail;
 	}
 	// Add psl to list
+	prev = NULL;
 	while ((*head != NULL) && ((*head)->major < psl->major)) {
+		prev = *head;
 		head = &((*head)->_next);
 	}
 	while ((*head != NULL) && ((*head)->major == psl->major) &&
 	       ((*head)->minor < psl->minor)) {
+		prev = *head;
 		head = &((*head)->_next);
 	}
+	psl->_prev = prev;
 	psl->_next = *head;
 	if (psl->_next != NULL)
 		psl->_next->_prev = psl;
@@ -833,14 +1060,56 @@ uint16_t psl_init(struct psl **head, struct parms *parms, char *id, char *host,
 	}
 	if (psl->max_clients == 0) {
 		error_msg("AFU programming model is invalid");
-		goto init_fail;
+		goto stop_fail;
 	}
 	psl->client = (struct client **)calloc(psl->max_clients,
 					       sizeof(struct client *));
+	psl->active = (int32_t *) calloc(psl->max_clients, sizeof(int32_t));
+	psl->active_slot = (int32_t *) malloc(psl->max_clients *
+					      sizeof(int32_t));
+	psl->cmd->pending = (uint32_t *) calloc(psl->max_clients,
+						sizeof(uint32_t));
+	if ((psl->client == NULL) || (psl->active == NULL) ||
+	    (psl->active_slot == NULL) || (psl->cmd->pending == NULL)) {
+		perror("malloc");
+		goto stop_fail;
+	}
+	for (i = 0; i < psl->max_clients; i++)
+		psl->active_slot[i] = -1;
 	psl->cmd->client = psl->client;
+	// Commands are only counted once max_clients is set, so the pending
+	// counts have to be in place first
 	psl->cmd->max_clients = psl->max_clients;
+	if ((psl->cmd->erat = erat_init(parms, &(psl->prng),
+					 psl->max_clients)) == NULL) {
+		perror("erat_init");
+		goto stop_fail;
+	}
+	if ((psl->cmd->sched = sched_init(parms, psl->max_clients)) == NULL) {
+		perror("sched_init");
+		goto stop_fail;
+	}
 
-	return location;
+	// Publish in AFU registry
+	registry->psl[psl->dbg_id] = psl;
+	afu_map_set(registry->map, psl->dbg_id);
+	registry->legacy_map |= afu_legacy_location(psl->dbg_id);
+	++registry->count;
+	if (!afu_legacy_location(psl->dbg_id))
+		info_msg("%s is only visible to clients using extended AFU map",
+			 psl->name);
+
+	return 0;
+
+ stop_fail:
+	// The psl thread is running and psl is already in the list.  Let the
+	// thread unlink and free everything on its way out.
+	thread = psl->thread;
+	psl->state = PSLSE_DONE;
+	pthread_mutex_unlock(lock);
+	pthread_join(thread, NULL);
+	pthread_mutex_lock(lock);
+	return -1;
 
  init_fail:
 	if (psl) {
@@ -854,6 +1123,5 @@ uint16_t psl_init(struct psl **head, struct parms *parms, char *id, char *host,
 			free(psl->name);
 		free(psl);
 	}
-	pthread_mutex_unlock(lock);
-	return 0;
+	return -1;
 }
@@ -28,6 +28,13 @@
 #include "parms.h"
 #include "../common/utils.h"
 
+// AFU registry indexed by AFU id for constant time lookup
+struct psl_registry {
+	struct psl *psl[PSLSE_MAX_AFUS];
+	uint8_t map[PSLSE_AFU_MAP_BYTES];
+	uint16_t legacy_map;
+	int count;
+};
 
 struct psl {
 	struct AFU_EVENT *afu_event;
@@ -39,6 +46,7 @@ struct psl {
 	struct job *job;
 	struct mmio *mmio;
 	struct psl **head;
+	struct psl_registry *registry;
 	struct psl *_prev;
 	struct psl *_next;
 	volatile enum pslse_state state;
@@ -50,18 +58,33 @@ struct psl {
 	uint8_t minor;
 	uint8_t dbg_id;
 	int port;
+	uint64_t cycles;
+	struct prng prng;
 	int idle_cycles;
+	int32_t *active;
+	int32_t *active_slot;
 	int max_clients;
+	int active_count;
+	int client_start;
 	int attached_clients;
 	int timeout;
 	int has_been_reset;
+	int warm_open;
+	int afu_reset_idle;
 	uint16_t vsec_caia_version;
 	uint16_t vsec_psl_rev_level;
 	uint16_t vsec_image_loaded;
 	uint16_t vsec_base_image;
 };
 
-uint16_t psl_init(struct psl **head, struct parms *parms, char *id, char *host,
-		  int port, pthread_mutex_t * lock, FILE * dbg_fp);
+int psl_init(struct psl **head, struct psl_registry *registry,
+	     struct parms *parms, char *id, char *host, int port,
+	     pthread_mutex_t * lock, FILE * dbg_fp);
+
+void psl_add_client(struct psl *psl, struct client *client, int32_t context);
+
+void psl_unregister(struct psl *psl);
+
+void psl_stop(struct psl *psl);
 
 #endif				/* _PSL_H_ */
@@ -27,12 +27,22 @@
  *  connections.  Each time a valid client connection is made it will be
  *  assigned to the appropriate psl thread for whichever AFU it is accessing.
  *  If it is the first client to connect then the AFU is reset and the AFU
- *  descriptor is read.
+ *  descriptor is read.  Until a client is associated the main thread services
+ *  it from a single epoll loop together with the listening socket, so the
+ *  handshake, query and open requests of every pending client are handled
+ *  without a thread per connection.  Request bytes are collected in the
+ *  client as they arrive and a request is only handled once it is complete,
+ *  so a slow client never stalls the loop.  With the HOTPLUG parm set the same loop
+ *  watches shim_host.dat, and SIGHUP, to connect and disconnect AFU
+ *  simulators without restarting PSLSE.  A connection that sends PSLSE_MUX
+ *  carries many AFU handles, it is passed to a relay thread in mux.c which
+ *  hands each handle back to this loop as a new client connection.
  */
 
 #include <assert.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <netinet/in.h>
 #include <poll.h>
@@ -43,12 +53,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <termios.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "client.h"
 #include "mmio.h"
+#include "mux.h"
 #include "parms.h"
 #include "psl.h"
 #include "shim_host.h"
@@ -56,14 +70,23 @@
 #include "../common/utils.h"
 
 #define PSL_MAX_IRQS 2037
+#define MAX_EPOLL_EVENTS 64
+#define EPOLL_WAIT_MS 100
 
 struct psl *psl_list;
 struct client *client_list;
+struct psl_registry registry;
 pthread_mutex_t lock;
-uint16_t afu_map;
 int timeout;
 FILE *fp;
 
+static volatile int _shutdown;
+static volatile int _rescan;
+static int _watch_fd = -1;
+static int _epoll_fd = -1;
+static int _mux_pipe[2] = { -1, -1 };
+static char *_host_data_name;
+
 // Disconnect client connections and stop threads gracefully on Ctrl-C
 static void _INThandler(int sig)
 {
@@ -73,15 +96,14 @@ static void _INThandler(int sig)
 
 	// Flush debug output
 	fflush(fp);
+	_shutdown = 1;
 
 	// Shut down PSL threads
 	psl = psl_list;
 	while (psl != NULL) {
 		info_msg("Shutting down connection to %s\n", psl->name);
-		for (i = 0; i < psl->max_clients; i++) {
-			if (psl->client[i] != NULL)
-				psl->client[i]->abort = 1;
-		}
+		for (i = 0; i < psl->active_count; i++)
+			psl->client[psl->active[i]]->abort = 1;
 		psl->state = PSLSE_DONE;
 		thread = psl->thread;
 		psl = psl->_next;
@@ -89,36 +111,104 @@ static void _INThandler(int sig)
 	}
 }
 
-// Find PSL for specific AFU id
-static struct psl *_find_psl(uint8_t id, uint8_t * major, uint8_t * minor)
+// Rescan shim_host.dat on SIGHUP when hotplug is enabled
+static void _HUPhandler(int sig)
 {
-	struct psl *psl;
+	_rescan = 1;
+}
 
-	*major = id >> 4;
-	*minor = id & 0x3;
-	psl = psl_list;
-	while (psl) {
-		if (id == psl->dbg_id)
-			break;
-		psl = psl->_next;
+// Watch directory of shim_host.dat so both in place edits and editors that
+// rename a new copy over the file are seen
+static int _watch_host_data(int epoll_fd, char *path)
+{
+	struct epoll_event event;
+	char *dir, *slash;
+
+	if ((_watch_fd = inotify_init1(IN_NONBLOCK)) < 0) {
+		perror("inotify_init1");
+		return -1;
+	}
+	dir = strdup(path);
+	slash = strrchr(dir, '/');
+	if (slash == NULL) {
+		free(dir);
+		dir = strdup(".");
+		_host_data_name = path;
+	} else {
+		_host_data_name = path + (slash - dir) + 1;
+		slash[(slash == dir) ? 1 : 0] = '\0';
 	}
-	return psl;
+	if (inotify_add_watch(_watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+			      IN_ATTRIB) < 0) {
+		perror("inotify_add_watch");
+		goto watch_fail;
+	}
+	event.events = EPOLLIN;
+	event.data.ptr = &_watch_fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, _watch_fd, &event) < 0) {
+		perror("epoll_ctl");
+		goto watch_fail;
+	}
+	free(dir);
+	return 0;
+
+ watch_fail:
+	free(dir);
+	close(_watch_fd);
+	_watch_fd = -1;
+	return -1;
+}
+
+// Drain inotify events and flag rescan if shim_host.dat changed
+static void _host_data_event()
+{
+	char buffer[4096]
+	    __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	ssize_t len;
+	char *ptr;
+
+	while ((len = read(_watch_fd, buffer, sizeof(buffer))) > 0) {
+		for (ptr = buffer; ptr < buffer + len;
+		     ptr += sizeof(struct inotify_event) + event->len) {
+			event = (struct inotify_event *)ptr;
+			if (event->len && !strcmp(event->name, _host_data_name))
+				_rescan = 1;
+		}
+	}
+}
+
+// Find PSL for specific AFU id, only registered once brought up
+static struct psl *_find_psl(uint8_t id, uint8_t * major, uint8_t * minor)
+{
+	*major = PSLSE_AFU_MAJOR(id);
+	*minor = PSLSE_AFU_MINOR(id);
+	return registry.psl[id];
 }
 
 // Query AFU descriptor data
 static void _query(struct client *client, uint8_t id)
 {
 	struct psl *psl;
+	struct config_record *cr;
 	uint8_t *buffer;
 	uint8_t major, minor;
-	int size, offset;
+	int size, offset, i;
 
 	psl = _find_psl(id, &major, &minor);
+	if (!psl) {
+		info_msg("Did not find valid PSL for afu%d.%d\n", major, minor);
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		return;
+	}
 	size = 1 + sizeof(psl->mmio->desc.num_ints_per_process) + sizeof(client->max_irqs) + 
 	    sizeof(psl->mmio->desc.req_prog_model) +
 	    sizeof(psl->mmio->desc.PerProcessPSA) + sizeof(psl->mmio->desc.PerProcessPSA_offset) +
-	    sizeof(psl->mmio->desc.AFU_EB_len) + sizeof(psl->mmio->desc.crptr->cr_device) +
-	    sizeof(psl->mmio->desc.crptr->cr_vendor) + sizeof(psl->mmio->desc.crptr->cr_class);
+	    sizeof(psl->mmio->desc.AFU_EB_len) +
+	    sizeof(psl->mmio->desc.num_of_afu_CRs) +
+	    psl->mmio->desc.num_of_afu_CRs * (sizeof(cr->cr_device) +
+					      sizeof(cr->cr_vendor) +
+					      sizeof(cr->cr_class));
 	buffer = (uint8_t *) malloc(size);
 	buffer[0] = PSLSE_QUERY;
 	offset = 1;
@@ -148,16 +238,22 @@ static void _query(struct client *client, uint8_t id)
 	       sizeof(psl->mmio->desc.AFU_EB_len));
         offset += sizeof(psl->mmio->desc.AFU_EB_len);
 	memcpy(&(buffer[offset]),
-	       (char *)&(psl->mmio->desc.crptr->cr_device),
-	       sizeof(psl->mmio->desc.crptr->cr_device));
-        offset += sizeof(psl->mmio->desc.crptr->cr_device);
-	memcpy(&(buffer[offset]),
-	       (char *)&(psl->mmio->desc.crptr->cr_vendor),
-	       sizeof(psl->mmio->desc.crptr->cr_vendor));
-        offset += sizeof(psl->mmio->desc.crptr->cr_vendor);
-	memcpy(&(buffer[offset]),
-	       (char *)&(psl->mmio->desc.crptr->cr_class),
-	       sizeof(psl->mmio->desc.crptr->cr_class));
+	       (char *)&(psl->mmio->desc.num_of_afu_CRs),
+	       sizeof(psl->mmio->desc.num_of_afu_CRs));
+	offset += sizeof(psl->mmio->desc.num_of_afu_CRs);
+	// All configuration records cached by read_descriptor()
+	for (i = 0; i < psl->mmio->desc.num_of_afu_CRs; i++) {
+		cr = &(psl->mmio->desc.crptr[i]);
+		memcpy(&(buffer[offset]), (char *)&(cr->cr_device),
+		       sizeof(cr->cr_device));
+		offset += sizeof(cr->cr_device);
+		memcpy(&(buffer[offset]), (char *)&(cr->cr_vendor),
+		       sizeof(cr->cr_vendor));
+		offset += sizeof(cr->cr_vendor);
+		memcpy(&(buffer[offset]), (char *)&(cr->cr_class),
+		       sizeof(cr->cr_class));
+		offset += sizeof(cr->cr_class);
+	}
 	if (put_bytes(client->fd, size, buffer, psl->dbg_fp, psl->dbg_id,
 		      client->context) < 0) {
 		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
@@ -165,22 +261,22 @@ static void _query(struct client *client, uint8_t id)
 	free(buffer);
 }
 
-// Increase the maximum number of interrupts
-static void _max_irqs(struct client *client, uint8_t id)
+// Increase the maximum number of interrupts to the value the client asked for
+static void _max_irqs(struct client *client, uint8_t id, uint8_t * max)
 {
 	struct psl *psl;
-	uint8_t buffer[MAX_LINE_CHARS];
+	uint8_t buffer[3];
 	uint8_t major, minor;
 	uint16_t value;
 
 	// Retrieve requested new maximum interrupts
 	psl = _find_psl(id, &major, &minor);
-	if (get_bytes(client->fd, 2, buffer, psl->timeout, &(client->abort),
-		      psl->dbg_fp, psl->dbg_id, client->context) < 0) {
+	if (!psl) {
+		info_msg("Did not find valid PSL for afu%d.%d\n", major, minor);
 		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
 		return;
 	}
-	memcpy((char *)&client->max_irqs, (char *)buffer, sizeof(uint16_t));
+	memcpy((char *)&client->max_irqs, (char *)max, sizeof(uint16_t));
 	client->max_irqs = ntohs(client->max_irqs);
 
 	// Limit to legal value
@@ -210,54 +306,41 @@ static void _free_client(struct client *client)
 	free(client);
 }
 
-// Handshake with client and attach to PSL
-static struct client *_client_connect(int *fd, char *ip)
+// Handshake with newly accepted client, handshake is "PSLSE" followed by
+// the major and minor version
+static int _client_connect(struct client *client, uint8_t * handshake)
 {
-	struct client *client;
-	uint8_t buffer[MAX_LINE_CHARS];
+	char name[6];
 	uint8_t ack[3];
 	uint16_t map;
-	int rc;
 
 	// Parse client handshake data
 	ack[0] = PSLSE_DETACH;
-	memset(buffer, '\0', MAX_LINE_CHARS);
-	rc = get_bytes(*fd, 5, buffer, timeout, 0, fp, -1, -1);
-	if ((rc < 0) || (strcmp((char *)buffer, "PSLSE"))) {
+	memcpy(name, handshake, 5);
+	name[5] = '\0';
+	if (strcmp(name, "PSLSE")) {
 		info_msg("Connecting application is not PSLSE client\n");
-		info_msg("Expected: \"PSLSE\" Got: \"%s\"", buffer);
-		put_bytes(*fd, 1, ack, fp, -1, -1);
-		close_socket(fd);
-		return NULL;
-	}
-	rc = get_bytes_silent(*fd, 2, buffer, timeout, 0);
-	if ((rc < 0) || ((uint8_t) buffer[0] != PSLSE_VERSION_MAJOR) ||
-	    ((uint8_t) buffer[1] != PSLSE_VERSION_MINOR)) {
+		info_msg("Expected: \"PSLSE\" Got: \"%s\"", name);
+		put_bytes(client->fd, 1, ack, fp, -1, -1);
+		return -1;
+	}
+	if ((handshake[5] != PSLSE_VERSION_MAJOR) ||
+	    (handshake[6] != PSLSE_VERSION_MINOR)) {
 		info_msg("Client is wrong version\n");
-		put_bytes(*fd, 1, ack, fp, -1, -1);
-		close_socket(fd);
-		return NULL;
+		put_bytes(client->fd, 1, ack, fp, -1, -1);
+		return -1;
 	}
-	// Initialize client struct
-	client = (struct client *)calloc(1, sizeof(struct client));
-	client->fd = *fd;
-	client->ip = ip;
-	client->pending = 1;
-	client->timeout = timeout;
-	client->flushing = FLUSH_NONE;
 	client->state = CLIENT_INIT;
 
 	// Return acknowledge to client
 	ack[0] = PSLSE_CONNECT;
-	map = htons(afu_map);
+	map = htons(registry.legacy_map);
 	memcpy(&(ack[1]), &map, sizeof(map));
-	if (put_bytes(client->fd, 3, ack, fp, -1, -1) < 0) {
-		_free_client(client);
-		return NULL;
-	}
+	if (put_bytes(client->fd, 3, ack, fp, -1, -1) < 0)
+		return -1;
 
 	info_msg("%s connected", client->ip);
-	return client;
+	return 0;
 }
 
 // Associate client to PSL
@@ -328,14 +411,15 @@ static int _client_associate(struct client *client, uint8_t id, char afu_type)
 	assert(psl->max_clients > 0);
 	clients = 0;
 	context = -1;
-	for (i = 0; i < psl->max_clients; i++) {
+	for (i = 0; (psl->active_count < psl->max_clients) &&
+	     (i < psl->max_clients); i++) {
 		if (psl->client[i] != NULL)
 			++clients;
 		if ((context < 0) && (psl->client[i] == NULL)) {
 			client->context = context = i;
 			client->state = CLIENT_VALID;
 			client->pending = 0;
-			psl->client[i] = client;
+			psl_add_client(psl, client, i);
 			break;
 		}
 	}
@@ -372,6 +456,12 @@ static int _client_associate(struct client *client, uint8_t id, char afu_type)
 	// don't even send a reset if we've dropped to 0 clients and are now opening a new one
 	switch ( afu_type ) {
 	case 'd':
+		// warm open reuses an AFU that is reset or already resetting
+		if (psl->warm_open && (psl->afu_reset_idle ||
+				       job_reset_queued(psl->job))) {
+			debug_msg("_client_associate: warm open of dedicated device, skipping reset");
+			break;
+		}
 	        // send a reset
 	        debug_msg( "_client_associate: adding reset for open of dedicated device", afu_type );
 		add_job(psl->job, PSL_JOB_RESET, 0L);
@@ -400,70 +490,215 @@ static int _client_associate(struct client *client, uint8_t id, char afu_type)
 	return 0;
 }
 
-static void *_client_loop(void *ptr)
+// Send extended AFU map covering every possible AFU id
+static void _afu_map(struct client *client)
 {
-	struct client *client = (struct client *)ptr;
-	uint8_t data[2];
-	int rc;
+	uint8_t buffer[1 + PSLSE_AFU_MAP_BYTES];
 
-	pthread_mutex_lock(&lock);
-	while (client->pending) {
-		rc = bytes_ready(client->fd, client->timeout, &(client->abort));
-		if (rc == 0) {
-			lock_delay(&lock);
-			continue;
+	buffer[0] = PSLSE_AFU_MAP;
+	memcpy(&(buffer[1]), registry.map, PSLSE_AFU_MAP_BYTES);
+	if (put_bytes(client->fd, sizeof(buffer), buffer, fp, -1, -1) < 0)
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+}
+
+// Switch connection to multiplexed handles, serviced by a relay thread
+static void _client_mux(struct client *client)
+{
+	uint8_t ack = PSLSE_MUX;
+
+	if (client->state != CLIENT_INIT) {
+		warn_msg("Multiplex request from %s before handshake",
+			 client->ip);
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		return;
+	}
+	if (put_bytes(client->fd, 1, &ack, fp, -1, -1) < 0) {
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		return;
+	}
+	epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	if (mux_start(client->fd, client->ip, _mux_pipe[1]) < 0)
+		close_socket(&(client->fd));
+	else
+		info_msg("%s multiplexing AFU handles", client->ip);
+	client->fd = -1;
+	client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+}
+
+// Bytes in the next request from a client that is not yet associated to a
+// PSL.  Must match what _client_request() parses.
+static int _request_size(struct client *client)
+{
+	// Handshake is "PSLSE" and the major and minor version
+	if (client->state == CLIENT_NONE)
+		return 7;
+	if (client->request_len == 0)
+		return 1;
+	switch (client->request[0]) {
+	case PSLSE_QUERY:
+		return 2;
+	case PSLSE_MAX_INT:
+		return 5;
+	case PSLSE_OPEN:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+// Receive what has arrived of the next request without blocking.  Never
+// reads past the request so a connection handed to a psl thread or relay
+// keeps all later data.  Returns 1 once the request is complete, 0 if more
+// is needed and -1 if the client disconnected.
+static int _client_receive(struct client *client)
+{
+	int size, count;
+
+	while (client->request_len < (size = _request_size(client))) {
+		count = recv(client->fd, &(client->request[client->request_len]),
+			     size - client->request_len, MSG_DONTWAIT);
+		if (count == 0)
+			return -1;
+		if (count < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return 0;
+			return -1;
 		}
-		if ((rc < 0) || get_bytes(client->fd, 1, data, 10,
-					  &(client->abort), fp, -1, -1) < 0) {
+		client->request_len += count;
+	}
+	return 1;
+}
+
+// Handle request from a client that is not yet associated to a PSL once all
+// of it has arrived
+static void _client_request(struct client *client)
+{
+	uint8_t *data;
+	int rc;
+
+	if ((rc = _client_receive(client)) <= 0) {
+		if (rc < 0)
 			client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
-			break;
-		}
-		if (data[0] == PSLSE_QUERY) {
-			if (get_bytes_silent(client->fd, 1, data, timeout,
-					     &(client->abort)) < 0) {
-			        debug_msg("_client_loop failed PSLSE_QUERY");
-				client_drop(client, PSL_IDLE_CYCLES,
-					    CLIENT_NONE);
-				break;
-			}
-			_query(client, data[0]);
-			lock_delay(&lock);
-			continue;
-		}
-		if (data[0] == PSLSE_MAX_INT) {
-			if (get_bytes(client->fd, 2, data, timeout,
-				      &(client->abort), fp, -1, -1) < 0) {
-				client_drop(client, PSL_IDLE_CYCLES,
-					    CLIENT_NONE);
-				break;
-			}
-			_max_irqs(client, data[0]);
-			lock_delay(&lock);
-			continue;
-		}
-		if (data[0] == PSLSE_OPEN) {
-			if (get_bytes_silent(client->fd, 2, data, timeout,
-					     &(client->abort)) < 0) {
+		return;
+	}
+	data = client->request;
+	client->request_len = 0;
+	debug_socket_get(fp, -1, -1, data[0]);
+
+	// First data from a new connection is the handshake
+	if (client->state == CLIENT_NONE) {
+		if (_client_connect(client, data) < 0)
+			client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
+		return;
+	}
+
+	switch (data[0]) {
+	case PSLSE_QUERY:
+		_query(client, data[1]);
+		break;
+	case PSLSE_AFU_MAP:
+		_afu_map(client);
+		break;
+	case PSLSE_MUX:
+		_client_mux(client);
+		break;
+	case PSLSE_MAX_INT:
+		_max_irqs(client, data[1], &(data[3]));
+		break;
+	case PSLSE_OPEN:
+		if (_client_associate(client, data[1], (char)data[2]) < 0) {
+			// Socket is already closed, release struct on next sweep
+			if (client->state != CLIENT_VALID)
 				client_drop(client, PSL_IDLE_CYCLES,
 					    CLIENT_NONE);
-				debug_msg("_client_loop: client associate failed; could not communicate with socket");
-				break;
-			}
-			_client_associate(client, data[0], (char)data[1]);
-			debug_msg("_client_loop: client associated");
 			break;
 		}
-		client->pending = 0;
+		debug_msg("_client_request: client associated");
+		break;
+	default:
+		warn_msg("Unexpected request 0x%02x from %s", data[0],
+			 client->ip);
+		client_drop(client, PSL_IDLE_CYCLES, CLIENT_NONE);
 		break;
-		lock_delay(&lock);
 	}
-	pthread_mutex_unlock(&lock);
+}
+
+// Track new client connection and register it with epoll
+static int _client_add(int epoll_fd, int connect_fd, char *ip)
+{
+	struct epoll_event event;
+	struct client *client;
 
-	// Terminate thread
-	pthread_exit(NULL);
+	// Handshake happens once the client sends data
+	client = (struct client *)calloc(1, sizeof(struct client));
+	client->fd = connect_fd;
+	client->ip = ip;
+	client->pending = 1;
+	client->timeout = timeout;
+	client->flushing = FLUSH_NONE;
+	client->state = CLIENT_NONE;
+	event.events = EPOLLIN;
+	event.data.ptr = client;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connect_fd, &event) < 0) {
+		perror("epoll_ctl");
+		close_socket(&(client->fd));
+		_free_client(client);
+		return 0;
+	}
+	if (client_list != NULL)
+		client_list->_prev = client;
+	client->_next = client_list;
+	client_list = client;
+	return 1;
+}
+
+// Add handles opened on multiplexed connections as new clients
+static int _mux_accept(int epoll_fd)
+{
+	struct mux_client *handle;
+	int accepted;
+
+	accepted = 0;
+	while (read(_mux_pipe[0], &handle, sizeof(handle)) == sizeof(handle)) {
+		accepted += _client_add(epoll_fd, handle->fd, handle->ip);
+		free(handle);
+	}
+	return accepted;
 }
 
-static int _start_server()
+// Accept all queued connections and register them with epoll
+static int _client_accept(int listen_fd, int epoll_fd)
+{
+	struct sockaddr_in client_addr;
+	socklen_t client_len;
+	int connect_fd, accepted;
+	char *ip;
+
+	accepted = 0;
+	while (1) {
+		client_len = sizeof(client_addr);
+		connect_fd = accept(listen_fd, (struct sockaddr *)&client_addr,
+				    &client_len);
+		if (connect_fd < 0) {
+			if (errno == EINTR)
+				continue;
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+				perror("accept");
+			break;
+		}
+		ip = (char *)malloc(INET_ADDRSTRLEN + 1);
+		inet_ntop(AF_INET, &(client_addr.sin_addr.s_addr), ip,
+			  INET_ADDRSTRLEN);
+		info_msg("Connection from %s", ip);
+		accepted += _client_add(epoll_fd, connect_fd, ip);
+	}
+
+	return accepted;
+}
+
+static int _start_server(int backlog)
 {
 	struct sockaddr_in serv_addr;
 	int listen_fd, port, bound, yes;
@@ -501,7 +736,16 @@ static int _start_server()
 		}
 		bound = 1;
 	}
-	listen(listen_fd, 4);	// FIXME: constant 4
+	if (listen(listen_fd, backlog) < 0) {
+		perror("listen");
+		return -1;
+	}
+	// Connections are accepted from the epoll loop, never block there
+	if (fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK)
+	    < 0) {
+		perror("fcntl");
+		return -1;
+	}
 	hostname[MAX_LINE_CHARS - 1] = '\0';
 	gethostname(hostname, MAX_LINE_CHARS - 1);
 	info_msg("Started PSLSE server, listening on %s:%d", hostname, port);
@@ -515,18 +759,17 @@ static int _start_server()
 
 int main(int argc, char **argv)
 {
-	struct sockaddr_in client_addr;
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	struct epoll_event event;
 	struct client *client;
 	struct client **client_ptr;
-	int listen_fd, connect_fd;
-	socklen_t client_len;
+	int listen_fd, epoll_fd, count, accepted, i;
 	sigset_t set;
 	struct sigaction action;
 	char *shim_host_path;
 	char *parms_path;
 	char *debug_log_path;
 	struct parms *parms;
-	char *ip;
 
 	// Open debug.log file
 	debug_log_path = getenv("DEBUG_LOG_PATH");
@@ -570,34 +813,97 @@ int main(int argc, char **argv)
 	pthread_mutex_lock(&lock);
 	shim_host_path = getenv("SHIM_HOST_DAT");
 	if (!shim_host_path) shim_host_path = "shim_host.dat";
-	afu_map = parse_host_data(&psl_list, parms, shim_host_path, &lock, fp);
-	if (psl_list == NULL) {
+	if ((parse_host_data(&psl_list, &registry, parms, shim_host_path, &lock,
+			     fp) == 0) && !parms->hotplug) {
+		pthread_mutex_unlock(&lock);
 		free(parms);
 		fclose(fp);
 		warn_msg("Unable to connect to any simulators");
 		return -1;
 	}
 	// Start server
-	if ((listen_fd = _start_server()) < 0) {
+	if ((listen_fd = _start_server(parms->listen_backlog)) < 0) {
+		pthread_mutex_unlock(&lock);
 		free(parms);
 		fclose(fp);
 		return -1;
 	}
-	// Watch for client connections
-	while (psl_list != NULL) {
-		// Wait for next client to connect
-		client_len = sizeof(client_addr);
+	_epoll_fd = epoll_fd = epoll_create1(0);
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if ((epoll_fd < 0) ||
+	    (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) < 0)) {
+		perror("epoll");
 		pthread_mutex_unlock(&lock);
-		connect_fd = accept(listen_fd, (struct sockaddr *)&client_addr,
-				    &client_len);
+		free(parms);
+		fclose(fp);
+		return -1;
+	}
+	// Handles opened on multiplexed connections arrive through a pipe
+	event.data.ptr = &_mux_pipe[0];
+	if ((pipe(_mux_pipe) < 0) ||
+	    (fcntl(_mux_pipe[0], F_SETFL, O_NONBLOCK) < 0) ||
+	    (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, _mux_pipe[0], &event) < 0)) {
+		perror("mux pipe");
+		pthread_mutex_unlock(&lock);
+		free(parms);
+		fclose(fp);
+		return -1;
+	}
+	// Watch for AFU simulators being added, removed or restarted
+	if (parms->hotplug) {
+		_watch_host_data(epoll_fd, shim_host_path);
+		action.sa_handler = _HUPhandler;
+		sigaction(SIGHUP, &action, NULL);
+	}
+	// Watch for client connections and requests from pending clients
+	while (!_shutdown && ((psl_list != NULL) || parms->hotplug)) {
+		pthread_mutex_unlock(&lock);
+		count = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS,
+				   EPOLL_WAIT_MS);
 		pthread_mutex_lock(&lock);
-		if (connect_fd < 0) {
+		if (count < 0) {
+			if (errno != EINTR)
+				perror("epoll_wait");
 			lock_delay(&lock);
 			continue;
 		}
-		ip = (char *)malloc(INET_ADDRSTRLEN + 1);
-		inet_ntop(AF_INET, &(client_addr.sin_addr.s_addr), ip,
-			  INET_ADDRSTRLEN);
+		accepted = 0;
+		for (i = 0; i < count; i++) {
+			client = (struct client *)events[i].data.ptr;
+			if (client == NULL) {
+				accepted += _client_accept(listen_fd, epoll_fd);
+				continue;
+			}
+			if (events[i].data.ptr == &_watch_fd) {
+				_host_data_event();
+				continue;
+			}
+			if (events[i].data.ptr == &_mux_pipe[0]) {
+				accepted += _mux_accept(epoll_fd);
+				continue;
+			}
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				client_drop(client, PSL_IDLE_CYCLES,
+					    CLIENT_NONE);
+			else
+				_client_request(client);
+			// Associated clients are now serviced by psl thread
+			if (!client->pending) {
+				if (client->fd >= 0)
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL,
+						  client->fd, NULL);
+				if (client->state == CLIENT_NONE)
+					close_socket(&(client->fd));
+			}
+		}
+		if (_rescan) {
+			_rescan = 0;
+			rescan_host_data(&psl_list, &registry, parms,
+					 shim_host_path, &lock, fp);
+		}
+		if (!accepted)
+			continue;
 		// Clean up disconnected clients
 		client_ptr = &client_list;
 		while (*client_ptr != NULL) {
@@ -608,40 +914,26 @@ int main(int argc, char **argv)
 				if (client->_next != NULL)
 					client->_next->_prev = client->_prev;
 				_free_client(client);
-				lock_delay(&lock);
 				continue;
 			}
 			client_ptr = &((*client_ptr)->_next);
 		}
-		// Add new client
-		info_msg("Connection from %s", ip);
-		client = _client_connect(&connect_fd, ip);
-		if (client != NULL) {
-			if (client_list != NULL)
-				client_list->_prev = client;
-			client->_next = client_list;
-			client_list = client;
-			if (pthread_create(&(client->thread), NULL,
-					   _client_loop, client)) {
-				perror("pthread_create");
-				break;
-			}
-		}
-		lock_delay(&lock);
 	}
 	info_msg("No AFUs connected, Shutting down PSLSE\n");
+	if (_watch_fd >= 0)
+		close(_watch_fd);
+	close(_mux_pipe[0]);
+	close(_mux_pipe[1]);
+	close(epoll_fd);
 	close_socket(&listen_fd);
 
-	// Shutdown unassociated client connections
+	// Shutdown remaining client connections
 	while (client_list != NULL) {
 		client = client_list;
 		client_list = client->_next;
-		if (client->pending)
-			client->pending = 0;
-		pthread_mutex_unlock(&lock);
-		pthread_join(client->thread, NULL);
-		pthread_mutex_lock(&lock);
-		close_socket(&(client->fd));
+		client->pending = 0;
+		if (client->fd >= 0)
+			close_socket(&(client->fd));
 		_free_client(client);
 	}
 	pthread_mutex_unlock(&lock);
@@ -0,0 +1,245 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Description: sched.c
+ *
+ *  This file contains the scheduler that decides which context is served
+ *  next when several contexts have memory requests, responses or interrupts
+ *  waiting.  Each time the cmd code looks for work of a class it marks the
+ *  contexts that have some with sched_ready() and asks sched_pick() which
+ *  context to take it from.  The SCHEDULER parm selects the policy:
+ *
+ *   FIFO        - no choice is made, the first waiting event in the list is
+ *                 served as before
+ *   ROUND_ROBIN - contexts take turns, starting after the last one picked
+ *   WEIGHTED    - contexts take turns, each getting up to CONTEXT_WEIGHT
+ *                 turns per round
+ *   PRIORITY    - the context with the highest CONTEXT_WEIGHT is picked,
+ *                 contexts with equal weight take turns
+ *
+ *  sched_served() counts the work done for each context.  Counts are
+ *  reported when a context is released and when the AFU disconnects.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sched.h"
+#include "../common/utils.h"
+
+// Initialize scheduler for AFU with max_contexts contexts
+struct sched *sched_init(struct parms *parms, int max_contexts)
+{
+	struct sched *sched;
+	int i;
+
+	sched = (struct sched *)calloc(1, sizeof(struct sched));
+	if (sched == NULL)
+		return NULL;
+
+	sched->policy = parms->sched_policy;
+	sched->max_contexts = max_contexts;
+	sched->weight = (uint32_t *) calloc(max_contexts, sizeof(uint32_t));
+	sched->ready = (int32_t *) calloc(max_contexts, sizeof(int32_t));
+	sched->is_ready = (uint8_t *) calloc(max_contexts, sizeof(uint8_t));
+	if ((sched->weight == NULL) || (sched->ready == NULL) ||
+	    (sched->is_ready == NULL))
+		goto init_fail;
+	for (i = 0; i < SCHED_CLASSES; i++) {
+		sched->last[i] = -1;
+		sched->credit[i] = (uint32_t *) calloc(max_contexts,
+						       sizeof(uint32_t));
+		sched->served[i] = (uint64_t *) calloc(max_contexts,
+						       sizeof(uint64_t));
+		if ((sched->credit[i] == NULL) || (sched->served[i] == NULL))
+			goto init_fail;
+	}
+	for (i = 0; i < max_contexts; i++) {
+		if (i < MAX_WEIGHTED_CONTEXTS)
+			sched->weight[i] = parms->context_weight[i];
+		else
+			sched->weight[i] = 1;
+	}
+	return sched;
+
+ init_fail:
+	sched_free(sched);
+	return NULL;
+}
+
+// Start over collecting the contexts that have work ready
+void sched_clear(struct sched *sched)
+{
+	int i;
+
+	if (sched == NULL)
+		return;
+	for (i = 0; i < sched->ready_count; i++)
+		sched->is_ready[sched->ready[i]] = 0;
+	sched->ready_count = 0;
+}
+
+// Mark context as having work ready
+void sched_ready(struct sched *sched, int32_t context)
+{
+	if ((sched == NULL) || (context < 0) ||
+	    (context >= sched->max_contexts) || sched->is_ready[context])
+		return;
+	sched->is_ready[context] = 1;
+	sched->ready[sched->ready_count++] = context;
+}
+
+// Rank of context for policy, higher ranks are picked first
+static uint32_t _rank(struct sched *sched, enum sched_class class,
+		      int32_t context)
+{
+	switch (sched->policy) {
+	case SCHED_WEIGHTED:
+		return (sched->credit[class][context] > 0);
+	case SCHED_PRIORITY:
+		return sched->weight[context];
+	default:
+		return 0;
+	}
+}
+
+// Find the ready context with the highest rank, ties go to the first one
+// after the last context picked
+static int32_t _next(struct sched *sched, enum sched_class class)
+{
+	int32_t context, best;
+	uint32_t rank, best_rank;
+	int i, distance, best_distance;
+
+	best = -1;
+	best_rank = 0;
+	best_distance = 0;
+	for (i = 0; i < sched->ready_count; i++) {
+		context = sched->ready[i];
+		rank = _rank(sched, class, context);
+		distance = (context - sched->last[class] - 1 +
+			    sched->max_contexts) % sched->max_contexts;
+		if ((best < 0) || (rank > best_rank) ||
+		    ((rank == best_rank) && (distance < best_distance))) {
+			best = context;
+			best_rank = rank;
+			best_distance = distance;
+		}
+	}
+	return best;
+}
+
+// Pick the context to serve work of class from, -1 leaves the choice to the
+// caller
+int32_t sched_pick(struct sched *sched, enum sched_class class)
+{
+	int32_t context;
+	int i;
+
+	if ((sched == NULL) || (sched->policy == SCHED_FIFO) ||
+	    (sched->ready_count == 0))
+		return -1;
+
+	context = _next(sched, class);
+
+	// Start a new weighted round once no ready context has turns left
+	if ((sched->policy == SCHED_WEIGHTED) &&
+	    (sched->credit[class][context] == 0)) {
+		for (i = 0; i < sched->ready_count; i++)
+			sched->credit[class][sched->ready[i]] =
+			    sched->weight[sched->ready[i]];
+		context = _next(sched, class);
+	}
+
+	sched->last[class] = context;
+	return context;
+}
+
+// Count work of class done for context
+void sched_served(struct sched *sched, enum sched_class class,
+		  int32_t context)
+{
+	if ((sched == NULL) || (context < 0) ||
+	    (context >= sched->max_contexts))
+		return;
+	++sched->served[class][context];
+	++sched->total[class];
+	if (sched->credit[class][context] > 0)
+		--sched->credit[class][context];
+}
+
+// Start the counts and turns of context over
+void sched_reset(struct sched *sched, int32_t context)
+{
+	int i;
+
+	if ((sched == NULL) || (context < 0) ||
+	    (context >= sched->max_contexts))
+		return;
+	for (i = 0; i < SCHED_CLASSES; i++) {
+		sched->served[i][context] = 0;
+		sched->credit[i][context] = 0;
+	}
+}
+
+// Report counts for context, or totals if context is negative
+void sched_report(struct sched *sched, char *name, int32_t context)
+{
+	uint64_t memory, responses, interrupts;
+
+	if ((sched == NULL) || (context >= sched->max_contexts))
+		return;
+
+	if (context < 0) {
+		memory = sched->total[SCHED_MEMORY];
+		responses = sched->total[SCHED_RESPONSE];
+		interrupts = sched->total[SCHED_INTERRUPT];
+	} else {
+		memory = sched->served[SCHED_MEMORY][context];
+		responses = sched->served[SCHED_RESPONSE][context];
+		interrupts = sched->served[SCHED_INTERRUPT][context];
+	}
+	if (!(memory + responses + interrupts))
+		return;
+
+	if (context < 0)
+		info_msg("%s served: %"PRIu64" memory requests, %"PRIu64
+			 " responses, %"PRIu64" interrupts", name, memory,
+			 responses, interrupts);
+	else
+		info_msg("%s served context %d: %"PRIu64" memory requests, %"
+			 PRIu64" responses, %"PRIu64" interrupts", name,
+			 context, memory, responses, interrupts);
+}
+
+// Free scheduler
+void sched_free(struct sched *sched)
+{
+	int i;
+
+	if (sched == NULL)
+		return;
+	for (i = 0; i < SCHED_CLASSES; i++) {
+		free(sched->credit[i]);
+		free(sched->served[i]);
+	}
+	free(sched->weight);
+	free(sched->ready);
+	free(sched->is_ready);
+	free(sched);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2014,2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+
+#include "parms.h"
+
+enum sched_policy {
+	SCHED_FIFO,
+	SCHED_ROUND_ROBIN,
+	SCHED_WEIGHTED,
+	SCHED_PRIORITY
+};
+
+// Kinds of work each scheduled separately
+enum sched_class {
+	SCHED_MEMORY,
+	SCHED_RESPONSE,
+	SCHED_INTERRUPT,
+	SCHED_CLASSES
+};
+
+struct sched {
+	enum sched_policy policy;
+	uint32_t *weight;
+	uint32_t *credit[SCHED_CLASSES];
+	uint64_t *served[SCHED_CLASSES];
+	uint64_t total[SCHED_CLASSES];
+	int32_t last[SCHED_CLASSES];
+	int32_t *ready;
+	uint8_t *is_ready;
+	int ready_count;
+	int max_contexts;
+};
+
+struct sched *sched_init(struct parms *parms, int max_contexts);
+
+void sched_clear(struct sched *sched);
+
+void sched_ready(struct sched *sched, int32_t context);
+
+int32_t sched_pick(struct sched *sched, enum sched_class class);
+
+void sched_served(struct sched *sched, enum sched_class class,
+		  int32_t context);
+
+void sched_reset(struct sched *sched, int32_t context);
+
+void sched_report(struct sched *sched, char *name, int32_t context);
+
+void sched_free(struct sched *sched);
+
+#endif				/* _SCHED_H_ */
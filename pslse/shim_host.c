@@ -19,88 +19,236 @@
  *
  *  This file contains parse_host_data() which reads the file with the
  *  hostname and ports of each AFU simulator and calls psl_init for each.
+ *  Each psl_init runs in its own thread so the connect, reset and
+ *  descriptor reads of all AFUs overlap.  parse_host_data() returns as soon
+ *  as the first AFU is ready, the rest are added to the AFU map as they
+ *  complete.  rescan_host_data() re-reads the file while PSLSE is running to
+ *  bring up new or restarted simulators and shut down removed ones.
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "shim_host.h"
 #include "../common/utils.h"
 
-// Parse file to find hostname and ports for AFU simulator(s)
-uint16_t parse_host_data(struct psl ** head, struct parms * parms,
-			 char *filename, pthread_mutex_t * lock, FILE * dbg_fp)
+struct bringup {
+	struct psl **head;
+	struct psl_registry *registry;
+	struct parms *parms;
+	char *afu_id;
+	char *host;
+	int port;
+	int id;
+	pthread_mutex_t *lock;
+	FILE *dbg_fp;
+};
+
+static pthread_cond_t _ready = PTHREAD_COND_INITIALIZER;
+static int _pending;
+static uint8_t _starting[PSLSE_AFU_MAP_BYTES];
+
+// Bring up a single AFU, psl_init() publishes it in the AFU registry
+static void *_bringup(void *ptr)
+{
+	struct bringup *afu = (struct bringup *)ptr;
+
+	pthread_mutex_lock(afu->lock);
+	psl_init(afu->head, afu->registry, afu->parms, afu->afu_id, afu->host,
+		 afu->port, afu->lock, afu->dbg_fp);
+	if (afu->id >= 0)
+		afu_map_clear(_starting, afu->id);
+	--_pending;
+	pthread_cond_broadcast(&_ready);
+	pthread_mutex_unlock(afu->lock);
+
+	free(afu->afu_id);
+	free(afu->host);
+	free(afu);
+	pthread_exit(NULL);
+}
+
+static int _start_bringup(struct psl **head, struct psl_registry *registry,
+			  struct parms *parms, char *afu_id, char *host,
+			  int port, int id, pthread_mutex_t * lock,
+			  FILE * dbg_fp)
+{
+	struct bringup *afu;
+	pthread_t thread;
+
+	if ((afu = (struct bringup *)calloc(1, sizeof(struct bringup))) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	afu->head = head;
+	afu->registry = registry;
+	afu->parms = parms;
+	afu->afu_id = strdup(afu_id);
+	afu->host = strdup(host);
+	afu->port = port;
+	afu->id = id;
+	afu->lock = lock;
+	afu->dbg_fp = dbg_fp;
+	if ((afu->afu_id == NULL) || (afu->host == NULL)) {
+		perror("strdup");
+		goto bringup_fail;
+	}
+	if (pthread_create(&thread, NULL, _bringup, afu)) {
+		perror("pthread_create");
+		goto bringup_fail;
+	}
+	pthread_detach(thread);
+	if (id >= 0)
+		afu_map_set(_starting, id);
+	++_pending;
+	return 0;
+
+ bringup_fail:
+	free(afu->afu_id);
+	free(afu->host);
+	free(afu);
+	return -1;
+}
+
+// Split "AFU_DEVICE,HOSTNAME:PORT" line in place, -1 for lines to skip
+static int _parse_line(char *hostdata, char *filename, char **afu_id,
+		       char **host, int *port)
+{
+	char *comment, *port_str;
+
+	*afu_id = hostdata;
+	comment = strchr(hostdata, '#');
+	if (comment)
+		return -1;
+	*host = strchr(hostdata, ',');
+	if (*host) {
+		**host = '\0';
+		++(*host);
+	} else {
+		error_msg("Invalid format in %s: Expected ',' :%s\n",
+			  filename, hostdata);
+		return -1;
+	}
+	port_str = strchr(*host, ':');
+	if (port_str) {
+		*port_str = '\0';
+		++port_str;
+	} else {
+		error_msg("Invalid format in %s: Expected ':' :%s\n",
+			  filename, *host);
+		return -1;
+	}
+	*port = atoi(port_str);
+	return 0;
+}
+
+static FILE *_open_host_data(char *filename)
 {
 	FILE *fp;
-	struct psl *psl;
-	char *hostdata, *comment, *afu_id, *host, *port_str;
-	uint16_t location, afu_map;
-	int port;
+	char *msg;
 
-	afu_map = 0;
-	*head = NULL;
 	fp = fopen(filename, "r");
 	if (!fp) {
-		hostdata =
-		    (char *)malloc(strlen(filename) + strlen("fopen:") + 1);
-		strcpy(hostdata, "fopen:");
-		strcat(hostdata, filename);
-		perror(hostdata);
-		free(hostdata);
-		return 0;
+		msg = (char *)malloc(strlen(filename) + strlen("fopen:") + 1);
+		strcpy(msg, "fopen:");
+		strcat(msg, filename);
+		perror(msg);
+		free(msg);
 	}
-	host = NULL;
-	port_str = NULL;
+	return fp;
+}
+
+// Parse file to find hostname and ports for AFU simulator(s).  Caller must
+// hold lock.  Returns the number of registered AFUs once at least one AFU is
+// ready or all of them have failed.  AFUs that finish later are added to the
+// registry under lock.
+int parse_host_data(struct psl **head, struct psl_registry *registry,
+		    struct parms *parms, char *filename,
+		    pthread_mutex_t * lock, FILE * dbg_fp)
+{
+	FILE *fp;
+	char *hostdata, *afu_id, *host;
+	uint8_t major, minor;
+	int port, id;
+
+	memset(registry, 0, sizeof(struct psl_registry));
+	*head = NULL;
+	if ((fp = _open_host_data(filename)) == NULL)
+		return 0;
 	hostdata = (char *)malloc(MAX_LINE_CHARS);
 	while (fgets(hostdata, MAX_LINE_CHARS - 1, fp)) {
 		// Parse host & port from file
-		afu_id = hostdata;
-		comment = strchr(hostdata, '#');
-		if (comment)
-			continue;
-		host = strchr(hostdata, ',');
-		if (host) {
-			*host = '\0';
-			++host;
-		} else {
-			error_msg("Invalid format in %s: Expected ',' :%s\n",
-				  filename, hostdata);
-			continue;
-		}
-		port_str = strchr(host, ':');
-		if (port_str) {
-			*port_str = '\0';
-			++port_str;
-		} else {
-			error_msg("Invalid format in %s: Expected ':' :%s\n",
-				  filename, host);
+		if (_parse_line(hostdata, filename, &afu_id, &host, &port) < 0)
 			continue;
-		}
-		if (!host) {
-			error_msg("Invalid format in %s, hostname not found\n");
-			continue;
-		}
-		if (!port_str) {
-			error_msg("Invalid format in %s, Port not found\n");
-			continue;
-		}
-		port = atoi(port_str);
+		id = -1;
+		if (parse_afu_name(afu_id, &major, &minor) > 0)
+			id = PSLSE_AFU_ID(major, minor);
+
+		// Initialize PSL in the background
+		_start_bringup(head, registry, parms, afu_id, host, port, id,
+			       lock, dbg_fp);
+	}
+	free(hostdata);
+	fclose(fp);
+
+	// Wait for first AFU to be ready
+	while ((registry->count == 0) && _pending)
+		pthread_cond_wait(&_ready, lock);
+
+	return registry->count;
+}
+
+// Re-read file while running.  Listed AFUs that aren't registered or being
+// brought up are started, this re-attaches simulators that were restarted.
+// Registered AFUs that are no longer listed, or listed with another host or
+// port, are shut down.  Caller must hold lock.
+void rescan_host_data(struct psl **head, struct psl_registry *registry,
+		      struct parms *parms, char *filename,
+		      pthread_mutex_t * lock, FILE * dbg_fp)
+{
+	FILE *fp;
+	struct psl *psl;
+	uint8_t listed[PSLSE_AFU_MAP_BYTES];
+	char *hostdata, *afu_id, *host;
+	uint8_t major, minor;
+	int port, id, len;
 
-		// Initialize PSL
-		if ((location = psl_init(head, parms, afu_id, host, port,
-					 lock, dbg_fp)) == 0) {
+	if ((fp = _open_host_data(filename)) == NULL)
+		return;
+	info_msg("Rescanning %s", filename);
+	memset(listed, 0, sizeof(listed));
+	hostdata = (char *)malloc(MAX_LINE_CHARS);
+	while (fgets(hostdata, MAX_LINE_CHARS - 1, fp)) {
+		if (_parse_line(hostdata, filename, &afu_id, &host, &port) < 0)
+			continue;
+		len = parse_afu_name(afu_id, &major, &minor);
+		if ((len < 0) || (afu_id[len] != '\0')) {
+			warn_msg("Invalid afu name: %s", afu_id);
 			continue;
 		}
-		afu_map |= location;
+		id = PSLSE_AFU_ID(major, minor);
+		afu_map_set(listed, id);
 
-		// Update all psl entries to point to new list head
-		psl = *head;
-		while (psl) {
-			psl->head = head;
-			psl = psl->_next;
+		// Simulator moved, drop old connection before bringing up new
+		psl = registry->psl[id];
+		if ((psl != NULL) && (strcmp(psl->host, host) ||
+				      (psl->port != port))) {
+			psl_stop(psl);
+			psl = NULL;
 		}
+		if ((psl != NULL) || afu_map_test(_starting, id))
+			continue;
+		info_msg("Adding %s @ %s:%d", afu_id, host, port);
+		_start_bringup(head, registry, parms, afu_id, host, port, id,
+			       lock, dbg_fp);
 	}
 	free(hostdata);
 	fclose(fp);
 
-	return afu_map;
+	// Shut down AFUs removed from file
+	for (id = afu_map_next(registry->map, -1); id >= 0;
+	     id = afu_map_next(registry->map, id)) {
+		if (!afu_map_test(listed, id))
+			psl_stop(registry->psl[id]);
+	}
 }
@@ -24,7 +24,12 @@
 #include "parms.h"
 #include "psl.h"
 
-uint16_t parse_host_data(struct psl ** head, struct parms * parms,
-			 char *filename, pthread_mutex_t * lock, FILE * dbg_fp);
+int parse_host_data(struct psl **head, struct psl_registry *registry,
+		    struct parms *parms, char *filename,
+		    pthread_mutex_t * lock, FILE * dbg_fp);
+
+void rescan_host_data(struct psl **head, struct psl_registry *registry,
+		      struct parms *parms, char *filename,
+		      pthread_mutex_t * lock, FILE * dbg_fp);
 
 #endif				/* _SHIM_HOST_H_ */
@@ -120,6 +120,19 @@ Descriptor::parse_descriptor_file (string filename)
         else
             warn_msg ("Field %s is currently not supported", field.c_str ());
     }
+
+    // fill error buffer so each byte holds the low byte of its offset,
+    // doublewords set with data lines are kept
+    uint64_t eb_offset = get_AFU_EB_offset ();
+    for (uint64_t i = 0; i < get_AFU_EB_len (); i += 8) {
+        uint32_t index = to_vector_index (eb_offset + i);
+        while (index >= regs.size ())
+            regs.push_back (0);
+        if (regs[index])
+            continue;
+        for (uint64_t byte = 0; byte < 8; byte++)
+            regs[index] |= ((i + byte) & 0xFF) << (56 - 8 * byte);
+    }
 }
 
 uint32_t Descriptor::to_vector_index (uint32_t byte_address) const
@@ -130,6 +143,9 @@ uint32_t Descriptor::to_vector_index (uint32_t byte_address) const
 uint64_t
 Descriptor::get_reg (uint32_t word_address, uint32_t mmio_double) const
 {
+    if (to_vector_index (word_address << 2) >= regs.size ())
+        return 0;
+
     uint64_t
     data = regs[to_vector_index (word_address << 2)];
 
@@ -229,13 +229,17 @@ def start_pslse(path, pslse, port, parm_list):
 	os.remove(parms)
 	return process
 
-def check_for_fail(process, output, fails):
+def check_for_fail(process, output, fails, served=None):
 	
 	# Check output for fail message
 	poller = register_poller(output)
 	while poller_ready(poller, process) is True:
 		# Read next line of stdout from pslse
 		out = output.readline()
+		# Collect memory requests pslse served for each context
+		counted = re.match('.*served context (\d+): (\d+) memory requests', out)
+		if counted and (served is not None):
+			served[int(counted.group(1))] = int(counted.group(2))
 		# Check all possible fail conditions for match
 		for fail in fails:
 			pattern = '.*' + fail + '.*'
@@ -245,6 +249,33 @@ def check_for_fail(process, output, fails):
 				return True
 	return False
 
+# Check the memory requests pslse served for each context follow the weights
+# given as "context:weight,...".  Each count divided by its weight must be
+# within a factor of 2 of the others.  The scheduler hands turns a busy
+# context can not use to the others, so shares only approach the weights.
+def check_weights(process, weights, served):
+	expected = {}
+	for pair in weights.split(','):
+		context, weight = pair.split(':')
+		expected[int(context)] = int(weight)
+	# pslse reports a context after it is freed, wait for late reports
+	wait_start = time.time()
+	while not set(expected).issubset(served):
+		if (time.time() - wait_start) > 5:
+			print "REGRESS:FAILED"
+			print "Served counts missing for contexts", sorted(set(expected) - set(served))
+			return True
+		check_for_fail(process, process.stdout, [], served)
+	share = {}
+	for context, weight in expected.iteritems():
+		share[context] = float(served[context]) / weight
+		print "REGRESS: Context %d weight %d served %d memory requests" % (context, weight, served[context])
+	if (min(share.values()) == 0) or ((max(share.values()) / min(share.values())) > 2):
+		print "REGRESS:FAILED"
+		print "Served counts do not follow context weights"
+		return True
+	return False
+
 def run_tests(tree, test_afu_dir, test_afu_exec, pslse_dir, pslse_exec, tests_dir, test_file, seed):
 	### Start AFUs
 	# Open shim_host.dat
@@ -326,6 +357,7 @@ def run_tests(tree, test_afu_dir, test_afu_exec, pslse_dir, pslse_exec, tests_di
 		# Search stdout for PASSED or FAILED messages
 		test_stdout = register_poller(process.stdout)
 		test_stderr = register_poller(process.stderr)
+		served = {}
 		counter = 0
 		while not passed and not failed:
 			counter += 1
@@ -341,7 +373,7 @@ def run_tests(tree, test_afu_dir, test_afu_exec, pslse_dir, pslse_exec, tests_di
 				failed = True
 				break
 			# Flush pslse stderr
-			if check_for_fail(pslse, pslse.stderr, pslse_fail):
+			if check_for_fail(pslse, pslse.stderr, pslse_fail, served):
 				failed = True
 				break
 			# Flush test stderr
@@ -352,7 +384,7 @@ def run_tests(tree, test_afu_dir, test_afu_exec, pslse_dir, pslse_exec, tests_di
 					print line
 				continue
 			# Flush pslse stdout
-			if check_for_fail(pslse, pslse.stdout, pslse_fail):
+			if check_for_fail(pslse, pslse.stdout, pslse_fail, served):
 				failed = True
 				break
 			# Flush test output
@@ -366,9 +398,11 @@ def run_tests(tree, test_afu_dir, test_afu_exec, pslse_dir, pslse_exec, tests_di
 
 		# Check for pslse fails
 		if not failed:
-			failed = check_for_fail(pslse, pslse.stdout, pslse_fail)
+			failed = check_for_fail(pslse, pslse.stdout, pslse_fail, served)
 		if not failed:
-			failed = check_for_fail(pslse, pslse.stderr, pslse_fail)
+			failed = check_for_fail(pslse, pslse.stderr, pslse_fail, served)
+		if passed and not failed and test.get('weights'):
+			failed = check_weights(pslse, test.get('weights'), served)
 
 		# Report fail and exit if failed or not explicit success
 		if failed or not passed:
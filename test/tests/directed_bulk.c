@@ -0,0 +1,201 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : directed_bulk.c
+ *
+ * This test opens a master and a number of slave contexts on a directed mode
+ * AFU, attaches all slaves with cxl_afu_attach_bulk() and checks each slave
+ * MMIO space through the master before freeing the slaves with
+ * cxl_afu_free_bulk().
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "TestAFU_config.h"
+#include "libcxl.h"
+
+#define DEFAULT_SLAVES 8
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("  -n, --slaves\t\tnumber of slave contexts, default %d\n",
+	       DEFAULT_SLAVES);
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct cxl_afu_h *afu_h, *afu_m;
+	struct cxl_afu_h **afu_s;
+	uint64_t *weds;
+	uint64_t wed, wed_check;
+	unsigned seed;
+	int opt, option_index, context, slaves, i;
+	char *name;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{"slaves",	required_argument,	0,		'n'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	slaves = DEFAULT_SLAVES;
+	while ((opt = getopt_long (argc, argv, "hs:n:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			slaves = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	afu_m = NULL;
+	afu_s = (struct cxl_afu_h **)calloc(slaves, sizeof(struct cxl_afu_h *));
+	weds = (uint64_t *) calloc(slaves, sizeof(uint64_t));
+	if ((slaves <= 0) || (afu_s == NULL) || (weds == NULL)) {
+		printf("FAILED:Invalid number of slaves %d\n", slaves);
+		goto done;
+	}
+
+	// Find first AFU in system
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "FAILED:No AFU found!\n");
+		goto done;
+	}
+
+	// Open and attach master AFU
+	afu_m = cxl_afu_open_h(afu_h, CXL_VIEW_MASTER);
+	if (!afu_m) {
+		perror("FAILED:cxl_afu_open_h for master");
+		goto done;
+	}
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	cxl_afu_attach(afu_m, wed);
+	printf("Mapping AFU registers for master...\n");
+	if ((cxl_mmio_map(afu_m, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("FAILED:cxl_mmio_map for master");
+		goto done;
+	}
+
+	// Open slaves, each with its own random WED
+	for (i = 0; i < slaves; i++) {
+		afu_h = cxl_afu_next(NULL);
+		if (!afu_h) {
+			fprintf(stderr, "FAILED:No AFU found!\n");
+			goto done;
+		}
+		afu_s[i] = cxl_afu_open_h(afu_h, CXL_VIEW_SLAVE);
+		if (!afu_s[i]) {
+			perror("FAILED:cxl_afu_open_h for slave");
+			goto done;
+		}
+		weds[i] = rand();
+		weds[i] <<= 32;
+		weds[i] |= rand();
+	}
+
+	// Attach all slaves at once
+	printf("Attaching %d slaves...\n", slaves);
+	if (cxl_afu_attach_bulk(afu_s, slaves, weds) < 0) {
+		perror("FAILED:cxl_afu_attach_bulk");
+		goto done;
+	}
+
+	// Write WED of each slave to its MMIO space and check it via master
+	for (i = 0; i < slaves; i++) {
+		if ((cxl_mmio_map(afu_s[i], CXL_MMIO_BIG_ENDIAN)) < 0) {
+			perror("FAILED:cxl_mmio_map for slave");
+			goto done;
+		}
+		if (cxl_mmio_write64(afu_s[i], 0x7f8, weds[i])) {
+			perror("FAILED:cxl_mmio_write64 to slave mmio space");
+			goto done;
+		}
+		context = cxl_afu_get_process_element(afu_s[i]);
+		if (cxl_mmio_read64(afu_m,
+				    PPPSA_OFFSET + (context * PPPSA_SIZE) +
+				    0x7f8, &wed_check)) {
+			perror("FAILED:cxl_mmio_read64 of slave via master");
+			goto done;
+		}
+		if (wed_check != weds[i]) {
+			printf("\nFAILED: WED value mismatch for context %d!\n",
+			       context);
+			printf("\tExpected: 0x%016"PRIx64"\n", weds[i]);
+			printf("\tActual  : 0x%016"PRIx64"\n", wed_check);
+			goto done;
+		}
+		cxl_mmio_unmap(afu_s[i]);
+	}
+
+	// Detach all slaves at once
+	printf("Freeing %d slaves...\n", slaves);
+	cxl_afu_free_bulk(afu_s, slaves);
+	memset(afu_s, 0, slaves * sizeof(struct cxl_afu_h *));
+
+	// Report test as passing
+	printf("PASSED\n");
+done:
+	if (afu_s) {
+		for (i = 0; i < slaves; i++) {
+			if (afu_s[i])
+				cxl_afu_free(afu_s[i]);
+		}
+		free(afu_s);
+	}
+	free(weds);
+	if (afu_m) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_m);
+		// Free AFU
+		cxl_afu_free(afu_m);
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : errinfo.c
+ *
+ * This test reads the AFU error buffer with cxl_errinfo_read at aligned and
+ * unaligned offsets.  The Test AFU fills the error buffer so each byte holds
+ * the low byte of its offset.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "utils.h"
+
+#define EB_MAX_COPY 4096
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Build the data cxl_errinfo_read returns for off and len.  Each complete
+// doubleword is converted from big endian, with an unaligned offset a final
+// partial doubleword is returned in error buffer byte order.
+static size_t expected(uint8_t *exp, off_t off, size_t len, size_t eb_len)
+{
+	uint8_t stream[EB_MAX_COPY + 8];
+	uint64_t data;
+	size_t i;
+
+	if (len > eb_len - off)
+		len = eb_len - off;
+	if ((((off & 0x7) + len + 0x7) & ~0x7) > EB_MAX_COPY)
+		len = EB_MAX_COPY - (off & 0x7);
+	for (i = 0; i < len + 8; i++)
+		stream[i] = (uint8_t) (off + i);
+	for (i = 0; i < len; i += 8) {
+		if (((off & 0x7) == 0) || (i + 8 <= len)) {
+			memcpy(&data, &(stream[i]), 8);
+			data = ntohll(data);
+			memcpy(&(stream[i]), &data, 8);
+		}
+	}
+	memcpy(exp, stream, len);
+	return len;
+}
+
+static int check_read(struct cxl_afu_h *afu_h, off_t off, size_t len,
+		      size_t eb_len)
+{
+	uint8_t actual[EB_MAX_COPY + 8], exp[EB_MAX_COPY + 8];
+	ssize_t rc;
+	size_t exp_len;
+
+	memset(actual, 0, sizeof(actual));
+	exp_len = expected(exp, off, len, eb_len);
+	rc = cxl_errinfo_read(afu_h, actual, off, len);
+	if (rc != (ssize_t) exp_len) {
+		printf("FAILED:cxl_errinfo_read off=0x%lx len=%zu returned %zd,"
+		       " expected %zu\n", (long)off, len, rc, exp_len);
+		return -1;
+	}
+	if (memcmp(actual, exp, exp_len) != 0) {
+		printf("FAILED:memcmp off=0x%lx len=%zu\n", (long)off, len);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char *name;
+	uint64_t wed;
+	unsigned seed;
+	size_t eb_len, len;
+	off_t off;
+	int i, opt, option_index;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	while ((opt = getopt_long (argc, argv, "hs:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Open first AFU found
+	struct cxl_afu_h *afu_h;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("cxl_afu_open_h");
+		goto done;
+	}
+
+	// Set WED to random value
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	// Start AFU
+	cxl_afu_attach(afu_h, wed);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("cxl_mmio_map");
+		goto done;
+	}
+
+	if (cxl_errinfo_size(afu_h, &eb_len) < 0) {
+		perror("cxl_errinfo_size");
+		goto done;
+	}
+	if (eb_len == 0) {
+		printf("FAILED:AFU has no error buffer\n");
+		goto done;
+	}
+	printf("Error buffer is %zu bytes\n", eb_len);
+
+	// Whole buffer, aligned and unaligned
+	if (check_read(afu_h, 0, eb_len, eb_len) < 0)
+		goto done;
+	if (check_read(afu_h, 3, eb_len, eb_len) < 0)
+		goto done;
+	// Short reads and reads past the end of the buffer
+	if (check_read(afu_h, 0, 13, eb_len) < 0)
+		goto done;
+	if (check_read(afu_h, 5, 100, eb_len) < 0)
+		goto done;
+	if (check_read(afu_h, eb_len - 9, 100, eb_len) < 0)
+		goto done;
+	// Random reads
+	for (i = 0; i < 16; i++) {
+		off = rand() % eb_len;
+		len = 1 + rand() % eb_len;
+		if (check_read(afu_h, off, len, eb_len) < 0)
+			goto done;
+	}
+
+	printf("PASSED\n");
+
+done:
+	if (afu_h) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_h);
+
+		// Free AFU
+		cxl_afu_free(afu_h);
+	}
+
+	return 0;
+}
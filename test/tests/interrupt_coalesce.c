@@ -0,0 +1,205 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : interrupt_coalesce.c
+ *
+ * This test causes the AFU to drive interrupts from three sources, one of
+ * them twice, before any event is read.  All three sources must be delivered
+ * by a single cxl_read_events call, with the repeated source only once.  A
+ * source that fires again after its event was read is delivered again.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+#define MAX_EVENTS 8
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Use AFU Machine 1 to generate an interrupt from irq
+static int fire(struct cxl_afu_h *afu_h, MachineConfig * machine, long irq)
+{
+	int response;
+
+	response = config_enable_and_run_machine(afu_h, machine, 1, 0,
+						 PSL_COMMAND_INTREQ, 0, 0, 0,
+						 (uint64_t) irq, 1, DEDICATED);
+	if (response < 0) {
+		printf("FAILED:config_enable_and_run_machine\n");
+		return -1;
+	}
+	if (response != PSL_RESPONSE_DONE) {
+		printf("FAILED: Unexpected response code 0x%x\n", response);
+		return -1;
+	}
+	return 0;
+}
+
+// Read events and check they are interrupts from irqs in order
+static int check(struct cxl_afu_h *afu_h, long *irqs, int count)
+{
+	struct cxl_event events[MAX_EVENTS];
+	int i, rc;
+
+	rc = cxl_read_events(afu_h, events, MAX_EVENTS);
+	if (rc != count) {
+		printf("FAILED: Read %d events, expected %d\n", rc, count);
+		return -1;
+	}
+	for (i = 0; i < count; i++) {
+		if (events[i].header.type != CXL_EVENT_AFU_INTERRUPT) {
+			printf("FAILED: Expected AFU interrupt type\n");
+			return -1;
+		}
+		if (events[i].irq.irq != irqs[i]) {
+			printf("FAILED: Expected AFU interrupt %ld but got %d\n",
+			       irqs[i], events[i].irq.irq);
+			return -1;
+		}
+	}
+	if (cxl_event_pending(afu_h)) {
+		printf("FAILED: Unexpected event pending\n");
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	MachineConfig machine;
+	char *name;
+	uint64_t wed;
+	unsigned seed;
+	long max_irqs, irqs[3];
+	int opt, option_index;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	while ((opt = getopt_long (argc, argv, "hs:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Open first AFU found
+	struct cxl_afu_h *afu_h;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("cxl_afu_open_h");
+		goto done;
+	}
+	if ((cxl_get_irqs_max(afu_h, &max_irqs) < 0) || (max_irqs < 3)) {
+		printf("FAILED: Need at least 3 interrupt sources\n");
+		goto done;
+	}
+
+	// Three different legal sources
+	irqs[0] = 1 + rand() % max_irqs;
+	irqs[1] = 1 + irqs[0] % max_irqs;
+	irqs[2] = 1 + irqs[1] % max_irqs;
+
+	// Set WED to random value
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	// Start AFU
+	cxl_afu_attach(afu_h, wed);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("cxl_mmio_map");
+		goto done;
+	}
+
+	// Initialize machine configuration
+	init_machine(&machine);
+
+	// First source fires twice before software reads any event
+	if ((fire(afu_h, &machine, irqs[0]) < 0) ||
+	    (fire(afu_h, &machine, irqs[1]) < 0) ||
+	    (fire(afu_h, &machine, irqs[0]) < 0) ||
+	    (fire(afu_h, &machine, irqs[2]) < 0))
+		goto done;
+	if (check(afu_h, irqs, 3) < 0)
+		goto done;
+	printf("Coalesced interrupt check complete\n");
+
+	// Source fires again once its event was read
+	if (fire(afu_h, &machine, irqs[0]) < 0)
+		goto done;
+	if (check(afu_h, irqs, 1) < 0)
+		goto done;
+	printf("Repeated interrupt check complete\n");
+
+	printf("PASSED\n");
+
+done:
+	if (afu_h) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_h);
+
+		// Free AFU
+		cxl_afu_free(afu_h);
+	}
+
+	return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : lock_contention.c
+ *
+ * This test has AFU Machine 0 repeatedly lock a cacheline with read_cl_lck
+ * and release it with write_unlock while other machines keep reading their
+ * own cachelines.  Taking the lock must not cause NLOCK responses for the
+ * reads of other cachelines.
+ *
+ * With a directed mode AFU the lock is taken by one slave context.  The
+ * commands of a second slave context to the locked cacheline must get
+ * NLOCK, its commands to other cachelines must complete.  The second
+ * context then checks that write_c only succeeds while it still holds the
+ * reservation of the cacheline.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+#define READERS 16
+#define LOCK_ROUNDS 16
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("  -a, --afu\t\tdirected mode AFU to use\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Check the last response of each reader is DONE or still pending
+static int check_readers(struct cxl_afu_h *afu_h, MachineConfig * machine)
+{
+	uint8_t response;
+	int i;
+
+	for (i = 1; i <= READERS; i++) {
+		if (poll_machine(afu_h, machine, i, DEDICATED) < 0) {
+			printf("FAILED:poll_machine\n");
+			return -1;
+		}
+		get_machine_config_response_code(machine, &response);
+		if ((response != PSL_RESPONSE_DONE) && (response != 0xFF)) {
+			printf("FAILED: Reader %d got response code 0x%x\n", i,
+			       response);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Use AFU Machine 0 to run command on the lock line
+static int run_lock(struct cxl_afu_h *afu_h, MachineConfig * machine,
+		    uint16_t command, char *line)
+{
+	int response;
+
+	response = config_enable_and_run_machine(afu_h, machine, 0, 0, command,
+						 CACHELINE_BYTES, 0, 0,
+						 (uint64_t) line,
+						 CACHELINE_BYTES, DEDICATED);
+	if (response < 0) {
+		printf("FAILED:config_enable_and_run_machine\n");
+		return -1;
+	}
+	if (response != PSL_RESPONSE_DONE) {
+		printf("FAILED: Lock command 0x%x got response code 0x%x\n",
+		       command, response);
+		return -1;
+	}
+	return 0;
+}
+
+// The AFU drops MMIO to a context it hasn't added yet and reads back all
+// ones, so wait for the add to land before programming machines
+static int wait_context(struct cxl_afu_h *afu_h)
+{
+	uint64_t data;
+
+	do {
+		if (cxl_mmio_read64(afu_h, 0, &data) < 0) {
+			perror("FAILED:cxl_mmio_read64");
+			return -1;
+		}
+	} while (data == 0xFFFFFFFFFFFFFFFFLL);
+	return 0;
+}
+
+// Use AFU Machine 0 of slave afu_h to run command on line of its context
+// and check the response
+static int run_slave(struct cxl_afu_h *afu_h, int context, uint16_t command,
+		     char *line, int expect)
+{
+	MachineConfig machine;
+	int response;
+
+	init_machine(&machine);
+	response = config_enable_and_run_machine(afu_h, &machine, 0, context,
+						 command, CACHELINE_BYTES, 0, 0,
+						 (uint64_t) line,
+						 CACHELINE_BYTES, DIRECTED);
+	if (response < 0) {
+		printf("FAILED:config_enable_and_run_machine\n");
+		return -1;
+	}
+	if (response != expect) {
+		printf("FAILED: Context %d command 0x%x got response code "
+		       "0x%x, expected 0x%x\n", context, command, response,
+		       expect);
+		return -1;
+	}
+	return 0;
+}
+
+// Slave a locks the first cacheline of area, slave b runs commands to it
+// and to its other cachelines
+static int run_directed(char *afu, char *area)
+{
+	struct cxl_afu_h *afu_m, *afu_a, *afu_b;
+	char path[32];
+	uint64_t wed;
+	int a, b, i, rc;
+
+	rc = -1;
+	afu_a = afu_b = NULL;
+	snprintf(path, sizeof(path), "/dev/cxl/%sm", afu);
+	afu_m = cxl_afu_open_dev(path);
+	if (!afu_m) {
+		perror("FAILED:cxl_afu_open_dev for master");
+		goto done;
+	}
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	cxl_afu_attach(afu_m, wed);
+
+	snprintf(path, sizeof(path), "/dev/cxl/%ss", afu);
+	afu_a = cxl_afu_open_dev(path);
+	afu_b = cxl_afu_open_dev(path);
+	if (!afu_a || !afu_b) {
+		perror("FAILED:cxl_afu_open_dev for slave");
+		goto done;
+	}
+	if ((cxl_afu_attach(afu_a, wed) < 0) ||
+	    (cxl_afu_attach(afu_b, wed) < 0)) {
+		perror("FAILED:cxl_afu_attach for slave");
+		goto done;
+	}
+	a = cxl_afu_get_process_element(afu_a);
+	b = cxl_afu_get_process_element(afu_b);
+
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_a, CXL_MMIO_BIG_ENDIAN) < 0) ||
+	    (cxl_mmio_map(afu_b, CXL_MMIO_BIG_ENDIAN) < 0)) {
+		perror("FAILED:cxl_mmio_map");
+		goto done;
+	}
+	if ((wait_context(afu_a) < 0) || (wait_context(afu_b) < 0))
+		goto done;
+
+	// While a holds the lock b can't use the line, only its other lines
+	if (run_slave(afu_a, a, PSL_COMMAND_READ_CL_LCK, area,
+		      PSL_RESPONSE_DONE) < 0)
+		goto done;
+	if ((run_slave(afu_b, b, PSL_COMMAND_READ_CL_NA, area,
+		       PSL_RESPONSE_NLOCK) < 0) ||
+	    (run_slave(afu_b, b, PSL_COMMAND_WRITE_NA, area,
+		       PSL_RESPONSE_NLOCK) < 0))
+		goto done;
+	for (i = 1; i <= READERS; i++) {
+		if (run_slave(afu_b, b, PSL_COMMAND_READ_CL_NA,
+			      area + i * CACHELINE_BYTES,
+			      PSL_RESPONSE_DONE) < 0)
+			goto done;
+	}
+	if (run_slave(afu_a, a, PSL_COMMAND_WRITE_UNLOCK, area,
+		      PSL_RESPONSE_DONE) < 0)
+		goto done;
+	if (run_slave(afu_b, b, PSL_COMMAND_READ_CL_NA, area,
+		      PSL_RESPONSE_DONE) < 0)
+		goto done;
+	printf("Lock held by context %d only stopped context %d on its line\n",
+	       a, b);
+
+	// write_c needs a reservation of the line and uses it up
+	if ((run_slave(afu_b, b, PSL_COMMAND_WRITE_C,
+		       area + CACHELINE_BYTES, PSL_RESPONSE_NRES) < 0) ||
+	    (run_slave(afu_b, b, PSL_COMMAND_READ_CL_RES,
+		       area + CACHELINE_BYTES, PSL_RESPONSE_DONE) < 0) ||
+	    (run_slave(afu_b, b, PSL_COMMAND_WRITE_C,
+		       area + CACHELINE_BYTES, PSL_RESPONSE_DONE) < 0) ||
+	    (run_slave(afu_b, b, PSL_COMMAND_WRITE_C,
+		       area + CACHELINE_BYTES, PSL_RESPONSE_NRES) < 0))
+		goto done;
+
+	// A write from another context ends the reservation
+	if ((run_slave(afu_b, b, PSL_COMMAND_READ_CL_RES,
+		       area + 2 * CACHELINE_BYTES, PSL_RESPONSE_DONE) < 0) ||
+	    (run_slave(afu_a, a, PSL_COMMAND_WRITE_NA,
+		       area + 2 * CACHELINE_BYTES, PSL_RESPONSE_DONE) < 0) ||
+	    (run_slave(afu_b, b, PSL_COMMAND_WRITE_C,
+		       area + 2 * CACHELINE_BYTES, PSL_RESPONSE_NRES) < 0))
+		goto done;
+	printf("Conditional writes followed the reservation\n");
+
+	rc = 0;
+
+done:
+	if (afu_b) {
+		cxl_mmio_unmap(afu_b);
+		cxl_afu_free(afu_b);
+	}
+	if (afu_a) {
+		cxl_mmio_unmap(afu_a);
+		cxl_afu_free(afu_a);
+	}
+	if (afu_m)
+		cxl_afu_free(afu_m);
+
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	MachineConfig machine, lock;
+	char *area, *afu, *name;
+	uint64_t wed;
+	unsigned seed;
+	int i, opt, option_index;
+	int response;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{"afu",		required_argument,	0,		'a'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	afu = NULL;
+	while ((opt = getopt_long (argc, argv, "hs:a:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			afu = optarg;
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Allocate a cacheline to lock and one for each reader
+	if (posix_memalign((void **)&area, CACHELINE_BYTES,
+			   (READERS + 1) * CACHELINE_BYTES) != 0) {
+		perror("FAILED:posix_memalign");
+		return 0;
+	}
+	for (i = 0; i < (READERS + 1) * CACHELINE_BYTES; i++)
+		area[i] = rand();
+
+	// Contention between the slave contexts of a directed mode AFU
+	if (afu != NULL) {
+		if (run_directed(afu, area) == 0)
+			printf("PASSED\n");
+		return 0;
+	}
+
+	// Open first AFU found
+	struct cxl_afu_h *afu_h;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("cxl_afu_open_h");
+		goto done;
+	}
+
+	// Set WED to random value
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	// Start AFU
+	cxl_afu_attach(afu_h, wed);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("cxl_mmio_map");
+		goto done;
+	}
+
+	// Readers keep reading their own cacheline, the delay leaves the
+	// last response in place long enough to be checked
+	init_machine(&machine);
+	printf("Starting readers\n");
+	for (i = 1; i <= READERS; i++) {
+		if (config_and_enable_machine(afu_h, &machine, i, 0,
+					      PSL_COMMAND_READ_CL_NA,
+					      CACHELINE_BYTES, 50, 100,
+					      (uint64_t) (area +
+							  i * CACHELINE_BYTES),
+					      CACHELINE_BYTES, 1,
+					      DEDICATED) < 0) {
+			printf("FAILED:config_and_enable_machine\n");
+			goto done;
+		}
+	}
+
+	// Lock and unlock the first cacheline
+	init_machine(&lock);
+	for (i = 0; i < LOCK_ROUNDS; i++) {
+		if (run_lock(afu_h, &lock, PSL_COMMAND_READ_CL_LCK, area) < 0)
+			goto done;
+		if (check_readers(afu_h, &machine) < 0)
+			goto done;
+		if (run_lock(afu_h, &lock, PSL_COMMAND_WRITE_UNLOCK, area) < 0)
+			goto done;
+		if (check_readers(afu_h, &machine) < 0)
+			goto done;
+	}
+	printf("Completed %d lock rounds\n", LOCK_ROUNDS);
+
+	// Stop readers and check their last responses
+	for (i = 1; i <= READERS; i++) {
+		init_machine(&machine);
+		config_machine(&machine, 0, PSL_COMMAND_READ_CL_NA,
+			       CACHELINE_BYTES, 50, 100,
+			       (uint64_t) (area + i * CACHELINE_BYTES),
+			       CACHELINE_BYTES, 0);
+		set_machine_config_disable(&machine);
+		if (enable_machine(afu_h, &machine, i, DEDICATED) < 0) {
+			printf("FAILED:enable_machine\n");
+			goto done;
+		}
+	}
+	for (i = 1; i <= READERS; i++) {
+		if ((response = get_response(afu_h, &machine, i,
+					     DEDICATED)) != 0) {
+			printf("FAILED: Unexpected response code 0x%x\n",
+			       response);
+			goto done;
+		}
+	}
+
+	printf("PASSED\n");
+
+done:
+	if (afu_h) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_h);
+
+		// Free AFU
+		cxl_afu_free(afu_h);
+	}
+
+	return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : mux_handles.c
+ *
+ * This test keeps many enumeration handles open while the AFU is opened,
+ * used and freed several times.  libcxl carries all of these handles over a
+ * single connection to PSLSE unless PSLSE_MUX=0 is set.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+
+#define ENUM_HANDLES 16
+#define OPEN_ROUNDS 4
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Open AFU, check WED and an MMIO register, then free it
+static int open_round(int round)
+{
+	struct cxl_afu_h *afu_h;
+	uint64_t wed, wed_check, value, value_check;
+	int rc;
+
+	rc = -1;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		printf("FAILED:cxl_afu_next round %d\n", round);
+		return -1;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("FAILED:cxl_afu_open_h");
+		return -1;
+	}
+
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	cxl_afu_attach(afu_h, wed);
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("FAILED:cxl_mmio_map");
+		goto done;
+	}
+	if (cxl_mmio_read64(afu_h, 0x8, &wed_check) < 0) {
+		perror("FAILED:cxl_mmio_read64");
+		goto done;
+	}
+	if (wed != wed_check) {
+		printf("FAILED:WED mismatch in round %d\n", round);
+		printf("\tExpected:0x%016"PRIx64"\n", wed);
+		printf("\tActual  :0x%016"PRIx64"\n", wed_check);
+		goto done;
+	}
+
+	value = rand();
+	value <<= 32;
+	value |= rand();
+	if (cxl_mmio_write64(afu_h, 0x17f0, value) < 0) {
+		perror("FAILED:cxl_mmio_write64");
+		goto done;
+	}
+	if (cxl_mmio_read64(afu_h, 0x17f0, &value_check) < 0) {
+		perror("FAILED:cxl_mmio_read64");
+		goto done;
+	}
+	if (value != value_check) {
+		printf("FAILED:MMIO mismatch in round %d\n", round);
+		printf("\tExpected:0x%016"PRIx64"\n", value);
+		printf("\tActual  :0x%016"PRIx64"\n", value_check);
+		goto done;
+	}
+	printf("Round %d complete\n", round);
+	rc = 0;
+
+done:
+	cxl_mmio_unmap(afu_h);
+	cxl_afu_free(afu_h);
+	return rc;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cxl_afu_h *handles[ENUM_HANDLES];
+	char *name;
+	unsigned seed;
+	int i, opt, option_index;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	while ((opt = getopt_long (argc, argv, "hs:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Keep enumeration handles open for the whole test
+	for (i = 0; i < ENUM_HANDLES; i++) {
+		handles[i] = cxl_afu_next(NULL);
+		if (!handles[i]) {
+			printf("FAILED:cxl_afu_next handle %d\n", i);
+			return 0;
+		}
+		if (strcmp(cxl_afu_dev_name(handles[i]),
+			   cxl_afu_dev_name(handles[0]))) {
+			printf("FAILED:handle %d found %s, expected %s\n", i,
+			       cxl_afu_dev_name(handles[i]),
+			       cxl_afu_dev_name(handles[0]));
+			return 0;
+		}
+	}
+	printf("%d handles found %s\n", ENUM_HANDLES,
+	       cxl_afu_dev_name(handles[0]));
+
+	// Open and free the AFU repeatedly alongside them
+	for (i = 0; i < OPEN_ROUNDS; i++) {
+		if (open_round(i) < 0)
+			return 0;
+	}
+
+	printf("PASSED\n");
+	return 0;
+}
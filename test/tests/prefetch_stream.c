@@ -0,0 +1,260 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : prefetch_stream.c
+ *
+ * This test uses the Test AFU to copy consecutive cachelines of a page one
+ * at a time, so with PREFETCH_LINES set pslse fetches the stream ahead and
+ * serves the following reads from its line buffer.  Part way through the
+ * AFU overwrites a line that has already been fetched ahead, the read of
+ * that line must then see the new data rather than the buffered copy.
+ *
+ * MMIO writes discard the buffered lines of their context, so the commands
+ * run on one slave context of a directed mode AFU while the machines are
+ * programmed through another.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+#define DEFAULT_AFU "afu0.0"
+#define PAGE_BYTES 4096
+#define STREAM_LINES 16
+// After reading this line the AFU writes it over the stale line, which was
+// fetched ahead when the stream started and hasn't been read yet
+#define WRITE_AFTER 4
+#define STALE_LINE 6
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("  -a, --afu\t\tdirected mode AFU to use, default %s\n",
+	       DEFAULT_AFU);
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// The AFU drops MMIO to a context it hasn't added yet and reads back all
+// ones, so wait for the add to land before programming machines
+static int wait_context(struct cxl_afu_h *afu_h)
+{
+	uint64_t data;
+
+	do {
+		if (cxl_mmio_read64(afu_h, 1 << 5, &data) < 0) {
+			perror("FAILED:cxl_mmio_read64");
+			return -1;
+		}
+	} while (data == 0xFFFFFFFFFFFFFFFFLL);
+	return 0;
+}
+
+// Run command for one cacheline of context on AFU machine 1 of afu_h
+static int run_line(struct cxl_afu_h *afu_h, MachineConfig * machine,
+		    int context, uint16_t command, char *addr)
+{
+	int response;
+
+	response = config_enable_and_run_machine(afu_h, machine, 1, context,
+						 command, CACHELINE_BYTES, 0, 0,
+						 (uint64_t) addr,
+						 CACHELINE_BYTES, DIRECTED);
+	if (response < 0) {
+		printf("FAILED:config_enable_and_run_machine\n");
+		return -1;
+	}
+	if (response != PSL_RESPONSE_DONE) {
+		printf("FAILED: Unexpected response code 0x%x\n", response);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	MachineConfig machine;
+	struct cxl_afu_h *afu_m, *afu_s, *afu_c;
+	char path[32];
+	char *src, *dst, *orig, *afu, *name;
+	uint64_t wed;
+	unsigned seed;
+	int i, line, opt, option_index, context;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{"afu",		required_argument,	0,		'a'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	afu = DEFAULT_AFU;
+	while ((opt = getopt_long (argc, argv, "hs:a:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			afu = optarg;
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Open and attach master AFU, it only holds the AFU open
+	afu_s = afu_c = NULL;
+	snprintf(path, sizeof(path), "/dev/cxl/%sm", afu);
+	afu_m = cxl_afu_open_dev(path);
+	if (!afu_m) {
+		perror("FAILED:cxl_afu_open_dev for master");
+		goto done;
+	}
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	cxl_afu_attach(afu_m, wed);
+
+	// Open and attach the slave the commands run on and the slave that
+	// programs the machines
+	snprintf(path, sizeof(path), "/dev/cxl/%ss", afu);
+	afu_s = cxl_afu_open_dev(path);
+	afu_c = cxl_afu_open_dev(path);
+	if (!afu_s || !afu_c) {
+		perror("FAILED:cxl_afu_open_dev for slave");
+		goto done;
+	}
+	if ((cxl_afu_attach(afu_s, wed) < 0) ||
+	    (cxl_afu_attach(afu_c, wed) < 0)) {
+		perror("FAILED:cxl_afu_attach for slave");
+		goto done;
+	}
+	context = cxl_afu_get_process_element(afu_s);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_c, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("FAILED:cxl_mmio_map");
+		goto done;
+	}
+
+	if (wait_context(afu_c) < 0)
+		goto done;
+
+	// Page aligned source so the stream isn't cut short at a page boundary
+	if (posix_memalign((void **)&src, PAGE_BYTES,
+			   STREAM_LINES * CACHELINE_BYTES) != 0) {
+		perror("FAILED:posix_memalign");
+		goto done;
+	}
+	if (posix_memalign((void **)&dst, CACHELINE_BYTES,
+			   STREAM_LINES * CACHELINE_BYTES) != 0) {
+		perror("FAILED:posix_memalign");
+		goto done;
+	}
+	if ((orig = (char *)malloc(STREAM_LINES * CACHELINE_BYTES)) == NULL) {
+		perror("FAILED:malloc");
+		goto done;
+	}
+
+	// Pollute source buffer with random values
+	for (i = 0; i < STREAM_LINES * CACHELINE_BYTES; i++)
+		src[i] = rand();
+	memcpy(orig, src, STREAM_LINES * CACHELINE_BYTES);
+	memset(dst, 0, STREAM_LINES * CACHELINE_BYTES);
+
+	// Initialize machine configuration
+	init_machine(&machine);
+
+	for (line = 0; line < STREAM_LINES; line++) {
+		// Use AFU Machine 1 to read cacheline from memory to AFU
+		if (run_line(afu_c, &machine, context, PSL_COMMAND_READ_CL_NA,
+			     src + line * CACHELINE_BYTES) < 0)
+			goto done;
+
+		// Use AFU Machine 1 to write the data to destination buffer
+		if (run_line(afu_c, &machine, context, PSL_COMMAND_WRITE_NA,
+			     dst + line * CACHELINE_BYTES) < 0)
+			goto done;
+
+		// Overwrite a line pslse has already fetched ahead
+		if ((line == WRITE_AFTER) &&
+		    (run_line(afu_c, &machine, context, PSL_COMMAND_WRITE_NA,
+			      src + STALE_LINE * CACHELINE_BYTES) < 0))
+			goto done;
+	}
+
+	printf("Completed %d cacheline copies\n", STREAM_LINES);
+
+	// The AFU write must have reached memory
+	if (memcmp(src + STALE_LINE * CACHELINE_BYTES,
+		   orig + WRITE_AFTER * CACHELINE_BYTES, CACHELINE_BYTES) != 0) {
+		printf("FAILED:AFU write to line %d missing\n", STALE_LINE);
+		goto done;
+	}
+
+	// Test if copy from src to dst was successful, including the line
+	// overwritten after it was fetched ahead
+	for (line = 0; line < STREAM_LINES; line++) {
+		if (memcmp(src + line * CACHELINE_BYTES,
+			   dst + line * CACHELINE_BYTES, CACHELINE_BYTES) != 0) {
+			printf("FAILED:memcmp line %d%s\n", line,
+			       (line == STALE_LINE) ? ", stale prefetched copy" :
+			       "");
+			goto done;
+		}
+	}
+
+	printf("PASSED\n");
+
+done:
+	if (afu_c) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_c);
+		cxl_afu_free(afu_c);
+	}
+	if (afu_s)
+		cxl_afu_free(afu_s);
+	if (afu_m)
+		cxl_afu_free(afu_m);
+
+	return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : ro_buffer.c
+ *
+ * This test registers a read-only buffer with pslse and then uses the Test
+ * AFU to copy every cacheline of it.  The buffer is changed after it is
+ * registered, so the copy only matches the registered contents if the reads
+ * were served from the pslse copy of the buffer.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+#define RO_LINES 8
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+int main(int argc, char *argv[])
+{
+	MachineConfig machine;
+	char *src, *dst, *ro, *name;
+	uint64_t wed;
+	unsigned seed;
+	int i, line, opt, option_index;
+	int response;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	while ((opt = getopt_long (argc, argv, "hs:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Open first AFU found
+	struct cxl_afu_h *afu_h;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("cxl_afu_open_h");
+		goto done;
+	}
+
+	// Set WED to random value
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	// Start AFU
+	cxl_afu_attach(afu_h, wed);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("cxl_mmio_map");
+		goto done;
+
+	}
+
+	// Allocate aligned memory for source and destination buffers
+	if (posix_memalign((void **)&src, CACHELINE_BYTES,
+			   RO_LINES * CACHELINE_BYTES) != 0) {
+		perror("FAILED:posix_memalign");
+		goto done;
+	}
+	if (posix_memalign((void **)&dst, CACHELINE_BYTES,
+			   RO_LINES * CACHELINE_BYTES) != 0) {
+		perror("FAILED:posix_memalign");
+		goto done;
+	}
+	if ((ro = (char *)malloc(RO_LINES * CACHELINE_BYTES)) == NULL) {
+		perror("FAILED:malloc");
+		goto done;
+	}
+
+	// Pollute source buffer with random values
+	for (i = 0; i < RO_LINES * CACHELINE_BYTES; i++)
+		src[i] = rand();
+	memset(dst, 0, RO_LINES * CACHELINE_BYTES);
+
+	// Empty buffer must be rejected
+	if ((cxl_sim_register_ro(afu_h, src, 0) == 0) || (errno != EINVAL)) {
+		printf("FAILED:cxl_sim_register_ro accepted empty buffer\n");
+		goto done;
+	}
+
+	// Register source buffer as read-only
+	if (cxl_sim_register_ro(afu_h, src, RO_LINES * CACHELINE_BYTES) < 0) {
+		perror("FAILED:cxl_sim_register_ro");
+		goto done;
+	}
+
+	// Keep the registered contents and change every byte of the source
+	// buffer, reads from the client would now see the changed data
+	memcpy(ro, src, RO_LINES * CACHELINE_BYTES);
+	for (i = 0; i < RO_LINES * CACHELINE_BYTES; i++)
+		src[i] = ~ro[i];
+
+	// Initialize machine configuration
+	init_machine(&machine);
+
+	for (line = 0; line < RO_LINES; line++) {
+		// Use AFU Machine 1 to read cacheline from memory to AFU
+		if ((response = config_enable_and_run_machine(afu_h, &machine, 1, 0, PSL_COMMAND_READ_CL_NA, CACHELINE_BYTES, 0, 0, (uint64_t)(src + line * CACHELINE_BYTES), CACHELINE_BYTES, DEDICATED)) < 0)
+		{
+			printf("FAILED:config_enable_and_run_machine");
+			goto done;
+		}
+		if (response != PSL_RESPONSE_DONE)
+		{
+			printf("FAILED: Unexpected response code 0x%x\n", response);
+			goto done;
+		}
+
+		// Use AFU Machine 1 to write the data to destination buffer
+		if ((response = config_enable_and_run_machine(afu_h, &machine, 1, 0, PSL_COMMAND_WRITE_NA, CACHELINE_BYTES, 0, 0, (uint64_t)(dst + line * CACHELINE_BYTES), CACHELINE_BYTES, DEDICATED)) < 0)
+		{
+			printf("FAILED:config_enable_and_run_machine");
+			goto done;
+		}
+		if (response != PSL_RESPONSE_DONE)
+		{
+			printf("FAILED: Unexpected response code 0x%x\n", response);
+			goto done;
+		}
+	}
+
+	printf("Completed %d cacheline copies\n", RO_LINES);
+
+	// Test if dst holds the registered contents rather than src
+	for (line = 0; line < RO_LINES; line++) {
+		if (memcmp(ro + line * CACHELINE_BYTES,
+			   dst + line * CACHELINE_BYTES, CACHELINE_BYTES) != 0) {
+			printf("FAILED:memcmp line %d, read not served from "
+			       "registered copy\n", line);
+			goto done;
+		}
+	}
+
+	printf("PASSED\n");
+
+done:
+	if (afu_h) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_h);
+
+		// Free AFU
+		cxl_afu_free(afu_h);
+	}
+
+	return 0;
+}
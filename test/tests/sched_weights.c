@@ -0,0 +1,265 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : sched_weights.c
+ *
+ * This test keeps several slave contexts of a directed mode AFU reading
+ * memory at the same time for a while, then stops them all together and
+ * frees them.  PSLSE reports the memory requests it served for each context
+ * as the context is freed, regress.py checks those counts against the
+ * context weights.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+#define DEFAULT_AFU "afu0.0"
+#define DEFAULT_SLAVES 2
+#define DEFAULT_MSECS 3000
+#define READERS 16
+#define LINES 8
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("  -a, --afu\t\tdirected mode AFU to use, default %s\n",
+	       DEFAULT_AFU);
+	printf("  -n, --slaves\t\tnumber of slave contexts, default %d\n",
+	       DEFAULT_SLAVES);
+	printf("  -t, --msecs\t\ttime contexts keep reading, default %d\n",
+	       DEFAULT_MSECS);
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Start or stop the readers of a slave, each reading its own lines
+static int set_readers(struct cxl_afu_h *afu_h, int context, char *area,
+		       int enable)
+{
+	MachineConfig machine;
+	int i;
+
+	for (i = 0; i < READERS; i++) {
+		init_machine(&machine);
+		config_machine(&machine, context, PSL_COMMAND_READ_CL_NA,
+			       CACHELINE_BYTES, 0, 0,
+			       (uint64_t) (area + i * LINES * CACHELINE_BYTES),
+			       LINES * CACHELINE_BYTES, 1);
+		if (!enable)
+			set_machine_config_disable(&machine);
+		if (enable_machine(afu_h, &machine, i, DIRECTED) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+// Wait for the last response of each reader of a slave
+static int wait_readers(struct cxl_afu_h *afu_h)
+{
+	MachineConfig machine;
+	int i, response;
+
+	for (i = 0; i < READERS; i++) {
+		response = get_response(afu_h, &machine, i, DIRECTED);
+		if ((response != PSL_RESPONSE_DONE) && (response != 0)) {
+			printf("FAILED: Reader %d got response code 0x%x\n",
+			       i, response);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct cxl_afu_h *afu_m;
+	struct cxl_afu_h **afu_s;
+	char path[32];
+	char **area;
+	char *afu;
+	uint64_t wed;
+	unsigned seed;
+	int opt, option_index, slaves, msecs, i, j;
+	int *context;
+	char *name;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{"afu",		required_argument,	0,		'a'},
+		{"slaves",	required_argument,	0,		'n'},
+		{"msecs",	required_argument,	0,		't'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	afu = DEFAULT_AFU;
+	slaves = DEFAULT_SLAVES;
+	msecs = DEFAULT_MSECS;
+	while ((opt = getopt_long (argc, argv, "hs:a:n:t:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			afu = optarg;
+			break;
+		case 'n':
+			slaves = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			msecs = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	afu_m = NULL;
+	afu_s = (struct cxl_afu_h **)calloc(slaves, sizeof(struct cxl_afu_h *));
+	area = (char **)calloc(slaves, sizeof(char *));
+	context = (int *)calloc(slaves, sizeof(int));
+	if ((slaves <= 0) || (afu_s == NULL) || (area == NULL) ||
+	    (context == NULL)) {
+		printf("FAILED:Invalid number of slaves %d\n", slaves);
+		goto done;
+	}
+
+	// Open and attach master AFU, it only holds the AFU open
+	snprintf(path, sizeof(path), "/dev/cxl/%sm", afu);
+	afu_m = cxl_afu_open_dev(path);
+	if (!afu_m) {
+		perror("FAILED:cxl_afu_open_dev for master");
+		goto done;
+	}
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	cxl_afu_attach(afu_m, wed);
+
+	// Open, attach and map each slave and give it memory to read
+	for (i = 0; i < slaves; i++) {
+		snprintf(path, sizeof(path), "/dev/cxl/%ss", afu);
+		afu_s[i] = cxl_afu_open_dev(path);
+		if (!afu_s[i]) {
+			perror("FAILED:cxl_afu_open_dev for slave");
+			goto done;
+		}
+		wed = rand();
+		wed <<= 32;
+		wed |= rand();
+		if (cxl_afu_attach(afu_s[i], wed) < 0) {
+			perror("FAILED:cxl_afu_attach for slave");
+			goto done;
+		}
+		if ((cxl_mmio_map(afu_s[i], CXL_MMIO_BIG_ENDIAN)) < 0) {
+			perror("FAILED:cxl_mmio_map for slave");
+			goto done;
+		}
+		context[i] = cxl_afu_get_process_element(afu_s[i]);
+		if (posix_memalign((void **)&(area[i]), CACHELINE_BYTES,
+				   READERS * LINES * CACHELINE_BYTES) != 0) {
+			perror("FAILED:posix_memalign");
+			goto done;
+		}
+		for (j = 0; j < READERS * LINES * CACHELINE_BYTES; j++)
+			area[i][j] = rand();
+		// PSLSE serves the reads from its own copy so the contexts
+		// compete for PSLSE rather than wait on this process
+		if (cxl_sim_register_ro(afu_s[i], area[i],
+					READERS * LINES * CACHELINE_BYTES) < 0) {
+			perror("FAILED:cxl_sim_register_ro");
+			goto done;
+		}
+	}
+
+	// Keep all slaves reading at once
+	printf("Starting readers for %d slaves\n", slaves);
+	for (i = 0; i < slaves; i++) {
+		if (set_readers(afu_s[i], context[i], area[i], 1) < 0) {
+			printf("FAILED:enable_machine\n");
+			goto done;
+		}
+	}
+	usleep(msecs * 1000);
+
+	// Stop all slaves before any is freed so the counts PSLSE reports
+	// cover the same time
+	printf("Stopping readers\n");
+	for (i = 0; i < slaves; i++) {
+		if (set_readers(afu_s[i], context[i], area[i], 0) < 0) {
+			printf("FAILED:enable_machine\n");
+			goto done;
+		}
+	}
+	for (i = 0; i < slaves; i++) {
+		if (wait_readers(afu_s[i]) < 0)
+			goto done;
+	}
+
+	// Free slaves, PSLSE reports the work it served for each
+	for (i = 0; i < slaves; i++) {
+		cxl_mmio_unmap(afu_s[i]);
+		cxl_afu_free(afu_s[i]);
+		afu_s[i] = NULL;
+	}
+
+	printf("PASSED\n");
+done:
+	if (afu_s) {
+		for (i = 0; i < slaves; i++) {
+			if (afu_s[i])
+				cxl_afu_free(afu_s[i]);
+		}
+		free(afu_s);
+	}
+	if (area) {
+		for (i = 0; i < slaves; i++)
+			free(area[i]);
+		free(area);
+	}
+	free(context);
+	if (afu_m)
+		cxl_afu_free(afu_m);
+
+	return 0;
+}
@@ -0,0 +1,212 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : timing.c
+ *
+ * This test is run with the PSLSE timing model enabled.  It times a cacheline
+ * read and an interrupt in simulated PSL cycles and checks each took at least
+ * the latency configured for its command class.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("  -r, --read\t\tminimum READ_LATENCY in cycles\n");
+	printf("  -i, --interrupt\tminimum INTERRUPT_LATENCY in cycles\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Check at least latency cycles passed from first to last
+static int check_latency(char *what, uint64_t first, uint64_t last,
+			 uint64_t latency)
+{
+	printf("%s took %"PRIu64" cycles\n", what, last - first);
+	if ((last < first) || (last - first < latency)) {
+		printf("FAILED:%s took less than %"PRIu64" cycles\n", what,
+		       latency);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	MachineConfig machine;
+	char *data, *name;
+	uint64_t wed, before, after, irq_cycle;
+	uint64_t read_latency, irq_latency;
+	unsigned seed;
+	long max_irqs, irq;
+	int i, opt, option_index;
+	int response;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{"read",	required_argument,	0,		'r'},
+		{"interrupt",	required_argument,	0,		'i'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	read_latency = irq_latency = 0;
+	while ((opt = getopt_long (argc, argv, "hs:r:i:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			read_latency = strtoull(optarg, NULL, 0);
+			break;
+		case 'i':
+			irq_latency = strtoull(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Open first AFU found
+	struct cxl_afu_h *afu_h;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("cxl_afu_open_h");
+		goto done;
+	}
+	if (cxl_get_irqs_max(afu_h, &max_irqs) < 0) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	irq = 1 + rand() % max_irqs;
+
+	// Set WED to random value
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	// Start AFU
+	cxl_afu_attach(afu_h, wed);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("cxl_mmio_map");
+		goto done;
+	}
+
+	// Allocate aligned memory for the cacheline to read
+	if (posix_memalign((void **)&data, CACHELINE_BYTES,
+			   CACHELINE_BYTES) != 0) {
+		perror("FAILED:posix_memalign");
+		goto done;
+	}
+	for (i = 0; i < CACHELINE_BYTES; i++)
+		data[i] = rand();
+
+	// Time a cacheline read with AFU Machine 1
+	init_machine(&machine);
+	if (cxl_sim_get_cycles(afu_h, &before, NULL, NULL) < 0) {
+		perror("FAILED:cxl_sim_get_cycles");
+		goto done;
+	}
+	if ((response = config_enable_and_run_machine(afu_h, &machine, 1, 0,
+						      PSL_COMMAND_READ_CL_NA,
+						      CACHELINE_BYTES, 0, 0,
+						      (uint64_t)data,
+						      CACHELINE_BYTES,
+						      DEDICATED)) < 0) {
+		printf("FAILED:config_enable_and_run_machine");
+		goto done;
+	}
+	if (response != PSL_RESPONSE_DONE) {
+		printf("FAILED: Unexpected response code 0x%x\n", response);
+		goto done;
+	}
+	if (cxl_sim_get_cycles(afu_h, &after, NULL, NULL) < 0) {
+		perror("FAILED:cxl_sim_get_cycles");
+		goto done;
+	}
+	if (check_latency("Read", before, after, read_latency) < 0)
+		goto done;
+
+	// Time an interrupt with AFU Machine 1
+	before = after;
+	if ((response = config_enable_and_run_machine(afu_h, &machine, 1, 0,
+						      PSL_COMMAND_INTREQ, 0, 0,
+						      0, (uint64_t)irq, 1,
+						      DEDICATED)) < 0) {
+		printf("FAILED:config_enable_and_run_machine");
+		goto done;
+	}
+	if (response != PSL_RESPONSE_DONE) {
+		printf("FAILED: Unexpected response code 0x%x\n", response);
+		goto done;
+	}
+	if (cxl_sim_get_cycles(afu_h, &after, NULL, &irq_cycle) < 0) {
+		perror("FAILED:cxl_sim_get_cycles");
+		goto done;
+	}
+	if (check_latency("Interrupt", before, irq_cycle, irq_latency) < 0)
+		goto done;
+
+	printf("PASSED\n");
+
+done:
+	if (afu_h) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_h);
+
+		// Free AFU
+		cxl_afu_free(afu_h);
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Copyright 2015 International Business Machines
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Description : write_combine.c
+ *
+ * This test has several AFU machines each copy one cacheline of a page, so
+ * their writes to adjacent cachelines are in flight at the same time and
+ * pslse may combine them into one write.  The whole destination must match
+ * the source afterwards.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libcxl.h"
+#include "psl_interface_t.h"
+#include "TestAFU_config.h"
+#include "utils.h"
+
+#define PAGE_BYTES 4096
+#define WRITERS 8
+// Dedicated mode machine configs start at this MMIO offset, 32 bytes each
+#define MACHINE_CONFIG_OFFSET 0x1000
+#define ROUNDS (PAGE_BYTES / (WRITERS * CACHELINE_BYTES))
+
+void usage(char *name)
+{
+	printf("Usage: %s [OPTION]...\n\n", name);
+	printf("  -s, --seed\t\tseed for random number generation\n");
+	printf("      --help\tdisplay this help and exit\n\n");
+}
+
+// Run command on machines 1 to WRITERS, machine i on cacheline i - 1 of
+// area, and wait for all of them to finish.  The machines are configured
+// disabled first and then enabled with one MMIO write each, so their
+// commands reach pslse close together.
+static int run_machines(struct cxl_afu_h *afu_h, uint16_t command,
+			char *area)
+{
+	MachineConfig machine[WRITERS + 1];
+	int i, response;
+
+	for (i = 1; i <= WRITERS; i++) {
+		init_machine(&machine[i]);
+		config_machine(&machine[i], 0, command, CACHELINE_BYTES, 0, 0,
+			       (uint64_t) (area + (i - 1) * CACHELINE_BYTES),
+			       CACHELINE_BYTES, 0);
+		set_machine_config_disable(&machine[i]);
+		if (enable_machine(afu_h, &machine[i], i, DEDICATED) < 0) {
+			printf("FAILED:enable_machine\n");
+			return -1;
+		}
+	}
+	for (i = 1; i <= WRITERS; i++) {
+		set_machine_config_enable_once(&machine[i]);
+		if (cxl_mmio_write64(afu_h, MACHINE_CONFIG_OFFSET + (i << 5),
+				     machine[i].config[0]) < 0) {
+			perror("FAILED:cxl_mmio_write64");
+			return -1;
+		}
+	}
+	for (i = 1; i <= WRITERS; i++) {
+		response = get_response(afu_h, &machine[i], i, DEDICATED);
+		if (response != PSL_RESPONSE_DONE) {
+			printf("FAILED: Machine %d command 0x%x got response "
+			       "code 0x%x\n", i, command, response);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	char *src, *dst, *name;
+	uint64_t wed;
+	unsigned seed;
+	int i, round, opt, option_index;
+
+	name = strrchr(argv[0], '/');
+	if (name)
+		name++;
+	else
+		name = argv[0];
+
+	static struct option long_options[] = {
+		{"help",	no_argument,		0,		'h'},
+		{"seed",	required_argument,	0,		's'},
+		{NULL, 0, 0, 0}
+	};
+
+	option_index = 0;
+	seed = time(NULL);
+	while ((opt = getopt_long (argc, argv, "hs:",
+				   long_options, &option_index)) >= 0) {
+		switch (opt)
+		{
+		case 0:
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'h':
+		default:
+			usage(name);
+			return 0;
+		}
+	}
+
+	// Seed random number generator
+	srand(seed);
+	printf("%s: seed=%d\n", name, seed);
+
+	// Page aligned buffers so every round of writes stays in one page
+	if ((posix_memalign((void **)&src, PAGE_BYTES, PAGE_BYTES) != 0) ||
+	    (posix_memalign((void **)&dst, PAGE_BYTES, PAGE_BYTES) != 0)) {
+		perror("FAILED:posix_memalign");
+		return 0;
+	}
+
+	// Pollute source buffer with random values
+	for (i = 0; i < PAGE_BYTES; i++)
+		src[i] = rand();
+	memset(dst, 0, PAGE_BYTES);
+
+	// Open first AFU found
+	struct cxl_afu_h *afu_h;
+	afu_h = cxl_afu_next(NULL);
+	if (!afu_h) {
+		fprintf(stderr, "\nNo AFU found!\n\n");
+		goto done;
+	}
+	afu_h = cxl_afu_open_h(afu_h, CXL_VIEW_DEDICATED);
+	if (!afu_h) {
+		perror("cxl_afu_open_h");
+		goto done;
+	}
+
+	// Set WED to random value
+	wed = rand();
+	wed <<= 32;
+	wed |= rand();
+	// Start AFU
+	cxl_afu_attach(afu_h, wed);
+
+	// Map AFU MMIO registers
+	printf("Mapping AFU registers...\n");
+	if ((cxl_mmio_map(afu_h, CXL_MMIO_BIG_ENDIAN)) < 0) {
+		perror("cxl_mmio_map");
+		goto done;
+	}
+
+	// Each machine reads its source cacheline, then all machines write
+	// their cachelines of the destination together
+	for (round = 0; round < ROUNDS; round++) {
+		i = round * WRITERS * CACHELINE_BYTES;
+		if (run_machines(afu_h, PSL_COMMAND_READ_CL_NA, src + i) < 0)
+			goto done;
+		if (run_machines(afu_h, PSL_COMMAND_WRITE_NA, dst + i) < 0)
+			goto done;
+	}
+	printf("Completed %d rounds of %d writes\n", ROUNDS, WRITERS);
+
+	// Test if copy from src to dst was successful
+	if (memcmp(src, dst, PAGE_BYTES) != 0) {
+		for (i = 0; i < PAGE_BYTES / CACHELINE_BYTES; i++) {
+			if (memcmp(src + i * CACHELINE_BYTES,
+				   dst + i * CACHELINE_BYTES,
+				   CACHELINE_BYTES) != 0)
+				break;
+		}
+		printf("FAILED:memcmp line %d\n", i);
+		goto done;
+	}
+
+	printf("PASSED\n");
+
+done:
+	if (afu_h) {
+		// Unmap AFU MMIO registers
+		cxl_mmio_unmap(afu_h);
+
+		// Free AFU
+		cxl_afu_free(afu_h);
+	}
+
+	return 0;
+}